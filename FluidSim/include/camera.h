@@ -0,0 +1,26 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+typedef struct {
+    float eye[3];
+    float target[3];
+    float up[3];
+    float fovY; // Radians
+    float nearPlane;
+    float farPlane;
+} Camera;
+
+extern Camera camera;
+
+void cameraFitBounds(Camera* camera, const float boundsMin[3], const float boundsMax[3]);
+
+void cameraView(const Camera* camera, float out[16]);
+
+void cameraProjection(const Camera* camera, float aspect, float out[16]);
+
+void cameraViewProjection(const Camera* camera, float aspect, float out[16]);
+
+// Clip space back to world space, for rays cast through the pixels
+void cameraInverseViewProjection(const Camera* camera, float aspect, float out[16]);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef DESCRIPTOR_HEAP_H
+#define DESCRIPTOR_HEAP_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+// Slots of the heap, lowered to the update-after-bind limits of the device
+#define DESCRIPTOR_HEAP_BUFFERS 4096
+#define DESCRIPTOR_HEAP_IMAGES 1024
+
+// Handle of no resource, also what registration returns when the heap is not supported
+#define DESCRIPTOR_HANDLE_NONE UINT32_MAX
+
+// Bindings of the heap set, shaders declare each as an unsized array and index it with a handle
+typedef enum {
+    DESCRIPTOR_HEAP_BINDING_BUFFERS, // Storage buffers
+    DESCRIPTOR_HEAP_BINDING_IMAGES,  // Storage images in the general layout
+    DESCRIPTOR_HEAP_BINDING_COUNT
+} DescriptorHeapBinding;
+
+// Use the heap when the device supports it (default on, --no-bindless)
+extern int descriptorHeapRequested;
+
+// Set by descriptorHeapEnableFeatures() when the device can index partially bound, update-after-bind
+// arrays of storage buffers and images with push constants. Passes keep their own descriptor sets otherwise
+extern int descriptorHeapSupported;
+
+// Layout of the heap set, VK_NULL_HANDLE until createDescriptorHeap() or when it is not supported
+extern VkDescriptorSetLayout descriptorHeapSetLayout;
+
+// Turns on the features the heap needs in the features the device is created with, when the physical
+// device has every one of them
+void descriptorHeapEnableFeatures(const VkPhysicalDeviceFeatures* supported, const VkPhysicalDeviceVulkan12Features* supported12,
+                                  VkPhysicalDeviceFeatures* enabled, VkPhysicalDeviceVulkan12Features* enabled12);
+
+// The one global descriptor set every bindless pass indexes. Call once the device exists, before any
+// resource is registered
+void createDescriptorHeap();
+
+// Writes the descriptor of a resource into a free slot and returns the slot, the handle shaders index
+// the heap with. The heap is update-after-bind and partially bound: registering never invalidates
+// command buffers that bound the heap, and slots without a resource are never read
+uint32_t descriptorHeapAddBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+uint32_t descriptorHeapAddImage(VkImageView view);
+
+// Frees the slot for the next registration. Call before the resource is destroyed and once no pending
+// command buffer reads it. DESCRIPTOR_HANDLE_NONE is ignored
+void descriptorHeapRemoveBuffer(uint32_t handle);
+void descriptorHeapRemoveImage(uint32_t handle);
+
+// Binds the heap as set firstSet of layout. Once per command buffer and bind point: every pass indexing
+// the heap shares the set, and secondary command buffers inherit no bindings
+void descriptorHeapBind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t firstSet);
+
+void destroyDescriptorHeap();
+
+#endif
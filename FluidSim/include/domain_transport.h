@@ -0,0 +1,24 @@
+#ifndef DOMAIN_TRANSPORT_H
+#define DOMAIN_TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Point to point messages between the processes of a domain decomposed run. Sends and receives
+// block until the whole buffer went through, and messages between two ranks arrive in order.
+// Backends fill in the function pointers, a failing transport is fatal like any other setup error.
+typedef struct DomainTransport {
+    uint32_t rank;
+    uint32_t rankCount;
+    void *context;
+
+    void (*send)(struct DomainTransport *transport, uint32_t peer, const void *data, size_t size);
+    void (*receive)(struct DomainTransport *transport, uint32_t peer, void *data, size_t size);
+    void (*destroy)(struct DomainTransport *transport);
+} DomainTransport;
+
+// Fully connected Unix domain sockets between the processes of one machine. Every rank listens on
+// DIRECTORY/rank-N.sock and connects to the ranks below it, so the ranks can be started in any order
+void domainTransportInitUnix(DomainTransport *transport, const char *directory, uint32_t rank, uint32_t rankCount);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef FRAME_BENCH_H
+#define FRAME_BENCH_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+// CPU phases of a frame, timed by drawFrame() and drawOffscreenFrame()
+typedef enum {
+    FRAME_PHASE_ACQUIRE,    // Waiting for the frame slot and acquiring the swapchain image
+    FRAME_PHASE_RECORD,     // Fluid mesh update and the frame command buffer
+    FRAME_PHASE_SUBMIT,     // Graphics queue submission
+    FRAME_PHASE_PRESENT,    // Presentation, nothing when headless
+    FRAME_PHASE_SIMULATION, // Handing the next simulation batch to the compute queue
+    FRAME_PHASE_COUNT
+} FramePhase;
+
+// Set between frameBenchStart() and frameBenchDestroy()
+extern int frameBenchActive;
+
+// Set while the benchmark or the metrics exporter needs the frame timings, the frame loops only time
+// themselves then
+extern int frameTimingActive;
+
+// Times the next warmUpFrames + frameCount frames and keeps the last frameCount. Call once the command
+// pools exist and before the first simulation batch is submitted
+void frameBenchStart(uint32_t frameCount, uint32_t warmUpFrames);
+
+// Every frame that was started has been drawn
+int frameBenchDone();
+
+// Opens frame `frame`, which also closes the frame-to-frame interval of the previous one
+void frameBenchBeginFrame(uint64_t frame);
+
+// Adds the time since the last mark (or the start of the frame) to a phase of the current frame, and
+// publishes it to the metrics when they are served
+void frameBenchMark(FramePhase phase);
+
+// Surrounds the command buffer of a frame (graphics queue) or of a simulation batch (compute queue)
+// with command buffers writing GPU timestamps. Fills commandBuffers and returns how many to submit,
+// just the given one when the frame is not measured or the queue family has no timestamps
+uint32_t frameBenchWrapGraphics(uint64_t frame, VkCommandBuffer commandBuffer, VkCommandBuffer commandBuffers[3]);
+uint32_t frameBenchWrapCompute(uint64_t batch, VkCommandBuffer commandBuffer, VkCommandBuffer commandBuffers[3]);
+
+// Waits for the device, prints p50/p95/p99 of the frame time, every CPU phase and the GPU time of the
+// rendering and the simulation, and the frame-to-frame jitter. configuration describes the scene, a
+// baseline is only compared against the same configuration and device. Writes the results as a baseline
+// to savePath and compares them with baselinePath when not NULL; returns 0 when a metric regressed by
+// more than tolerance (relative) or the baseline does not apply
+int frameBenchReport(const char* configuration, const char* baselinePath, const char* savePath, float tolerance);
+
+void frameBenchDestroy();
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <SDL3/SDL.h>
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+
+// What the swapchain and the frame loop optimize for
+typedef enum {
+    FRAME_PACING_LOW_LATENCY, // MAILBOX (or FIFO) with one image over the minimum, paced so input is read late
+    FRAME_PACING_THROUGHPUT,  // IMMEDIATE (or MAILBOX, then FIFO) with spare images, never sleeps
+    FRAME_PACING_VSYNC        // FIFO, one frame per refresh without tearing, paced like low latency
+} FramePacing;
+
+extern FramePacing framePacing;
+
+// Present mode for the pacing among the ones the surface supports, FIFO is always there
+VkPresentModeKHR framePacingPresentMode(uint32_t availablePresentModesCount, const VkPresentModeKHR* availablePresentModes);
+
+// Swapchain images for the pacing, within the surface limits
+uint32_t framePacingImageCount(const VkSurfaceCapabilitiesKHR* capabilities);
+
+// Called by the frame loop before it polls input. Sleeps for the time the next frame would otherwise
+// spend blocked on its fence and swapchain image, minus a margin, so the input it reads is as recent
+// as possible. Nothing with the throughput pacing
+void framePacingSleep();
+
+// Time the frame just spent waiting for its fence and swapchain image, which steers the sleep
+void framePacingBlocked(uint64_t nanoseconds);
+
+// An input event (SDL timestamp) polled before the next present. No event changes the frame yet, so
+// this measures how late the loop polls and presents, not the latency of an input to its effect
+void framePacingEvent(uint64_t timestamp);
+
+// Right after vkQueuePresentKHR, closes the event to present time of the events polled for this frame
+void framePacingPresented();
+
+// Prints the event to present time: count, mean, p50, p95 and max
+void framePacingReport();
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <stdint.h>
+
+typedef enum {
+    FRAME_FORMAT_PNG, // 8-bit RGB, stored (uncompressed) deflate blocks
+    FRAME_FORMAT_RAW  // Tightly packed RGBA8 rows, top row first
+} FrameFormat;
+
+// Encodes and writes frames on a worker thread so the render loop never waits on the disk.
+// Frames are copied into one of queueDepth preallocated slots, frameWriterSubmit() only blocks
+// when every slot is still waiting to be written.
+void frameWriterStart(const char* directory, FrameFormat format, uint32_t width, uint32_t height, uint32_t queueDepth);
+
+// rgba points to width * height tightly packed RGBA8 pixels, rowPitch bytes apart
+void frameWriterSubmit(uint64_t frameIndex, const uint8_t* rgba, uint32_t rowPitch);
+
+// Writes the frames still queued and joins the worker thread
+void frameWriterStop();
+
+#endif
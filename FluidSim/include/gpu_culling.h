@@ -0,0 +1,41 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "sph.h"
+
+// Blocks per axis of the culling grid laid over the simulation domain
+#define CULL_BLOCK_DIM 8
+#define CULL_BLOCK_COUNT (CULL_BLOCK_DIM * CULL_BLOCK_DIM * CULL_BLOCK_DIM)
+
+// Frustum cull particle blocks on the GPU and draw them indirectly (default on, --no-gpu-cull)
+extern int gpuCulling;
+
+// Blocks whose simulation cells project smaller than this many pixels draw one aggregate splat per
+// cell instead of its particles, 0 disables aggregation (--lod-pixels)
+extern float lodPixelThreshold;
+
+// Per frame slot block counters, draw commands and compacted vertex buffer. Call after sphGpuInit(),
+// does nothing when culling is disabled or the render mode has no particle draws
+void createGpuCulling(const SphParams* params);
+
+// Records the culling dispatches of a frame outside of a render pass: particles are binned into
+// blocks, every block is tested against the frustum of viewProjection and the particles of the visible
+// blocks are compacted into gpuCullVertexBuffer(frame) with one VkDrawIndirectCommand per block.
+// Distant blocks and fully interior cells are drawn as the aggregates of sphGpuLodBuffer(frame).
+void recordGpuCulling(VkCommandBuffer commandBuffer, uint64_t frame, const float viewProjection[16]);
+
+// Vertex buffer holding the visible particles and aggregates of a frame: vec4, w packs the density
+// and the splat radius scale with packHalf2x16 (see cull_common.glsl)
+VkBuffer gpuCullVertexBuffer(uint64_t frame);
+
+// Handle of gpuCullVertexBuffer(frame) in the descriptor heap, DESCRIPTOR_HANDLE_NONE without the heap
+uint32_t gpuCullVertexHandle(uint64_t frame);
+
+// Draws the visible particles of a frame with the bound pipeline and gpuCullVertexBuffer(frame)
+void recordCulledDraw(VkCommandBuffer commandBuffer, uint64_t frame);
+
+void destroyGpuCulling();
+
+#endif
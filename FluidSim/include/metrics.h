@@ -0,0 +1,61 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Values served by the metrics socket, counters only ever grow
+typedef enum {
+    METRIC_STEPS,              // Counter: solver steps, CPU and GPU
+    METRIC_FRAMES,             // Counter: frames submitted
+    METRIC_SIMULATION_BATCHES, // Counter: simulation batches submitted to the compute queue
+    METRIC_PARTICLES,          // Gauge: live particles
+    METRIC_TIME_STEP,          // Gauge: dt of the last step in seconds
+    METRIC_SOLVER_ITERATIONS,  // Gauge: conjugate gradient iterations of the last implicit viscosity solve
+    METRIC_FRAME_QUEUE,        // Gauge: frames submitted that the GPU has not finished
+    METRIC_SIMULATION_QUEUE,   // Gauge: simulation batches submitted that the GPU has not finished
+    METRIC_WRITER_QUEUE,       // Gauge: headless frames waiting for the frame writer
+    METRIC_RESIDENT_BYTES,     // Gauge: resident set size of the process
+    METRIC_GPU_MEMORY_BYTES,   // Gauge: device local heap usage, only with VK_EXT_memory_budget
+    METRIC_EVENT_TO_PRESENT,   // Gauge: seconds from the oldest input event polled for the last frame with one to its present
+    METRIC_COUNT
+} MetricId;
+
+// Timed phases, exported as the total seconds and the number of times each ran
+typedef enum {
+    METRIC_PHASE_FRAME_ACQUIRE,    // FramePhase, in the same order
+    METRIC_PHASE_FRAME_RECORD,
+    METRIC_PHASE_FRAME_SUBMIT,
+    METRIC_PHASE_FRAME_PRESENT,
+    METRIC_PHASE_FRAME_SIMULATION,
+    METRIC_PHASE_NEIGHBORS,        // CPU solver: grid or Verlet list update
+    METRIC_PHASE_DENSITY,
+    METRIC_PHASE_FORCES,
+    METRIC_PHASE_VISCOSITY,        // Implicit viscosity solve
+    METRIC_PHASE_INTEGRATE,
+    METRIC_PHASE_COUNT
+} MetricPhase;
+
+// Set between metricsStart() and metricsStop(), publishers skip their timing otherwise
+extern int metricsActive;
+
+// Serves the metrics in the Prometheus text format on a Unix domain socket at socketPath, from a thread
+// of its own. A connection gets one snapshot and is closed: a plain read (socat, nc -U) gets the text
+// and an HTTP request (curl --unix-socket, a Prometheus scrape through a socket proxy) gets it as the
+// body of an HTTP response. collect, when not NULL, runs on the exporter thread before every snapshot
+// to refresh the values that are polled rather than published
+void metricsStart(const char *socketPath, void (*collect)());
+
+// Publishing only stores into atomics, it never takes a lock or waits for the exporter
+void metricsSet(MetricId metric, double value);
+void metricsAdd(MetricId metric, double value);
+void metricsAddPhaseTime(MetricPhase phase, double seconds);
+
+double metricsGet(MetricId metric);
+
+// Writes the current snapshot into buffer, returns its length
+size_t metricsFormat(char *buffer, size_t size);
+
+void metricsStop();
+
+#endif
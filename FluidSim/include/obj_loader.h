@@ -0,0 +1,30 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Triangle mesh of an OBJ file. Only positions and faces are kept, polygons are fan triangulated.
+// The arrays either point into a mapped cache file or into memory owned by the mesh.
+typedef struct {
+    const float* positions;  // xyz per vertex
+    const uint32_t* indices; // Three per triangle, in the winding of the file
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    float boundsMin[3];
+    float boundsMax[3];
+
+    void* mapping;           // Mapped cache, NULL when the mesh was parsed
+    size_t mappingSize;
+    float* ownedPositions;
+    uint32_t* ownedIndices;
+} ObjMesh;
+
+// Loads path, preferring the binary cache path.fsmesh when it matches the size and modification
+// time of the file. Otherwise the OBJ is mapped and parsed in parallel chunks on the thread pool, then
+// the cache is written next to it (a read-only directory only skips the cache). Returns 0 on failure.
+int objMeshLoad(const char* path, ObjMesh* mesh);
+
+void objMeshDestroy(ObjMesh* mesh);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <vulkan/vulkan.h>
+
+// Number of offscreen targets, each with its own readback buffer, command buffer and fence.
+// The CPU reads frame N back while the GPU renders frame N + 1.
+#define OFFSCREEN_FRAME_COUNT 2
+
+// Set to drop the rendered frames instead of writing them, keeps the disk out of the frame benchmark
+extern int offscreenDiscardFrames;
+
+// Stands in for createSwapChain(): fills swapChainImages, swapChainImageFormat, swapChainExtent
+// and imageCount with device images, so the image views, render pass and framebuffers are shared
+void createOffscreenTargets(uint32_t width, uint32_t height);
+
+// Readback buffers, command buffers and fences, needs the command pool
+void createOffscreenReadback();
+
+// Appended to the frame command buffer after the render pass, copies the image to its readback buffer
+void recordOffscreenReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+
+// Headless counterpart of drawFrame(), hands the previous frame of the slot to the frame writer
+void drawOffscreenFrame();
+
+// Waits for the frames still in flight and hands them to the frame writer
+void flushOffscreenFrames();
+
+void destroyOffscreen();
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PARALLEL_RECORDING_H
+#define PARALLEL_RECORDING_H
+
+#include <vulkan/vulkan.h>
+
+// Frames that can be recorded while older ones are still executing, every thread owns one
+// command pool per slot so a pool is only reset once the GPU is done with its buffers
+#define RECORD_FRAME_SLOTS 2
+
+// Records the commands of one batch into a secondary command buffer that continues the main
+// render pass. The viewport and scissor are already set, everything else must be bound.
+typedef void (*DrawBatchRecorder)(VkCommandBuffer commandBuffer, const void* data);
+
+typedef struct {
+    DrawBatchRecorder record;
+    const void* data; // Must stay valid until recordDrawBatches() returns
+} DrawBatch;
+
+// One graphics command pool per thread of the thread pool and per frame slot
+void createParallelRecording();
+
+// Records the batches in parallel on the thread pool, then executes them in order with
+// vkCmdExecuteCommands. The render pass must have been begun with
+// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS on primaryCommandBuffer.
+void recordDrawBatches(VkCommandBuffer primaryCommandBuffer, uint32_t imageIndex, uint64_t frame, const DrawBatch* batches, uint32_t batchCount);
+
+// Single threaded variant for command buffers that are recorded once and replayed (see
+// cacheCommandBuffers), the render pass must have been begun with VK_SUBPASS_CONTENTS_INLINE
+void recordDrawBatchesInline(VkCommandBuffer primaryCommandBuffer, const DrawBatch* batches, uint32_t batchCount);
+
+void destroyParallelRecording();
+
+#endif
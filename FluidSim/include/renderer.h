@@ -0,0 +1,80 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include "sph.h"
+
+typedef enum {
+    RENDER_MODE_PARTICLES, // Point sprites colored by density
+    RENDER_MODE_SURFACE,   // Screen-space fluid surface
+    RENDER_MODE_MESH,      // Marching cubes mesh extracted on the CPU
+    RENDER_MODE_VOLUME     // Density field uploaded as a 3D texture and ray marched
+} RenderMode;
+
+// Uniform block of the fluid surface passes, std140 compatible (see fluid_common.glsl)
+typedef struct {
+    float view[16];
+    float projection[16];
+    float screen[4];     // xy = full resolution, zw = resolution of the depth filter
+    float particle[4];   // sphere radius, world space filter radius, depth range sigma, thickness scale
+    float absorption[4];
+    float color[4];
+    float light[4];      // xyz = direction to the light in view space
+    float vertices[4];   // x = 1 when w of the splat positions packs density and radius scale (GPU culling)
+} FluidUniforms;
+
+extern RenderMode renderMode;
+
+// Filter the depth at half resolution and upsample it in the composite pass
+extern int fluidHalfResolution;
+
+// Volume mode: march at half resolution and accumulate the jittered result over frames with
+// temporal reprojection
+extern int volumeHalfResolution;
+
+// Radius of the spheres splatted for every particle, in world units
+extern float fluidParticleRadius;
+
+// Directory the extracted mesh of every frame is written to as PLY, NULL to disable
+extern const char* fluidMeshOutput;
+
+// Field change a mesh block tolerates before it is extracted again, and a volume brick before it is
+// uploaded again
+extern float fluidMeshThreshold;
+
+// Offscreen targets, render pass and pipelines of the surface passes. Call after the main render
+// pass and the command pool exist, the targets have the size of swapChainExtent
+void createFluidRenderer();
+
+// Records everything that has to run before the main render pass: sphere depth and thickness splats,
+// then the separable bilateral filter of the depth. Must be called outside of a render pass. With
+// gpuCulling set, particleBuffer is the culled vertex buffer and the splats are drawn indirectly.
+void recordFluidPasses(VkCommandBuffer commandBuffer, VkBuffer particleBuffer, uint32_t particleCount);
+
+// DrawBatchRecorder shading the filtered surface inside the main render pass, data is unused
+void recordFluidComposite(VkCommandBuffer commandBuffer, const void* data);
+
+// Mesh and volume modes: sets up the surface extractor for the particles of params and, for the
+// volume, the 3D textures sized by its grid. Call after sphGpuInit()
+void fluidMeshInit(const SphParams* params);
+
+// Mesh and volume modes: reads back the positions of frame and samples their field. The mesh mode
+// re-meshes the blocks that changed and uploads the mesh to the buffers of the frame slot, the volume
+// mode packs the bricks that changed into the staging buffer of the slot. Call once the slot is no
+// longer in flight and before the frame is submitted.
+void prepareFluidFrame(uint64_t frame);
+
+// DrawBatchRecorder drawing the extracted mesh with an indexed indirect draw, data is unused
+void recordFluidMesh(VkCommandBuffer commandBuffer, const void* data);
+
+// Volume mode: copies the changed bricks into the 3D textures, then ray marches the volume into the
+// target of the frame slot. Must be called outside of a render pass
+void recordVolumePasses(VkCommandBuffer commandBuffer);
+
+// DrawBatchRecorder blending the ray marched volume over the background, data is unused
+void recordVolumeComposite(VkCommandBuffer commandBuffer, const void* data);
+
+void destroyFluidRenderer();
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SDF_H
+#define SDF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "obj_loader.h"
+
+// Where and how finely a mesh is baked. The mesh is scaled uniformly to fit placementMin/Max, centered
+// on x and z and resting on placementMin[1]; the grid covers gridMin/Max with samples cellSize apart
+typedef struct {
+    float placementMin[3];
+    float placementMax[3];
+    float gridMin[3];
+    float gridMax[3];
+    float cellSize;
+    float bandWidth; // Distances are exact up to bandWidth from the surface and clamped beyond it
+} SdfBakeInfo;
+
+// Narrow band signed distance field sampled on a regular grid, negative inside the mesh
+typedef struct SdfGrid {
+    float origin[3];  // Position of sample (0, 0, 0)
+    float cellSize;
+    float bandWidth;
+    uint32_t dim[3];  // Samples per axis
+    const float *distances; // x fastest, then y, then z
+
+    void *mapping;    // Mapped cache, NULL when the field was baked
+    size_t mappingSize;
+    float *ownedDistances;
+} SdfGrid;
+
+// Maps the cache at cachePath when it was baked from the same mesh and info, otherwise bakes the field
+// on the thread pool (closest triangle through a BVH, sign by ray parity along x) and writes the cache
+void sdfBake(const ObjMesh *mesh, const SdfBakeInfo *info, const char *cachePath, SdfGrid *sdf);
+
+// Trilinear distance at a position (clamped to the grid) and the gradient of the interpolant
+float sdfSample(const SdfGrid *sdf, float x, float y, float z, float gradient[3]);
+
+void sdfDestroy(SdfGrid *sdf);
+
+#endif
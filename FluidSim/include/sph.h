@@ -0,0 +1,125 @@
+#ifndef SPH_H
+#define SPH_H
+
+#include <stdint.h>
+
+struct SdfGrid;
+
+typedef struct {
+    uint32_t particleCount;
+    float smoothingRadius;  // h, also the size of a neighbor grid cell
+    float particleSpacing;  // Distance between particles when seeding
+    float particleMass;
+    float restDensity;
+    float stiffness;        // Equation of state: p = stiffness * (density - restDensity)
+    float viscosity;
+    float boundaryDamping;  // Fraction of the velocity kept when bouncing off the domain walls
+    float timeStep;
+    float gravity[3];
+    float boundsMin[3];
+    float boundsMax[3];
+
+    // Signed distance field of an obstacle inside the domain, NULL without one. Particles closer to
+    // its surface than obstacleMargin are pushed out along the SDF gradient
+    const struct SdfGrid *obstacle;
+    float obstacleMargin;
+
+    // 0 integrates the viscosity explicitly with the other forces, which is only stable below
+    // sphViscousTimeStepLimit(). Otherwise the new velocities are solved from (I - dt L) v = v + dt a, L
+    // being the viscosity operator, with at most this many Jacobi preconditioned conjugate gradient
+    // iterations. That is stable for any viscosity, so dt is only limited by advection and pressure
+    uint32_t viscosityIterations;
+    float viscosityTolerance; // Residual relative to the initial one (preconditioned norm) that ends the solve
+
+    // 0 walks the neighbor grid every step. Otherwise sphStep keeps a Verlet list per particle with the
+    // neighbors within h + neighborSkin and only rebuilds the grid and the lists once a particle moved
+    // more than neighborSkin / 2 since the last build
+    float neighborSkin;
+} SphParams;
+
+// Weakly compressible SPH solver on the CPU, stored as a structure of arrays.
+// It is the reference implementation the GPU backend is verified against, so both
+// must walk the neighbor grid in the same order and use the same kernel constants.
+typedef struct {
+    SphParams params;
+    uint32_t count;
+
+    float *posX, *posY, *posZ;
+    float *velX, *velY, *velZ;
+    float *accX, *accY, *accZ;
+    float *density;
+    float *pressure;
+
+    // Kernel constants (Muller et al. 2003), derived from the smoothing radius
+    float poly6;          // 315 / (64 * pi * h^9)
+    float spikyGradient;  // -45 / (pi * h^6)
+    float viscosityLaplacian; // 45 / (pi * h^6)
+
+    // Uniform grid used for the neighbor search, cells are h wide
+    uint32_t gridDim[3];
+    uint32_t cellCount;
+    uint32_t *cellKeys;      // Cell of every particle
+    uint32_t *sortedIndices; // Particle indices sorted (stable) by cell key
+    uint32_t *cellStart;     // First entry of a cell in sortedIndices
+    uint32_t *cellEnd;       // One past the last entry of a cell in sortedIndices
+
+    // Implicit viscosity solve, xyz interleaved, only allocated with params.viscosityIterations > 0
+    float *viscositySolution;
+    float *viscosityResidual;
+    float *viscosityDirection;
+    float *viscosityProduct;
+    float *viscosityDiagonal; // One per particle, the operator is the same for the three components
+    uint32_t viscosityIterationsUsed; // Iterations of the last solve
+
+    // Verlet lists, only allocated with params.neighborSkin > 0. The neighbors of particle i, itself
+    // included, are neighborList[neighborStart[i]] up to neighborList[neighborStart[i + 1]]
+    uint32_t *neighborStart;
+    uint32_t *neighborList;
+    uint32_t neighborCapacity;
+    float *buildX, *buildY, *buildZ; // Positions at the last build
+    float maxDisplacement2; // Largest squared distance from the build position, kept by sphIntegrate. INFINITY forces a rebuild
+    uint32_t neighborBuilds;  // Rebuilds and sphUpdateNeighbors calls since init, their ratio is the rebuild frequency
+    uint32_t neighborUpdates;
+
+    // Live mask of the particle slots, NULL when every slot below count holds a particle. Owned by a
+    // particle pool (sph_pool.h): dead slots are left out of the grid and skipped by every kernel, they
+    // keep their last state until the pool reuses them
+    uint8_t *alive;
+} SphSolver;
+
+SphParams sphDefaultParams(uint32_t particleCount);
+
+void sphInit(SphSolver *solver, const SphParams *params);
+
+void sphSeedDamBreak(SphSolver *solver);
+
+uint32_t sphCellKey(const SphSolver *solver, float x, float y, float z);
+
+void sphBuildGrid(SphSolver *solver);
+
+// Rebuilds the grid and the Verlet lists when a particle moved more than half the skin since the last
+// build (or maxDisplacement2 was set to INFINITY after moving particles outside sphIntegrate)
+void sphUpdateNeighbors(SphSolver *solver);
+
+void sphComputeDensity(SphSolver *solver);
+
+void sphComputeForces(SphSolver *solver);
+
+// Implicit viscosity: turns the accelerations of sphComputeForces into the ones reaching the solved
+// velocities, so sphIntegrate is the same for both integrators
+void sphSolveViscosity(SphSolver *solver);
+
+// Largest time step the explicit viscosity stays stable at, dt < rest density * h^2 / (15 viscosity)
+float sphViscousTimeStepLimit(const SphParams *params);
+
+void sphIntegrate(SphSolver *solver);
+
+void sphStep(SphSolver *solver);
+
+// Runs the dam break for stepCount steps with the Verlet lists of params->neighborSkin (0.2 h when 0) and
+// with the grid walk, then prints the rebuild interval, list length and memory and the time per step of both
+void sphNeighborReport(const SphParams *params, uint32_t stepCount);
+
+void sphDestroy(SphSolver *solver);
+
+#endif
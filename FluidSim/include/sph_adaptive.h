@@ -0,0 +1,78 @@
+#ifndef SPH_ADAPTIVE_H
+#define SPH_ADAPTIVE_H
+
+#include <stdint.h>
+#include "sph.h"
+
+// Resolution levels: 0 is the seeded resolution, every level below merges two particles of the level
+// above (twice the mass, 2^(1/3) times the smoothing length). -4 carries sixteen seeded particles.
+#define SPH_ADAPTIVE_MIN_LEVEL -4
+#define SPH_ADAPTIVE_LEVEL_COUNT (1 - SPH_ADAPTIVE_MIN_LEVEL)
+
+// Adaptive resolution on top of the CPU solver: particles at the free surface or in vortices keep the
+// seeded resolution, the bulk behind them is merged one level further per ring of neighbors down to
+// SPH_ADAPTIVE_MIN_LEVEL. The solver arrays are reused, solver->count changes as particles split and
+// merge and never exceeds the seeded count
+typedef struct {
+    SphSolver *solver;
+    uint32_t capacity;
+
+    int8_t *level;
+    float *mass;
+    uint8_t *refine;   // Classified by the last density pass: at the free surface or in a vortex
+    float *vorticity;  // |curl v| of the last step
+    int8_t *target;    // Level a particle should have, one coarser per ring of neighbors away from a classified particle
+    int8_t *gradedTarget; // Output of a grading pass, swapped with target
+    float *densityOffset; // Density jump of the last passes, subtracted from the pressure while it decays
+    float *densityBefore;
+    uint8_t *claimed;  // Split and merge pass: 1 = merged this pass, 2 = merged into another particle, 3 = next to a merge
+
+    // Kernel constants of every pair of levels, the pair uses the mean of the two smoothing lengths
+    // so the pressure and viscosity forces stay antisymmetric and conserve momentum
+    float smoothing[SPH_ADAPTIVE_LEVEL_COUNT];
+    float pairH[SPH_ADAPTIVE_LEVEL_COUNT][SPH_ADAPTIVE_LEVEL_COUNT];
+    float pairPoly6[SPH_ADAPTIVE_LEVEL_COUNT][SPH_ADAPTIVE_LEVEL_COUNT];
+    float pairSpiky[SPH_ADAPTIVE_LEVEL_COUNT][SPH_ADAPTIVE_LEVEL_COUNT];
+    float pairViscosity[SPH_ADAPTIVE_LEVEL_COUNT][SPH_ADAPTIVE_LEVEL_COUNT];
+
+    // Neighbor grid with cells as wide as the largest smoothing length in use, so the 27 cell stencil
+    // covers every mixed pair. The arrays are sized for the seeded smoothing length, the finest grid
+    float cellSize;
+    uint32_t gridDim[3];
+    uint32_t cellCount;
+    uint32_t *cellKeys;
+    uint32_t *sortedIndices;
+    uint32_t *cellStart;
+    uint32_t *cellEnd;
+
+    float surfaceDensityRatio; // Density / rest density below which a particle is at the free surface
+    float vorticityThreshold;  // 1/s, a particle is in a vortex above this and above vorticityRatio times the mean
+    float vorticityRatio;      // Relative to meanVorticity, in a sloshing bulk most of the fluid is above any fixed rate
+    float meanVorticity;       // Of every particle in the last step
+    uint32_t adaptInterval;    // Steps between two split and merge passes
+    float offsetDecay;         // Per step factor of the density offsets
+    uint32_t stepIndex;
+
+    // Statistics of the last split and merge pass
+    uint32_t splits;
+    uint32_t merges;
+    float massError;     // Relative change of the total mass over the pass
+    float momentumError; // Change of the total momentum over the pass, relative to its magnitude plus mass * 1 m/s
+} SphAdaptive;
+
+// Takes over a seeded solver, every particle starts at level 0
+void sphAdaptiveInit(SphAdaptive *adaptive, SphSolver *solver);
+
+// One solver step with per particle masses and smoothing lengths, followed every adaptInterval steps
+// by a split and merge pass
+void sphAdaptiveStep(SphAdaptive *adaptive);
+
+// Runs the dam break with adaptive resolution for stepCount steps and prints the particle count, level
+// histogram and conservation error of the split and merge passes. The run ends with the measured average
+// reduction next to the most the refined particles allow, which depends on the surface to volume ratio,
+// and whether it met the target of 3-5x fewer particles
+void sphAdaptiveReport(const SphParams *params, uint32_t stepCount);
+
+void sphAdaptiveDestroy(SphAdaptive *adaptive);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef SPH_DOMAIN_H
+#define SPH_DOMAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sph.h"
+#include "domain_transport.h"
+
+// Slab decomposition of the CPU solver along x, one slab per rank of the transport. Every step the
+// particles within h of a slab edge are sent to the neighbor as ghosts, their densities follow once
+// computed, and particles that left the slab migrate to the neighbor. Every rebalanceInterval steps
+// the slab edges move so the measured compute time evens out between the ranks.
+typedef struct {
+    DomainTransport *transport;
+
+    SphSolver solver;    // Owned particles first, then the ghosts of the last exchange
+    uint32_t ownedCount;
+    uint32_t capacity;   // Particles the solver arrays can hold, grown on demand
+    uint32_t *ids;       // Index of every owned particle in the seeded state, travels with it
+
+    float *boundaries;   // rankCount + 1 slab edges along x, the outer two are the domain walls
+    float minimumWidth;  // Twice the ghost layer, so ghosts only ever come from the direct neighbors
+
+    // Owned particles sent as ghosts to the left [0] and right [1] neighbor in the last exchange, and
+    // the number of ghosts received from them
+    uint32_t *ghostSources[2];
+    uint32_t ghostSourceCapacity[2];
+    uint32_t sentGhosts[2];
+    uint32_t receivedGhosts[2];
+
+    // Scratch buffers of the neighbor exchanges
+    void *sendBuffer[2];
+    size_t sendCapacity[2];
+    void *receiveBuffer[2];
+    size_t receiveCapacity[2];
+
+    uint32_t rebalanceInterval;
+    uint32_t stepIndex;
+    double computeSeconds; // Density, force and integration time since the last rebalance
+    uint32_t migrated;     // Particles that changed slabs in the last step
+} SphDomain;
+
+// Takes the particles of a seeded solver that fall into the rank's slab. The slabs start equally wide
+void sphDomainInit(SphDomain *domain, DomainTransport *transport, const SphSolver *seeded);
+
+// One solver step over all ranks, every rank has to call it
+void sphDomainStep(SphDomain *domain);
+
+// Collects the owned particles of every rank into solver on rank 0, at their index in the seeded state.
+// The other ranks only send and ignore solver
+void sphDomainGather(SphDomain *domain, SphSolver *solver);
+
+// Runs the dam break for stepCount steps on rankCount forked processes connected by Unix sockets, prints
+// the slab edges, particle counts and step times at every rebalance and compares the result against
+// the single process solver. Returns whether the positions match within tolerance
+int sphDomainReport(const SphParams *params, uint32_t rankCount, uint32_t stepCount);
+
+void sphDomainDestroy(SphDomain *domain);
+
+#endif
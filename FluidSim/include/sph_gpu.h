@@ -0,0 +1,94 @@
+#ifndef SPH_GPU_H
+#define SPH_GPU_H
+
+#include <vulkan/vulkan.h>
+#include "sph.h"
+
+// Uniform block shared by every SPH compute shader, std140 compatible (see sph_common.glsl)
+typedef struct {
+    float boundsMin[4];  // xyz, w = smoothing radius
+    float boundsMax[4];  // xyz, w = time step
+    float gravity[4];    // xyz, w = particle mass
+    float material[4];   // rest density, stiffness, viscosity, boundary damping
+    float kernels[4];    // poly6, spiky gradient, viscosity laplacian, h^2
+    uint32_t gridDim[4]; // xyz, w = particle count
+    float obstacleOrigin[4];   // xyz = first SDF sample, w = SDF cell size
+    float obstacleMargin[4];   // x = collision margin
+    uint32_t obstacleDim[4];   // xyz = SDF samples, w = 1 when an obstacle is bound
+    float viscositySolver[4];  // x = squared relative CG tolerance, y = viscosity when solved implicitly (material[2] is 0 then)
+} SphGpuParams;
+
+// Level of detail aggregate of the particles of one grid cell, std430 compatible (see sph_common.glsl)
+typedef struct {
+    float position[4]; // xyz = centroid, w = mean density
+    uint32_t count;    // Particles merged, the aggregate carries their summed mass
+    uint32_t interior; // The cell and its six face neighbours are occupied
+    uint32_t padding[2];
+} SphLodCell;
+
+extern uint32_t sphGpuParticleCount; // Particle slots, params.particleCount of the solver given to sphGpuInit
+extern uint32_t sphStepsPerFrame;
+
+// Stores positions as 21 bit fixed point relative to the domain origin and velocity and density as
+// fp16 (16 bytes per particle instead of 36). Read by sphGpuInit() (--compact-storage)
+extern int sphCompactStorage;
+
+void sphGpuInit(const SphSolver* source);
+
+void sphGpuRecordStep(VkCommandBuffer commandBuffer, uint32_t stepCount, uint32_t slot);
+
+// Submits simulation batch `batch` (sphStepsPerFrame steps) to the compute queue. It signals
+// simulationTimeline = batch and only waits for the frame that last drew its render slot
+void sphGpuSubmitStep(uint64_t batch);
+
+// Particle positions (vec4, w = density, 0 for a dead pool slot) produced by a batch. The compute passes write it and the
+// particle pipeline binds it as its vertex buffer, so the simulation never goes through the CPU
+VkBuffer sphGpuRenderBuffer(uint64_t batch);
+
+// Handle of sphGpuRenderBuffer(batch) in the descriptor heap, DESCRIPTOR_HANDLE_NONE without the heap
+uint32_t sphGpuRenderBufferHandle(uint64_t batch);
+
+// One SphLodCell per grid cell, rebuilt at the end of every batch from the positions of
+// sphGpuRenderBuffer(batch). Cells are h wide and start at boundsMin, like the neighbor grid
+VkBuffer sphGpuLodBuffer(uint64_t batch);
+
+void sphGpuGridDim(uint32_t gridDim[3]);
+
+// Waits for a batch and copies its render positions (vec4 per particle) to the host. Must be called
+// before the frame drawing that batch is submitted, afterwards the slot may be reused
+void sphGpuReadRenderPositions(uint64_t batch, float* positions);
+
+void sphGpuDownload(SphSolver* target);
+
+// Pool steps record into a command buffer of their own: sphGpuBeginPoolStep() returns it, waiting only when
+// the staging segment it packs into is still read by the pool step three submissions back, and
+// sphGpuSubmitPoolStep() submits it to the compute queue without waiting. sphGpuWaitPoolSteps() waits for
+// every submitted pool step, before a download
+VkCommandBuffer sphGpuBeginPoolStep();
+void sphGpuSubmitPoolStep(VkCommandBuffer commandBuffer);
+void sphGpuWaitPoolSteps();
+
+// Records the upload of the state and live flag of the listed slots of source, the incremental update after
+// a particle pool emitted or removed particles. They are packed into the persistently mapped staging segment
+// of the pool step at once. Returns the bytes sent
+VkDeviceSize sphGpuRecordUpdateSlots(VkCommandBuffer commandBuffer, const SphSolver* source, const uint32_t* slots, uint32_t count);
+
+// Records a compaction of the pool on the GPU buffers: slot from[k] moves to to[k] with copies inside
+// the device buffers, then the sources are marked dead
+void sphGpuRecordMoveSlots(VkCommandBuffer commandBuffer, const uint32_t* from, const uint32_t* to, uint32_t count);
+
+float sphGpuRestDensity();
+
+int sphGpuVerify(const SphParams* params, uint32_t stepCount);
+
+// Runs the inlet and drain scene of the particle pool on the CPU and mirrors it on the GPU through
+// sphGpuRecordMoveSlots and sphGpuRecordUpdateSlots, then compares the live masks and positions
+int sphGpuVerifyPool(const SphParams* params, uint32_t stepCount);
+
+// Runs stepCount steps with the fp32 and the compact storage and prints the particle state memory and
+// step time of both
+void sphGpuCompareStorage(const SphParams* params, uint32_t stepCount);
+
+void sphGpuDestroy();
+
+#endif
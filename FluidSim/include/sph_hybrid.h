@@ -0,0 +1,81 @@
+#ifndef SPH_HYBRID_H
+#define SPH_HYBRID_H
+
+#include <stdint.h>
+#include "sph.h"
+
+typedef enum {
+    SPH_HYBRID_AIR,   // No particles, pressure 0
+    SPH_HYBRID_FLUID, // Holds particles, solved for pressure
+    SPH_HYBRID_SOLID  // Inside the obstacle, fixed at init
+} SphHybridCell;
+
+// FLIP/PIC/APIC hybrid on top of the CPU solver's particles: the particles carry the velocity and are
+// advected, the pressure projection runs on a staggered (MAC) grid whose cells are the h wide cells of the
+// solver's neighbor grid. Both transfers run on the thread pool without atomics: particle to grid is a
+// gather, every face sums the particles of the cells around it in their sorted order, and grid to
+// particle writes every particle from one task. The result does not depend on the thread count.
+typedef struct {
+    SphSolver *solver;
+
+    // Blend of the particle velocity update: 0 takes the interpolated grid velocity (PIC, or APIC with
+    // the affine transfer), 1 adds the grid velocity change to the particle velocity (FLIP)
+    float flipRatio;
+    int apic;
+    float *affine; // APIC only, 9 per particle: row a is the gradient of velocity component a
+
+    float cellSize;
+    uint32_t gridDim[3];
+    uint32_t cellCount;
+    uint8_t *cellType;  // SphHybridCell
+
+    // Face velocities, one array per component. Faces of component a sit at the low a side of a cell,
+    // faceDim[a] has one more face than cells along a
+    uint32_t faceDim[3][3];
+    uint32_t faceCount[3];
+    float *velocity[3];
+    float *transferred[3]; // Particle to grid result, extrapolated, before gravity and projection (FLIP)
+    uint8_t *fixed[3];     // On a domain wall or next to a solid cell, the velocity stays 0
+    uint8_t *valid[3];     // Carries a velocity, the others are filled by extrapolation
+    uint8_t *validNext[3];
+    uint32_t extrapolationLayers;
+
+    // Pressure projection, Jacobi preconditioned conjugate gradients on the fluid cells
+    float *pressure;
+    float *residual;
+    float *preconditioned;
+    float *direction;
+    float *product;
+    double *partialSums; // One per z slice of cells, summed in order so the solve is deterministic
+    uint32_t pressureIterations;
+    float pressureTolerance; // Residual relative to the initial one (preconditioned norm)
+
+    float cflNumber;   // Cells a particle may cross per step
+    float maxTimeStep;
+    float timeStep;    // Of the last step
+    double time;
+    uint32_t stepIndex;
+
+    // Statistics of the last step
+    uint32_t fluidCells;
+    uint32_t iterationsUsed;
+    float maxDivergence; // Largest divergence of a fluid cell after the projection, 1/s
+    double transferSeconds;   // Particle to grid, including the extrapolation
+    double projectionSeconds; // Gravity, pressure solve and velocity update
+    double advectionSeconds;  // Grid to particle and advection
+} SphHybrid;
+
+// Takes over a seeded solver. flipRatio starts at 0.95 for FLIP and 0 for APIC
+void sphHybridInit(SphHybrid *hybrid, SphSolver *solver, int apic);
+
+// One step of dt = min(maxTimeStep, cflNumber * cellSize / fastest particle speed)
+void sphHybridStep(SphHybrid *hybrid);
+
+// Runs the dam break with the hybrid solver for stepCount steps and prints the time step, pressure
+// iterations, remaining divergence and energy, then the cost of every phase. A negative flipRatio keeps
+// the default of the transfer
+void sphHybridReport(const SphParams *params, int apic, float flipRatio, uint32_t stepCount);
+
+void sphHybridDestroy(SphHybrid *hybrid);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef SPH_POOL_H
+#define SPH_POOL_H
+
+#include <stdint.h>
+#include "sph.h"
+
+#define SPH_POOL_MAX_EMITTERS 8
+#define SPH_POOL_MAX_SINKS 8
+
+// Inlet: a disc of particles at the seeding spacing, facing along its velocity. A new layer leaves the
+// disc every time the previous one travelled one spacing
+typedef struct {
+    float center[3];
+    float velocity[3];
+    float radius;
+    float travelled; // Distance since the last layer
+    uint32_t emitted;
+} SphEmitter;
+
+// Drain: every particle inside the box is removed at the end of a step
+typedef struct {
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t removed;
+} SphSink;
+
+// Particle pool on top of the CPU solver: the solver arrays are allocated once for params.particleCount
+// slots and solver->count is the high water mark of the slots in use. A removed particle only clears its
+// bit of the live mask and pushes its slot on a free list, an emitted one pops a slot from it, so spawning
+// and despawning cost O(1) per particle. Once the dead slots below count pass compactThreshold, the live
+// particles above the new count are moved into the holes below it in parallel, which shrinks count again.
+//
+// Every step records what it changed, for a mirror of the state such as the GPU buffers: the moves of its
+// compaction, applied before the mirror's own step, and the slots its sinks and emitters wrote after it
+typedef struct {
+    SphSolver *solver;
+    uint32_t capacity;
+
+    uint8_t *alive;      // solver->alive
+    uint32_t *freeSlots; // Stack of the dead slots below solver->count
+    uint32_t freeCount;
+    uint32_t liveCount;
+
+    SphEmitter emitters[SPH_POOL_MAX_EMITTERS];
+    uint32_t emitterCount;
+    SphSink sinks[SPH_POOL_MAX_SINKS];
+    uint32_t sinkCount;
+
+    float compactThreshold; // Fraction of dead slots below solver->count that triggers a compaction
+
+    // Changes of the last step
+    uint32_t *changedSlots; // Emitted or removed, each slot once
+    uint8_t *changedFlag;
+    uint32_t changedCount;
+    uint32_t *moveFrom;     // Last compaction: slot moveFrom[k] now lives in moveTo[k]
+    uint32_t *moveTo;
+    uint32_t moveCount;
+
+    // Compaction scratch, one entry per block of slots
+    uint32_t blockCount;
+    uint32_t *blockHoles;   // Dead slots of a block below the new count, then their first index in moveTo
+    uint32_t *blockMovers;  // Live slots of a block at or above the new count, then their first index in moveFrom
+    uint32_t compactCount;  // Live count the running compaction packs into
+
+    // Statistics
+    uint32_t emitted;       // Of the last step
+    uint32_t removed;
+    uint32_t starved;       // Particles an emitter could not place, every slot was in use
+    uint64_t totalEmitted;  // Since init
+    uint64_t totalRemoved;
+    uint32_t compactions;
+    uint64_t compactMoved;  // Particles moved by all compactions
+    double compactSeconds;  // Of all compactions
+} SphPool;
+
+// Takes over a seeded solver, its first solver->count slots are live
+void sphPoolInit(SphPool *pool, SphSolver *solver);
+
+void sphPoolAddEmitter(SphPool *pool, const float center[3], const float velocity[3], float radius);
+
+void sphPoolAddSink(SphPool *pool, const float boundsMin[3], const float boundsMax[3]);
+
+// Takes a free slot for a particle and returns it, UINT32_MAX when the pool is full
+uint32_t sphPoolSpawn(SphPool *pool, const float position[3], const float velocity[3]);
+
+void sphPoolKill(SphPool *pool, uint32_t slot);
+
+// Packs the live particles into the first liveCount slots
+void sphPoolCompact(SphPool *pool);
+
+// Compaction when due, one solver step, then the sinks and the emitters
+void sphPoolStep(SphPool *pool);
+
+// Inlet and drain scene: a dam break of half the slots, an inlet above the far side of the tank and a drain
+// in its floor under the dam break, which empties the tank faster than the inlet refills it so the dead
+// slots pile up and get compacted. Initializes the solver with params and the pool on top of it
+void sphPoolInitScene(SphPool *pool, SphSolver *solver, const SphParams *params);
+
+// Runs the inlet and drain scene for stepCount steps and prints the live and free slots, the emitted and
+// removed particles and the compactions with their cost
+void sphPoolReport(const SphParams *params, uint32_t stepCount);
+
+void sphPoolDestroy(SphPool *pool);
+
+#endif
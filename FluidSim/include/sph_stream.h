@@ -0,0 +1,125 @@
+#ifndef SPH_STREAM_H
+#define SPH_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include "sph.h"
+
+// Out-of-core CPU solver. The domain is cut into bricks of brickCells³ grid cells, and every brick's
+// particles live in a region of a memory mapped file, not in RAM. A step sweeps the bricks twice in
+// index order (x fastest), once for the densities and once for the forces and the integration, and
+// only the bricks around the swept one (its halo, the neighbors within h) have to be mapped. An I/O
+// thread maps the bricks the next prefetchDistance sweep positions need while the solver works, and
+// the least recently used bricks are written back and unmapped once more than residentLimit are mapped.
+// The limit is soft: a brick a sweep position needs is mapped even when every mapped brick is pinned,
+// so a halo larger than the limit, or particles that moved past it, can go over it for a while
+typedef struct {
+    const char *directory;     // Where the brick file is created, it is unlinked right away
+    uint32_t brickCells;       // Grid cells along a brick edge
+    uint32_t residentLimit;    // Soft limit of the mapped bricks, at least 27. 0 picks the halo plus 9 bricks per prefetched position
+    uint32_t prefetchDistance; // Sweep positions mapped ahead of the swept one
+} SphStreamInfo;
+
+// A particle as stored in the brick file
+typedef struct {
+    uint32_t id; // Index in the seeded state
+    float position[3];
+    float velocity[3];
+    float density; // Of the last density sweep, read by the force sweep of the neighbor bricks
+} StreamParticle;
+
+typedef enum {
+    STREAM_BRICK_EVICTED,  // Only in the file
+    STREAM_BRICK_LOADING,  // Queued for or being mapped by the I/O thread
+    STREAM_BRICK_RESIDENT, // Mapped, the solver may read and write it while it is pinned
+    STREAM_BRICK_EVICTING  // Queued for or being written back and unmapped by the I/O thread
+} StreamBrickState;
+
+typedef struct {
+    StreamParticle *records; // capacity particles of state 0, then of state 1. NULL unless resident
+    uint32_t count[2];       // Particles in each state, kept in RAM so empty bricks are never mapped
+    uint32_t capacity;       // Particles of each state, doubled when the brick fills up
+    off_t offset;            // Of the records in the file
+    StreamBrickState state;
+    uint32_t pins;           // Sweep positions using the brick, it is not evicted while pinned
+    uint64_t lastUse;        // Clock of the last pin or prefetch
+    int32_t older, newer;    // LRU list of the loading and resident bricks, -1 at the ends
+    int prefetched;          // Mapped by a prefetch that no sweep position used yet
+} StreamBrick;
+
+typedef struct {
+    SphParams params;
+    uint32_t gridDim[3];   // Neighbor grid of the whole domain, cells are h wide
+    uint32_t brickCells;
+    uint32_t brickDim[3];
+    uint32_t brickCount;
+    uint32_t brickCapacity; // Particles of a brick in each state when it is created
+    size_t brickStride;     // Bytes of a brick of that capacity in the file, page aligned
+    off_t fileSize;         // The bricks in index order, then the regions of the bricks that grew
+    StreamBrick *bricks;
+    uint32_t parity;        // State the next step reads, it writes the other one
+    uint32_t particleCount;
+
+    int file;
+    uint32_t residentLimit;
+    uint32_t prefetchDistance;
+    uint32_t residentCount; // Loading and resident bricks
+    uint64_t clock;
+    uint64_t windowStamp;   // Clock when the current sweep position started, prefetches never evict past it
+    int32_t oldest, newest; // Ends of the LRU list
+
+    // Bricks pinned by the current sweep position
+    uint32_t *pinned;
+    uint32_t pinnedCount;
+    uint32_t pinnedCapacity;
+
+    // Owned particles of the swept brick first, then its halo. The grid covers the brick and one cell
+    // around it, its origin moves with the brick
+    SphSolver window;
+    uint32_t windowCapacity;
+    uint32_t windowOwned;
+    uint32_t *windowIds;
+
+    // Bricks for the I/O thread, a brick is queued at most once since it is queued on a state change
+    pthread_t ioThread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;    // Queue not empty or stop requested
+    pthread_cond_t changed; // A brick finished loading or evicting
+    uint32_t *queue;
+    uint32_t queueHead;
+    uint32_t queueCount;
+    int stopRequested;
+
+    // Statistics since init
+    uint64_t demandLoads;   // Bricks a sweep position had to wait for that no prefetch requested
+    uint64_t prefetchLoads;
+    uint64_t prefetchHits;  // Prefetched bricks that were mapped before their sweep position needed them
+    uint64_t evictions;
+    uint64_t wastedPrefetches; // Prefetched bricks evicted before any sweep position used them
+    uint64_t bytesTouched;  // Pages read in by the I/O thread
+    uint32_t peakResident;
+    uint32_t grownBricks;   // Bricks moved to a larger region at the end of the file
+    double stallSeconds;    // Waiting for bricks to be mapped
+    uint32_t stepIndex;
+} SphStream;
+
+// Creates the brick file and the I/O thread. Only the explicit viscosity is supported
+void sphStreamInit(SphStream *stream, const SphParams *params, const SphStreamInfo *info);
+
+// Writes the particles sphSeedDamBreak would seed straight into the bricks, one brick at a time
+void sphStreamSeedDamBreak(SphStream *stream);
+
+void sphStreamStep(SphStream *stream);
+
+// Copies every particle into solver at its index in the seeded state, solver must hold particleCount
+void sphStreamGather(SphStream *stream, SphSolver *solver);
+
+// Runs the dam break for stepCount steps out of core, printing the brick traffic every 50 steps,
+// then compares it against the in-memory solver. Returns whether the positions match within tolerance
+int sphStreamReport(const SphParams *params, const SphStreamInfo *info, uint32_t stepCount);
+
+void sphStreamDestroy(SphStream *stream);
+
+#endif
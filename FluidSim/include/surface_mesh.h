@@ -0,0 +1,74 @@
+#ifndef SURFACE_MESH_H
+#define SURFACE_MESH_H
+
+#include <stdint.h>
+#include "sph.h"
+
+// Cells per block edge. Blocks are meshed independently on the thread pool and only when their
+// part of the field moved since they were last meshed
+#define SURFACE_BLOCK_CELLS 8
+
+typedef struct {
+    float position[3];
+    float normal[3]; // Points out of the fluid
+} SurfaceVertex;
+
+// Indexed triangle list, counter-clockwise seen from outside the fluid
+typedef struct {
+    SurfaceVertex *vertices;
+    uint32_t vertexCount;
+    uint32_t vertexCapacity;
+    uint32_t *indices;
+    uint32_t indexCount;
+    uint32_t indexCapacity;
+} SurfaceMesh;
+
+// Marching cubes over a smoothed particle density sampled on a regular grid of nodes
+typedef struct {
+    float origin[3];
+    float cellSize;
+    float isoLevel;        // The field is ~1 inside the fluid and 0 outside
+    float changeThreshold; // Largest field change a block may drift by before it is meshed again
+    float kernelRadius;
+    float fieldScale;      // Normalizes the kernel sum of a particle lattice at rest to 1
+
+    uint32_t cellDim[3];
+    uint32_t nodeDim[3];   // cellDim + 1
+    uint32_t blockDim[3];
+    uint32_t blockCount;
+
+    float *field;          // Field of the last particle set, [nodeDim]
+    float *meshedField;    // Field the block meshes were extracted from, [nodeDim]
+    uint8_t *blockChanged; // The block moved its nodes beyond changeThreshold
+    uint8_t *blockDirty;   // The block or one of the blocks sharing its nodes changed
+    SurfaceMesh *blockMeshes;
+    int32_t **edgeCaches;  // Per thread vertex index of every block edge, reused across blocks
+
+    // Particles binned by kernelRadius for the field gather
+    uint32_t binDim[3];
+    uint32_t binCount;
+    uint32_t *binStart;
+    uint32_t *binEnd;
+    float *binnedPositions; // xyz, sorted by bin
+    uint32_t binnedCapacity;
+
+    SurfaceMesh mesh;      // Every block mesh compacted into one buffer
+    uint32_t remeshedBlocks; // Blocks meshed by the last update
+} SurfaceExtractor;
+
+// cellSize 0 uses the particle spacing
+void surfaceExtractorInit(SurfaceExtractor *extractor, const SphParams *params, float cellSize, float changeThreshold);
+
+// Samples the field from positions (stride floats per particle, xyz first) on the thread pool
+void surfaceExtractorBuildField(SurfaceExtractor *extractor, const float *positions, uint32_t count, uint32_t stride);
+
+// Re-meshes the blocks whose field changed and rebuilds the compact mesh when any did.
+// Returns the number of blocks that were meshed, 0 means extractor->mesh did not change
+uint32_t surfaceExtractorUpdate(SurfaceExtractor *extractor);
+
+// Binary little endian PLY with positions, normals and triangles
+int surfaceMeshWritePly(const SurfaceMesh *mesh, const char *path);
+
+void surfaceExtractorDestroy(SurfaceExtractor *extractor);
+
+#endif
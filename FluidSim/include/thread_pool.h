@@ -0,0 +1,22 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+
+// A task is called once per index in [0, taskCount). threadIndex is in [0, threadPoolThreadCount())
+// and identifies the calling thread, so tasks can use per-thread resources without locking.
+// Thread 0 is the thread that called threadPoolRun().
+typedef void (*ThreadPoolTask)(void* context, uint32_t taskIndex, uint32_t threadIndex);
+
+// threadCount includes the calling thread, 0 uses one thread per online core
+void threadPoolInit(uint32_t threadCount);
+
+uint32_t threadPoolThreadCount();
+
+// Runs every task index and returns once all of them have finished. The caller takes part in the work.
+// Not reentrant: a task must not call threadPoolRun()
+void threadPoolRun(ThreadPoolTask task, void* context, uint32_t taskCount);
+
+void threadPoolDestroy();
+
+#endif
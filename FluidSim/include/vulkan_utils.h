@@ -9,8 +9,19 @@
 typedef struct {
     int graphicsFamily;
     int presentFamily;
+    int computeFamily;           // Async compute, the graphics family when there is no dedicated one
+    int transferFamily;          // DMA-only family when the device exposes one
+    uint32_t computeQueueIndex;  // Queue within computeFamily
+    uint32_t transferQueueIndex; // Queue within transferFamily
 } QueueFamilyIndices;
 
+// Push constants of the particle pipeline, matches vertex_shader.vert
+typedef struct {
+    float viewProjection[16];
+    float shading[4]; // x = point size, y = rest density, z = 1 when the vertices come packed from the culling pass
+    uint32_t handles[4]; // x = descriptor heap handle of the positions, read by vert_bindless.spv only
+} ParticlePushConstants;
+
 typedef struct {
     VkSurfaceCapabilitiesKHR capabilities;
     uint32_t formatCount;
@@ -24,8 +35,17 @@ extern VkSurfaceKHR surface;
 extern VkDevice device;
 extern VkQueue graphicsQueue;
 extern VkQueue presentQueue;
+extern VkQueue computeQueue;
+extern VkQueue transferQueue;
 extern VkPhysicalDevice physicalDevice;
 
+// Device index or (part of a) device name forcing the GPU choice, NULL to pick the best scored one
+extern const char* gpuOverride;
+
+// Offscreen rendering: the swapchain globals describe device images read back to the host
+extern int headlessMode;
+extern VkExtent2D offscreenExtent;
+
 extern unsigned int logicalDeviceExtensionCount;
 extern const char* requiredExtensions[];
 
@@ -46,18 +66,38 @@ extern VkPipeline graphicsPipeline;
 
 extern VkFramebuffer* swapChainFramebuffers;
 extern VkCommandPool commandPool;
+extern VkCommandPool computeCommandPool;
+extern VkCommandPool transferCommandPool;
 extern VkCommandBuffer commandBuffer;
 
+// Replay pre-recorded command buffers instead of recording every frame, see markCommandBuffersDirty()
+extern int cacheCommandBuffers;
+
+extern float particlePointSize;
+
+// The drawIndirectCount feature is enabled, vkCmdDrawIndirectCount can be used
+extern int drawIndirectCountSupported;
+
 extern VkSemaphore imageAvailableSemaphore;
 extern VkSemaphore renderFinishedSemaphore;
 extern VkFence inFlightFence;
 
+// Timeline semaphores: simulationTimeline reaches N when simulation batch N is done,
+// renderTimeline reaches N when frame N has been drawn
+extern VkSemaphore simulationTimeline;
+extern VkSemaphore renderTimeline;
+extern uint64_t currentFrame;
+
 void baseSetupVulkan(SDL_Window *window);
 
+int rateDevice(VkPhysicalDevice device);
+
 VkPhysicalDevice selectGPU(VkInstance instance);
 
 QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
 
+uint32_t getUniqueQueueFamilies(uint32_t families[4]);
+
 SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
 
 VkSurfaceFormatKHR chooseSwapSurfaceFormat(const uint32_t availableFormatsCount, const VkSurfaceFormatKHR* availableFormats);
@@ -72,6 +112,29 @@ void createImageViews();
 
 VkShaderModule createShaderModule(VkDevice device, const char* shaderCode, size_t codeSize);
 
+VkShaderModule loadShaderModule(const char* filename);
+
+uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+
+void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* bufferMemory);
+
+// Same as createBuffer, but the buffer can be used from every queue family without ownership transfers
+void createSharedBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* bufferMemory);
+
+VkCommandBuffer beginSingleTimeCommands();
+
+void endSingleTimeCommands(VkCommandBuffer singleTimeBuffer);
+
+void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+
+VkPipeline createComputePipeline(const char* filename, VkPipelineLayout layout);
+
+// First depth format usable as an optimal tiling depth attachment
+VkFormat findDepthFormat();
+
+// Single subpass render pass: colorCount color attachments, then the depth attachment when hasDepth is set
+VkRenderPass createRenderPassWithAttachments(const VkAttachmentDescription* attachments, uint32_t colorCount, int hasDepth, const VkSubpassDependency* dependencies, uint32_t dependencyCount);
+
 void createRenderPass();
 
 void createGraphicsPipeline();
@@ -84,10 +147,24 @@ void createCommandBuffer();
 
 void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
 
+// Invalidates every cached command buffer, call it whenever what recordCommandBuffer() bakes in
+// changes: pipelines, framebuffers or extent, the draw list or the camera
+void markCommandBuffersDirty();
+
+// Command buffer holding the commands of the frame being drawn. With caching the pre-recorded
+// buffer of (imageIndex, frame slot) is returned, re-recorded first if it is dirty. Otherwise
+// fallback is reset and recorded.
+VkCommandBuffer acquireFrameCommandBuffer(VkCommandBuffer fallback, uint32_t imageIndex);
+
 void createSyncObjects();
 
 void initVulkan(SDL_Window* window);
 
+// Metrics collector, runs on the exporter thread: the frames and simulation batches the GPU has not
+// finished yet from the timeline semaphores, and the device local heap usage with VK_EXT_memory_budget
+void collectGpuMetrics();
+
+// Also stops the metrics exporter, whose collector queries the device
 void quitVulkan();
 
 #endif
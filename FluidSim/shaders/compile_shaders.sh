@@ -1,2 +1,47 @@
-/home/andrei/VulkanSDK/1.3.296.0/x86_64/bin/glslc vertex_shader.vert -o vert.spv
-/home/andrei/VulkanSDK/1.3.296.0/x86_64/bin/glslc fragment_shader.frag -o frag.spv
\ No newline at end of file
+#!/bin/sh
+# Compiles every shader the engine loads into SPIR-V next to this script. Required before the first run
+# and after any shader change, the .spv files are not kept in the repository. glslc is taken from
+# $GLSLC, then from the Vulkan SDK in $VULKAN_SDK, then from PATH
+set -e
+cd "$(dirname "$0")"
+GLSLC="${GLSLC:-${VULKAN_SDK:+$VULKAN_SDK/bin/}glslc}"
+
+"$GLSLC" vertex_shader.vert -o vert.spv
+"$GLSLC" -DPARTICLE_BINDLESS vertex_shader.vert -o vert_bindless.spv
+"$GLSLC" fragment_shader.frag -o frag.spv
+"$GLSLC" sph_hash.comp -o sph_hash.spv
+"$GLSLC" radix_histogram.comp -o radix_histogram.spv
+"$GLSLC" radix_scan.comp -o radix_scan.spv
+"$GLSLC" radix_scatter.comp -o radix_scatter.spv
+"$GLSLC" sph_cells.comp -o sph_cells.spv
+"$GLSLC" sph_density.comp -o sph_density.spv
+"$GLSLC" sph_forces.comp -o sph_forces.spv
+"$GLSLC" sph_integrate.comp -o sph_integrate.spv
+"$GLSLC" sph_lod.comp -o sph_lod.spv
+"$GLSLC" sph_viscosity_setup.comp -o sph_viscosity_setup.spv
+"$GLSLC" sph_viscosity_reduce.comp -o sph_viscosity_reduce.spv
+"$GLSLC" sph_viscosity_product.comp -o sph_viscosity_product.spv
+"$GLSLC" sph_viscosity_update.comp -o sph_viscosity_update.spv
+"$GLSLC" sph_viscosity_direction.comp -o sph_viscosity_direction.spv
+"$GLSLC" sph_viscosity_apply.comp -o sph_viscosity_apply.spv
+"$GLSLC" -DSPH_COMPACT_STORAGE sph_hash.comp -o sph_hash_compact.spv
+"$GLSLC" -DSPH_COMPACT_STORAGE sph_density.comp -o sph_density_compact.spv
+"$GLSLC" -DSPH_COMPACT_STORAGE sph_forces.comp -o sph_forces_compact.spv
+"$GLSLC" -DSPH_COMPACT_STORAGE sph_integrate.comp -o sph_integrate_compact.spv
+"$GLSLC" -DSPH_COMPACT_STORAGE sph_viscosity_setup.comp -o sph_viscosity_setup_compact.spv
+"$GLSLC" -DSPH_COMPACT_STORAGE sph_viscosity_product.comp -o sph_viscosity_product_compact.spv
+"$GLSLC" -DSPH_COMPACT_STORAGE sph_viscosity_apply.comp -o sph_viscosity_apply_compact.spv
+"$GLSLC" fluid_splat.vert -o fluid_splat_vert.spv
+"$GLSLC" fluid_depth.frag -o fluid_depth_frag.spv
+"$GLSLC" fluid_thickness.frag -o fluid_thickness_frag.spv
+"$GLSLC" fluid_filter.comp -o fluid_filter.spv
+"$GLSLC" -DFLUID_BINDLESS fluid_filter.comp -o fluid_filter_bindless.spv
+"$GLSLC" fullscreen.vert -o fullscreen_vert.spv
+"$GLSLC" fluid_composite.frag -o fluid_composite_frag.spv
+"$GLSLC" mesh.vert -o mesh_vert.spv
+"$GLSLC" mesh.frag -o mesh_frag.spv
+"$GLSLC" cull_count.comp -o cull_count.spv
+"$GLSLC" cull_blocks.comp -o cull_blocks.spv
+"$GLSLC" cull_scatter.comp -o cull_scatter.spv
+"$GLSLC" volume_march.comp -o volume_march.spv
+"$GLSLC" volume_composite.frag -o volume_composite_frag.spv
@@ -0,0 +1,77 @@
+// Shared declarations of the culling compute shaders, the layout mirrors CullPushConstants and
+// the descriptor set built in gpu_culling.c
+
+#define WORKGROUP_SIZE 256
+#define BLOCK_DIM 8
+#define BLOCK_COUNT (BLOCK_DIM * BLOCK_DIM * BLOCK_DIM)
+
+// Draw mode of a block, written by cull_blocks.comp
+#define BLOCK_CULLED 0u
+#define BLOCK_PARTICLES 1u  // Particles, interior cells as aggregates
+#define BLOCK_AGGREGATES 2u // One aggregate per occupied cell
+
+struct DrawCommand {
+    uint vertexCount;
+    uint instanceCount;
+    uint firstVertex;
+    uint firstInstance;
+};
+
+struct LodCell {
+    vec4 position; // xyz = centroid, w = mean density
+    uint count;
+    uint interior;
+    uint padding0;
+    uint padding1;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Positions { vec4 positions[]; }; // xyz, w = density
+// Counting: x = particles outside interior cells, y = occupied cells, z = interior cells. Then x = draw mode, y = write cursor
+layout(std430, set = 0, binding = 1) buffer Blocks { uvec4 blocks[]; };
+layout(std430, set = 0, binding = 2) buffer Draws {
+    uint drawCount;
+    uint padding[3];
+    DrawCommand commands[]; // Visible blocks first, VkDrawIndirectCommand layout
+};
+layout(std430, set = 0, binding = 3) writeonly buffer Vertices { vec4 vertices[]; };
+layout(std430, set = 0, binding = 4) readonly buffer LodCells { LodCell lodCells[]; };
+
+layout(push_constant) uniform PushConstants {
+    mat4 viewProjection;
+    vec4 origin; // xyz = corner of the grid, w = margin every block is grown by
+    vec4 lod;    // x = cell size, y = aggregate below this many pixels per cell (0 = off), z = pixels per unit at distance 1
+    uvec4 grid;  // x = particle count, yzw = cells per axis
+} pc;
+
+uvec3 cellsPerBlock() {
+    return (pc.grid.yzw + BLOCK_DIM - 1) / BLOCK_DIM;
+}
+
+// Same clamped cell as the neighbor grid of the simulation
+uvec3 cellCoord(vec3 position) {
+    ivec3 cell = ivec3(floor((position - pc.origin.xyz) / pc.lod.x));
+    return uvec3(clamp(cell, ivec3(0), ivec3(pc.grid.yzw) - 1));
+}
+
+uint cellKey(uvec3 cell) {
+    return cell.x + pc.grid.y * (cell.y + pc.grid.z * cell.z);
+}
+
+uvec3 cellFromKey(uint key) {
+    return uvec3(key % pc.grid.y, (key / pc.grid.y) % pc.grid.z, key / (pc.grid.y * pc.grid.z));
+}
+
+uint blockIndex(uvec3 cell) {
+    uvec3 block = cell / cellsPerBlock();
+    return block.x + BLOCK_DIM * (block.y + BLOCK_DIM * block.z);
+}
+
+bool aggregationEnabled() {
+    return pc.lod.y > 0.0;
+}
+
+// The density and the radius scale of the splat share the w component. Both halves stay in the
+// normal float range (density > 0, scale >= 1), so the bits survive the vertex fetch untouched.
+vec4 packVertex(vec3 position, float density, float radiusScale) {
+    return vec4(position, uintBitsToFloat(packHalf2x16(vec2(density, radiusScale))));
+}
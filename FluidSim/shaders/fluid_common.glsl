@@ -0,0 +1,12 @@
+// Shared declarations of the screen-space fluid passes, the layout mirrors FluidUniforms in renderer.h
+
+layout(set = 0, binding = 0) uniform FluidUniforms {
+    mat4 view;
+    mat4 projection;
+    vec4 screen;     // xy = full resolution, zw = resolution of the depth filter
+    vec4 particle;   // x = sphere radius, y = world space filter radius, z = depth range sigma, w = thickness scale
+    vec4 absorption; // rgb = Beer-Lambert absorption per unit of thickness
+    vec4 color;      // rgb = scattering color of the fluid
+    vec4 light;      // xyz = direction to the light in view space
+    vec4 vertices;   // x = 1 when w of the splat positions packs density and radius scale (GPU culling)
+} fluid;
@@ -0,0 +1,120 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "fluid_common.glsl"
+
+layout(set = 1, binding = 0) uniform sampler2D rawDepth;      // Full resolution, unfiltered
+layout(set = 1, binding = 1) uniform sampler2D filteredDepth; // Filter resolution
+layout(set = 1, binding = 2) uniform sampler2D thickness;     // Full resolution
+
+layout(location = 0) in vec2 uv;
+
+layout(location = 0) out vec4 outColor;
+
+// Filtered depth at a full resolution pixel. At half resolution the four nearest filtered texels
+// are weighted by how close they are to the raw depth, so the upsample does not bleed across edges.
+float surfaceDepth(ivec2 pixel) {
+    ivec2 fullSize = ivec2(fluid.screen.xy);
+    pixel = clamp(pixel, ivec2(0), fullSize - 1);
+
+    float reference = texelFetch(rawDepth, pixel, 0).r;
+
+    if (reference <= 0.0) {
+        return 0.0;
+    }
+
+    ivec2 filterSize = ivec2(fluid.screen.zw);
+
+    if (filterSize == fullSize) {
+        return texelFetch(filteredDepth, pixel, 0).r;
+    }
+
+    vec2 filterPosition = (vec2(pixel) + 0.5) * fluid.screen.zw / fluid.screen.xy - 0.5;
+    ivec2 base = ivec2(floor(filterPosition));
+    vec2 f = fract(filterPosition);
+    float rangeScale = 1.0 / (2.0 * fluid.particle.z * fluid.particle.z);
+
+    float sum = 0.0;
+    float weightSum = 0.0;
+
+    for (int y = 0; y <= 1; y++) {
+        for (int x = 0; x <= 1; x++) {
+            ivec2 texel = clamp(base + ivec2(x, y), ivec2(0), filterSize - 1);
+            float depth = texelFetch(filteredDepth, texel, 0).r;
+
+            if (depth <= 0.0) {
+                continue;
+            }
+
+            float bilinear = (x == 0 ? 1.0 - f.x : f.x) * (y == 0 ? 1.0 - f.y : f.y);
+            float difference = depth - reference;
+            float weight = bilinear * exp(-difference * difference * rangeScale) + 1e-5;
+
+            sum += depth * weight;
+            weightSum += weight;
+        }
+    }
+
+    return weightSum > 0.0 ? sum / weightSum : reference;
+}
+
+vec3 viewPosition(ivec2 pixel, float depth) {
+    vec2 ndc = (vec2(pixel) + 0.5) / fluid.screen.xy * 2.0 - 1.0;
+    return vec3(ndc.x * depth / fluid.projection[0][0], ndc.y * depth / fluid.projection[1][1], -depth);
+}
+
+// Central difference replaced by the smaller one-sided difference, so silhouettes keep sharp normals
+vec3 derivative(ivec2 pixel, ivec2 offset, vec3 center) {
+    float forwardDepth = surfaceDepth(pixel + offset);
+    float backwardDepth = surfaceDepth(pixel - offset);
+
+    vec3 forward = forwardDepth > 0.0 ? viewPosition(pixel + offset, forwardDepth) - center : vec3(0.0);
+    vec3 backward = backwardDepth > 0.0 ? center - viewPosition(pixel - offset, backwardDepth) : vec3(0.0);
+
+    if (forwardDepth <= 0.0) {
+        return backward;
+    }
+
+    if (backwardDepth <= 0.0) {
+        return forward;
+    }
+
+    return abs(forward.z) < abs(backward.z) ? forward : backward;
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = surfaceDepth(pixel);
+
+    if (depth <= 0.0) {
+        discard;
+    }
+
+    vec3 position = viewPosition(pixel, depth);
+    vec3 dx = derivative(pixel, ivec2(1, 0), position);
+    vec3 dy = derivative(pixel, ivec2(0, 1), position);
+    vec3 normal = normalize(cross(dx, dy));
+
+    if (normal.z < 0.0) {
+        normal = -normal;
+    }
+
+    vec3 viewDirection = normalize(-position);
+    vec3 lightDirection = normalize(fluid.light.xyz);
+    vec3 halfVector = normalize(lightDirection + viewDirection);
+
+    float diffuse = max(dot(normal, lightDirection), 0.0) * 0.5 + 0.5;
+    float specular = pow(max(dot(normal, halfVector), 0.0), 64.0);
+    float fresnel = 0.02 + 0.98 * pow(1.0 - max(dot(normal, viewDirection), 0.0), 5.0);
+
+    // Beer-Lambert: thin sheets let the background through, thick volumes take the fluid color
+    float t = texelFetch(thickness, pixel, 0).r * fluid.particle.w;
+    vec3 transmittance = exp(-fluid.absorption.rgb * t);
+    vec3 background = vec3(0.0);
+    vec3 refracted = mix(fluid.color.rgb * diffuse, background, transmittance);
+
+    vec3 sky = vec3(0.75, 0.85, 1.0);
+    vec3 color = mix(refracted, sky, fresnel) + specular * vec3(1.0);
+
+    outColor = vec4(color, 1.0);
+}
@@ -0,0 +1,27 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "fluid_common.glsl"
+
+layout(location = 0) in vec3 viewCenter;
+layout(location = 1) in float sphereRadius;
+
+layout(location = 0) out float outDepth;
+
+void main() {
+    // Sphere impostor: point sprite coordinates give the normal of the front hemisphere
+    vec2 coord = gl_PointCoord * 2.0 - 1.0;
+    float r2 = dot(coord, coord);
+
+    if (r2 > 1.0) {
+        discard;
+    }
+
+    vec3 normal = vec3(coord.x, -coord.y, sqrt(1.0 - r2));
+    vec3 viewPosition = viewCenter + normal * sphereRadius;
+
+    // The depth attachment keeps the nearest sphere surface, the color target stores its linear depth
+    vec4 clip = fluid.projection * vec4(viewPosition, 1.0);
+    gl_FragDepth = clip.z / clip.w;
+    outDepth = -viewPosition.z;
+}
@@ -0,0 +1,32 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "fluid_common.glsl"
+
+layout(location = 0) in vec4 inPosition; // xyz, w = density written by the SPH integrate pass
+
+layout(location = 0) out vec3 viewCenter;
+layout(location = 1) out float sphereRadius;
+
+void main() {
+    // Aggregates of several particles are larger spheres of the same total volume
+    float radius = fluid.particle.x;
+
+    if (fluid.vertices.x > 0.5) {
+        radius *= unpackHalf2x16(floatBitsToUint(inPosition.w)).y;
+    }
+
+    vec4 viewPosition = fluid.view * vec4(inPosition.xyz, 1.0);
+
+    viewCenter = viewPosition.xyz;
+    sphereRadius = radius;
+    gl_Position = fluid.projection * viewPosition;
+
+    // Projected diameter of the sphere in pixels (projection[1][1] is negative, y points down)
+    gl_PointSize = abs(fluid.projection[1][1]) * radius * fluid.screen.y / max(-viewPosition.z, 1e-4);
+
+    // Dead particle pool slots carry a zero w, moved outside the clip volume
+    if (inPosition.w == 0.0) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+    }
+}
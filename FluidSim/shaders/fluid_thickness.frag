@@ -0,0 +1,21 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "fluid_common.glsl"
+
+layout(location = 0) in vec3 viewCenter;
+layout(location = 1) in float sphereRadius;
+
+layout(location = 1) out float outThickness;
+
+void main() {
+    vec2 coord = gl_PointCoord * 2.0 - 1.0;
+    float r2 = dot(coord, coord);
+
+    if (r2 > 1.0) {
+        discard;
+    }
+
+    // Length of the view ray inside the sphere, summed over every particle with additive blending
+    outThickness = 2.0 * sphereRadius * sqrt(1.0 - r2);
+}
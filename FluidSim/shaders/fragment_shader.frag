@@ -5,5 +5,12 @@ layout(location = 0) in vec3 fragColor;
 layout(location = 0) out vec4 outColor;
 
 void main() {
+    // Round sprites: drop the corners of the point
+    vec2 coord = gl_PointCoord * 2.0 - 1.0;
+
+    if (dot(coord, coord) > 1.0) {
+        discard;
+    }
+
     outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+}
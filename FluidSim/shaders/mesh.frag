@@ -0,0 +1,34 @@
+#version 450
+
+layout(push_constant) uniform PushConstants {
+    mat4 viewProjection;
+    vec4 eye;
+} pc;
+
+layout(location = 0) in vec3 worldPosition;
+layout(location = 1) in vec3 worldNormal;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 normal = normalize(worldNormal);
+    vec3 viewDirection = normalize(pc.eye.xyz - worldPosition);
+
+    // Back faces are seen through holes of the surface, shade them from the inside
+    if (dot(normal, viewDirection) < 0.0) {
+        normal = -normal;
+    }
+
+    vec3 lightDirection = normalize(vec3(0.3, 1.0, 0.5));
+    vec3 halfVector = normalize(lightDirection + viewDirection);
+
+    float diffuse = max(dot(normal, lightDirection), 0.0) * 0.5 + 0.5;
+    float specular = pow(max(dot(normal, halfVector), 0.0), 64.0);
+    float fresnel = 0.02 + 0.98 * pow(1.0 - max(dot(normal, viewDirection), 0.0), 5.0);
+
+    vec3 water = vec3(0.1, 0.35, 0.9) * diffuse;
+    vec3 sky = vec3(0.75, 0.85, 1.0);
+    vec3 color = mix(water, sky, fresnel) + specular * vec3(1.0);
+
+    outColor = vec4(color, 1.0);
+}
@@ -0,0 +1,18 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal; // Points out of the fluid
+
+layout(push_constant) uniform PushConstants {
+    mat4 viewProjection;
+    vec4 eye; // xyz = camera position
+} pc;
+
+layout(location = 0) out vec3 worldPosition;
+layout(location = 1) out vec3 worldNormal;
+
+void main() {
+    gl_Position = pc.viewProjection * vec4(inPosition, 1.0);
+    worldPosition = inPosition;
+    worldNormal = inNormal;
+}
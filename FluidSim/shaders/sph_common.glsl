@@ -0,0 +1,164 @@
+// Shared declarations of the SPH compute shaders, the layout mirrors SphGpuParams and
+// the descriptor set built in sph_gpu.c
+
+layout(set = 0, binding = 0) uniform SimParams {
+    vec4 boundsMin; // xyz, w = smoothing radius
+    vec4 boundsMax; // xyz, w = time step
+    vec4 gravity;   // xyz, w = particle mass
+    vec4 material;  // rest density, stiffness, viscosity, boundary damping
+    vec4 kernels;   // poly6, spiky gradient, viscosity laplacian, h^2
+    uvec4 gridDim;  // xyz, w = particle count
+    vec4 obstacleOrigin; // xyz = first SDF sample, w = SDF cell size
+    vec4 obstacleMargin; // x = collision margin
+    uvec4 obstacleDim;   // xyz = SDF samples, w = 1 when an obstacle is bound
+    vec4 viscositySolver; // x = squared relative CG tolerance, y = viscosity when solved implicitly (material.z is 0 then)
+} params;
+
+#ifdef SPH_COMPACT_STORAGE
+// Compact storage (--compact-storage): 16 bytes of state per particle instead of 36, always accessed
+// through the load and store functions below, which decode to fp32 in registers
+layout(std430, set = 0, binding = 1) buffer Positions { uvec2 positions[]; };   // 21 bit fixed point per axis from boundsMin
+layout(std430, set = 0, binding = 2) buffer Velocities { uvec2 velocities[]; }; // fp16 xy, fp16 z and fp16 relative density
+#else
+layout(std430, set = 0, binding = 1) buffer Positions { vec4 positions[]; };     // xyz, w = density (used for shading)
+layout(std430, set = 0, binding = 2) buffer Velocities { vec4 velocities[]; };
+#endif
+layout(std430, set = 0, binding = 3) buffer Accelerations { vec4 accelerations[]; };
+layout(std430, set = 0, binding = 4) buffer Densities { float densities[]; };   // Unused by the compact storage
+layout(std430, set = 0, binding = 5) buffer KeysIn { uint keysIn[]; };
+layout(std430, set = 0, binding = 6) buffer ValuesIn { uint valuesIn[]; };
+layout(std430, set = 0, binding = 7) buffer KeysOut { uint keysOut[]; };
+layout(std430, set = 0, binding = 8) buffer ValuesOut { uint valuesOut[]; };
+layout(std430, set = 0, binding = 9) buffer Histogram { uint histogram[]; };
+layout(std430, set = 0, binding = 10) buffer CellStart { uint cellStart[]; };
+layout(std430, set = 0, binding = 11) buffer CellEnd { uint cellEnd[]; };
+layout(std430, set = 0, binding = 12) buffer RenderPositions { vec4 renderPositions[]; }; // Frame slot the renderer draws from
+
+struct LodCell {
+    vec4 position; // xyz = centroid, w = mean density
+    uint count;
+    uint interior;
+    uint padding0;
+    uint padding1;
+};
+
+layout(std430, set = 0, binding = 13) buffer LodCells { LodCell lodCells[]; }; // Frame slot of the render positions
+layout(std430, set = 0, binding = 14) readonly buffer Obstacle { float obstacleDistances[]; }; // Obstacle SDF, x fastest
+
+// Implicit viscosity solve (see sph_viscosity.glsl), the three velocity components in xyz
+layout(std430, set = 0, binding = 15) buffer ViscositySolution { vec4 viscositySolution[]; };   // w = diagonal of the operator
+layout(std430, set = 0, binding = 16) buffer ViscosityResidual { vec4 viscosityResidual[]; };
+layout(std430, set = 0, binding = 17) buffer ViscosityDirection { vec4 viscosityDirection[]; };
+layout(std430, set = 0, binding = 18) buffer ViscosityProduct { vec4 viscosityProduct[]; };     // Operator times direction, then the preconditioned residual
+layout(std430, set = 0, binding = 19) buffer ViscosityReduction { vec4 viscosityReduction[]; }; // Workgroup partial sums, then the solver scalars
+
+// Slots of a particle pool (sph_pool.h): a dead slot is sorted behind every cell and skipped by the kernels
+layout(std430, set = 0, binding = 20) readonly buffer Live { uint live[]; };
+
+layout(push_constant) uniform PushConstants {
+    uint shift;      // Radix sort: bit offset of the current digit. Viscosity reduction: phase
+    uint groupCount; // Radix sort: number of workgroups over the particles
+} pc;
+
+#define RADIX_BITS 8
+#define RADIX_SIZE 256
+#define WORKGROUP_SIZE 256
+
+ivec3 cellCoord(vec3 position) {
+    float h = params.boundsMin.w;
+    ivec3 cell = ivec3(floor((position - params.boundsMin.xyz) / h));
+    return clamp(cell, ivec3(0), ivec3(params.gridDim.xyz) - 1);
+}
+
+uint cellKey(ivec3 cell) {
+    return uint(cell.x) + params.gridDim.x * (uint(cell.y) + params.gridDim.y * uint(cell.z));
+}
+
+// Key of a dead slot, one past the last cell
+uint deadKey() {
+    return params.gridDim.x * params.gridDim.y * params.gridDim.z;
+}
+
+bool particleAlive(uint i) {
+    return live[i] != 0u;
+}
+
+float pressureFromDensity(float density) {
+    return max(params.material.y * (density - params.material.x), 0.0);
+}
+
+// Fixed point steps per axis of a compact position, ~2e-5 h across the default domain
+#define POSITION_QUANTA 2097151.0
+
+vec3 loadPosition(uint i) {
+#ifdef SPH_COMPACT_STORAGE
+    uvec2 bits = positions[i];
+    uvec3 quantized = uvec3(bits.x & 0x1FFFFFu, (bits.x >> 21) | ((bits.y & 0x3FFu) << 11), bits.y >> 10);
+    return params.boundsMin.xyz + vec3(quantized) * ((params.boundsMax.xyz - params.boundsMin.xyz) / POSITION_QUANTA);
+#else
+    return positions[i].xyz;
+#endif
+}
+
+void storePosition(uint i, vec3 position, float density) {
+#ifdef SPH_COMPACT_STORAGE
+    vec3 normalized = clamp((position - params.boundsMin.xyz) / (params.boundsMax.xyz - params.boundsMin.xyz), 0.0, 1.0);
+    uvec3 quantized = uvec3(round(normalized * POSITION_QUANTA));
+    positions[i] = uvec2(quantized.x | (quantized.y << 21), (quantized.y >> 11) | (quantized.z << 10));
+#else
+    positions[i] = vec4(position, density);
+#endif
+}
+
+vec3 loadVelocity(uint i) {
+#ifdef SPH_COMPACT_STORAGE
+    uvec2 bits = velocities[i];
+    return vec3(unpackHalf2x16(bits.x), unpackHalf2x16(bits.y).x);
+#else
+    return velocities[i].xyz;
+#endif
+}
+
+#ifdef SPH_COMPACT_STORAGE
+// Stochastic rounding to fp16: without the dither of half a unit in the last place, increments below
+// it (gravity over one step at a few m/s) would be rounded away every step
+vec3 ditherToHalf(vec3 value, uint seed) {
+    uvec3 hash = (uvec3(seed) + uvec3(0u, 1u, 2u)) * 747796405u + 2891336453u;
+    hash = ((hash >> ((hash >> 28u) + 4u)) ^ hash) * 277803737u;
+    hash = (hash >> 22u) ^ hash;
+
+    vec3 noise = vec3(hash >> 8u) / 16777216.0 - 0.5;
+    vec3 unit = exp2(floor(log2(max(abs(value), vec3(6.1e-5)))) - 10.0);
+
+    return value + noise * unit;
+}
+#endif
+
+void storeVelocity(uint i, vec3 velocity, uint seed) {
+#ifdef SPH_COMPACT_STORAGE
+    vec3 dithered = ditherToHalf(velocity, seed);
+    float relativeDensity = unpackHalf2x16(velocities[i].y).y;
+    velocities[i] = uvec2(packHalf2x16(dithered.xy), packHalf2x16(vec2(dithered.z, relativeDensity)));
+#else
+    velocities[i] = vec4(velocity, 0.0);
+#endif
+}
+
+// The compact density is stored relative to the rest density (density / rest - 1), which keeps the
+// few percent of compression that drive the pressure at full fp16 precision
+float loadDensity(uint i) {
+#ifdef SPH_COMPACT_STORAGE
+    return (unpackHalf2x16(velocities[i].y).y + 1.0) * params.material.x;
+#else
+    return densities[i];
+#endif
+}
+
+void storeDensity(uint i, float density) {
+#ifdef SPH_COMPACT_STORAGE
+    float velocityZ = unpackHalf2x16(velocities[i].y).x;
+    velocities[i].y = packHalf2x16(vec2(velocityZ, density / params.material.x - 1.0));
+#else
+    densities[i] = density;
+#endif
+}
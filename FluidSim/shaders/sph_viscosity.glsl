@@ -0,0 +1,115 @@
+// Implicit viscosity: preconditioned conjugate gradients on (I - dt L) v = v + dt a, the same iteration as
+// sphSolveViscosity. The scalars stay on the GPU behind the workgroup partial sums, so a step records a
+// fixed number of iterations without reading anything back; converged components get zero step sizes
+
+// Entries of viscosityReduction after the pc.groupCount partial sums
+#define VISCOSITY_RZ 0u
+#define VISCOSITY_RZ_INITIAL 1u
+#define VISCOSITY_ALPHA 2u
+#define VISCOSITY_BETA 3u
+
+vec4 viscosityScalar(uint index) {
+    return viscosityReduction[pc.groupCount + index];
+}
+
+// Right hand side and first iterate: the velocities the other forces lead to
+vec3 viscosityRightHandSide(uint j) {
+    return loadVelocity(j) + accelerations[j].xyz * params.boundsMax.w;
+}
+
+// (I - dt L) applied at particle i to the right hand side (fromVelocities) or to the search direction, and
+// the diagonal 1 + dt sum w_ij. Same weights and neighbor order as applyViscosityOperator
+vec3 applyViscosityOperator(uint i, bool fromVelocities, out float diagonal) {
+    vec3 position = loadPosition(i);
+    vec3 value = fromVelocities ? viscosityRightHandSide(i) : viscosityDirection[i].xyz;
+    float density = loadDensity(i);
+
+    ivec3 cell = cellCoord(position);
+    ivec3 dim = ivec3(params.gridDim.xyz);
+    float h = params.boundsMin.w;
+    float h2 = params.kernels.w;
+    float scale = params.boundsMax.w * params.viscositySolver.y * params.gravity.w * params.kernels.z;
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+
+    // A dead slot is an identity row, its residual stays 0 and it adds nothing to the dot products
+    if (!particleAlive(i)) {
+        diagonal = 1.0;
+        return value;
+    }
+
+    for (int z = cell.z - 1; z <= cell.z + 1; z++) {
+        if (z < 0 || z >= dim.z) {
+            continue;
+        }
+
+        for (int y = cell.y - 1; y <= cell.y + 1; y++) {
+            if (y < 0 || y >= dim.y) {
+                continue;
+            }
+
+            for (int x = cell.x - 1; x <= cell.x + 1; x++) {
+                if (x < 0 || x >= dim.x) {
+                    continue;
+                }
+
+                uint key = cellKey(ivec3(x, y, z));
+
+                for (uint k = cellStart[key]; k < cellEnd[key]; k++) {
+                    uint j = valuesIn[k];
+
+                    if (j == i) {
+                        continue;
+                    }
+
+                    vec3 delta = position - loadPosition(j);
+                    float r2 = dot(delta, delta);
+
+                    if (r2 >= h2 || r2 < 1e-12) {
+                        continue;
+                    }
+
+                    float weight = scale * (h - sqrt(r2)) / (density * loadDensity(j));
+                    vec3 neighborValue = fromVelocities ? viscosityRightHandSide(j) : viscosityDirection[j].xyz;
+
+                    weightSum += weight;
+                    sum += weight * (value - neighborValue);
+                }
+            }
+        }
+    }
+
+    diagonal = 1.0 + weightSum;
+
+    return value + sum;
+}
+
+shared vec3 groupSums[WORKGROUP_SIZE];
+
+// Sum of value over the workgroup, valid in invocation 0. Every invocation has to call it
+vec3 workgroupSum(vec3 value) {
+    uint localId = gl_LocalInvocationID.x;
+
+    groupSums[localId] = value;
+    barrier();
+
+    for (uint stride = WORKGROUP_SIZE / 2u; stride > 0u; stride >>= 1u) {
+        if (localId < stride) {
+            groupSums[localId] += groupSums[localId + stride];
+        }
+
+        barrier();
+    }
+
+    return groupSums[0];
+}
+
+// Partial sum of a dot product for the reduce kernel
+void storePartialSum(vec3 value) {
+    vec3 sum = workgroupSum(value);
+
+    if (gl_LocalInvocationID.x == 0u) {
+        viscosityReduction[gl_WorkGroupID.x] = vec4(sum, 0.0);
+    }
+}
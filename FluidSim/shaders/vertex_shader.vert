@@ -1,20 +1,49 @@
 #version 450
 
-layout(location = 0) out vec3 fragColor;
+#ifdef PARTICLE_BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Storage buffer array of the global descriptor heap (descriptor_heap.h), indexed by the handle of the positions
+layout(std430, set = 0, binding = 0) readonly buffer Vec4Buffer {
+    vec4 data[];
+} vec4Buffers[];
+#else
+layout(location = 0) in vec4 inPosition; // xyz, w = density written by the SPH integrate pass
+#endif
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(push_constant) uniform PushConstants {
+    mat4 viewProjection;
+    vec4 shading; // x = point size, y = rest density, z = 1 when w packs density and radius scale (GPU culling)
+    uvec4 handles; // x = heap handle of the positions, bindless variant only
+} pc;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) out vec3 fragColor;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+#ifdef PARTICLE_BINDLESS
+    // The handle comes from a push constant, so the index is uniform across the draw
+    vec4 inPosition = vec4Buffers[pc.handles.x].data[gl_VertexIndex];
+#endif
+
+    float density = inPosition.w;
+    float radiusScale = 1.0;
+
+    // Aggregates of several particles are larger splats with their mean density
+    if (pc.shading.z > 0.5) {
+        vec2 unpacked = unpackHalf2x16(floatBitsToUint(inPosition.w));
+        density = unpacked.x;
+        radiusScale = unpacked.y;
+    }
+
+    gl_Position = pc.viewProjection * vec4(inPosition.xyz, 1.0);
+    gl_PointSize = pc.shading.x * radiusScale;
+
+    // Dead particle pool slots carry a zero w (a packed w is never 0), moved outside the clip volume
+    if (inPosition.w == 0.0) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+    }
+
+    // Blue at rest density, brighter where the fluid is compressed
+    float compression = clamp((density / pc.shading.y - 1.0) * 5.0, 0.0, 1.0);
+    fragColor = mix(vec3(0.1, 0.35, 0.9), vec3(0.85, 0.95, 1.0), compression);
 }
@@ -0,0 +1,13 @@
+#version 450
+
+// The ray marched volume, premultiplied by its opacity and blended over the background. Bilinear
+// sampling upsamples the half resolution march
+layout(set = 0, binding = 0) uniform sampler2D volumeColor;
+
+layout(location = 0) in vec2 uv;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = texture(volumeColor, uv);
+}
@@ -0,0 +1,206 @@
+#include "domain_transport.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Give up on a peer that does not show up after this many connection attempts, 10 ms apart
+#define DOMAIN_CONNECT_ATTEMPTS 1000
+
+typedef struct {
+    int listener;
+    int *sockets; // Connected socket of every peer, -1 for the own rank
+    char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+} UnixTransport;
+
+static void socketPath(struct sockaddr_un *address, const char *directory, uint32_t rank)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    if (snprintf(address->sun_path, sizeof(address->sun_path), "%s/rank-%u.sock", directory, rank) >= (int)sizeof(address->sun_path))
+    {
+        fprintf(stderr, "Domain socket path in %s is too long!\n", directory);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void writeAll(int fd, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+
+    while (size > 0)
+    {
+        ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (written <= 0)
+        {
+            fprintf(stderr, "Failed to send to a domain peer!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        bytes += written;
+        size -= (size_t)written;
+    }
+}
+
+static void readAll(int fd, void *data, size_t size)
+{
+    uint8_t *bytes = data;
+
+    while (size > 0)
+    {
+        ssize_t received = recv(fd, bytes, size, 0);
+
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (received <= 0)
+        {
+            fprintf(stderr, "Failed to receive from a domain peer!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        bytes += received;
+        size -= (size_t)received;
+    }
+}
+
+static void unixSend(DomainTransport *transport, uint32_t peer, const void *data, size_t size)
+{
+    UnixTransport *unixTransport = transport->context;
+
+    writeAll(unixTransport->sockets[peer], data, size);
+}
+
+static void unixReceive(DomainTransport *transport, uint32_t peer, void *data, size_t size)
+{
+    UnixTransport *unixTransport = transport->context;
+
+    readAll(unixTransport->sockets[peer], data, size);
+}
+
+static void unixDestroy(DomainTransport *transport)
+{
+    UnixTransport *unixTransport = transport->context;
+
+    for (uint32_t peer = 0; peer < transport->rankCount; peer++)
+    {
+        if (unixTransport->sockets[peer] >= 0)
+        {
+            close(unixTransport->sockets[peer]);
+        }
+    }
+
+    close(unixTransport->listener);
+    unlink(unixTransport->path);
+
+    free(unixTransport->sockets);
+    free(unixTransport);
+
+    memset(transport, 0, sizeof(*transport));
+}
+
+void domainTransportInitUnix(DomainTransport *transport, const char *directory, uint32_t rank, uint32_t rankCount)
+{
+    UnixTransport *unixTransport = calloc(1, sizeof(UnixTransport));
+    int *sockets = malloc(rankCount * sizeof(int));
+
+    if (!unixTransport || !sockets)
+    {
+        fprintf(stderr, "Failed to allocate the domain transport!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t peer = 0; peer < rankCount; peer++)
+    {
+        sockets[peer] = -1;
+    }
+
+    unixTransport->sockets = sockets;
+
+    struct sockaddr_un address;
+    socketPath(&address, directory, rank);
+    memcpy(unixTransport->path, address.sun_path, sizeof(unixTransport->path));
+    unlink(address.sun_path); // Left over from a run that did not shut down
+
+    unixTransport->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (unixTransport->listener < 0 || bind(unixTransport->listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(unixTransport->listener, (int)rankCount) != 0)
+    {
+        fprintf(stderr, "Failed to listen on %s!\n", address.sun_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // Lower ranks are connected to, the listen backlog holds the connections of the higher ranks
+    // until they are accepted below, so no two ranks wait on each other
+    for (uint32_t peer = 0; peer < rank; peer++)
+    {
+        struct sockaddr_un peerAddress;
+        socketPath(&peerAddress, directory, peer);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        uint32_t attempt = 0;
+
+        while (fd >= 0 && connect(fd, (struct sockaddr*)&peerAddress, sizeof(peerAddress)) != 0)
+        {
+            if ((errno != ENOENT && errno != ECONNREFUSED) || ++attempt == DOMAIN_CONNECT_ATTEMPTS)
+            {
+                fprintf(stderr, "Failed to connect to %s!\n", peerAddress.sun_path);
+                exit(EXIT_FAILURE);
+            }
+
+            nanosleep(&(struct timespec){0, 10000000}, NULL);
+        }
+
+        if (fd < 0)
+        {
+            fprintf(stderr, "Failed to create a domain socket!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        writeAll(fd, &rank, sizeof(rank));
+        sockets[peer] = fd;
+    }
+
+    for (uint32_t accepted = rank + 1; accepted < rankCount; accepted++)
+    {
+        int fd = accept(unixTransport->listener, NULL, NULL);
+        uint32_t peer = 0;
+
+        if (fd < 0)
+        {
+            fprintf(stderr, "Failed to accept a domain peer!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        readAll(fd, &peer, sizeof(peer));
+
+        if (peer <= rank || peer >= rankCount || sockets[peer] >= 0)
+        {
+            fprintf(stderr, "Unexpected domain peer %u!\n", peer);
+            exit(EXIT_FAILURE);
+        }
+
+        sockets[peer] = fd;
+    }
+
+    transport->rank = rank;
+    transport->rankCount = rankCount;
+    transport->context = unixTransport;
+    transport->send = unixSend;
+    transport->receive = unixReceive;
+    transport->destroy = unixDestroy;
+}
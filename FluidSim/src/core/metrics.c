@@ -0,0 +1,318 @@
+#include "metrics.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// How long the exporter waits for a connection before it checks whether to stop, and for a client to
+// send its request before it answers without one
+#define METRICS_POLL_MILLISECONDS 200
+
+#define METRICS_BUFFER_SIZE 8192
+
+typedef struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} MetricInfo;
+
+static const MetricInfo metricInfo[METRIC_COUNT] = {
+    {"fluidsim_steps_total", "counter", "Solver steps, CPU and GPU"},
+    {"fluidsim_frames_total", "counter", "Frames submitted"},
+    {"fluidsim_simulation_batches_total", "counter", "Simulation batches submitted to the compute queue"},
+    {"fluidsim_particles", "gauge", "Live particles"},
+    {"fluidsim_time_step_seconds", "gauge", "Time step of the last solver step"},
+    {"fluidsim_solver_iterations", "gauge", "Conjugate gradient iterations of the last implicit viscosity solve"},
+    {"fluidsim_frame_queue_depth", "gauge", "Frames submitted that the GPU has not finished"},
+    {"fluidsim_simulation_queue_depth", "gauge", "Simulation batches submitted that the GPU has not finished"},
+    {"fluidsim_writer_queue_depth", "gauge", "Headless frames waiting for the frame writer"},
+    {"fluidsim_resident_memory_bytes", "gauge", "Resident set size of the process"},
+    {"fluidsim_gpu_memory_bytes", "gauge", "Device local heap usage reported by VK_EXT_memory_budget"},
+    {"fluidsim_event_to_present_seconds", "gauge", "From the oldest input event polled for the last frame with one to its present"}};
+
+static const char *phaseNames[METRIC_PHASE_COUNT] = {
+    "frame_acquire", "frame_record", "frame_submit", "frame_present", "frame_simulation",
+    "neighbors", "density", "forces", "viscosity", "integrate"};
+
+int metricsActive = 0;
+
+// Doubles stored by their bits, so every value is a single lock-free 64 bit atomic
+static atomic_uint_least64_t values[METRIC_COUNT];
+static atomic_uint_least64_t phaseNanoseconds[METRIC_PHASE_COUNT];
+static atomic_uint_least64_t phaseCounts[METRIC_PHASE_COUNT];
+static atomic_int published[METRIC_COUNT]; // Metrics without a value yet are left out
+
+static atomic_int stopRequested;
+static pthread_t exporterThread;
+static int listener = -1;
+static char listenerPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static void (*collectMetrics)() = NULL;
+
+// Exporter thread only: the steps and the time of the previous snapshot for the step rate
+static double lastSteps = 0.0;
+static struct timespec lastSnapshot;
+
+static uint64_t bitsOf(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double valueOf(uint64_t bits)
+{
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void metricsSet(MetricId metric, double value)
+{
+    atomic_store_explicit(&values[metric], bitsOf(value), memory_order_relaxed);
+    atomic_store_explicit(&published[metric], 1, memory_order_relaxed);
+}
+
+void metricsAdd(MetricId metric, double value)
+{
+    uint64_t expected = atomic_load_explicit(&values[metric], memory_order_relaxed);
+
+    // Only the few publishers of the same counter can make this retry
+    while (!atomic_compare_exchange_weak_explicit(&values[metric], &expected, bitsOf(valueOf(expected) + value), memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+
+    atomic_store_explicit(&published[metric], 1, memory_order_relaxed);
+}
+
+void metricsAddPhaseTime(MetricPhase phase, double seconds)
+{
+    atomic_fetch_add_explicit(&phaseNanoseconds[phase], (uint64_t)(seconds * 1e9), memory_order_relaxed);
+    atomic_fetch_add_explicit(&phaseCounts[phase], 1, memory_order_relaxed);
+}
+
+double metricsGet(MetricId metric)
+{
+    return valueOf(atomic_load_explicit(&values[metric], memory_order_relaxed));
+}
+
+static void collectResidentMemory()
+{
+    FILE *file = fopen("/proc/self/statm", "r");
+    unsigned long totalPages = 0;
+    unsigned long residentPages = 0;
+
+    if (!file)
+    {
+        return;
+    }
+
+    if (fscanf(file, "%lu %lu", &totalPages, &residentPages) == 2)
+    {
+        metricsSet(METRIC_RESIDENT_BYTES, (double)residentPages * (double)sysconf(_SC_PAGESIZE));
+    }
+
+    fclose(file);
+}
+
+size_t metricsFormat(char *buffer, size_t size)
+{
+    size_t length = 0;
+
+#define METRICS_APPEND(...)                                                      \
+    do                                                                           \
+    {                                                                            \
+        int written = snprintf(buffer + length, size - length, __VA_ARGS__);     \
+        length += written > 0 ? (size_t)written : 0;                             \
+        length = length < size ? length : size - 1;                              \
+    } while (0)
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double steps = metricsGet(METRIC_STEPS);
+    double seconds = (double)(now.tv_sec - lastSnapshot.tv_sec) + (double)(now.tv_nsec - lastSnapshot.tv_nsec) / 1e9;
+
+    METRICS_APPEND("# HELP fluidsim_steps_per_second Solver steps per second since the previous scrape\n");
+    METRICS_APPEND("# TYPE fluidsim_steps_per_second gauge\n");
+    METRICS_APPEND("fluidsim_steps_per_second %.6g\n", seconds > 0.0 ? (steps - lastSteps) / seconds : 0.0);
+
+    lastSteps = steps;
+    lastSnapshot = now;
+
+    for (int metric = 0; metric < METRIC_COUNT; metric++)
+    {
+        if (!atomic_load_explicit(&published[metric], memory_order_relaxed))
+        {
+            continue;
+        }
+
+        METRICS_APPEND("# HELP %s %s\n", metricInfo[metric].name, metricInfo[metric].help);
+        METRICS_APPEND("# TYPE %s %s\n", metricInfo[metric].name, metricInfo[metric].type);
+        METRICS_APPEND("%s %.17g\n", metricInfo[metric].name, metricsGet((MetricId)metric));
+    }
+
+    METRICS_APPEND("# HELP fluidsim_phase_seconds Time spent in each phase of a frame or a CPU solver step\n");
+    METRICS_APPEND("# TYPE fluidsim_phase_seconds summary\n");
+
+    for (int phase = 0; phase < METRIC_PHASE_COUNT; phase++)
+    {
+        uint64_t count = atomic_load_explicit(&phaseCounts[phase], memory_order_relaxed);
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        METRICS_APPEND("fluidsim_phase_seconds_sum{phase=\"%s\"} %.9f\n", phaseNames[phase],
+                       (double)atomic_load_explicit(&phaseNanoseconds[phase], memory_order_relaxed) / 1e9);
+        METRICS_APPEND("fluidsim_phase_seconds_count{phase=\"%s\"} %llu\n", phaseNames[phase], (unsigned long long)count);
+    }
+
+#undef METRICS_APPEND
+
+    return length;
+}
+
+static void writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        // A client that went away only loses its own snapshot
+        if (written <= 0)
+        {
+            return;
+        }
+
+        data += written;
+        size -= (size_t)written;
+    }
+}
+
+static void serveClient(int client)
+{
+    static char body[METRICS_BUFFER_SIZE];
+    char request[1024];
+    ssize_t received = 0;
+
+    // Clients that only read send nothing, so the request is optional
+    struct pollfd pending = {client, POLLIN, 0};
+
+    if (poll(&pending, 1, METRICS_POLL_MILLISECONDS) > 0)
+    {
+        received = recv(client, request, sizeof(request) - 1, 0);
+    }
+
+    if (collectMetrics)
+    {
+        collectMetrics();
+    }
+
+    collectResidentMemory();
+
+    size_t length = metricsFormat(body, sizeof(body));
+
+    if (received >= 4 && strncmp(request, "GET ", 4) == 0)
+    {
+        char header[256];
+        int headerLength = snprintf(header, sizeof(header),
+                                    "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", length);
+
+        writeAll(client, header, (size_t)headerLength);
+    }
+
+    writeAll(client, body, length);
+    close(client);
+}
+
+static void *exporterLoop(void *argument)
+{
+    (void)argument;
+
+    while (!atomic_load_explicit(&stopRequested, memory_order_relaxed))
+    {
+        struct pollfd incoming = {listener, POLLIN, 0};
+
+        if (poll(&incoming, 1, METRICS_POLL_MILLISECONDS) <= 0)
+        {
+            continue;
+        }
+
+        int client = accept(listener, NULL, NULL);
+
+        if (client >= 0)
+        {
+            serveClient(client);
+        }
+    }
+
+    return NULL;
+}
+
+void metricsStart(const char *socketPath, void (*collect)())
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath) >= (int)sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Metrics socket path %s is too long!\n", socketPath);
+        exit(EXIT_FAILURE);
+    }
+
+    // A socket left behind by a previous run would make bind fail
+    unlink(address.sun_path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 8) != 0)
+    {
+        fprintf(stderr, "Failed to listen on the metrics socket %s!\n", socketPath);
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(listenerPath, sizeof(listenerPath), "%s", address.sun_path);
+    collectMetrics = collect;
+    clock_gettime(CLOCK_MONOTONIC, &lastSnapshot);
+    atomic_store_explicit(&stopRequested, 0, memory_order_relaxed);
+
+    if (pthread_create(&exporterThread, NULL, exporterLoop, NULL) != 0)
+    {
+        fprintf(stderr, "Failed to create the metrics thread!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    metricsActive = 1;
+
+    printf("Serving metrics on %s\n", socketPath);
+}
+
+void metricsStop()
+{
+    if (!metricsActive)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&stopRequested, 1, memory_order_relaxed);
+    pthread_join(exporterThread, NULL);
+
+    close(listener);
+    unlink(listenerPath);
+    listener = -1;
+    metricsActive = 0;
+}
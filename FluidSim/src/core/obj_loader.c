@@ -0,0 +1,676 @@
+#include "obj_loader.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Sections of the cache start on a cache line so the arrays can be used straight from the mapping
+#define OBJ_CACHE_ALIGNMENT 64
+#define OBJ_CACHE_VERSION 1
+
+// Smallest piece of text a parse task gets, smaller files are parsed by a single task
+#define OBJ_MIN_CHUNK_SIZE (1u << 20)
+
+static const char objCacheMagic[8] = {'F', 'S', 'M', 'E', 'S', 'H', '\0', OBJ_CACHE_VERSION};
+
+// Little endian, followed by the positions at vertexOffset and the indices at indexOffset
+typedef struct {
+    char magic[8];
+    uint64_t sourceSize;
+    int64_t sourceSeconds; // Modification time of the OBJ the cache was built from
+    int64_t sourceNanoseconds;
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    float boundsMin[4];
+    float boundsMax[4];
+} ObjCacheHeader;
+
+// A run of whole lines parsed by one task
+typedef struct {
+    const char *begin;
+    const char *end;
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    uint32_t firstVertex; // Vertices of the chunks before this one, resolves relative indices
+    uint32_t firstTriangle;
+    float boundsMin[3];
+    float boundsMax[3];
+    int failed;
+} ObjChunk;
+
+typedef struct {
+    ObjChunk *chunks;
+    float *positions;
+    uint32_t *indices;
+    uint32_t vertexCount;
+} ObjParseJob;
+
+static double elapsedMilliseconds(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)(now.tv_sec - start->tv_sec) * 1000.0 + (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static int isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *skipBlanks(const char *p, const char *end)
+{
+    while (p < end && isBlank(*p))
+    {
+        p++;
+    }
+
+    return p;
+}
+
+static const char *lineEnd(const char *p, const char *end)
+{
+    const char *newline = memchr(p, '\n', (size_t)(end - p));
+
+    return newline ? newline : end;
+}
+
+// Decimal float without locale or errno handling. Digits past the 19th only move the exponent.
+static const char *parseFloat(const char *p, const char *end, float *value)
+{
+    static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    p = skipBlanks(p, end);
+
+    int negative = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+    {
+        if (mantissa < 1000000000000000000ull)
+        {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+        {
+            if (mantissa < 1000000000000000000ull)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                exponent--;
+            }
+        }
+    }
+
+    if (digits == 0)
+    {
+        return NULL;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+
+        int exponentNegative = 0;
+        int explicitExponent = 0;
+
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            exponentNegative = *p == '-';
+            p++;
+        }
+
+        if (p >= end || *p < '0' || *p > '9')
+        {
+            return NULL;
+        }
+
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            if (explicitExponent < 10000)
+            {
+                explicitExponent = explicitExponent * 10 + (*p - '0');
+            }
+        }
+
+        exponent += exponentNegative ? -explicitExponent : explicitExponent;
+    }
+
+    double result = (double)mantissa;
+
+    // Exact powers of ten stay exact, dividing keeps the common negative exponents correctly rounded
+    if (exponent >= 0)
+    {
+        result *= exponent <= 22 ? powersOfTen[exponent] : pow(10.0, exponent);
+    }
+    else
+    {
+        result /= -exponent <= 22 ? powersOfTen[-exponent] : pow(10.0, -exponent);
+    }
+
+    *value = (float)(negative ? -result : result);
+
+    return p;
+}
+
+// Vertex reference of a face (v, v/vt, v//vn or v/vt/vn), only the position index is kept
+static const char *parseIndex(const char *p, const char *end, int64_t *index)
+{
+    p = skipBlanks(p, end);
+
+    int negative = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    if (p >= end || *p < '0' || *p > '9')
+    {
+        return NULL;
+    }
+
+    int64_t value = 0;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        if (value < ((int64_t)1 << 40))
+        {
+            value = value * 10 + (*p - '0');
+        }
+    }
+
+    // Texture coordinate and normal indices
+    while (p < end && !isBlank(*p))
+    {
+        p++;
+    }
+
+    *index = negative ? -value : value;
+
+    return p;
+}
+
+static uint32_t countFaceReferences(const char *p, const char *end)
+{
+    uint32_t references = 0;
+
+    while (1)
+    {
+        p = skipBlanks(p, end);
+
+        if (p >= end || *p == '#')
+        {
+            return references;
+        }
+
+        references++;
+
+        while (p < end && !isBlank(*p))
+        {
+            p++;
+        }
+    }
+}
+
+// First pass: vertices and triangles of a chunk, so every chunk knows where its output goes
+static void countChunkTask(void *context, uint32_t chunkIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    ObjParseJob *job = context;
+    ObjChunk *chunk = &job->chunks[chunkIndex];
+
+    for (const char *line = chunk->begin; line < chunk->end;)
+    {
+        const char *end = lineEnd(line, chunk->end);
+        const char *p = skipBlanks(line, end);
+
+        if (end - p >= 2 && isBlank(p[1]))
+        {
+            if (p[0] == 'v')
+            {
+                chunk->vertexCount++;
+            }
+            else if (p[0] == 'f')
+            {
+                uint32_t references = countFaceReferences(p + 1, end);
+
+                if (references >= 3)
+                {
+                    chunk->triangleCount += references - 2;
+                }
+            }
+        }
+
+        line = end + 1;
+    }
+}
+
+// Second pass: writes the chunk's vertices and fan triangulated faces at its offsets
+static void parseChunkTask(void *context, uint32_t chunkIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    ObjParseJob *job = context;
+    ObjChunk *chunk = &job->chunks[chunkIndex];
+    float *position = job->positions + 3 * (size_t)chunk->firstVertex;
+    uint32_t *index = job->indices + 3 * (size_t)chunk->firstTriangle;
+    uint32_t verticesSoFar = chunk->firstVertex;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        chunk->boundsMin[axis] = INFINITY;
+        chunk->boundsMax[axis] = -INFINITY;
+    }
+
+    for (const char *line = chunk->begin; line < chunk->end && !chunk->failed;)
+    {
+        const char *end = lineEnd(line, chunk->end);
+        const char *p = skipBlanks(line, end);
+
+        if (end - p >= 2 && isBlank(p[1]) && p[0] == 'v')
+        {
+            p++;
+
+            for (int axis = 0; axis < 3 && p; axis++)
+            {
+                p = parseFloat(p, end, &position[axis]);
+
+                if (p)
+                {
+                    chunk->boundsMin[axis] = fminf(chunk->boundsMin[axis], position[axis]);
+                    chunk->boundsMax[axis] = fmaxf(chunk->boundsMax[axis], position[axis]);
+                }
+            }
+
+            chunk->failed = p == NULL;
+            position += 3;
+            verticesSoFar++;
+        }
+        else if (end - p >= 2 && isBlank(p[1]) && p[0] == 'f')
+        {
+            uint32_t references = countFaceReferences(p + 1, end);
+            uint32_t first = 0;
+            uint32_t previous = 0;
+
+            p++;
+
+            for (uint32_t i = 0; i < references && references >= 3; i++)
+            {
+                int64_t reference = 0;
+                p = parseIndex(p, end, &reference);
+
+                // 1 based, negative values count back from the last vertex read so far
+                int64_t resolved = reference > 0 ? reference - 1 : (int64_t)verticesSoFar + reference;
+
+                if (!p || reference == 0 || resolved < 0 || resolved >= job->vertexCount)
+                {
+                    chunk->failed = 1;
+                    break;
+                }
+
+                if (i == 0)
+                {
+                    first = (uint32_t)resolved;
+                }
+                else if (i >= 2)
+                {
+                    index[0] = first;
+                    index[1] = previous;
+                    index[2] = (uint32_t)resolved;
+                    index += 3;
+                }
+
+                previous = (uint32_t)resolved;
+            }
+        }
+
+        line = end + 1;
+    }
+}
+
+static int parseObj(const char *path, ObjMesh *mesh)
+{
+    int file = open(path, O_RDONLY);
+
+    if (file < 0)
+    {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 0;
+    }
+
+    struct stat info;
+
+    if (fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        fprintf(stderr, "Failed to read %s\n", path);
+        close(file);
+        return 0;
+    }
+
+    size_t size = (size_t)info.st_size;
+    const char *text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (text == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map %s\n", path);
+        return 0;
+    }
+
+    madvise((void *)text, size, MADV_SEQUENTIAL);
+
+    // A few chunks per thread balance files whose faces and vertices are not spread evenly
+    uint32_t chunkCount = threadPoolThreadCount() * 4;
+
+    if (size / chunkCount < OBJ_MIN_CHUNK_SIZE)
+    {
+        chunkCount = (uint32_t)(size / OBJ_MIN_CHUNK_SIZE) + 1;
+    }
+
+    ObjParseJob job = {};
+    job.chunks = calloc(chunkCount, sizeof(ObjChunk));
+
+    if (!job.chunks)
+    {
+        fprintf(stderr, "Failed to allocate OBJ chunks!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Chunk boundaries are moved forward to the next line start
+    const char *textEnd = text + size;
+    const char *begin = text;
+
+    for (uint32_t i = 0; i < chunkCount; i++)
+    {
+        const char *end = i + 1 == chunkCount ? textEnd : text + size * (i + 1) / chunkCount;
+
+        if (end < begin)
+        {
+            end = begin;
+        }
+
+        if (end < textEnd)
+        {
+            end = lineEnd(end, textEnd);
+            end = end < textEnd ? end + 1 : end;
+        }
+
+        job.chunks[i].begin = begin;
+        job.chunks[i].end = end;
+        begin = end;
+    }
+
+    threadPoolRun(countChunkTask, &job, chunkCount);
+
+    uint64_t vertexCount = 0;
+    uint64_t triangleCount = 0;
+
+    for (uint32_t i = 0; i < chunkCount; i++)
+    {
+        job.chunks[i].firstVertex = (uint32_t)vertexCount;
+        job.chunks[i].firstTriangle = (uint32_t)triangleCount;
+        vertexCount += job.chunks[i].vertexCount;
+        triangleCount += job.chunks[i].triangleCount;
+    }
+
+    if (vertexCount == 0 || triangleCount == 0 || vertexCount > UINT32_MAX || triangleCount > UINT32_MAX / 3)
+    {
+        fprintf(stderr, "%s has no triangles or too many vertices\n", path);
+        munmap((void *)text, size);
+        free(job.chunks);
+        return 0;
+    }
+
+    mesh->ownedPositions = malloc(vertexCount * 3 * sizeof(float));
+    mesh->ownedIndices = malloc(triangleCount * 3 * sizeof(uint32_t));
+
+    if (!mesh->ownedPositions || !mesh->ownedIndices)
+    {
+        fprintf(stderr, "Failed to allocate mesh memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    job.positions = mesh->ownedPositions;
+    job.indices = mesh->ownedIndices;
+    job.vertexCount = (uint32_t)vertexCount;
+
+    threadPoolRun(parseChunkTask, &job, chunkCount);
+    munmap((void *)text, size);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        mesh->boundsMin[axis] = INFINITY;
+        mesh->boundsMax[axis] = -INFINITY;
+    }
+
+    int failed = 0;
+
+    for (uint32_t i = 0; i < chunkCount; i++)
+    {
+        failed |= job.chunks[i].failed;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            mesh->boundsMin[axis] = fminf(mesh->boundsMin[axis], job.chunks[i].boundsMin[axis]);
+            mesh->boundsMax[axis] = fmaxf(mesh->boundsMax[axis], job.chunks[i].boundsMax[axis]);
+        }
+    }
+
+    free(job.chunks);
+
+    if (failed)
+    {
+        fprintf(stderr, "Malformed vertex or face in %s\n", path);
+        objMeshDestroy(mesh);
+        return 0;
+    }
+
+    mesh->positions = mesh->ownedPositions;
+    mesh->indices = mesh->ownedIndices;
+    mesh->vertexCount = (uint32_t)vertexCount;
+    mesh->triangleCount = (uint32_t)triangleCount;
+
+    return 1;
+}
+
+static uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + OBJ_CACHE_ALIGNMENT - 1) & ~(uint64_t)(OBJ_CACHE_ALIGNMENT - 1);
+}
+
+static int writePadding(FILE *file, uint64_t from, uint64_t to)
+{
+    static const char zeros[OBJ_CACHE_ALIGNMENT] = {0};
+
+    return to == from || fwrite(zeros, 1, (size_t)(to - from), file) == to - from;
+}
+
+// Written to a temporary file and renamed, so a concurrent run never maps a partial cache
+static void writeCache(const char *cachePath, const struct stat *source, const ObjMesh *mesh)
+{
+    ObjCacheHeader header = {};
+    memcpy(header.magic, objCacheMagic, sizeof(header.magic));
+    header.sourceSize = (uint64_t)source->st_size;
+    header.sourceSeconds = (int64_t)source->st_mtim.tv_sec;
+    header.sourceNanoseconds = (int64_t)source->st_mtim.tv_nsec;
+    header.vertexCount = mesh->vertexCount;
+    header.triangleCount = mesh->triangleCount;
+    header.vertexOffset = alignOffset(sizeof(header));
+    header.indexOffset = alignOffset(header.vertexOffset + (uint64_t)mesh->vertexCount * 3 * sizeof(float));
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        header.boundsMin[axis] = mesh->boundsMin[axis];
+        header.boundsMax[axis] = mesh->boundsMax[axis];
+    }
+
+    char temporaryPath[4096];
+    int pathLength = snprintf(temporaryPath, sizeof(temporaryPath), "%s.%ld.tmp", cachePath, (long)getpid());
+
+    // A truncated name could be another file, the cache is only an optimization
+    if (pathLength < 0 || (size_t)pathLength >= sizeof(temporaryPath))
+    {
+        return;
+    }
+
+    FILE *file = fopen(temporaryPath, "wb");
+
+    if (!file)
+    {
+        return;
+    }
+
+    size_t positionCount = (size_t)mesh->vertexCount * 3;
+    size_t indexCount = (size_t)mesh->triangleCount * 3;
+
+    int written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  writePadding(file, sizeof(header), header.vertexOffset) &&
+                  fwrite(mesh->positions, sizeof(float), positionCount, file) == positionCount &&
+                  writePadding(file, header.vertexOffset + positionCount * sizeof(float), header.indexOffset) &&
+                  fwrite(mesh->indices, sizeof(uint32_t), indexCount, file) == indexCount;
+
+    if (fclose(file) != 0 || !written || rename(temporaryPath, cachePath) != 0)
+    {
+        fprintf(stderr, "Failed to write the mesh cache %s\n", cachePath);
+        remove(temporaryPath);
+    }
+}
+
+static int mapCache(const char *cachePath, const struct stat *source, ObjMesh *mesh)
+{
+    int file = open(cachePath, O_RDONLY);
+
+    if (file < 0)
+    {
+        return 0;
+    }
+
+    struct stat info;
+
+    if (fstat(file, &info) != 0 || (size_t)info.st_size < sizeof(ObjCacheHeader))
+    {
+        close(file);
+        return 0;
+    }
+
+    size_t size = (size_t)info.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (mapping == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    const ObjCacheHeader *header = mapping;
+    uint64_t positionBytes = (uint64_t)header->vertexCount * 3 * sizeof(float);
+    uint64_t indexBytes = (uint64_t)header->triangleCount * 3 * sizeof(uint32_t);
+
+    // A cache of another version, of an edited OBJ or cut short is rebuilt
+    int valid = memcmp(header->magic, objCacheMagic, sizeof(objCacheMagic)) == 0 &&
+                header->sourceSize == (uint64_t)source->st_size &&
+                header->sourceSeconds == (int64_t)source->st_mtim.tv_sec &&
+                header->sourceNanoseconds == (int64_t)source->st_mtim.tv_nsec &&
+                header->vertexOffset % OBJ_CACHE_ALIGNMENT == 0 && header->indexOffset % OBJ_CACHE_ALIGNMENT == 0 &&
+                header->vertexOffset >= sizeof(ObjCacheHeader) && header->vertexOffset + positionBytes <= header->indexOffset &&
+                header->indexOffset + indexBytes <= size;
+
+    if (!valid)
+    {
+        munmap(mapping, size);
+        return 0;
+    }
+
+    mesh->mapping = mapping;
+    mesh->mappingSize = size;
+    mesh->positions = (const float *)((const char *)mapping + header->vertexOffset);
+    mesh->indices = (const uint32_t *)((const char *)mapping + header->indexOffset);
+    mesh->vertexCount = header->vertexCount;
+    mesh->triangleCount = header->triangleCount;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        mesh->boundsMin[axis] = header->boundsMin[axis];
+        mesh->boundsMax[axis] = header->boundsMax[axis];
+    }
+
+    return 1;
+}
+
+int objMeshLoad(const char *path, ObjMesh *mesh)
+{
+    memset(mesh, 0, sizeof(*mesh));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct stat source;
+
+    if (stat(path, &source) != 0)
+    {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 0;
+    }
+
+    char cachePath[4096];
+    snprintf(cachePath, sizeof(cachePath), "%s.fsmesh", path);
+
+    if (mapCache(cachePath, &source, mesh))
+    {
+        printf("Mesh %s mapped from its cache: %u vertices, %u triangles in %.1f ms\n", path, mesh->vertexCount, mesh->triangleCount, elapsedMilliseconds(&start));
+        return 1;
+    }
+
+    if (!parseObj(path, mesh))
+    {
+        return 0;
+    }
+
+    double parseTime = elapsedMilliseconds(&start);
+    writeCache(cachePath, &source, mesh);
+
+    printf("Mesh %s parsed: %u vertices, %u triangles in %.1f ms (%u threads), cache written in %.1f ms\n", path, mesh->vertexCount, mesh->triangleCount,
+           parseTime, threadPoolThreadCount(), elapsedMilliseconds(&start) - parseTime);
+
+    return 1;
+}
+
+void objMeshDestroy(ObjMesh *mesh)
+{
+    if (mesh->mapping)
+    {
+        munmap(mesh->mapping, mesh->mappingSize);
+    }
+
+    free(mesh->ownedPositions);
+    free(mesh->ownedIndices);
+    memset(mesh, 0, sizeof(*mesh));
+}
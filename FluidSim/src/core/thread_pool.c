@@ -0,0 +1,181 @@
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static pthread_t *workers = NULL;
+static uint32_t threadCount = 1;
+
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t workDone = PTHREAD_COND_INITIALIZER;
+
+// Current job, published under poolMutex. Workers claim indices with an atomic counter
+static ThreadPoolTask currentTask = NULL;
+static void *currentContext = NULL;
+static uint32_t currentTaskCount = 0;
+static atomic_uint nextTaskIndex;
+static uint64_t jobGeneration = 0;
+static uint32_t busyWorkers = 0;
+static int shuttingDown = 0;
+
+static void runTasks(ThreadPoolTask task, void *context, uint32_t taskCount, uint32_t threadIndex)
+{
+    for (;;)
+    {
+        uint32_t index = atomic_fetch_add_explicit(&nextTaskIndex, 1, memory_order_relaxed);
+
+        if (index >= taskCount)
+        {
+            break;
+        }
+
+        task(context, index, threadIndex);
+    }
+}
+
+static void *workerLoop(void *argument)
+{
+    uint32_t threadIndex = (uint32_t)(uintptr_t)argument;
+    uint64_t seenGeneration = 0;
+
+    pthread_mutex_lock(&poolMutex);
+
+    for (;;)
+    {
+        while (jobGeneration == seenGeneration && !shuttingDown)
+        {
+            pthread_cond_wait(&workReady, &poolMutex);
+        }
+
+        if (shuttingDown)
+        {
+            break;
+        }
+
+        seenGeneration = jobGeneration;
+
+        ThreadPoolTask task = currentTask;
+        void *context = currentContext;
+        uint32_t taskCount = currentTaskCount;
+
+        pthread_mutex_unlock(&poolMutex);
+
+        runTasks(task, context, taskCount, threadIndex);
+
+        pthread_mutex_lock(&poolMutex);
+
+        if (--busyWorkers == 0)
+        {
+            pthread_cond_signal(&workDone);
+        }
+    }
+
+    pthread_mutex_unlock(&poolMutex);
+
+    return NULL;
+}
+
+void threadPoolInit(uint32_t requestedThreads)
+{
+    if (workers != NULL)
+    {
+        return;
+    }
+
+    if (requestedThreads == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        requestedThreads = cores > 0 ? (uint32_t)cores : 1;
+    }
+
+    threadCount = requestedThreads;
+    shuttingDown = 0;
+    workers = malloc(sizeof(pthread_t) * threadCount);
+
+    // Index 0 is the thread calling threadPoolRun(), it does not get a worker
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        if (pthread_create(&workers[i], NULL, workerLoop, (void *)(uintptr_t)i) != 0)
+        {
+            fprintf(stderr, "Failed to create worker thread %u!\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("Thread pool created with %u threads\n", threadCount);
+}
+
+uint32_t threadPoolThreadCount()
+{
+    return threadCount;
+}
+
+void threadPoolRun(ThreadPoolTask task, void *context, uint32_t taskCount)
+{
+    if (taskCount == 0)
+    {
+        return;
+    }
+
+    // Not worth waking anybody up
+    if (workers == NULL || threadCount == 1 || taskCount == 1)
+    {
+        for (uint32_t i = 0; i < taskCount; i++)
+        {
+            task(context, i, 0);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&poolMutex);
+
+    currentTask = task;
+    currentContext = context;
+    currentTaskCount = taskCount;
+    atomic_store_explicit(&nextTaskIndex, 0, memory_order_relaxed);
+    busyWorkers = threadCount - 1;
+    jobGeneration++;
+
+    pthread_cond_broadcast(&workReady);
+    pthread_mutex_unlock(&poolMutex);
+
+    runTasks(task, context, taskCount, 0);
+
+    // Every worker has to check in, even the ones that found no index left, before the next job can start
+    pthread_mutex_lock(&poolMutex);
+
+    while (busyWorkers > 0)
+    {
+        pthread_cond_wait(&workDone, &poolMutex);
+    }
+
+    pthread_mutex_unlock(&poolMutex);
+}
+
+void threadPoolDestroy()
+{
+    if (workers == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&poolMutex);
+    shuttingDown = 1;
+    pthread_cond_broadcast(&workReady);
+    pthread_mutex_unlock(&poolMutex);
+
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    workers = NULL;
+    threadCount = 1;
+
+    printf("Destroyed thread pool\n");
+}
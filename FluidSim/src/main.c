@@ -1,44 +1,122 @@
 #include "../include/sdl_init.h"
 #include "../include/vulkan_utils.h"
+#include "../include/sph_gpu.h"
+#include "../include/camera.h"
+#include "../include/offscreen.h"
+#include "../include/frame_writer.h"
+#include "../include/thread_pool.h"
+#include "../include/renderer.h"
+#include "../include/gpu_culling.h"
+#include "../include/obj_loader.h"
+#include "../include/sdf.h"
+#include "../include/sph_adaptive.h"
+#include "../include/sph_domain.h"
+#include "../include/sph_stream.h"
+#include "../include/sph_hybrid.h"
+#include "../include/sph_pool.h"
+#include "../include/frame_bench.h"
+#include "../include/metrics.h"
+#include "../include/frame_pacing.h"
+#include "../include/descriptor_heap.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 void drawFrame()
 {
+    currentFrame++;
+
+    if (frameTimingActive)
+    {
+        frameBenchBeginFrame(currentFrame);
+    }
+
+    // The time blocked on the fence and the image is what the pacing sleeps off before the next input
+    uint64_t blockedStart = SDL_GetTicksNS();
+
     vkWaitForFences(device, 1, &inFlightFence, VK_TRUE, UINT64_MAX); // Device, number of fences, array of fences, wait on all fences or not, timeout (in nanoseconds)
     vkResetFences(device, 1, &inFlightFence);                        // Reset the fences manually to continue execution
+
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_ACQUIRE);
+    }
+
+    uint64_t blocked = SDL_GetTicksNS() - blockedStart;
+
+    prepareFluidFrame(currentFrame); // The previous frame finished, the mesh buffers of this slot are free
     uint32_t imageIndex = 0;
 
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_RECORD);
+    }
+
+    blockedStart = SDL_GetTicksNS();
     vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    framePacingBlocked(blocked + SDL_GetTicksNS() - blockedStart);
 
-    vkResetCommandBuffer(commandBuffer, 0);
-    recordCommandBuffer(commandBuffer, imageIndex);
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_ACQUIRE);
+    }
+
+    VkCommandBuffer frameCommandBuffer = acquireFrameCommandBuffer(commandBuffer, imageIndex);
+
+    // The benchmark brackets the frame with timestamp writes on the GPU
+    VkCommandBuffer submitCommandBuffers[3];
+    uint32_t submitCommandBufferCount = 1;
+    submitCommandBuffers[0] = frameCommandBuffer;
+
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_RECORD);
+        submitCommandBufferCount = frameBenchWrapGraphics(currentFrame, frameCommandBuffer, submitCommandBuffers);
+    }
 
     // Submiting the command buffer
 
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = {imageAvailableSemaphore};
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
+    // Wait for the swapchain image and for the simulation batch this frame draws. Timeline
+    // values are ignored for the binary semaphores, so they are left at 0
+    VkSemaphore waitSemaphores[] = {imageAvailableSemaphore, simulationTimeline};
+    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT};
+    uint64_t waitValues[] = {0, currentFrame};
+    submitInfo.waitSemaphoreCount = 2;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
 
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.commandBufferCount = submitCommandBufferCount;
+    submitInfo.pCommandBuffers = submitCommandBuffers;
 
-    VkSemaphore signalSemaphores[] = {renderFinishedSemaphore};
-    submitInfo.signalSemaphoreCount = 1;
+    // renderTimeline tells the compute queue when the positions of this frame may be overwritten
+    VkSemaphore signalSemaphores[] = {renderFinishedSemaphore, renderTimeline};
+    uint64_t signalValues[] = {0, currentFrame};
+    submitInfo.signalSemaphoreCount = 2;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 2;
+    timelineInfo.pWaitSemaphoreValues = waitValues;
+    timelineInfo.signalSemaphoreValueCount = 2;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
+    submitInfo.pNext = &timelineInfo;
+
     if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence) != VK_SUCCESS)
     {
         fprintf(stderr, "Failed to submit draw command buffer!\n");
         exit(EXIT_FAILURE);
     }
 
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_SUBMIT);
+    }
+
     // Draw image to the swapchain
 
     VkPresentInfoKHR presentInfo = {};
@@ -54,26 +132,630 @@ void drawFrame()
     presentInfo.pResults = NULL; // Optional - used to check results between multiple swapchains
 
     vkQueuePresentKHR(presentQueue, &presentInfo);
+    framePacingPresented();
+
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_PRESENT);
+    }
+
+    // Queue the batch the next frame draws, it overlaps with the rendering of this one
+    sphGpuSubmitStep(currentFrame + 1);
+
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_SIMULATION);
+    }
+}
+
+static void printUsage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--particles N] [--steps-per-frame N] [--gpu index|name] [--threads N] [--cache-commands] [--no-gpu-cull] [--no-bindless] [--lod-pixels X] [--verify-gpu [steps]]\n"
+                    "       [--compact-storage] [--compare-storage [steps]] [--adaptive [steps]] [--domains N [steps]]\n"
+                    "       [--stream [steps]] [--stream-brick N] [--stream-resident N] [--stream-prefetch N] [--stream-dir DIR]\n"
+                    "       [--hybrid [steps]] [--flip-ratio X] [--apic]\n"
+                    "       [--headless] [--size WxH] [--frames N] [--output DIR] [--format png|raw] [--render particles|surface|mesh|volume]\n"
+                    "       [--half-res-filter] [--volume-half-res]\n"
+                    "       [--mesh-output DIR] [--mesh-threshold X] [--object PATH.obj] [--viscosity X] [--implicit-viscosity [iterations]]\n"
+                    "       [--neighbor-skin X] [--neighbor-report [steps]] [--emitters [steps]] [--verify-emitters [steps]]\n"
+                    "       [--bench-frames N] [--bench-baseline PATH] [--bench-save PATH] [--bench-tolerance X]\n"
+                    "       [--metrics-socket PATH] [--present low-latency|throughput|vsync]\n", program);
+}
+
+// Tears down whatever main() set up, each part only if it exists: the CPU reports leave without a
+// window or a Vulkan device, the headless modes without a window
+static void shutdownEngine(SdfGrid *obstacle)
+{
+    if (device != VK_NULL_HANDLE)
+    {
+        vkDeviceWaitIdle(device);
+    }
+
+    destroyGpuCulling();
+    sphGpuDestroy();
+    quitVulkan(); // Also stops the metrics exporter
+    threadPoolDestroy();
+    sdfDestroy(obstacle);
+
+    if (window)
+    {
+        quitSDL(&window);
+    }
 }
 
 int main(int argc, char *argv[])
 {
-    setupWindow(&window);
+    uint32_t particleCount = 32768;
+    uint32_t verifySteps = 0;
+    uint32_t compareSteps = 0;
+    uint32_t adaptiveSteps = 0;
+    uint32_t domainRanks = 0;
+    uint32_t viscosityIterations = 0;
+    float viscosity = -1.0f;
+    uint32_t domainSteps = 0;
+    uint32_t streamSteps = 0;
+    SphStreamInfo streamInfo = {"/tmp", 4, 0, 4};
+    uint32_t hybridSteps = 0;
+    uint32_t neighborSteps = 0;
+    float neighborSkin = 0.0f;
+    uint32_t poolSteps = 0;
+    uint32_t poolVerifySteps = 0;
+    float flipRatio = -1.0f;
+    int apic = 0;
+    uint32_t threadCount = 0;
+    uint32_t headlessFrames = 240;
+    uint32_t benchFrames = 0;
+    const char *benchBaseline = NULL;
+    const char *benchSave = NULL;
+    float benchTolerance = 0.1f;
+    const char *metricsSocket = NULL;
+    const char *outputDirectory = "frames";
+    const char *objectPath = NULL;
+    FrameFormat outputFormat = FRAME_FORMAT_PNG;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc)
+        {
+            particleCount = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--steps-per-frame") == 0 && i + 1 < argc)
+        {
+            sphStepsPerFrame = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--gpu") == 0 && i + 1 < argc)
+        {
+            gpuOverride = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threadCount = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--cache-commands") == 0)
+        {
+            cacheCommandBuffers = 1;
+        }
+        else if (strcmp(argv[i], "--headless") == 0)
+        {
+            headlessMode = 1;
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%ux%u", &offscreenExtent.width, &offscreenExtent.height) != 2)
+            {
+                fprintf(stderr, "Expected --size WIDTHxHEIGHT, got %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            headlessFrames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            outputDirectory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if (strcmp(argv[i], "png") == 0)
+            {
+                outputFormat = FRAME_FORMAT_PNG;
+            }
+            else if (strcmp(argv[i], "raw") == 0)
+            {
+                outputFormat = FRAME_FORMAT_RAW;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown argument: --format %s\n", argv[i]);
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if (strcmp(argv[i], "particles") == 0)
+            {
+                renderMode = RENDER_MODE_PARTICLES;
+            }
+            else if (strcmp(argv[i], "surface") == 0)
+            {
+                renderMode = RENDER_MODE_SURFACE;
+            }
+            else if (strcmp(argv[i], "mesh") == 0)
+            {
+                renderMode = RENDER_MODE_MESH;
+            }
+            else if (strcmp(argv[i], "volume") == 0)
+            {
+                renderMode = RENDER_MODE_VOLUME;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown argument: --render %s\n", argv[i]);
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--mesh-output") == 0 && i + 1 < argc)
+        {
+            fluidMeshOutput = argv[++i];
+        }
+        else if (strcmp(argv[i], "--mesh-threshold") == 0 && i + 1 < argc)
+        {
+            fluidMeshThreshold = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--no-gpu-cull") == 0)
+        {
+            gpuCulling = 0;
+        }
+        else if (strcmp(argv[i], "--no-bindless") == 0)
+        {
+            descriptorHeapRequested = 0;
+        }
+        else if (strcmp(argv[i], "--lod-pixels") == 0 && i + 1 < argc)
+        {
+            lodPixelThreshold = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--object") == 0 && i + 1 < argc)
+        {
+            objectPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--half-res-filter") == 0)
+        {
+            fluidHalfResolution = 1;
+        }
+        else if (strcmp(argv[i], "--volume-half-res") == 0)
+        {
+            volumeHalfResolution = 1;
+        }
+        else if (strcmp(argv[i], "--compact-storage") == 0)
+        {
+            sphCompactStorage = 1;
+        }
+        else if (strcmp(argv[i], "--compare-storage") == 0)
+        {
+            compareSteps = 100;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                compareSteps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else if (strcmp(argv[i], "--adaptive") == 0)
+        {
+            adaptiveSteps = 1000;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                adaptiveSteps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else if (strcmp(argv[i], "--domains") == 0 && i + 1 < argc)
+        {
+            domainRanks = (uint32_t)strtoul(argv[++i], NULL, 10);
+            domainSteps = 500;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                domainSteps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else if (strcmp(argv[i], "--stream") == 0)
+        {
+            streamSteps = 200;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                streamSteps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else if (strcmp(argv[i], "--stream-brick") == 0 && i + 1 < argc)
+        {
+            streamInfo.brickCells = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--stream-resident") == 0 && i + 1 < argc)
+        {
+            streamInfo.residentLimit = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--stream-prefetch") == 0 && i + 1 < argc)
+        {
+            streamInfo.prefetchDistance = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--stream-dir") == 0 && i + 1 < argc)
+        {
+            streamInfo.directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--hybrid") == 0)
+        {
+            hybridSteps = 300;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                hybridSteps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else if (strcmp(argv[i], "--flip-ratio") == 0 && i + 1 < argc)
+        {
+            flipRatio = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--apic") == 0)
+        {
+            apic = 1;
+        }
+        else if (strcmp(argv[i], "--viscosity") == 0 && i + 1 < argc)
+        {
+            viscosity = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--implicit-viscosity") == 0)
+        {
+            viscosityIterations = 30;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                viscosityIterations = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else if (strcmp(argv[i], "--neighbor-skin") == 0 && i + 1 < argc)
+        {
+            neighborSkin = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--neighbor-report") == 0)
+        {
+            neighborSteps = 500;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                neighborSteps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else if (strcmp(argv[i], "--emitters") == 0)
+        {
+            poolSteps = 2000;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                poolSteps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else if (strcmp(argv[i], "--verify-emitters") == 0)
+        {
+            poolVerifySteps = 1200;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                poolVerifySteps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else if (strcmp(argv[i], "--bench-frames") == 0 && i + 1 < argc)
+        {
+            benchFrames = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--bench-baseline") == 0 && i + 1 < argc)
+        {
+            benchBaseline = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bench-save") == 0 && i + 1 < argc)
+        {
+            benchSave = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bench-tolerance") == 0 && i + 1 < argc)
+        {
+            benchTolerance = strtof(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--present") == 0 && i + 1 < argc)
+        {
+            i++;
+
+            if (strcmp(argv[i], "low-latency") == 0)
+            {
+                framePacing = FRAME_PACING_LOW_LATENCY;
+            }
+            else if (strcmp(argv[i], "throughput") == 0)
+            {
+                framePacing = FRAME_PACING_THROUGHPUT;
+            }
+            else if (strcmp(argv[i], "vsync") == 0)
+            {
+                framePacing = FRAME_PACING_VSYNC;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown argument: --present %s\n", argv[i]);
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc)
+        {
+            metricsSocket = argv[++i];
+        }
+        else if (strcmp(argv[i], "--verify-gpu") == 0)
+        {
+            verifySteps = 10;
+
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+            {
+                verifySteps = (uint32_t)strtoul(argv[++i], NULL, 10);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (particleCount == 0)
+    {
+        fprintf(stderr, "The particle count must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (offscreenExtent.width == 0 || offscreenExtent.height == 0)
+    {
+        fprintf(stderr, "The offscreen size must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    // Worker threads for command buffer recording, created before Vulkan sizes its per-thread pools
+    threadPoolInit(threadCount);
+
+    // Obstacle mesh, parsed on the pool the first time and mapped from its cache afterwards
+    ObjMesh obstacleMesh = {};
+    SdfGrid obstacle = {};
+
+    if (objectPath && !objMeshLoad(objectPath, &obstacleMesh))
+    {
+        shutdownEngine(&obstacle);
+        return EXIT_FAILURE;
+    }
+
+    // Served for every mode from here on, shutdownEngine() stops the exporter. The GPU values are only
+    // collected once a device exists
+    if (metricsSocket)
+    {
+        metricsStart(metricsSocket, collectGpuMetrics);
+        frameTimingActive = 1;
+    }
+
+    SphParams params = sphDefaultParams(particleCount);
+    params.viscosityIterations = viscosityIterations;
+    params.neighborSkin = neighborSkin;
+
+    if (viscosity >= 0.0f)
+    {
+        params.viscosity = viscosity;
+    }
+
+    if (viscosityIterations == 0 && params.timeStep > sphViscousTimeStepLimit(&params))
+    {
+        printf("Warning: the time step %g is above the explicit viscosity limit %g, use --implicit-viscosity\n", params.timeStep, sphViscousTimeStepLimit(&params));
+    }
+
+    // Spheres slightly larger than half the spacing so neighbours overlap into a closed surface
+    fluidParticleRadius = 0.6f * params.particleSpacing;
+
+    if (objectPath)
+    {
+        SdfBakeInfo bakeInfo = {};
+        bakeInfo.cellSize = 0.5f * params.smoothingRadius;
+        bakeInfo.bandWidth = 2.0f * params.smoothingRadius;
+
+        // Beside the dam break block, which fills the first 40% of the domain along x
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = params.boundsMax[axis] - params.boundsMin[axis];
+
+            bakeInfo.gridMin[axis] = params.boundsMin[axis] - bakeInfo.cellSize;
+            bakeInfo.gridMax[axis] = params.boundsMax[axis] + bakeInfo.cellSize;
+            bakeInfo.placementMin[axis] = params.boundsMin[axis] + 0.2f * extent;
+            bakeInfo.placementMax[axis] = params.boundsMax[axis] - 0.2f * extent;
+        }
+
+        bakeInfo.placementMin[0] = params.boundsMin[0] + 0.55f * (params.boundsMax[0] - params.boundsMin[0]);
+        bakeInfo.placementMax[0] = params.boundsMin[0] + 0.9f * (params.boundsMax[0] - params.boundsMin[0]);
+        bakeInfo.placementMin[1] = params.boundsMin[1];
+        bakeInfo.placementMax[1] = params.boundsMin[1] + 0.5f * (params.boundsMax[1] - params.boundsMin[1]);
+
+        char cachePath[4096];
+        snprintf(cachePath, sizeof(cachePath), "%s.sdf", objectPath);
+
+        sdfBake(&obstacleMesh, &bakeInfo, cachePath, &obstacle);
+        objMeshDestroy(&obstacleMesh); // The solver only needs the field
+
+        params.obstacle = &obstacle;
+    }
+
+    // The CPU reports need neither a window nor a Vulkan device, they run and exit before either exists
+    if (adaptiveSteps > 0 || neighborSteps > 0 || poolSteps > 0 || hybridSteps > 0 || domainRanks > 0 || streamSteps > 0)
+    {
+        int passed = 1;
+
+        if (adaptiveSteps > 0)
+        {
+            // The dam break with adaptive particle resolution
+            sphAdaptiveReport(&params, adaptiveSteps);
+        }
+        else if (neighborSteps > 0)
+        {
+            // Verlet lists against the grid walk
+            sphNeighborReport(&params, neighborSteps);
+        }
+        else if (poolSteps > 0)
+        {
+            // The inlet and drain scene through the particle pool
+            sphPoolReport(&params, poolSteps);
+        }
+        else if (hybridSteps > 0)
+        {
+            // The dam break with the FLIP/PIC hybrid
+            sphHybridReport(&params, apic, flipRatio, hybridSteps);
+        }
+        else if (domainRanks > 0)
+        {
+            // Split over forked processes and compared against one process
+            passed = sphDomainReport(&params, domainRanks, domainSteps);
+        }
+        else
+        {
+            // Out of core over memory mapped bricks and compared against the in-memory solver
+            passed = sphStreamReport(&params, &streamInfo, streamSteps);
+        }
+
+        shutdownEngine(&obstacle);
+
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Farm renders have no display, SDL is not initialized at all
+    if (!headlessMode)
+    {
+        setupWindow(&window);
+    }
 
     initVulkan(window);
 
+    // The compute backend reports exit once they are done
+    if (compareSteps > 0 || verifySteps > 0 || poolVerifySteps > 0)
+    {
+        int passed = 1;
+
+        if (compareSteps > 0)
+        {
+            // The fp32 and compact particle storage against each other
+            sphGpuCompareStorage(&params, compareSteps);
+        }
+        else if (verifySteps > 0)
+        {
+            // The compute backend against the CPU solver
+            passed = sphGpuVerify(&params, verifySteps);
+        }
+        else
+        {
+            // The particle pool mirrored with incremental updates
+            passed = sphGpuVerifyPool(&params, poolVerifySteps);
+        }
+
+        shutdownEngine(&obstacle);
+
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    SphSolver initialState;
+    sphInit(&initialState, &params);
+    sphSeedDamBreak(&initialState);
+    sphGpuInit(&initialState);
+    sphDestroy(&initialState);
+
+    if (renderMode == RENDER_MODE_MESH || renderMode == RENDER_MODE_VOLUME)
+    {
+        fluidMeshInit(&params);
+    }
+
+    createGpuCulling(&params);
+
+    cameraFitBounds(&camera, params.boundsMin, params.boundsMax);
+    markCommandBuffersDirty(); // The camera matrix is baked into the push constants
+
+    // The benchmark scene is the seeded dam break from a fixed camera, the same on every run with the
+    // same arguments. The warm-up lets the caches, the allocators and the first splash settle
+    uint32_t benchWarmUp = benchFrames / 10 > 10 ? benchFrames / 10 : 10;
+    char benchConfiguration[256];
+
+    if (benchFrames > 0)
+    {
+        const char *modeNames[] = {"particles", "surface", "mesh", "volume"};
+
+        snprintf(benchConfiguration, sizeof(benchConfiguration), "particles=%u steps_per_frame=%u render=%s size=%ux%u headless=%d gpu_cull=%d compact=%d cache=%d",
+                 params.particleCount, sphStepsPerFrame, modeNames[renderMode], swapChainExtent.width, swapChainExtent.height, headlessMode, gpuCulling,
+                 sphCompactStorage, cacheCommandBuffers);
+
+        frameBenchStart(benchFrames, benchWarmUp);
+        offscreenDiscardFrames = 1;
+    }
+
+    // The first frame draws batch 1, every frame then queues the batch of the next one
+    sphGpuSubmitStep(1);
+
+    if (headlessMode)
+    {
+        // Two frames can wait for the writer while two more are being read back
+        if (benchFrames == 0)
+        {
+            frameWriterStart(outputDirectory, outputFormat, offscreenExtent.width, offscreenExtent.height, 2);
+        }
+
+        uint32_t frameTotal = benchFrames > 0 ? benchWarmUp + benchFrames : headlessFrames;
+
+        for (uint32_t frame = 0; frame < frameTotal; frame++)
+        {
+            drawOffscreenFrame();
+        }
+
+        flushOffscreenFrames();
+        frameWriterStop();
+
+        vkDeviceWaitIdle(device);
+
+        int passed = 1;
+
+        if (benchFrames > 0)
+        {
+            passed = frameBenchReport(benchConfiguration, benchBaseline, benchSave, benchTolerance);
+            frameBenchDestroy();
+        }
+
+        shutdownEngine(&obstacle);
+
+        return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     SDL_Event event;
 
     int running = 1;
 
-    while (running)
+    while (running && !(frameBenchActive && frameBenchDone()))
     {
+        // Events are polled as late as the pacing allows, right before the frame that follows them
+        framePacingSleep();
+
         while (SDL_PollEvent(&event))
         {
             if (event.type == SDL_EVENT_QUIT)
             {
                 running = 0;
             }
+            else if (event.type == SDL_EVENT_KEY_DOWN || event.type == SDL_EVENT_KEY_UP || event.type == SDL_EVENT_MOUSE_MOTION ||
+                     event.type == SDL_EVENT_MOUSE_BUTTON_DOWN || event.type == SDL_EVENT_MOUSE_BUTTON_UP || event.type == SDL_EVENT_MOUSE_WHEEL)
+            {
+                framePacingEvent(event.common.timestamp);
+            }
         }
 
         // Vulkan rendering here
@@ -83,8 +765,17 @@ int main(int argc, char *argv[])
 
     vkDeviceWaitIdle(device);
 
-    quitVulkan();
-    quitSDL(&window);
+    framePacingReport();
+
+    int passed = 1;
+
+    if (frameBenchActive)
+    {
+        passed = frameBenchReport(benchConfiguration, benchBaseline, benchSave, benchTolerance);
+        frameBenchDestroy();
+    }
+
+    shutdownEngine(&obstacle);
 
-    return 0;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
\ No newline at end of file
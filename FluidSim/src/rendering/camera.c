@@ -0,0 +1,177 @@
+#include "camera.h"
+#include <math.h>
+
+Camera camera = {
+    .eye = {0.0f, 0.0f, 3.0f},
+    .target = {0.0f, 0.0f, 0.0f},
+    .up = {0.0f, 1.0f, 0.0f},
+    .fovY = 0.8f,
+    .nearPlane = 0.01f,
+    .farPlane = 100.0f};
+
+static void normalize(float v[3])
+{
+    float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+
+    if (length > 0.0f)
+    {
+        v[0] /= length;
+        v[1] /= length;
+        v[2] /= length;
+    }
+}
+
+static void cross(const float a[3], const float b[3], float out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float dot(const float a[3], const float b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Column-major 4x4 multiply, out = a * b
+static void multiply(const float a[16], const float b[16], float out[16])
+{
+    for (int column = 0; column < 4; column++)
+    {
+        for (int row = 0; row < 4; row++)
+        {
+            float sum = 0.0f;
+
+            for (int k = 0; k < 4; k++)
+            {
+                sum += a[k * 4 + row] * b[column * 4 + k];
+            }
+
+            out[column * 4 + row] = sum;
+        }
+    }
+}
+
+void cameraFitBounds(Camera *camera, const float boundsMin[3], const float boundsMax[3])
+{
+    float radius = 0.0f;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float half = 0.5f * (boundsMax[axis] - boundsMin[axis]);
+        camera->target[axis] = boundsMin[axis] + half;
+        radius += half * half;
+    }
+
+    radius = sqrtf(radius);
+
+    // Look at the domain slightly from above so the free surface is visible
+    float direction[3] = {0.35f, 0.45f, 1.0f};
+    normalize(direction);
+
+    float distance = radius / sinf(0.5f * camera->fovY);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        camera->eye[axis] = camera->target[axis] + direction[axis] * distance;
+    }
+
+    camera->nearPlane = 0.01f * distance;
+    camera->farPlane = distance + 2.0f * radius;
+}
+
+void cameraView(const Camera *camera, float out[16])
+{
+    // Right handed look-at view matrix
+    float forward[3] = {
+        camera->target[0] - camera->eye[0],
+        camera->target[1] - camera->eye[1],
+        camera->target[2] - camera->eye[2]};
+    normalize(forward);
+
+    float side[3];
+    cross(forward, camera->up, side);
+    normalize(side);
+
+    float up[3];
+    cross(side, forward, up);
+
+    float view[16] = {
+        side[0], up[0], -forward[0], 0.0f,
+        side[1], up[1], -forward[1], 0.0f,
+        side[2], up[2], -forward[2], 0.0f,
+        -dot(side, camera->eye), -dot(up, camera->eye), dot(forward, camera->eye), 1.0f};
+
+    for (int i = 0; i < 16; i++)
+    {
+        out[i] = view[i];
+    }
+}
+
+void cameraProjection(const Camera *camera, float aspect, float out[16])
+{
+    // Perspective projection for Vulkan clip space: y points down and depth goes from 0 to 1
+    float f = 1.0f / tanf(0.5f * camera->fovY);
+    float n = camera->nearPlane;
+    float fa = camera->farPlane;
+
+    float projection[16] = {
+        f / aspect, 0.0f, 0.0f, 0.0f,
+        0.0f, -f, 0.0f, 0.0f,
+        0.0f, 0.0f, fa / (n - fa), -1.0f,
+        0.0f, 0.0f, n * fa / (n - fa), 0.0f};
+
+    for (int i = 0; i < 16; i++)
+    {
+        out[i] = projection[i];
+    }
+}
+
+void cameraViewProjection(const Camera *camera, float aspect, float out[16])
+{
+    float view[16];
+    float projection[16];
+
+    cameraView(camera, view);
+    cameraProjection(camera, aspect, projection);
+
+    multiply(projection, view, out);
+}
+
+// Inverse of a column-major 4x4 matrix by cofactors, the identity when it is singular
+static void invert(const float m[16], float out[16])
+{
+    float inverse[16];
+
+    inverse[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+    inverse[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+    inverse[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+    inverse[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+    inverse[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+    inverse[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+    inverse[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+    inverse[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+    inverse[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+    inverse[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+    inverse[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+    inverse[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+    inverse[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+    inverse[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+    inverse[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+    inverse[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+    float determinant = m[0] * inverse[0] + m[1] * inverse[4] + m[2] * inverse[8] + m[3] * inverse[12];
+
+    for (int i = 0; i < 16; i++)
+    {
+        out[i] = determinant != 0.0f ? inverse[i] / determinant : (i % 5 == 0 ? 1.0f : 0.0f);
+    }
+}
+
+void cameraInverseViewProjection(const Camera *camera, float aspect, float out[16])
+{
+    float viewProjection[16];
+
+    cameraViewProjection(camera, aspect, viewProjection);
+    invert(viewProjection, out);
+}
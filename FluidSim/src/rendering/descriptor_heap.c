@@ -0,0 +1,275 @@
+#include "descriptor_heap.h"
+#include "vulkan_utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct {
+    uint32_t capacity;
+    uint32_t *freeSlots; // Stack of free slots, the lowest on top
+    uint32_t freeCount;
+} DescriptorHeapSlots;
+
+int descriptorHeapRequested = 1;
+int descriptorHeapSupported = 0;
+VkDescriptorSetLayout descriptorHeapSetLayout = VK_NULL_HANDLE;
+
+static VkDescriptorPool descriptorHeapPool = VK_NULL_HANDLE;
+static VkDescriptorSet descriptorHeapSet = VK_NULL_HANDLE;
+static DescriptorHeapSlots heapSlots[DESCRIPTOR_HEAP_BINDING_COUNT];
+
+void descriptorHeapEnableFeatures(const VkPhysicalDeviceFeatures *supported, const VkPhysicalDeviceVulkan12Features *supported12,
+                                  VkPhysicalDeviceFeatures *enabled, VkPhysicalDeviceVulkan12Features *enabled12)
+{
+    // Handles come from push constants, so the indices are dynamically uniform: no non-uniform indexing
+    descriptorHeapSupported = descriptorHeapRequested && supported->shaderStorageBufferArrayDynamicIndexing && supported->shaderStorageImageArrayDynamicIndexing &&
+                              supported12->runtimeDescriptorArray && supported12->descriptorBindingPartiallyBound &&
+                              supported12->descriptorBindingUpdateUnusedWhilePending && supported12->descriptorBindingStorageBufferUpdateAfterBind &&
+                              supported12->descriptorBindingStorageImageUpdateAfterBind;
+
+    if (!descriptorHeapSupported)
+    {
+        return;
+    }
+
+    enabled->shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+    enabled->shaderStorageImageArrayDynamicIndexing = VK_TRUE;
+    enabled12->runtimeDescriptorArray = VK_TRUE;
+    enabled12->descriptorBindingPartiallyBound = VK_TRUE;
+    enabled12->descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    enabled12->descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+    enabled12->descriptorBindingStorageImageUpdateAfterBind = VK_TRUE;
+}
+
+static void initSlots(DescriptorHeapSlots *slots, uint32_t capacity)
+{
+    slots->capacity = capacity;
+    slots->freeSlots = malloc(capacity * sizeof(uint32_t));
+    slots->freeCount = capacity;
+
+    if (!slots->freeSlots)
+    {
+        fprintf(stderr, "Failed to allocate descriptor heap slots!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        slots->freeSlots[i] = capacity - 1 - i;
+    }
+}
+
+void createDescriptorHeap()
+{
+    if (!descriptorHeapSupported)
+    {
+        printf("Descriptor heap disabled or not supported, passes bind their own descriptor sets\n");
+        return;
+    }
+
+    VkPhysicalDeviceDescriptorIndexingProperties indexingProperties = {};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &indexingProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    // Each stage may see the whole heap, so the per-stage limits bound its size
+    uint32_t capacities[DESCRIPTOR_HEAP_BINDING_COUNT] = {DESCRIPTOR_HEAP_BUFFERS, DESCRIPTOR_HEAP_IMAGES};
+    uint32_t limits[DESCRIPTOR_HEAP_BINDING_COUNT] = {
+        indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers < indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers
+            ? indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers
+            : indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+        indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageImages < indexingProperties.maxDescriptorSetUpdateAfterBindStorageImages
+            ? indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageImages
+            : indexingProperties.maxDescriptorSetUpdateAfterBindStorageImages};
+    VkDescriptorType types[DESCRIPTOR_HEAP_BINDING_COUNT] = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE};
+
+    VkDescriptorSetLayoutBinding bindings[DESCRIPTOR_HEAP_BINDING_COUNT] = {};
+    VkDescriptorBindingFlags bindingFlags[DESCRIPTOR_HEAP_BINDING_COUNT];
+    VkDescriptorPoolSize poolSizes[DESCRIPTOR_HEAP_BINDING_COUNT] = {};
+
+    for (uint32_t i = 0; i < DESCRIPTOR_HEAP_BINDING_COUNT; i++)
+    {
+        if (capacities[i] > limits[i])
+        {
+            capacities[i] = limits[i];
+        }
+
+        bindings[i].binding = i;
+        bindings[i].descriptorType = types[i];
+        bindings[i].descriptorCount = capacities[i];
+        bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+
+        bindingFlags[i] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                          VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+        poolSizes[i].type = types[i];
+        poolSizes[i].descriptorCount = capacities[i];
+
+        initSlots(&heapSlots[i], capacities[i]);
+    }
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = DESCRIPTOR_HEAP_BINDING_COUNT;
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = DESCRIPTOR_HEAP_BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &descriptorHeapSetLayout) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create descriptor heap layout!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = DESCRIPTOR_HEAP_BINDING_COUNT;
+    poolInfo.pPoolSizes = poolSizes;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, NULL, &descriptorHeapPool) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create descriptor heap pool!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorHeapPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &descriptorHeapSetLayout;
+
+    if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorHeapSet) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate descriptor heap set!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Descriptor heap created successfully (%u storage buffers, %u storage images)\n", capacities[0], capacities[1]);
+}
+
+static uint32_t takeSlot(DescriptorHeapBinding binding)
+{
+    DescriptorHeapSlots *slots = &heapSlots[binding];
+
+    if (slots->freeCount == 0)
+    {
+        fprintf(stderr, "Descriptor heap is out of %s slots!\n", binding == DESCRIPTOR_HEAP_BINDING_BUFFERS ? "buffer" : "image");
+        exit(EXIT_FAILURE);
+    }
+
+    return slots->freeSlots[--slots->freeCount];
+}
+
+static void releaseSlot(DescriptorHeapBinding binding, uint32_t handle)
+{
+    DescriptorHeapSlots *slots = &heapSlots[binding];
+
+    if (handle == DESCRIPTOR_HANDLE_NONE || descriptorHeapSet == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    // The stale descriptor stays in the slot, partially bound arrays allow it as long as no shader reads it
+    slots->freeSlots[slots->freeCount++] = handle;
+}
+
+uint32_t descriptorHeapAddBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+    if (descriptorHeapSet == VK_NULL_HANDLE)
+    {
+        return DESCRIPTOR_HANDLE_NONE;
+    }
+
+    uint32_t handle = takeSlot(DESCRIPTOR_HEAP_BINDING_BUFFERS);
+
+    VkDescriptorBufferInfo bufferInfo = {};
+    bufferInfo.buffer = buffer;
+    bufferInfo.offset = offset;
+    bufferInfo.range = range;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorHeapSet;
+    write.dstBinding = DESCRIPTOR_HEAP_BINDING_BUFFERS;
+    write.dstArrayElement = handle;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &bufferInfo;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+
+    return handle;
+}
+
+uint32_t descriptorHeapAddImage(VkImageView view)
+{
+    if (descriptorHeapSet == VK_NULL_HANDLE)
+    {
+        return DESCRIPTOR_HANDLE_NONE;
+    }
+
+    uint32_t handle = takeSlot(DESCRIPTOR_HEAP_BINDING_IMAGES);
+
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.imageView = view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorHeapSet;
+    write.dstBinding = DESCRIPTOR_HEAP_BINDING_IMAGES;
+    write.dstArrayElement = handle;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+
+    return handle;
+}
+
+void descriptorHeapRemoveBuffer(uint32_t handle)
+{
+    releaseSlot(DESCRIPTOR_HEAP_BINDING_BUFFERS, handle);
+}
+
+void descriptorHeapRemoveImage(uint32_t handle)
+{
+    releaseSlot(DESCRIPTOR_HEAP_BINDING_IMAGES, handle);
+}
+
+void descriptorHeapBind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t firstSet)
+{
+    vkCmdBindDescriptorSets(commandBuffer, bindPoint, layout, firstSet, 1, &descriptorHeapSet, 0, NULL);
+}
+
+void destroyDescriptorHeap()
+{
+    if (descriptorHeapSetLayout == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    vkDestroyDescriptorPool(device, descriptorHeapPool, NULL); // Also frees the heap set
+    vkDestroyDescriptorSetLayout(device, descriptorHeapSetLayout, NULL);
+    descriptorHeapPool = VK_NULL_HANDLE;
+    descriptorHeapSet = VK_NULL_HANDLE;
+    descriptorHeapSetLayout = VK_NULL_HANDLE;
+
+    for (uint32_t i = 0; i < DESCRIPTOR_HEAP_BINDING_COUNT; i++)
+    {
+        free(heapSlots[i].freeSlots);
+        heapSlots[i].freeSlots = NULL;
+    }
+
+    printf("Destroyed descriptor heap\n");
+}
@@ -0,0 +1,530 @@
+#include "frame_bench.h"
+#include "vulkan_utils.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Timestamp slots in the ring, far more than the frames in flight so a slot is always done when reused
+#define FRAME_BENCH_QUERY_SLOTS 8
+
+// Graphics begin and end, compute begin and end
+#define FRAME_BENCH_QUERIES_PER_SLOT 4
+
+// A metric only regresses when it also grew by more than this, so sub-microsecond phases do not fail on noise
+#define FRAME_BENCH_NOISE_MS 0.02
+
+typedef enum {
+    FRAME_METRIC_FRAME,          // Frame-to-frame interval
+    FRAME_METRIC_CPU,            // Sum of the CPU phases
+    FRAME_METRIC_PHASES,         // One per FramePhase
+    FRAME_METRIC_GPU_RENDER = FRAME_METRIC_PHASES + FRAME_PHASE_COUNT,
+    FRAME_METRIC_GPU_SIMULATION,
+    FRAME_METRIC_COUNT
+} FrameMetric;
+
+static const char *metricNames[FRAME_METRIC_COUNT] = {
+    "frame", "cpu", "acquire", "record", "submit", "present", "simulation", "gpu_render", "gpu_simulation"};
+
+int frameBenchActive = 0;
+int frameTimingActive = 0;
+
+static uint32_t benchFrames = 0;
+static uint32_t benchWarmUp = 0;
+static uint32_t framesBegun = 0;
+static uint64_t firstMeasuredFrame = 0;
+static double *samples[FRAME_METRIC_COUNT]; // Milliseconds per measured frame, NAN when not measured
+
+static uint64_t openFrame = 0;
+static struct timespec frameStart;
+static struct timespec lastMark;
+
+static VkQueryPool timestampPool = VK_NULL_HANDLE;
+static double timestampPeriod = 0.0; // Nanoseconds per tick
+static int graphicsTimestamps = 0;
+static int computeTimestamps = 0;
+static VkCommandBuffer graphicsBegin[FRAME_BENCH_QUERY_SLOTS];
+static VkCommandBuffer graphicsEnd[FRAME_BENCH_QUERY_SLOTS];
+static VkCommandBuffer computeBegin[FRAME_BENCH_QUERY_SLOTS];
+static VkCommandBuffer computeEnd[FRAME_BENCH_QUERY_SLOTS];
+static uint64_t graphicsSlotFrame[FRAME_BENCH_QUERY_SLOTS]; // Frame whose timestamps a slot holds, 0 = none
+static uint64_t computeSlotBatch[FRAME_BENCH_QUERY_SLOTS];
+
+static double millisecondsBetween(const struct timespec *start, const struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1000.0 + (double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Index of a frame among the measured ones, -1 during the warm-up or after the run
+static int measuredIndex(uint64_t frame)
+{
+    if (!frameBenchActive || frame < firstMeasuredFrame || frame >= firstMeasuredFrame + benchFrames)
+    {
+        return -1;
+    }
+
+    return (int)(frame - firstMeasuredFrame);
+}
+
+// Pre-recorded once: the begin buffer resets the two queries of its slot and writes the first one
+static void recordTimestampCommands(VkCommandPool pool, VkCommandBuffer begin[], VkCommandBuffer end[], uint32_t firstQuery)
+{
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = pool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = FRAME_BENCH_QUERY_SLOTS;
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, begin) != VK_SUCCESS || vkAllocateCommandBuffers(device, &allocInfo, end) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate benchmark command buffers!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+    for (uint32_t slot = 0; slot < FRAME_BENCH_QUERY_SLOTS; slot++)
+    {
+        uint32_t query = slot * FRAME_BENCH_QUERIES_PER_SLOT + firstQuery;
+
+        vkBeginCommandBuffer(begin[slot], &beginInfo);
+        vkCmdResetQueryPool(begin[slot], timestampPool, query, 2);
+        vkCmdWriteTimestamp(begin[slot], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, query);
+
+        vkBeginCommandBuffer(end[slot], &beginInfo);
+        vkCmdWriteTimestamp(end[slot], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, query + 1);
+
+        if (vkEndCommandBuffer(begin[slot]) != VK_SUCCESS || vkEndCommandBuffer(end[slot]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to record benchmark command buffers!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void frameBenchStart(uint32_t frameCount, uint32_t warmUpFrames)
+{
+    benchFrames = frameCount;
+    benchWarmUp = warmUpFrames;
+    framesBegun = 0;
+    openFrame = 0;
+    firstMeasuredFrame = currentFrame + 1 + warmUpFrames;
+
+    for (int metric = 0; metric < FRAME_METRIC_COUNT; metric++)
+    {
+        samples[metric] = malloc(frameCount * sizeof(double));
+
+        if (!samples[metric])
+        {
+            fprintf(stderr, "Failed to allocate benchmark samples!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            samples[metric][i] = metric < FRAME_METRIC_GPU_RENDER ? 0.0 : NAN;
+        }
+    }
+
+    // Queues without valid timestamp bits only get CPU times
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    QueueFamilyIndices families = findQueueFamilies(physicalDevice);
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, NULL);
+
+    VkQueueFamilyProperties *familyProperties = malloc(familyCount * sizeof(VkQueueFamilyProperties));
+
+    if (!familyProperties)
+    {
+        fprintf(stderr, "Failed to allocate queue family properties!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, familyProperties);
+    graphicsTimestamps = familyProperties[families.graphicsFamily].timestampValidBits > 0;
+    computeTimestamps = familyProperties[families.computeFamily].timestampValidBits > 0;
+    free(familyProperties);
+
+    VkQueryPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = FRAME_BENCH_QUERY_SLOTS * FRAME_BENCH_QUERIES_PER_SLOT;
+
+    if (vkCreateQueryPool(device, &poolInfo, NULL, &timestampPool) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create benchmark query pool!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (graphicsTimestamps)
+    {
+        recordTimestampCommands(commandPool, graphicsBegin, graphicsEnd, 0);
+    }
+
+    if (computeTimestamps)
+    {
+        recordTimestampCommands(computeCommandPool, computeBegin, computeEnd, 2);
+    }
+
+    memset(graphicsSlotFrame, 0, sizeof(graphicsSlotFrame));
+    memset(computeSlotBatch, 0, sizeof(computeSlotBatch));
+
+    frameBenchActive = 1;
+    frameTimingActive = 1;
+
+    printf("Frame benchmark: %u frames after %u warm-up frames on %s, GPU timestamps %s\n", frameCount, warmUpFrames, properties.deviceName,
+           graphicsTimestamps && computeTimestamps ? "on both queues" : graphicsTimestamps ? "on the graphics queue" : computeTimestamps ? "on the compute queue" : "unavailable");
+}
+
+int frameBenchDone()
+{
+    return framesBegun >= benchWarmUp + benchFrames;
+}
+
+void frameBenchBeginFrame(uint64_t frame)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int previous = openFrame != 0 ? measuredIndex(openFrame) : -1;
+
+    if (previous >= 0)
+    {
+        samples[FRAME_METRIC_FRAME][previous] = millisecondsBetween(&frameStart, &now);
+    }
+
+    if (frame != 0 && metricsActive)
+    {
+        metricsAdd(METRIC_FRAMES, 1.0);
+    }
+
+    openFrame = frame;
+    frameStart = now;
+    lastMark = now;
+    framesBegun++;
+}
+
+void frameBenchMark(FramePhase phase)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int index = measuredIndex(openFrame);
+    double elapsed = millisecondsBetween(&lastMark, &now);
+
+    if (metricsActive)
+    {
+        metricsAddPhaseTime((MetricPhase)(METRIC_PHASE_FRAME_ACQUIRE + phase), elapsed / 1000.0);
+    }
+
+    if (index >= 0)
+    {
+        samples[FRAME_METRIC_PHASES + phase][index] += elapsed;
+        samples[FRAME_METRIC_CPU][index] += elapsed;
+    }
+
+    lastMark = now;
+}
+
+// Reads back the timestamps a slot holds into the samples of its frame and frees the slot
+static void collectSlot(uint64_t *slotFrame, uint32_t slot, uint32_t firstQuery, FrameMetric metric)
+{
+    if (*slotFrame == 0)
+    {
+        return;
+    }
+
+    uint64_t ticks[2];
+
+    if (vkGetQueryPoolResults(device, timestampPool, slot * FRAME_BENCH_QUERIES_PER_SLOT + firstQuery, 2, sizeof(ticks), ticks, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS)
+    {
+        samples[metric][measuredIndex(*slotFrame)] = (double)(ticks[1] - ticks[0]) * timestampPeriod / 1e6;
+    }
+
+    *slotFrame = 0;
+}
+
+static uint32_t wrapCommands(uint64_t frame, VkCommandBuffer commandBuffer, VkCommandBuffer commandBuffers[3], int supported,
+                             VkCommandBuffer begin[], VkCommandBuffer end[], uint64_t slotFrames[], uint32_t firstQuery, FrameMetric metric)
+{
+    if (!supported || measuredIndex(frame) < 0)
+    {
+        commandBuffers[0] = commandBuffer;
+        return 1;
+    }
+
+    // The frame that used the slot last was retired frames ago, its results are there already
+    uint32_t slot = (uint32_t)(frame % FRAME_BENCH_QUERY_SLOTS);
+
+    collectSlot(&slotFrames[slot], slot, firstQuery, metric);
+    slotFrames[slot] = frame;
+
+    commandBuffers[0] = begin[slot];
+    commandBuffers[1] = commandBuffer;
+    commandBuffers[2] = end[slot];
+
+    return 3;
+}
+
+uint32_t frameBenchWrapGraphics(uint64_t frame, VkCommandBuffer commandBuffer, VkCommandBuffer commandBuffers[3])
+{
+    return wrapCommands(frame, commandBuffer, commandBuffers, graphicsTimestamps, graphicsBegin, graphicsEnd, graphicsSlotFrame, 0, FRAME_METRIC_GPU_RENDER);
+}
+
+uint32_t frameBenchWrapCompute(uint64_t batch, VkCommandBuffer commandBuffer, VkCommandBuffer commandBuffers[3])
+{
+    return wrapCommands(batch, commandBuffer, commandBuffers, computeTimestamps, computeBegin, computeEnd, computeSlotBatch, 2, FRAME_METRIC_GPU_SIMULATION);
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Nearest rank p50, p95 and p99 of the measured values of a metric, 0 when there are none
+static int percentiles(FrameMetric metric, double result[3])
+{
+    double *sorted = malloc(benchFrames * sizeof(double));
+    uint32_t count = 0;
+
+    if (!sorted)
+    {
+        fprintf(stderr, "Failed to allocate benchmark samples!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < benchFrames; i++)
+    {
+        if (!isnan(samples[metric][i]))
+        {
+            sorted[count++] = samples[metric][i];
+        }
+    }
+
+    qsort(sorted, count, sizeof(double), compareDoubles);
+
+    const double ranks[3] = {0.50, 0.95, 0.99};
+
+    for (int r = 0; r < 3 && count > 0; r++)
+    {
+        uint32_t rank = (uint32_t)ceil(ranks[r] * count);
+        result[r] = sorted[rank > 0 ? rank - 1 : 0];
+    }
+
+    free(sorted);
+
+    return count > 0;
+}
+
+// Mean absolute change of the frame time from one frame to the next
+static double frameJitter()
+{
+    double sum = 0.0;
+
+    for (uint32_t i = 1; i < benchFrames; i++)
+    {
+        sum += fabs(samples[FRAME_METRIC_FRAME][i] - samples[FRAME_METRIC_FRAME][i - 1]);
+    }
+
+    return benchFrames > 1 ? sum / (benchFrames - 1) : 0.0;
+}
+
+static void saveBaseline(const char *path, const char *configuration, const char *deviceName, const double values[FRAME_METRIC_COUNT][3],
+                         const int measured[FRAME_METRIC_COUNT], double jitter)
+{
+    FILE *file = fopen(path, "w");
+
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write the benchmark baseline %s!\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(file, "# FluidSim frame benchmark, milliseconds: metric p50 p95 p99\n");
+    fprintf(file, "config %s\n", configuration);
+    fprintf(file, "device %s\n", deviceName);
+    fprintf(file, "frames %u\n", benchFrames);
+
+    for (int metric = 0; metric < FRAME_METRIC_COUNT; metric++)
+    {
+        if (measured[metric])
+        {
+            fprintf(file, "%s %.4f %.4f %.4f\n", metricNames[metric], values[metric][0], values[metric][1], values[metric][2]);
+        }
+    }
+
+    fprintf(file, "jitter %.4f\n", jitter);
+    fclose(file);
+
+    printf("Frame benchmark baseline written to %s\n", path);
+}
+
+static int regressed(double baseline, double current, float tolerance)
+{
+    return current > baseline * (1.0 + tolerance) + FRAME_BENCH_NOISE_MS;
+}
+
+// Compares the results line by line with a saved baseline, metrics missing on either side are skipped
+static int compareBaseline(const char *path, const char *configuration, const char *deviceName, const double values[FRAME_METRIC_COUNT][3],
+                           const int measured[FRAME_METRIC_COUNT], double jitter, float tolerance)
+{
+    FILE *file = fopen(path, "r");
+
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open the benchmark baseline %s\n", path);
+        return 0;
+    }
+
+    char line[512];
+    int passed = 1;
+
+    printf("Comparison with %s (tolerance %.0f%%):\n", path, 100.0 * tolerance);
+
+    while (fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] == '#' || line[0] == '\0')
+        {
+            continue;
+        }
+
+        // Times of another scene or device say nothing about this one
+        if (strncmp(line, "config ", 7) == 0 || strncmp(line, "device ", 7) == 0)
+        {
+            const char *expected = line[0] == 'c' ? configuration : deviceName;
+
+            if (strcmp(line + 7, expected) != 0)
+            {
+                fprintf(stderr, "The baseline was taken with %s \"%s\", this run has \"%s\"\n", line[0] == 'c' ? "config" : "device", line + 7, expected);
+                passed = 0;
+                break;
+            }
+
+            continue;
+        }
+
+        char name[64];
+        double baseline[3];
+        int fields = sscanf(line, "%63s %lf %lf %lf", name, &baseline[0], &baseline[1], &baseline[2]);
+
+        if (strcmp(name, "jitter") == 0 && fields >= 2)
+        {
+            int worse = regressed(baseline[0], jitter, tolerance);
+
+            printf("  %-15s %8.3f -> %8.3f ms %s\n", name, baseline[0], jitter, worse ? "REGRESSED" : "ok");
+            passed &= !worse;
+            continue;
+        }
+
+        for (int metric = 0; metric < FRAME_METRIC_COUNT && fields == 4; metric++)
+        {
+            if (strcmp(name, metricNames[metric]) != 0 || !measured[metric])
+            {
+                continue;
+            }
+
+            int worse = 0;
+
+            for (int r = 0; r < 3; r++)
+            {
+                worse |= regressed(baseline[r], values[metric][r], tolerance);
+            }
+
+            printf("  %-15s p50 %8.3f -> %8.3f  p95 %8.3f -> %8.3f  p99 %8.3f -> %8.3f ms %s\n", name, baseline[0], values[metric][0], baseline[1],
+                   values[metric][1], baseline[2], values[metric][2], worse ? "REGRESSED" : "ok");
+            passed &= !worse;
+        }
+    }
+
+    fclose(file);
+
+    printf("Frame benchmark against the baseline: %s\n", passed ? "PASSED" : "FAILED");
+
+    return passed;
+}
+
+int frameBenchReport(const char *configuration, const char *baselinePath, const char *savePath, float tolerance)
+{
+    // Closes the interval of the last frame, then lets its timestamps land
+    frameBenchBeginFrame(0);
+    vkDeviceWaitIdle(device);
+
+    for (uint32_t slot = 0; slot < FRAME_BENCH_QUERY_SLOTS; slot++)
+    {
+        collectSlot(&graphicsSlotFrame[slot], slot, 0, FRAME_METRIC_GPU_RENDER);
+        collectSlot(&computeSlotBatch[slot], slot, 2, FRAME_METRIC_GPU_SIMULATION);
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    double values[FRAME_METRIC_COUNT][3] = {};
+    int measured[FRAME_METRIC_COUNT];
+    double jitter = frameJitter();
+
+    printf("Frame benchmark over %u frames (%s), milliseconds:\n", benchFrames, configuration);
+
+    for (int metric = 0; metric < FRAME_METRIC_COUNT; metric++)
+    {
+        measured[metric] = percentiles((FrameMetric)metric, values[metric]);
+
+        if (measured[metric])
+        {
+            printf("  %-15s p50 %8.3f  p95 %8.3f  p99 %8.3f\n", metricNames[metric], values[metric][0], values[metric][1], values[metric][2]);
+        }
+    }
+
+    printf("  %-15s %8.3f (mean change of the frame time between consecutive frames), %.1f frames per second at p50\n", "jitter", jitter,
+           values[FRAME_METRIC_FRAME][0] > 0.0 ? 1000.0 / values[FRAME_METRIC_FRAME][0] : 0.0);
+
+    if (savePath)
+    {
+        saveBaseline(savePath, configuration, properties.deviceName, values, measured, jitter);
+    }
+
+    return baselinePath ? compareBaseline(baselinePath, configuration, properties.deviceName, values, measured, jitter, tolerance) : 1;
+}
+
+void frameBenchDestroy()
+{
+    if (timestampPool != VK_NULL_HANDLE)
+    {
+        vkDeviceWaitIdle(device);
+
+        if (graphicsTimestamps)
+        {
+            vkFreeCommandBuffers(device, commandPool, FRAME_BENCH_QUERY_SLOTS, graphicsBegin);
+            vkFreeCommandBuffers(device, commandPool, FRAME_BENCH_QUERY_SLOTS, graphicsEnd);
+        }
+
+        if (computeTimestamps)
+        {
+            vkFreeCommandBuffers(device, computeCommandPool, FRAME_BENCH_QUERY_SLOTS, computeBegin);
+            vkFreeCommandBuffers(device, computeCommandPool, FRAME_BENCH_QUERY_SLOTS, computeEnd);
+        }
+
+        vkDestroyQueryPool(device, timestampPool, NULL);
+        timestampPool = VK_NULL_HANDLE;
+    }
+
+    for (int metric = 0; metric < FRAME_METRIC_COUNT; metric++)
+    {
+        free(samples[metric]);
+        samples[metric] = NULL;
+    }
+
+    frameBenchActive = 0;
+    frameTimingActive = metricsActive;
+}
@@ -0,0 +1,183 @@
+#include "frame_pacing.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Blocking the pacing leaves in place, absorbs the frame-to-frame variation of the CPU and GPU work
+#define FRAME_PACING_MARGIN_NS 1500000ull
+
+// Upper bound of the sleep, far below any frame the loop would still want to pace
+#define FRAME_PACING_MAX_SLEEP_NS 50000000ull
+
+// Event to present samples kept for the report, the most recent ones
+#define FRAME_PACING_SAMPLES 4096
+
+FramePacing framePacing = FRAME_PACING_LOW_LATENCY;
+
+static uint64_t sleepNanoseconds = 0;
+static uint64_t pendingEvent = 0; // Oldest input event polled since the last present, 0 = none
+static uint64_t delays[FRAME_PACING_SAMPLES];
+static uint64_t delayCount = 0;
+
+static int presentModeAvailable(VkPresentModeKHR mode, uint32_t availablePresentModesCount, const VkPresentModeKHR *availablePresentModes)
+{
+    for (uint32_t i = 0; i < availablePresentModesCount; i++)
+    {
+        if (availablePresentModes[i] == mode)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+VkPresentModeKHR framePacingPresentMode(uint32_t availablePresentModesCount, const VkPresentModeKHR *availablePresentModes)
+{
+    // MAILBOX replaces the queued image with the newest one without tearing, IMMEDIATE does not wait at all
+    // and tears, so only the throughput pacing asks for it
+    static const VkPresentModeKHR lowLatency[] = {VK_PRESENT_MODE_MAILBOX_KHR};
+    static const VkPresentModeKHR throughput[] = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+
+    const VkPresentModeKHR *preferred = framePacing == FRAME_PACING_THROUGHPUT ? throughput : lowLatency;
+    uint32_t preferredCount = framePacing == FRAME_PACING_THROUGHPUT ? 3 : framePacing == FRAME_PACING_LOW_LATENCY ? 1 : 0;
+
+    for (uint32_t i = 0; i < preferredCount; i++)
+    {
+        if (presentModeAvailable(preferred[i], availablePresentModesCount, availablePresentModes))
+        {
+            return preferred[i];
+        }
+    }
+
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+uint32_t framePacingImageCount(const VkSurfaceCapabilitiesKHR *capabilities)
+{
+    // One more than the minimum so acquiring never waits on the driver, as before the pacing modes
+    uint32_t count = capabilities->minImageCount + 1;
+
+    if (framePacing == FRAME_PACING_THROUGHPUT)
+    {
+        // Spare images so the CPU never waits for one to come back from the display
+        count = capabilities->minImageCount + 2;
+    }
+
+    if (count < capabilities->minImageCount)
+    {
+        count = capabilities->minImageCount;
+    }
+
+    if (capabilities->maxImageCount > 0 && count > capabilities->maxImageCount)
+    {
+        count = capabilities->maxImageCount;
+    }
+
+    return count;
+}
+
+void framePacingSleep()
+{
+    if (framePacing != FRAME_PACING_THROUGHPUT && sleepNanoseconds > 0)
+    {
+        SDL_DelayNS(sleepNanoseconds);
+    }
+}
+
+void framePacingBlocked(uint64_t nanoseconds)
+{
+    if (framePacing == FRAME_PACING_THROUGHPUT)
+    {
+        return;
+    }
+
+    // Still blocked after the sleep: sleep half the excess longer next time. Barely blocked means the
+    // sleep may have overshot the refresh, so back off quickly to not drop to half the frame rate
+    if (nanoseconds > FRAME_PACING_MARGIN_NS)
+    {
+        sleepNanoseconds += (nanoseconds - FRAME_PACING_MARGIN_NS) / 2;
+    }
+    else if (nanoseconds < FRAME_PACING_MARGIN_NS / 2)
+    {
+        sleepNanoseconds /= 2;
+    }
+
+    if (sleepNanoseconds > FRAME_PACING_MAX_SLEEP_NS)
+    {
+        sleepNanoseconds = FRAME_PACING_MAX_SLEEP_NS;
+    }
+}
+
+void framePacingEvent(uint64_t timestamp)
+{
+    if (pendingEvent == 0 || timestamp < pendingEvent)
+    {
+        pendingEvent = timestamp;
+    }
+}
+
+void framePacingPresented()
+{
+    if (pendingEvent == 0)
+    {
+        return;
+    }
+
+    uint64_t now = SDL_GetTicksNS();
+    uint64_t delay = now > pendingEvent ? now - pendingEvent : 0;
+
+    delays[delayCount % FRAME_PACING_SAMPLES] = delay;
+    delayCount++;
+    pendingEvent = 0;
+
+    if (metricsActive)
+    {
+        metricsSet(METRIC_EVENT_TO_PRESENT, (double)delay / 1e9);
+    }
+}
+
+static int compareDelays(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void framePacingReport()
+{
+    static const char *pacingNames[] = {"low-latency", "throughput", "vsync"};
+
+    if (delayCount == 0)
+    {
+        printf("Event to present time (%s): no input events\n", pacingNames[framePacing]);
+        return;
+    }
+
+    uint32_t count = delayCount < FRAME_PACING_SAMPLES ? (uint32_t)delayCount : FRAME_PACING_SAMPLES;
+    uint64_t *sorted = malloc(count * sizeof(uint64_t));
+
+    if (!sorted)
+    {
+        fprintf(stderr, "Failed to allocate the event to present samples!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(sorted, delays, count * sizeof(uint64_t));
+    qsort(sorted, count, sizeof(uint64_t), compareDelays);
+
+    double sum = 0.0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sum += (double)sorted[i];
+    }
+
+    printf("Event to present time (%s) over the last %u frames with input events: mean %.2f ms, p50 %.2f ms, p95 %.2f ms, max %.2f ms, pacing sleep %.2f ms\n",
+           pacingNames[framePacing], count, sum / count / 1e6, sorted[count / 2] / 1e6, sorted[(uint32_t)(0.95 * (count - 1))] / 1e6,
+           sorted[count - 1] / 1e6, sleepNanoseconds / 1e6);
+
+    free(sorted);
+}
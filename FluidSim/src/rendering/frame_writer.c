@@ -0,0 +1,347 @@
+#include "frame_writer.h"
+#include "metrics.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+typedef struct {
+    uint64_t frameIndex;
+    uint8_t *pixels; // width * height * 4 bytes, owned by the slot
+} FrameSlot;
+
+static FrameSlot *slots = NULL;
+static uint32_t slotCount = 0;
+static uint32_t queueHead = 0;  // Next slot the worker writes
+static uint32_t queueCount = 0; // Slots waiting to be written
+static int stopRequested = 0;
+
+static pthread_t writerThread;
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frameQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t slotFreed = PTHREAD_COND_INITIALIZER;
+
+static char outputDirectory[1024];
+static FrameFormat outputFormat;
+static uint32_t frameWidth = 0;
+static uint32_t frameHeight = 0;
+
+static uint32_t crcTable[256];
+
+static void buildCrcTable()
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+
+        crcTable[n] = c;
+    }
+}
+
+static uint32_t updateCrc(uint32_t crc, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+static void writeBigEndian(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+static void writeChunk(FILE *file, const char type[4], const uint8_t *data, uint32_t length)
+{
+    uint8_t header[8];
+    writeBigEndian(header, length);
+    memcpy(header + 4, type, 4);
+
+    uint32_t crc = updateCrc(0xFFFFFFFFu, (const uint8_t *)type, 4);
+    crc = updateCrc(crc, data, length) ^ 0xFFFFFFFFu;
+
+    uint8_t footer[4];
+    writeBigEndian(footer, crc);
+
+    fwrite(header, 1, 8, file);
+
+    // IEND has no data, and fwrite must not be handed a NULL buffer
+    if (length > 0)
+    {
+        fwrite(data, 1, length, file);
+    }
+
+    fwrite(footer, 1, 4, file);
+}
+
+// PNG with the image data in stored deflate blocks: no compression, but the encoder stays cheap
+// enough to keep up with the renderer and the files open everywhere
+static int writePng(const char *path, const uint8_t *rgba)
+{
+    FILE *file = fopen(path, "wb");
+
+    if (!file)
+    {
+        return 0;
+    }
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, 8, file);
+
+    uint8_t ihdr[13];
+    writeBigEndian(ihdr, frameWidth);
+    writeBigEndian(ihdr + 4, frameHeight);
+    ihdr[8] = 8;  // Bit depth
+    ihdr[9] = 2;  // Truecolor RGB
+    ihdr[10] = 0; // Deflate
+    ihdr[11] = 0; // Adaptive filtering
+    ihdr[12] = 0; // No interlace
+    writeChunk(file, "IHDR", ihdr, sizeof(ihdr));
+
+    // Filtered scanlines: a filter byte (0 = none) followed by the RGB row
+    size_t rowSize = 1 + (size_t)frameWidth * 3;
+    size_t rawSize = rowSize * frameHeight;
+    size_t blockCount = (rawSize + 65534) / 65535;
+    size_t zlibSize = 2 + rawSize + blockCount * 5 + 4;
+
+    uint8_t *zlib = malloc(zlibSize);
+    uint8_t *raw = malloc(rawSize);
+
+    if (!zlib || !raw)
+    {
+        fprintf(stderr, "Failed to allocate PNG encoding memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t y = 0; y < frameHeight; y++)
+    {
+        uint8_t *row = raw + y * rowSize;
+        const uint8_t *source = rgba + (size_t)y * frameWidth * 4;
+
+        row[0] = 0;
+
+        for (uint32_t x = 0; x < frameWidth; x++)
+        {
+            row[1 + x * 3] = source[x * 4];
+            row[2 + x * 3] = source[x * 4 + 1];
+            row[3 + x * 3] = source[x * 4 + 2];
+        }
+    }
+
+    // zlib header, stored blocks of at most 65535 bytes, then the Adler-32 of the raw data
+    size_t offset = 0;
+    zlib[offset++] = 0x78;
+    zlib[offset++] = 0x01;
+
+    uint32_t adlerA = 1;
+    uint32_t adlerB = 0;
+
+    for (size_t position = 0; position < rawSize; position += 65535)
+    {
+        size_t length = rawSize - position < 65535 ? rawSize - position : 65535;
+
+        zlib[offset++] = position + length == rawSize ? 1 : 0; // BFINAL, BTYPE = 00
+        zlib[offset++] = (uint8_t)length;
+        zlib[offset++] = (uint8_t)(length >> 8);
+        zlib[offset++] = (uint8_t)~length;
+        zlib[offset++] = (uint8_t)(~length >> 8);
+
+        memcpy(zlib + offset, raw + position, length);
+        offset += length;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            adlerA = (adlerA + raw[position + i]) % 65521;
+            adlerB = (adlerB + adlerA) % 65521;
+        }
+    }
+
+    writeBigEndian(zlib + offset, (adlerB << 16) | adlerA);
+    offset += 4;
+
+    writeChunk(file, "IDAT", zlib, (uint32_t)offset);
+    writeChunk(file, "IEND", NULL, 0);
+
+    free(raw);
+    free(zlib);
+
+    return fclose(file) == 0;
+}
+
+static int writeRaw(const char *path, const uint8_t *rgba)
+{
+    FILE *file = fopen(path, "wb");
+
+    if (!file)
+    {
+        return 0;
+    }
+
+    size_t size = (size_t)frameWidth * frameHeight * 4;
+    size_t written = fwrite(rgba, 1, size, file);
+
+    return fclose(file) == 0 && written == size;
+}
+
+static void *writerLoop(void *argument)
+{
+    (void)argument;
+
+    char path[1100];
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queueMutex);
+
+        while (queueCount == 0 && !stopRequested)
+        {
+            pthread_cond_wait(&frameQueued, &queueMutex);
+        }
+
+        if (queueCount == 0)
+        {
+            pthread_mutex_unlock(&queueMutex);
+            break;
+        }
+
+        FrameSlot *slot = &slots[queueHead];
+        pthread_mutex_unlock(&queueMutex);
+
+        // The slot is not released before it is written, so the pixels can be read without the lock
+        int written;
+
+        if (outputFormat == FRAME_FORMAT_PNG)
+        {
+            snprintf(path, sizeof(path), "%s/frame_%06llu.png", outputDirectory, (unsigned long long)slot->frameIndex);
+            written = writePng(path, slot->pixels);
+        }
+        else
+        {
+            snprintf(path, sizeof(path), "%s/frame_%06llu.rgba", outputDirectory, (unsigned long long)slot->frameIndex);
+            written = writeRaw(path, slot->pixels);
+        }
+
+        if (!written)
+        {
+            fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        }
+
+        pthread_mutex_lock(&queueMutex);
+        queueHead = (queueHead + 1) % slotCount;
+        queueCount--;
+        metricsSet(METRIC_WRITER_QUEUE, queueCount);
+        pthread_cond_signal(&slotFreed);
+        pthread_mutex_unlock(&queueMutex);
+    }
+
+    return NULL;
+}
+
+void frameWriterStart(const char *directory, FrameFormat format, uint32_t width, uint32_t height, uint32_t queueDepth)
+{
+    snprintf(outputDirectory, sizeof(outputDirectory), "%s", directory);
+    outputFormat = format;
+    frameWidth = width;
+    frameHeight = height;
+
+    if (mkdir(outputDirectory, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Failed to create output directory %s: %s\n", outputDirectory, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    buildCrcTable();
+
+    slotCount = queueDepth > 0 ? queueDepth : 1;
+    slots = calloc(slotCount, sizeof(FrameSlot));
+
+    for (uint32_t i = 0; i < slotCount; i++)
+    {
+        slots[i].pixels = malloc((size_t)width * height * 4);
+
+        if (!slots[i].pixels)
+        {
+            fprintf(stderr, "Failed to allocate frame writer slots!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    queueHead = 0;
+    queueCount = 0;
+    stopRequested = 0;
+
+    if (pthread_create(&writerThread, NULL, writerLoop, NULL) != 0)
+    {
+        fprintf(stderr, "Failed to start the frame writer thread!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Frame writer started: %ux%u %s frames to %s\n", width, height, format == FRAME_FORMAT_PNG ? "PNG" : "raw RGBA", outputDirectory);
+}
+
+void frameWriterSubmit(uint64_t frameIndex, const uint8_t *rgba, uint32_t rowPitch)
+{
+    pthread_mutex_lock(&queueMutex);
+
+    while (queueCount == slotCount)
+    {
+        pthread_cond_wait(&slotFreed, &queueMutex);
+    }
+
+    FrameSlot *slot = &slots[(queueHead + queueCount) % slotCount];
+    pthread_mutex_unlock(&queueMutex);
+
+    // Only this thread fills free slots, the copy happens outside the lock
+    size_t rowSize = (size_t)frameWidth * 4;
+
+    for (uint32_t y = 0; y < frameHeight; y++)
+    {
+        memcpy(slot->pixels + y * rowSize, rgba + (size_t)y * rowPitch, rowSize);
+    }
+
+    slot->frameIndex = frameIndex;
+
+    pthread_mutex_lock(&queueMutex);
+    queueCount++;
+    metricsSet(METRIC_WRITER_QUEUE, queueCount);
+    pthread_cond_signal(&frameQueued);
+    pthread_mutex_unlock(&queueMutex);
+}
+
+void frameWriterStop()
+{
+    if (slots == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&queueMutex);
+    stopRequested = 1;
+    pthread_cond_signal(&frameQueued);
+    pthread_mutex_unlock(&queueMutex);
+
+    pthread_join(writerThread, NULL);
+
+    for (uint32_t i = 0; i < slotCount; i++)
+    {
+        free(slots[i].pixels);
+    }
+
+    free(slots);
+    slots = NULL;
+    slotCount = 0;
+
+    printf("Frame writer stopped\n");
+}
@@ -0,0 +1,343 @@
+#include "gpu_culling.h"
+#include "vulkan_utils.h"
+#include "parallel_recording.h"
+#include "renderer.h"
+#include "sph_gpu.h"
+#include "camera.h"
+#include "descriptor_heap.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define CULL_WORKGROUP_SIZE 256
+
+// The draw count sits in front of the commands, padded so the commands stay 16 byte aligned
+#define CULL_COMMANDS_OFFSET 16
+
+// Order matches the bindings declared in cull_common.glsl
+typedef enum {
+    CULL_BINDING_POSITIONS, // Render positions of the simulation batch
+    CULL_BINDING_BLOCKS,    // uvec4 per block: counts, then draw mode / write cursor
+    CULL_BINDING_DRAWS,     // Draw count and one VkDrawIndirectCommand per block
+    CULL_BINDING_VERTICES,  // Compacted visible particles and aggregates
+    CULL_BINDING_LOD_CELLS, // SphLodCell aggregates of the simulation batch
+    CULL_BINDING_COUNT
+} CullBinding;
+
+typedef enum {
+    CULL_KERNEL_COUNT_BLOCKS,
+    CULL_KERNEL_CULL_BLOCKS,
+    CULL_KERNEL_SCATTER,
+    CULL_KERNEL_TOTAL
+} CullKernelId;
+
+static const char *cullKernelPaths[CULL_KERNEL_TOTAL] = {
+    "../shaders/cull_count.spv",
+    "../shaders/cull_blocks.spv",
+    "../shaders/cull_scatter.spv"};
+
+// Matches the push constants of cull_common.glsl
+typedef struct {
+    float viewProjection[16];
+    float origin[4]; // xyz = corner of the grid, w = margin every block is grown by
+    float lod[4];    // x = cell size, y = aggregate below this many pixels per cell (0 = off), z = pixels per unit at distance 1
+    uint32_t grid[4]; // x = particle count, yzw = cells per axis
+} CullPushConstants;
+
+typedef struct {
+    VkBuffer blockBuffer;
+    VkDeviceMemory blockMemory;
+    VkBuffer drawBuffer;
+    VkDeviceMemory drawMemory;
+    VkBuffer vertexBuffer;
+    VkDeviceMemory vertexMemory;
+    VkDescriptorSet descriptorSet;
+} CullSlot;
+
+int gpuCulling = 1;
+float lodPixelThreshold = 1.0f;
+
+static CullSlot cullSlots[RECORD_FRAME_SLOTS];
+static VkDescriptorSetLayout cullSetLayout = VK_NULL_HANDLE;
+static VkDescriptorPool cullDescriptorPool = VK_NULL_HANDLE;
+static VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+static VkPipeline cullPipelines[CULL_KERNEL_TOTAL];
+static CullPushConstants cullConstants;
+static uint32_t cullVertexHandles[RECORD_FRAME_SLOTS] = {DESCRIPTOR_HANDLE_NONE, DESCRIPTOR_HANDLE_NONE}; // Slots of the vertex buffers in the descriptor heap
+
+static void createCullBuffers()
+{
+    uint32_t gridDim[3];
+    sphGpuGridDim(gridDim);
+
+    // A particle can be drawn on its own while the aggregate of the cell it just left also counts it
+    VkDeviceSize vertexSize = ((VkDeviceSize)sphGpuParticleCount + (VkDeviceSize)gridDim[0] * gridDim[1] * gridDim[2]) * 4 * sizeof(float);
+
+    for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+    {
+        CullSlot *cullSlot = &cullSlots[slot];
+
+        createBuffer(CULL_BLOCK_COUNT * 4 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &cullSlot->blockBuffer, &cullSlot->blockMemory);
+        createBuffer(CULL_COMMANDS_OFFSET + CULL_BLOCK_COUNT * sizeof(VkDrawIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &cullSlot->drawBuffer, &cullSlot->drawMemory);
+        createBuffer(vertexSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &cullSlot->vertexBuffer, &cullSlot->vertexMemory);
+
+        cullVertexHandles[slot] = descriptorHeapAddBuffer(cullSlot->vertexBuffer, 0, VK_WHOLE_SIZE);
+    }
+}
+
+static void createCullDescriptors()
+{
+    VkDescriptorSetLayoutBinding bindings[CULL_BINDING_COUNT] = {};
+
+    for (uint32_t i = 0; i < CULL_BINDING_COUNT; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = CULL_BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &cullSetLayout) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create culling descriptor set layout!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = RECORD_FRAME_SLOTS * CULL_BINDING_COUNT;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = RECORD_FRAME_SLOTS;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, NULL, &cullDescriptorPool) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create culling descriptor pool!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+    {
+        CullSlot *cullSlot = &cullSlots[slot];
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = cullDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &cullSetLayout;
+
+        if (vkAllocateDescriptorSets(device, &allocInfo, &cullSlot->descriptorSet) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate culling descriptor sets!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Frame slots and simulation render slots alternate together, frame N draws batch N
+        VkBuffer buffers[CULL_BINDING_COUNT] = {sphGpuRenderBuffer(slot), cullSlot->blockBuffer, cullSlot->drawBuffer, cullSlot->vertexBuffer, sphGpuLodBuffer(slot)};
+        VkDescriptorBufferInfo bufferInfos[CULL_BINDING_COUNT];
+        VkWriteDescriptorSet writes[CULL_BINDING_COUNT] = {};
+
+        for (uint32_t i = 0; i < CULL_BINDING_COUNT; i++)
+        {
+            bufferInfos[i].buffer = buffers[i];
+            bufferInfos[i].offset = 0;
+            bufferInfos[i].range = VK_WHOLE_SIZE;
+
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = cullSlot->descriptorSet;
+            writes[i].dstBinding = i;
+            writes[i].dstArrayElement = 0;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+
+        vkUpdateDescriptorSets(device, CULL_BINDING_COUNT, writes, 0, NULL);
+    }
+}
+
+static void createCullPipelines()
+{
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &cullSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &cullPipelineLayout) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create culling pipeline layout!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < CULL_KERNEL_TOTAL; i++)
+    {
+        cullPipelines[i] = createComputePipeline(cullKernelPaths[i], cullPipelineLayout);
+    }
+}
+
+void createGpuCulling(const SphParams *params)
+{
+    // The mesh and the volume are built on the CPU, there are no particle draws to cull
+    if (!gpuCulling || renderMode == RENDER_MODE_MESH || renderMode == RENDER_MODE_VOLUME)
+    {
+        gpuCulling = 0;
+        return;
+    }
+
+    uint32_t gridDim[3];
+    sphGpuGridDim(gridDim);
+
+    // Blocks are made of whole simulation cells, so a cell and its particles share a block
+    for (int axis = 0; axis < 3; axis++)
+    {
+        cullConstants.origin[axis] = params->boundsMin[axis];
+        cullConstants.grid[axis + 1] = gridDim[axis];
+    }
+
+    // Particles sit on the block bounds, their sprites reach past them. Aggregates are larger, but
+    // the centroid of a cell stays inside it
+    cullConstants.origin[3] = 2.0f * params->particleSpacing + fluidParticleRadius;
+    cullConstants.lod[0] = params->smoothingRadius;
+    cullConstants.lod[1] = lodPixelThreshold;
+    cullConstants.grid[0] = sphGpuParticleCount;
+
+    createCullBuffers();
+    createCullDescriptors();
+    createCullPipelines();
+
+    markCommandBuffersDirty(); // Particle draws become indirect
+    printf("GPU culling created successfully (%u blocks, %s, aggregates below %.2f pixels per cell)\n", CULL_BLOCK_COUNT,
+           drawIndirectCountSupported ? "indirect count draws" : "indirect draws", lodPixelThreshold);
+}
+
+static void cullBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+void recordGpuCulling(VkCommandBuffer commandBuffer, uint64_t frame, const float viewProjection[16])
+{
+    const CullSlot *cullSlot = &cullSlots[frame % RECORD_FRAME_SLOTS];
+
+    // Every invocation handles one particle and one cell
+    uint32_t cellCount = cullConstants.grid[1] * cullConstants.grid[2] * cullConstants.grid[3];
+    uint32_t itemCount = sphGpuParticleCount > cellCount ? sphGpuParticleCount : cellCount;
+    uint32_t itemGroups = (itemCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE;
+
+    memcpy(cullConstants.viewProjection, viewProjection, sizeof(cullConstants.viewProjection));
+
+    // Projected size of a cell: the LOD of a block is picked from its distance to the camera
+    float projection[16];
+    cameraProjection(&camera, (float)swapChainExtent.width / (float)swapChainExtent.height, projection);
+    cullConstants.lod[2] = fabsf(projection[5]) * 0.5f * (float)swapChainExtent.height;
+
+    // The slot was last read by the draws of frame - 2, which the caller already waited for
+    vkCmdFillBuffer(commandBuffer, cullSlot->blockBuffer, 0, VK_WHOLE_SIZE, 0);
+    cullBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullSlot->descriptorSet, 0, NULL);
+    vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(cullConstants), &cullConstants);
+
+    // Particles and aggregates per block
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelines[CULL_KERNEL_COUNT_BLOCKS]);
+    vkCmdDispatch(commandBuffer, itemGroups, 1, 1);
+    cullBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // Frustum test, level of detail and compacted draw commands, a single workgroup scans every block
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelines[CULL_KERNEL_CULL_BLOCKS]);
+    vkCmdDispatch(commandBuffer, 1, 1, 1);
+    cullBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // Visible particles and aggregates into the ranges of their block commands
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelines[CULL_KERNEL_SCATTER]);
+    vkCmdDispatch(commandBuffer, itemGroups, 1, 1);
+    cullBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+}
+
+VkBuffer gpuCullVertexBuffer(uint64_t frame)
+{
+    return cullSlots[frame % RECORD_FRAME_SLOTS].vertexBuffer;
+}
+
+uint32_t gpuCullVertexHandle(uint64_t frame)
+{
+    return cullVertexHandles[frame % RECORD_FRAME_SLOTS];
+}
+
+void recordCulledDraw(VkCommandBuffer commandBuffer, uint64_t frame)
+{
+    const CullSlot *cullSlot = &cullSlots[frame % RECORD_FRAME_SLOTS];
+
+    // Visible blocks are compacted to the front, the commands behind them draw nothing
+    if (drawIndirectCountSupported)
+    {
+        vkCmdDrawIndirectCount(commandBuffer, cullSlot->drawBuffer, CULL_COMMANDS_OFFSET, cullSlot->drawBuffer, 0, CULL_BLOCK_COUNT, sizeof(VkDrawIndirectCommand));
+    }
+    else
+    {
+        vkCmdDrawIndirect(commandBuffer, cullSlot->drawBuffer, CULL_COMMANDS_OFFSET, CULL_BLOCK_COUNT, sizeof(VkDrawIndirectCommand));
+    }
+}
+
+void destroyGpuCulling()
+{
+    if (cullPipelineLayout == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    for (int i = 0; i < CULL_KERNEL_TOTAL; i++)
+    {
+        vkDestroyPipeline(device, cullPipelines[i], NULL);
+        cullPipelines[i] = VK_NULL_HANDLE;
+    }
+
+    vkDestroyPipelineLayout(device, cullPipelineLayout, NULL);
+    vkDestroyDescriptorPool(device, cullDescriptorPool, NULL); // Also frees the descriptor sets
+    vkDestroyDescriptorSetLayout(device, cullSetLayout, NULL);
+    cullPipelineLayout = VK_NULL_HANDLE;
+
+    for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+    {
+        CullSlot *cullSlot = &cullSlots[slot];
+
+        vkDestroyBuffer(device, cullSlot->blockBuffer, NULL);
+        vkFreeMemory(device, cullSlot->blockMemory, NULL);
+        vkDestroyBuffer(device, cullSlot->drawBuffer, NULL);
+        vkFreeMemory(device, cullSlot->drawMemory, NULL);
+        descriptorHeapRemoveBuffer(cullVertexHandles[slot]);
+        vkDestroyBuffer(device, cullSlot->vertexBuffer, NULL);
+        vkFreeMemory(device, cullSlot->vertexMemory, NULL);
+    }
+
+    printf("Destroyed GPU culling\n");
+}
@@ -0,0 +1,363 @@
+#include "offscreen.h"
+#include "vulkan_utils.h"
+#include "frame_writer.h"
+#include "sph_gpu.h"
+#include "renderer.h"
+#include "frame_bench.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct {
+    VkDeviceMemory imageMemory;
+    VkBuffer readbackBuffer;
+    VkDeviceMemory readbackMemory;
+    void *mapped;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    uint64_t frame; // Frame rendered into this slot, 0 when nothing is waiting to be read back
+} OffscreenFrame;
+
+static OffscreenFrame offscreenFrames[OFFSCREEN_FRAME_COUNT];
+static VkDeviceSize readbackSize = 0;
+static int readbackCoherent = 1;
+
+int offscreenDiscardFrames = 0;
+
+void createOffscreenTargets(uint32_t width, uint32_t height)
+{
+    // RGBA8 so the readback can be written out without swizzling, sRGB like the B8G8R8A8_SRGB swapchain the
+    // window prefers, so the frames get the same gamma encoding as the window and the PNGs match it
+    swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+    swapChainExtent.width = width;
+    swapChainExtent.height = height;
+    imageCount = OFFSCREEN_FRAME_COUNT;
+
+    swapChainImages = malloc(imageCount * sizeof(VkImage));
+
+    for (uint32_t i = 0; i < imageCount; i++)
+    {
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = swapChainImageFormat;
+        imageInfo.extent.width = width;
+        imageInfo.extent.height = height;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        if (vkCreateImage(device, &imageInfo, NULL, &swapChainImages[i]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create offscreen image!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        VkMemoryRequirements memoryRequirements;
+        vkGetImageMemoryRequirements(device, swapChainImages[i], &memoryRequirements);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memoryRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        if (vkAllocateMemory(device, &allocInfo, NULL, &offscreenFrames[i].imageMemory) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate offscreen image memory!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        vkBindImageMemory(device, swapChainImages[i], offscreenFrames[i].imageMemory, 0);
+    }
+
+    printf("Offscreen targets created successfully (%ux%u)\n", width, height);
+}
+
+// Host cached memory makes the CPU copy out of the readback buffer fast, it is not coherent everywhere
+static uint32_t findReadbackMemoryType(uint32_t typeFilter)
+{
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+    {
+        if ((typeFilter & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & cached) == cached)
+        {
+            readbackCoherent = (memoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+            return i;
+        }
+    }
+
+    readbackCoherent = 1;
+    return findMemoryType(typeFilter, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void createOffscreenReadback()
+{
+    readbackSize = (VkDeviceSize)swapChainExtent.width * swapChainExtent.height * 4;
+
+    VkCommandBuffer commandBuffers[OFFSCREEN_FRAME_COUNT];
+
+    VkCommandBufferAllocateInfo commandAllocInfo = {};
+    commandAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandAllocInfo.commandPool = commandPool;
+    commandAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandAllocInfo.commandBufferCount = OFFSCREEN_FRAME_COUNT;
+
+    if (vkAllocateCommandBuffers(device, &commandAllocInfo, commandBuffers) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate offscreen command buffers!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < OFFSCREEN_FRAME_COUNT; i++)
+    {
+        OffscreenFrame *frame = &offscreenFrames[i];
+
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = readbackSize;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferInfo, NULL, &frame->readbackBuffer) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create readback buffer!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        VkMemoryRequirements memoryRequirements;
+        vkGetBufferMemoryRequirements(device, frame->readbackBuffer, &memoryRequirements);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memoryRequirements.size;
+        allocInfo.memoryTypeIndex = findReadbackMemoryType(memoryRequirements.memoryTypeBits);
+
+        if (vkAllocateMemory(device, &allocInfo, NULL, &frame->readbackMemory) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate readback memory!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        vkBindBufferMemory(device, frame->readbackBuffer, frame->readbackMemory, 0);
+
+        // Persistently mapped, the fence tells when the copy has landed
+        vkMapMemory(device, frame->readbackMemory, 0, VK_WHOLE_SIZE, 0, &frame->mapped);
+
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+        if (vkCreateFence(device, &fenceInfo, NULL, &frame->fence) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create offscreen fence!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        frame->commandBuffer = commandBuffers[i];
+        frame->frame = 0;
+    }
+
+    printf("Readback buffers created successfully\n");
+}
+
+void recordOffscreenReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    // The render pass left the image in TRANSFER_SRC_OPTIMAL and its external dependency
+    // orders the color writes before this copy
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0; // Tightly packed
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = swapChainExtent.width;
+    region.imageExtent.height = swapChainExtent.height;
+    region.imageExtent.depth = 1;
+
+    vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, offscreenFrames[imageIndex].readbackBuffer, 1, &region);
+
+    // Make the copy available to the host once the fence signals
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = offscreenFrames[imageIndex].readbackBuffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+// Waits for the slot and queues its pixels on the writer thread, which copies them out right away
+static void retireFrame(OffscreenFrame *frame)
+{
+    vkWaitForFences(device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+
+    if (frame->frame == 0)
+    {
+        return;
+    }
+
+    if (!readbackCoherent)
+    {
+        VkMappedMemoryRange range = {};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = frame->readbackMemory;
+        range.offset = 0;
+        range.size = VK_WHOLE_SIZE;
+        vkInvalidateMappedMemoryRanges(device, 1, &range);
+    }
+
+    if (!offscreenDiscardFrames)
+    {
+        frameWriterSubmit(frame->frame, frame->mapped, swapChainExtent.width * 4);
+    }
+
+    frame->frame = 0;
+}
+
+void drawOffscreenFrame()
+{
+    currentFrame++;
+
+    if (frameTimingActive)
+    {
+        frameBenchBeginFrame(currentFrame);
+    }
+
+    uint32_t slot = (uint32_t)(currentFrame % OFFSCREEN_FRAME_COUNT);
+    OffscreenFrame *frame = &offscreenFrames[slot];
+
+    // The slot still holds frame currentFrame - 2, the GPU keeps rendering currentFrame - 1 meanwhile
+    retireFrame(frame);
+    vkResetFences(device, 1, &frame->fence);
+
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_ACQUIRE);
+    }
+
+    prepareFluidFrame(currentFrame);
+
+    VkCommandBuffer frameCommandBuffer = acquireFrameCommandBuffer(frame->commandBuffer, slot);
+
+    VkCommandBuffer submitCommandBuffers[3];
+    uint32_t submitCommandBufferCount = 1;
+    submitCommandBuffers[0] = frameCommandBuffer;
+
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_RECORD);
+        submitCommandBufferCount = frameBenchWrapGraphics(currentFrame, frameCommandBuffer, submitCommandBuffers);
+    }
+
+    // Same timeline handshake with the simulation as drawFrame(), without the swapchain semaphores
+    VkSemaphore waitSemaphores[] = {simulationTimeline};
+    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT};
+    uint64_t waitValues[] = {currentFrame};
+    VkSemaphore signalSemaphores[] = {renderTimeline};
+    uint64_t signalValues[] = {currentFrame};
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = waitValues;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = waitSemaphores;
+    submitInfo.pWaitDstStageMask = waitStages;
+    submitInfo.commandBufferCount = submitCommandBufferCount;
+    submitInfo.pCommandBuffers = submitCommandBuffers;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = signalSemaphores;
+
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame->fence) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to submit offscreen command buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    frame->frame = currentFrame;
+
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_SUBMIT);
+    }
+
+    sphGpuSubmitStep(currentFrame + 1);
+
+    if (frameTimingActive)
+    {
+        frameBenchMark(FRAME_PHASE_SIMULATION);
+    }
+}
+
+void flushOffscreenFrames()
+{
+    // Oldest first so the frames reach the writer in order
+    for (uint32_t i = 1; i <= OFFSCREEN_FRAME_COUNT; i++)
+    {
+        retireFrame(&offscreenFrames[(currentFrame + i) % OFFSCREEN_FRAME_COUNT]);
+    }
+}
+
+void destroyOffscreen()
+{
+    for (uint32_t i = 0; i < OFFSCREEN_FRAME_COUNT; i++)
+    {
+        OffscreenFrame *frame = &offscreenFrames[i];
+
+        if (frame->fence != VK_NULL_HANDLE)
+        {
+            vkDestroyFence(device, frame->fence, NULL);
+            frame->fence = VK_NULL_HANDLE;
+        }
+
+        if (frame->readbackBuffer != VK_NULL_HANDLE)
+        {
+            vkUnmapMemory(device, frame->readbackMemory);
+            vkDestroyBuffer(device, frame->readbackBuffer, NULL);
+            vkFreeMemory(device, frame->readbackMemory, NULL);
+            frame->readbackBuffer = VK_NULL_HANDLE;
+        }
+    }
+
+    if (swapChainImages != NULL)
+    {
+        for (uint32_t i = 0; i < imageCount; i++)
+        {
+            if (swapChainImageViews != NULL)
+            {
+                vkDestroyImageView(device, swapChainImageViews[i], NULL);
+            }
+
+            vkDestroyImage(device, swapChainImages[i], NULL);
+            vkFreeMemory(device, offscreenFrames[i].imageMemory, NULL);
+        }
+
+        free(swapChainImageViews);
+        swapChainImageViews = NULL;
+
+        free(swapChainImages);
+        swapChainImages = NULL;
+
+        printf("Destroyed offscreen targets\n");
+    }
+}
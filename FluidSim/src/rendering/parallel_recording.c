@@ -0,0 +1,195 @@
+#include "parallel_recording.h"
+#include "vulkan_utils.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+// Secondary command buffers of one thread for one frame slot. They stay allocated across frames,
+// resetting the pool puts them back in the initial state
+typedef struct {
+    VkCommandPool pool;
+    VkCommandBuffer *buffers;
+    uint32_t allocated;
+    uint32_t used;
+} ThreadRecorder;
+
+typedef struct {
+    const DrawBatch *batches;
+    VkCommandBuffer *results; // Secondary command buffer of every batch, in batch order
+    VkCommandBufferInheritanceInfo inheritance;
+    uint32_t slot;
+} RecordJob;
+
+static ThreadRecorder *recorders = NULL; // [thread * RECORD_FRAME_SLOTS + slot]
+static uint32_t recorderThreads = 0;
+static VkCommandBuffer *batchResults = NULL;
+static uint32_t batchResultCapacity = 0;
+
+void createParallelRecording()
+{
+    recorderThreads = threadPoolThreadCount();
+    recorders = calloc(recorderThreads * RECORD_FRAME_SLOTS, sizeof(ThreadRecorder));
+
+    QueueFamilyIndices queueFamilies = findQueueFamilies(physicalDevice);
+
+    for (uint32_t i = 0; i < recorderThreads * RECORD_FRAME_SLOTS; i++)
+    {
+        // Transient: the buffers are re-recorded every frame, the pool is reset as a whole
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = queueFamilies.graphicsFamily;
+
+        if (vkCreateCommandPool(device, &poolInfo, NULL, &recorders[i].pool) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create recording command pool!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("Parallel recording created with %u threads\n", recorderThreads);
+}
+
+// Dynamic state is not inherited from the primary command buffer, every batch buffer sets it
+static void setFrameViewport(VkCommandBuffer commandBuffer)
+{
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)swapChainExtent.width;
+    viewport.height = (float)swapChainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    scissor.extent = swapChainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+static VkCommandBuffer nextSecondaryBuffer(ThreadRecorder *recorder)
+{
+    if (recorder->used == recorder->allocated)
+    {
+        uint32_t capacity = recorder->allocated == 0 ? 4 : recorder->allocated * 2;
+        recorder->buffers = realloc(recorder->buffers, capacity * sizeof(VkCommandBuffer));
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = recorder->pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = capacity - recorder->allocated;
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, recorder->buffers + recorder->allocated) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate secondary command buffers!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        recorder->allocated = capacity;
+    }
+
+    return recorder->buffers[recorder->used++];
+}
+
+static void recordBatchTask(void *context, uint32_t batchIndex, uint32_t threadIndex)
+{
+    RecordJob *job = context;
+    ThreadRecorder *recorder = &recorders[threadIndex * RECORD_FRAME_SLOTS + job->slot];
+    VkCommandBuffer secondary = nextSecondaryBuffer(recorder);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = &job->inheritance;
+
+    if (vkBeginCommandBuffer(secondary, &beginInfo) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to begin recording secondary command buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    setFrameViewport(secondary);
+
+    job->batches[batchIndex].record(secondary, job->batches[batchIndex].data);
+
+    if (vkEndCommandBuffer(secondary) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to record secondary command buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    job->results[batchIndex] = secondary;
+}
+
+void recordDrawBatches(VkCommandBuffer primaryCommandBuffer, uint32_t imageIndex, uint64_t frame, const DrawBatch *batches, uint32_t batchCount)
+{
+    if (batchCount == 0)
+    {
+        return;
+    }
+
+    RecordJob job = {};
+    job.batches = batches;
+    job.slot = (uint32_t)(frame % RECORD_FRAME_SLOTS);
+
+    // The caller waited for the fence of the frame that last used this slot
+    for (uint32_t thread = 0; thread < recorderThreads; thread++)
+    {
+        ThreadRecorder *recorder = &recorders[thread * RECORD_FRAME_SLOTS + job.slot];
+        vkResetCommandPool(device, recorder->pool, 0);
+        recorder->used = 0;
+    }
+
+    if (batchCount > batchResultCapacity)
+    {
+        batchResults = realloc(batchResults, batchCount * sizeof(VkCommandBuffer));
+        batchResultCapacity = batchCount;
+    }
+
+    job.results = batchResults;
+
+    job.inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    job.inheritance.renderPass = renderPass;
+    job.inheritance.subpass = 0;
+    job.inheritance.framebuffer = swapChainFramebuffers[imageIndex];
+
+    threadPoolRun(recordBatchTask, &job, batchCount);
+
+    vkCmdExecuteCommands(primaryCommandBuffer, batchCount, batchResults);
+}
+
+void recordDrawBatchesInline(VkCommandBuffer primaryCommandBuffer, const DrawBatch *batches, uint32_t batchCount)
+{
+    setFrameViewport(primaryCommandBuffer);
+
+    for (uint32_t i = 0; i < batchCount; i++)
+    {
+        batches[i].record(primaryCommandBuffer, batches[i].data);
+    }
+}
+
+void destroyParallelRecording()
+{
+    if (recorders == NULL)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < recorderThreads * RECORD_FRAME_SLOTS; i++)
+    {
+        vkDestroyCommandPool(device, recorders[i].pool, NULL); // Also frees the secondary buffers
+        free(recorders[i].buffers);
+    }
+
+    free(recorders);
+    recorders = NULL;
+
+    free(batchResults);
+    batchResults = NULL;
+    batchResultCapacity = 0;
+
+    printf("Destroyed recording command pools\n");
+}
@@ -0,0 +1,1779 @@
+#include "renderer.h"
+#include "vulkan_utils.h"
+#include "camera.h"
+#include "sph_gpu.h"
+#include "surface_mesh.h"
+#include "parallel_recording.h"
+#include "gpu_culling.h"
+#include "thread_pool.h"
+#include "descriptor_heap.h"
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#define FLUID_FILTER_GROUP_SIZE 16
+#define FLUID_FILTER_MAX_RADIUS 16
+
+#define VOLUME_BRICK_VOXELS 8 // Voxels per brick edge: the unit of the uploads and of the empty space skipping
+#define VOLUME_BRICK_BYTES (VOLUME_BRICK_VOXELS * VOLUME_BRICK_VOXELS * VOLUME_BRICK_VOXELS * sizeof(uint16_t))
+#define VOLUME_MARCH_GROUP_SIZE 8
+#define VOLUME_STEP_VOXELS 0.5f         // Ray march step
+#define VOLUME_EXTINCTION 0.25f         // Optical depth of a voxel of path at density 1, the fluid at rest
+#define VOLUME_EMPTY_DENSITY 0.001f     // Bricks whose apron never reaches this are skipped
+#define VOLUME_HISTORY_WEIGHT 0.8f      // Share of the reprojected history in the half resolution result
+
+RenderMode renderMode = RENDER_MODE_PARTICLES;
+int fluidHalfResolution = 0;
+int volumeHalfResolution = 0;
+float fluidParticleRadius = 0.05f;
+const char *fluidMeshOutput = NULL;
+float fluidMeshThreshold = 0.05f;
+
+typedef struct {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkExtent2D extent;
+} FluidTarget;
+
+// Matches the push constants of fluid_filter.comp
+typedef struct {
+    int32_t direction[2];
+    int32_t sourceStride;
+    int32_t maxRadius;
+    uint32_t images[2]; // Descriptor heap handles of the source and the target, with the heap only
+} FluidFilterPushConstants;
+
+enum {
+    FLUID_TARGET_DEPTH,     // R32F linear view depth of the nearest sphere, 0 where there is no fluid
+    FLUID_TARGET_THICKNESS, // R16F summed length of the view rays inside the spheres
+    FLUID_TARGET_ZBUFFER,   // Depth attachment of the splat pass
+    FLUID_TARGET_FILTER_TEMP,
+    FLUID_TARGET_FILTERED,  // Filter resolution, the output of the vertical filter pass
+    FLUID_TARGET_COUNT
+};
+
+static FluidTarget fluidTargets[FLUID_TARGET_COUNT];
+static VkRenderPass fluidSplatPass = VK_NULL_HANDLE;
+static VkFramebuffer fluidSplatFramebuffer = VK_NULL_HANDLE;
+
+static VkBuffer fluidUniformBuffer = VK_NULL_HANDLE;
+static VkDeviceMemory fluidUniformMemory = VK_NULL_HANDLE;
+static FluidUniforms fluidUniforms;
+
+static VkSampler fluidSampler = VK_NULL_HANDLE;
+static VkDescriptorSetLayout fluidUniformSetLayout = VK_NULL_HANDLE;
+static VkDescriptorSetLayout fluidFilterSetLayout = VK_NULL_HANDLE;
+static VkDescriptorSetLayout fluidCompositeSetLayout = VK_NULL_HANDLE;
+static VkDescriptorPool fluidDescriptorPool = VK_NULL_HANDLE;
+static VkDescriptorSet fluidUniformSet = VK_NULL_HANDLE;
+static VkDescriptorSet fluidFilterSets[2]; // [0] horizontal: depth -> temp, [1] vertical: temp -> filtered
+static uint32_t fluidFilterHandles[3] = {DESCRIPTOR_HANDLE_NONE, DESCRIPTOR_HANDLE_NONE, DESCRIPTOR_HANDLE_NONE}; // Heap: depth, temp, filtered
+static VkDescriptorSet fluidCompositeSet = VK_NULL_HANDLE;
+
+static VkPipelineLayout fluidSplatLayout = VK_NULL_HANDLE;
+static VkPipelineLayout fluidFilterLayout = VK_NULL_HANDLE;
+static VkPipelineLayout fluidCompositeLayout = VK_NULL_HANDLE;
+static VkPipeline fluidDepthPipeline = VK_NULL_HANDLE;
+static VkPipeline fluidThicknessPipeline = VK_NULL_HANDLE;
+static VkPipeline fluidFilterPipeline = VK_NULL_HANDLE;
+static VkPipeline fluidCompositePipeline = VK_NULL_HANDLE;
+
+// Matches the push constants of mesh.vert
+typedef struct {
+    float viewProjection[16];
+    float eye[4];
+} FluidMeshPushConstants;
+
+// Host visible copy of the extracted mesh drawn by one frame slot. The draw goes through an indirect
+// command so a changing index count does not invalidate cached command buffers
+typedef struct {
+    VkBuffer vertexBuffer;
+    VkDeviceMemory vertexMemory;
+    void *vertexMapped;
+    VkDeviceSize vertexCapacity;
+    VkBuffer indexBuffer;
+    VkDeviceMemory indexMemory;
+    void *indexMapped;
+    VkDeviceSize indexCapacity;
+    VkBuffer indirectBuffer;
+    VkDeviceMemory indirectMemory;
+    VkDrawIndexedIndirectCommand *indirect;
+    uint64_t version; // fluidMeshVersion of the uploaded mesh
+} FluidMeshSlot;
+
+static FluidMeshSlot fluidMeshSlots[RECORD_FRAME_SLOTS];
+static SurfaceExtractor fluidExtractor;
+static int fluidExtractorReady = 0;
+static float *fluidMeshPositions = NULL;
+static uint64_t fluidMeshVersion = 0;
+static VkPipelineLayout fluidMeshLayout = VK_NULL_HANDLE;
+static VkPipeline fluidMeshPipeline = VK_NULL_HANDLE;
+
+// Matches VolumeUniforms of volume_march.comp, std140 compatible. Everything after the grid is in voxels
+typedef struct {
+    float inverseViewProjection[16];
+    float previousViewProjection[16]; // For the reprojection of the history
+    float eye[4];      // xyz = camera position, w = frame index for the jitter of the ray start
+    float grid[4];     // xyz = world position of voxel 0, w = voxel size
+    float gridSize[4]; // xyz = voxels, w = voxels per brick edge
+    float shading[4];  // extinction per voxel at density 1, empty brick density, history weight, step
+    float screen[4];   // xy = march resolution
+} VolumeUniforms;
+
+// Everything one frame slot reads: changed bricks are packed at their own offset of the staging buffer,
+// the occupancy of every brick after all the bricks. Uniforms are written by the host, so cached command
+// buffers still see this frame's camera
+typedef struct {
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingMemory;
+    uint8_t *staging;
+    VkBuffer uniformBuffer;
+    VkDeviceMemory uniformMemory;
+    VolumeUniforms *uniforms;
+    VkBufferImageCopy *densityRegions;
+    uint32_t densityRegionCount;
+    VkBufferImageCopy *occupancyRegions;
+    uint32_t occupancyRegionCount;
+    VkDescriptorSet marchSet;
+    VkDescriptorSet compositeSet;
+} VolumeSlot;
+
+static VolumeSlot volumeSlots[RECORD_FRAME_SLOTS];
+static FluidTarget volumeDensity;                      // R16F field, one voxel per extractor node
+static FluidTarget volumeOccupancy;                    // R16G16F min and max of every brick and its one voxel apron
+static FluidTarget volumeTargets[RECORD_FRAME_SLOTS];  // RGBA16F premultiplied march result, the previous slot's is the history
+static uint32_t volumeBrickDim[3];
+static uint32_t volumeBrickCount = 0;
+static float *volumeUploadedField = NULL;              // Field as last uploaded, [nodeDim]
+static uint32_t *volumeUploadedOccupancy = NULL;       // Packed half min and max as last uploaded, [volumeBrickCount]
+static uint8_t *volumeBrickChanged = NULL;
+static uint8_t *volumeOccupancyChanged = NULL;
+static VolumeSlot *volumeUploadSlot = NULL;            // Slot the brick tasks pack into
+static int volumeUploadsPending = 0;                   // The last recorded frame copied bricks
+static int volumeHistoryValid = 0;
+static float volumePreviousViewProjection[16];
+static uint64_t volumeUploadedBricks = 0;
+static uint64_t volumeUploadFrames = 0;
+
+static VkSampler volumeSampler = VK_NULL_HANDLE;
+static VkDescriptorSetLayout volumeMarchSetLayout = VK_NULL_HANDLE;
+static VkDescriptorSetLayout volumeCompositeSetLayout = VK_NULL_HANDLE;
+static VkDescriptorPool volumeDescriptorPool = VK_NULL_HANDLE;
+static VkPipelineLayout volumeMarchLayout = VK_NULL_HANDLE;
+static VkPipelineLayout volumeCompositeLayout = VK_NULL_HANDLE;
+static VkPipeline volumeMarchPipeline = VK_NULL_HANDLE;
+static VkPipeline volumeCompositePipeline = VK_NULL_HANDLE;
+
+typedef enum {
+    FLUID_INPUT_NONE,      // Positions generated in the vertex shader
+    FLUID_INPUT_PARTICLES, // One vec4 per particle, drawn as points
+    FLUID_INPUT_MESH       // SurfaceVertex triangles
+} FluidVertexInput;
+
+static void createFluidImage(FluidTarget *target, VkImageType type, VkFormat format, VkExtent3D extent, VkImageUsageFlags usage, VkImageAspectFlags aspect)
+{
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = type;
+    imageInfo.format = format;
+    imageInfo.extent = extent;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = usage;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (vkCreateImage(device, &imageInfo, NULL, &target->image) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create fluid target image!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(device, target->image, &memoryRequirements);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memoryRequirements.size;
+    allocInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    if (vkAllocateMemory(device, &allocInfo, NULL, &target->memory) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate fluid target memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    vkBindImageMemory(device, target->image, target->memory, 0);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = target->image;
+    viewInfo.viewType = type == VK_IMAGE_TYPE_3D ? VK_IMAGE_VIEW_TYPE_3D : VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = aspect;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(device, &viewInfo, NULL, &target->view) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create fluid target image view!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    target->extent.width = extent.width;
+    target->extent.height = extent.height;
+}
+
+static void createFluidTarget(FluidTarget *target, VkFormat format, VkExtent2D extent, VkImageUsageFlags usage, VkImageAspectFlags aspect)
+{
+    VkExtent3D imageExtent = {extent.width, extent.height, 1};
+    createFluidImage(target, VK_IMAGE_TYPE_2D, format, imageExtent, usage, aspect);
+}
+
+static void destroyFluidTarget(FluidTarget *target)
+{
+    vkDestroyImageView(device, target->view, NULL);
+    vkDestroyImage(device, target->image, NULL);
+    vkFreeMemory(device, target->memory, NULL);
+}
+
+static void createFluidTargets(VkFormat depthFormat)
+{
+    VkExtent2D fullExtent = swapChainExtent;
+    VkExtent2D filterExtent = fullExtent;
+
+    if (fluidHalfResolution)
+    {
+        filterExtent.width = (fullExtent.width + 1) / 2;
+        filterExtent.height = (fullExtent.height + 1) / 2;
+    }
+
+    createFluidTarget(&fluidTargets[FLUID_TARGET_DEPTH], VK_FORMAT_R32_SFLOAT, fullExtent,
+                      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+    createFluidTarget(&fluidTargets[FLUID_TARGET_THICKNESS], VK_FORMAT_R16_SFLOAT, fullExtent,
+                      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+    createFluidTarget(&fluidTargets[FLUID_TARGET_ZBUFFER], depthFormat, fullExtent,
+                      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT);
+    createFluidTarget(&fluidTargets[FLUID_TARGET_FILTER_TEMP], VK_FORMAT_R32_SFLOAT, filterExtent,
+                      VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+    createFluidTarget(&fluidTargets[FLUID_TARGET_FILTERED], VK_FORMAT_R32_SFLOAT, filterExtent,
+                      VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    // The filter targets never leave the general layout, move them there once
+    VkImageMemoryBarrier barriers[2] = {};
+
+    for (int i = 0; i < 2; i++)
+    {
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].srcAccessMask = 0;
+        barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barriers[i].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].image = fluidTargets[FLUID_TARGET_FILTER_TEMP + i].image;
+        barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barriers[i].subresourceRange.levelCount = 1;
+        barriers[i].subresourceRange.layerCount = 1;
+    }
+
+    VkCommandBuffer setupBuffer = beginSingleTimeCommands();
+    vkCmdPipelineBarrier(setupBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 2, barriers);
+    endSingleTimeCommands(setupBuffer);
+}
+
+static void createFluidSplatPass(VkFormat depthFormat)
+{
+    VkAttachmentDescription attachments[3] = {};
+
+    // Depth, read by the filter as a storage image and by the composite pass for the upsample
+    attachments[0].format = VK_FORMAT_R32_SFLOAT;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    // Thickness, only sampled
+    attachments[1] = attachments[0];
+    attachments[1].format = VK_FORMAT_R16_SFLOAT;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    // Z-buffer of the spheres, not needed after the pass
+    attachments[2] = attachments[0];
+    attachments[2].format = depthFormat;
+    attachments[2].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[2].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDependency dependencies[2] = {};
+
+    // The previous frame's filter and composite passes read the targets we are about to clear
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependencies[0].srcAccessMask = 0;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    fluidSplatPass = createRenderPassWithAttachments(attachments, 2, 1, dependencies, 2);
+
+    VkImageView views[3] = {
+        fluidTargets[FLUID_TARGET_DEPTH].view,
+        fluidTargets[FLUID_TARGET_THICKNESS].view,
+        fluidTargets[FLUID_TARGET_ZBUFFER].view};
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = fluidSplatPass;
+    framebufferInfo.attachmentCount = 3;
+    framebufferInfo.pAttachments = views;
+    framebufferInfo.width = swapChainExtent.width;
+    framebufferInfo.height = swapChainExtent.height;
+    framebufferInfo.layers = 1;
+
+    if (vkCreateFramebuffer(device, &framebufferInfo, NULL, &fluidSplatFramebuffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create fluid framebuffer!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static VkDescriptorSetLayout createSetLayout(const VkDescriptorType *types, uint32_t count, VkShaderStageFlags stages)
+{
+    VkDescriptorSetLayoutBinding bindings[8] = {};
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = types[i];
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = stages;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = count;
+    layoutInfo.pBindings = bindings;
+
+    VkDescriptorSetLayout layout;
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &layout) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create fluid descriptor set layout!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return layout;
+}
+
+static void writeImageDescriptor(VkDescriptorSet set, uint32_t binding, VkDescriptorType type, const FluidTarget *target, VkImageLayout layout, VkSampler sampler)
+{
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.sampler = sampler;
+    imageInfo.imageView = target->view;
+    imageInfo.imageLayout = layout;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = binding;
+    write.descriptorCount = 1;
+    write.descriptorType = type;
+    write.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+}
+
+static void createFluidDescriptors()
+{
+    createBuffer(sizeof(FluidUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &fluidUniformBuffer, &fluidUniformMemory);
+
+    // Every read is a texelFetch, nearest filtering keeps the background zeros out of the surface
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+    if (vkCreateSampler(device, &samplerInfo, NULL, &fluidSampler) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create fluid sampler!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorType uniformTypes[] = {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER};
+    VkDescriptorType filterTypes[] = {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE};
+    VkDescriptorType compositeTypes[] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER};
+
+    fluidUniformSetLayout = createSetLayout(uniformTypes, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT);
+    fluidFilterSetLayout = createSetLayout(filterTypes, 2, VK_SHADER_STAGE_COMPUTE_BIT);
+    fluidCompositeSetLayout = createSetLayout(compositeTypes, 3, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+    VkDescriptorPoolSize poolSizes[3] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = 1;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = 4;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[2].descriptorCount = 3;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = 4;
+    poolInfo.poolSizeCount = 3;
+    poolInfo.pPoolSizes = poolSizes;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, NULL, &fluidDescriptorPool) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create fluid descriptor pool!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorSetLayout setLayouts[4] = {fluidUniformSetLayout, fluidFilterSetLayout, fluidFilterSetLayout, fluidCompositeSetLayout};
+    VkDescriptorSet sets[4];
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = fluidDescriptorPool;
+    allocInfo.descriptorSetCount = 4;
+    allocInfo.pSetLayouts = setLayouts;
+
+    if (vkAllocateDescriptorSets(device, &allocInfo, sets) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate fluid descriptor sets!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fluidUniformSet = sets[0];
+    fluidFilterSets[0] = sets[1];
+    fluidFilterSets[1] = sets[2];
+    fluidCompositeSet = sets[3];
+
+    VkDescriptorBufferInfo bufferInfo = {};
+    bufferInfo.buffer = fluidUniformBuffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = sizeof(FluidUniforms);
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = fluidUniformSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    write.pBufferInfo = &bufferInfo;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+
+    writeImageDescriptor(fluidFilterSets[0], 0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &fluidTargets[FLUID_TARGET_DEPTH], VK_IMAGE_LAYOUT_GENERAL, VK_NULL_HANDLE);
+    writeImageDescriptor(fluidFilterSets[0], 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &fluidTargets[FLUID_TARGET_FILTER_TEMP], VK_IMAGE_LAYOUT_GENERAL, VK_NULL_HANDLE);
+    writeImageDescriptor(fluidFilterSets[1], 0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &fluidTargets[FLUID_TARGET_FILTER_TEMP], VK_IMAGE_LAYOUT_GENERAL, VK_NULL_HANDLE);
+    writeImageDescriptor(fluidFilterSets[1], 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &fluidTargets[FLUID_TARGET_FILTERED], VK_IMAGE_LAYOUT_GENERAL, VK_NULL_HANDLE);
+
+    // The bindless filter indexes the same images in the heap, the sets above are the fallback
+    fluidFilterHandles[0] = descriptorHeapAddImage(fluidTargets[FLUID_TARGET_DEPTH].view);
+    fluidFilterHandles[1] = descriptorHeapAddImage(fluidTargets[FLUID_TARGET_FILTER_TEMP].view);
+    fluidFilterHandles[2] = descriptorHeapAddImage(fluidTargets[FLUID_TARGET_FILTERED].view);
+
+    writeImageDescriptor(fluidCompositeSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &fluidTargets[FLUID_TARGET_DEPTH], VK_IMAGE_LAYOUT_GENERAL, fluidSampler);
+    writeImageDescriptor(fluidCompositeSet, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &fluidTargets[FLUID_TARGET_FILTERED], VK_IMAGE_LAYOUT_GENERAL, fluidSampler);
+    writeImageDescriptor(fluidCompositeSet, 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &fluidTargets[FLUID_TARGET_THICKNESS], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, fluidSampler);
+}
+
+static VkPipelineLayout createFluidPipelineLayout(const VkDescriptorSetLayout *setLayouts, uint32_t setCount, const VkPushConstantRange *pushConstantRange)
+{
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = setCount;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = pushConstantRange != NULL ? 1 : 0;
+    pipelineLayoutInfo.pPushConstantRanges = pushConstantRange;
+
+    VkPipelineLayout layout;
+
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &layout) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create fluid pipeline layout!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return layout;
+}
+
+// Graphics pipeline of one fluid pass. Splat pipelines take the particle positions as points, the
+// composite pipeline draws a fullscreen triangle without vertex input and the mesh pipeline triangles
+static VkPipeline createFluidGraphicsPipeline(const char *vertexPath, const char *fragmentPath, VkPipelineLayout layout, VkRenderPass pass,
+                                              FluidVertexInput input, const VkPipelineColorBlendAttachmentState *blendAttachments, uint32_t colorCount,
+                                              const VkPipelineDepthStencilStateCreateInfo *depthStencil)
+{
+    VkShaderModule vertexModule = loadShaderModule(vertexPath);
+    VkShaderModule fragmentModule = loadShaderModule(fragmentPath);
+
+    VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = vertexModule;
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = fragmentModule;
+    shaderStages[1].pName = "main";
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    // Particles use the layout of the particle pipeline: one vec4 per particle
+    VkVertexInputBindingDescription bindingDescription = {};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = input == FLUID_INPUT_MESH ? sizeof(SurfaceVertex) : 4 * sizeof(float);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    VkVertexInputAttributeDescription attributeDescriptions[2] = {};
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = input == FLUID_INPUT_MESH ? VK_FORMAT_R32G32B32_SFLOAT : VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[0].offset = 0;
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[1].offset = offsetof(SurfaceVertex, normal);
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    if (input != FLUID_INPUT_NONE)
+    {
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.vertexAttributeDescriptionCount = input == FLUID_INPUT_MESH ? 2 : 1;
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
+    }
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = input == FLUID_INPUT_PARTICLES ? VK_PRIMITIVE_TOPOLOGY_POINT_LIST : VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    // Viewport and scissor are dynamic, only the counts matter
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.minSampleShading = 1.0f;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.attachmentCount = colorCount;
+    colorBlending.pAttachments = blendAttachments;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = layout;
+    pipelineInfo.renderPass = pass;
+    pipelineInfo.subpass = 0;
+    pipelineInfo.basePipelineIndex = -1;
+
+    VkPipeline pipeline;
+
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create fluid pipeline %s!\n", fragmentPath);
+        exit(EXIT_FAILURE);
+    }
+
+    vkDestroyShaderModule(device, fragmentModule, NULL);
+    vkDestroyShaderModule(device, vertexModule, NULL);
+
+    return pipeline;
+}
+
+static void createFluidPipelines()
+{
+    VkDescriptorSetLayout filterSetLayouts[2] = {fluidUniformSetLayout, descriptorHeapSupported ? descriptorHeapSetLayout : fluidFilterSetLayout};
+    VkDescriptorSetLayout compositeSetLayouts[2] = {fluidUniformSetLayout, fluidCompositeSetLayout};
+
+    VkPushConstantRange filterPushConstants = {};
+    filterPushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    filterPushConstants.offset = 0;
+    filterPushConstants.size = sizeof(FluidFilterPushConstants);
+
+    fluidSplatLayout = createFluidPipelineLayout(&fluidUniformSetLayout, 1, NULL);
+    fluidFilterLayout = createFluidPipelineLayout(filterSetLayouts, 2, &filterPushConstants);
+    fluidCompositeLayout = createFluidPipelineLayout(compositeSetLayouts, 2, NULL);
+
+    const VkColorComponentFlags allComponents = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    // Both splat pipelines share the render pass, each one only writes its own attachment
+    VkPipelineColorBlendAttachmentState depthBlend[2] = {};
+    depthBlend[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+    depthBlend[1].colorWriteMask = 0;
+
+    VkPipelineColorBlendAttachmentState thicknessBlend[2] = {};
+    thicknessBlend[0].colorWriteMask = 0;
+    thicknessBlend[1].colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+    thicknessBlend[1].blendEnable = VK_TRUE;
+    thicknessBlend[1].srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    thicknessBlend[1].dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    thicknessBlend[1].colorBlendOp = VK_BLEND_OP_ADD;
+    thicknessBlend[1].srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    thicknessBlend[1].dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    thicknessBlend[1].alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendAttachmentState compositeBlend = {};
+    compositeBlend.colorWriteMask = allComponents;
+
+    VkPipelineDepthStencilStateCreateInfo depthTest = {};
+    depthTest.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthTest.depthTestEnable = VK_TRUE;
+    depthTest.depthWriteEnable = VK_TRUE;
+    depthTest.depthCompareOp = VK_COMPARE_OP_LESS;
+
+    // Thickness accumulates every sphere along the ray, hidden or not
+    VkPipelineDepthStencilStateCreateInfo noDepthTest = depthTest;
+    noDepthTest.depthTestEnable = VK_FALSE;
+    noDepthTest.depthWriteEnable = VK_FALSE;
+
+    fluidDepthPipeline = createFluidGraphicsPipeline("../shaders/fluid_splat_vert.spv", "../shaders/fluid_depth_frag.spv",
+                                                     fluidSplatLayout, fluidSplatPass, FLUID_INPUT_PARTICLES, depthBlend, 2, &depthTest);
+    fluidThicknessPipeline = createFluidGraphicsPipeline("../shaders/fluid_splat_vert.spv", "../shaders/fluid_thickness_frag.spv",
+                                                         fluidSplatLayout, fluidSplatPass, FLUID_INPUT_PARTICLES, thicknessBlend, 2, &noDepthTest);
+    fluidCompositePipeline = createFluidGraphicsPipeline("../shaders/fullscreen_vert.spv", "../shaders/fluid_composite_frag.spv",
+                                                         fluidCompositeLayout, renderPass, FLUID_INPUT_NONE, &compositeBlend, 1, NULL);
+    fluidFilterPipeline = createComputePipeline(descriptorHeapSupported ? "../shaders/fluid_filter_bindless.spv" : "../shaders/fluid_filter.spv", fluidFilterLayout);
+}
+
+static void createMappedBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer *buffer, VkDeviceMemory *memory, void **mapped)
+{
+    createBuffer(size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory);
+    vkMapMemory(device, *memory, 0, size, 0, mapped);
+}
+
+static void destroyMappedBuffer(VkBuffer *buffer, VkDeviceMemory *memory)
+{
+    if (*buffer != VK_NULL_HANDLE)
+    {
+        vkUnmapMemory(device, *memory);
+        vkDestroyBuffer(device, *buffer, NULL);
+        vkFreeMemory(device, *memory, NULL);
+        *buffer = VK_NULL_HANDLE;
+    }
+}
+
+// Grows a slot buffer to hold at least size bytes, the caller made sure the GPU is not reading it
+static void reserveMeshBuffer(VkBuffer *buffer, VkDeviceMemory *memory, void **mapped, VkDeviceSize *capacity, VkDeviceSize size, VkBufferUsageFlags usage)
+{
+    if (*buffer != VK_NULL_HANDLE && size <= *capacity)
+    {
+        return;
+    }
+
+    VkDeviceSize newCapacity = *capacity > 0 ? *capacity : 64 * 1024;
+
+    while (newCapacity < size)
+    {
+        newCapacity *= 2;
+    }
+
+    destroyMappedBuffer(buffer, memory);
+    createMappedBuffer(newCapacity, usage, buffer, memory, mapped);
+    *capacity = newCapacity;
+
+    markCommandBuffersDirty(); // Cached command buffers bind the old buffer
+}
+
+static void createFluidMeshResources()
+{
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(FluidMeshPushConstants);
+
+    fluidMeshLayout = createFluidPipelineLayout(NULL, 0, &pushConstantRange);
+
+    VkPipelineColorBlendAttachmentState meshBlend = {};
+    meshBlend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    VkPipelineDepthStencilStateCreateInfo depthTest = {};
+    depthTest.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthTest.depthTestEnable = VK_TRUE;
+    depthTest.depthWriteEnable = VK_TRUE;
+    depthTest.depthCompareOp = VK_COMPARE_OP_LESS;
+
+    fluidMeshPipeline = createFluidGraphicsPipeline("../shaders/mesh_vert.spv", "../shaders/mesh_frag.spv",
+                                                    fluidMeshLayout, renderPass, FLUID_INPUT_MESH, &meshBlend, 1, &depthTest);
+
+    for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+    {
+        FluidMeshSlot *meshSlot = &fluidMeshSlots[slot];
+
+        reserveMeshBuffer(&meshSlot->vertexBuffer, &meshSlot->vertexMemory, &meshSlot->vertexMapped, &meshSlot->vertexCapacity, 0, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        reserveMeshBuffer(&meshSlot->indexBuffer, &meshSlot->indexMemory, &meshSlot->indexMapped, &meshSlot->indexCapacity, 0, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+        createMappedBuffer(sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, &meshSlot->indirectBuffer, &meshSlot->indirectMemory, (void **)&meshSlot->indirect);
+
+        // Nothing to draw until the first extraction
+        memset(meshSlot->indirect, 0, sizeof(VkDrawIndexedIndirectCommand));
+        meshSlot->indirect->instanceCount = 1;
+    }
+}
+
+static void transitionFluidImages(const FluidTarget *targets, uint32_t count, VkImageLayout newLayout)
+{
+    VkImageMemoryBarrier barriers[RECORD_FRAME_SLOTS] = {};
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].srcAccessMask = 0;
+        barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barriers[i].newLayout = newLayout;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].image = targets[i].image;
+        barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barriers[i].subresourceRange.levelCount = 1;
+        barriers[i].subresourceRange.layerCount = 1;
+    }
+
+    VkCommandBuffer setupBuffer = beginSingleTimeCommands();
+    vkCmdPipelineBarrier(setupBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, count, barriers);
+    endSingleTimeCommands(setupBuffer);
+}
+
+// March targets, sampler, layouts and pipelines. The textures depend on the extractor grid and are
+// created by fluidMeshInit()
+static void createVolumeRenderer()
+{
+    VkExtent2D extent = swapChainExtent;
+
+    if (volumeHalfResolution)
+    {
+        extent.width = (extent.width + 1) / 2;
+        extent.height = (extent.height + 1) / 2;
+    }
+
+    for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+    {
+        createFluidTarget(&volumeTargets[slot], VK_FORMAT_R16G16B16A16_SFLOAT, extent, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+    }
+
+    // Written by the march and sampled as the history and by the composite, they stay in the general layout
+    transitionFluidImages(volumeTargets, RECORD_FRAME_SLOTS, VK_IMAGE_LAYOUT_GENERAL);
+
+    // Trilinear density, bilinear upsample of the march result. The occupancy is only read by texelFetch
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+    if (vkCreateSampler(device, &samplerInfo, NULL, &volumeSampler) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create volume sampler!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorType marchTypes[] = {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                     VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE};
+    VkDescriptorType compositeTypes[] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER};
+
+    volumeMarchSetLayout = createSetLayout(marchTypes, 5, VK_SHADER_STAGE_COMPUTE_BIT);
+    volumeCompositeSetLayout = createSetLayout(compositeTypes, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+    VkDescriptorPoolSize poolSizes[3] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = RECORD_FRAME_SLOTS;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[1].descriptorCount = 4 * RECORD_FRAME_SLOTS;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[2].descriptorCount = RECORD_FRAME_SLOTS;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = 2 * RECORD_FRAME_SLOTS;
+    poolInfo.poolSizeCount = 3;
+    poolInfo.pPoolSizes = poolSizes;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, NULL, &volumeDescriptorPool) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create volume descriptor pool!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+    {
+        VolumeSlot *volumeSlot = &volumeSlots[slot];
+        VkDescriptorSetLayout setLayouts[2] = {volumeMarchSetLayout, volumeCompositeSetLayout};
+        VkDescriptorSet sets[2];
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = volumeDescriptorPool;
+        allocInfo.descriptorSetCount = 2;
+        allocInfo.pSetLayouts = setLayouts;
+
+        if (vkAllocateDescriptorSets(device, &allocInfo, sets) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate volume descriptor sets!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        volumeSlot->marchSet = sets[0];
+        volumeSlot->compositeSet = sets[1];
+
+        // The previous slot's result is this slot's history
+        const FluidTarget *history = &volumeTargets[(slot + RECORD_FRAME_SLOTS - 1) % RECORD_FRAME_SLOTS];
+
+        writeImageDescriptor(volumeSlot->marchSet, 3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, history, VK_IMAGE_LAYOUT_GENERAL, volumeSampler);
+        writeImageDescriptor(volumeSlot->marchSet, 4, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &volumeTargets[slot], VK_IMAGE_LAYOUT_GENERAL, VK_NULL_HANDLE);
+        writeImageDescriptor(volumeSlot->compositeSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &volumeTargets[slot], VK_IMAGE_LAYOUT_GENERAL, volumeSampler);
+    }
+
+    volumeMarchLayout = createFluidPipelineLayout(&volumeMarchSetLayout, 1, NULL);
+    volumeCompositeLayout = createFluidPipelineLayout(&volumeCompositeSetLayout, 1, NULL);
+
+    // The march result is premultiplied by its opacity
+    VkPipelineColorBlendAttachmentState compositeBlend = {};
+    compositeBlend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    compositeBlend.blendEnable = VK_TRUE;
+    compositeBlend.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    compositeBlend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    compositeBlend.colorBlendOp = VK_BLEND_OP_ADD;
+    compositeBlend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    compositeBlend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    compositeBlend.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    volumeMarchPipeline = createComputePipeline("../shaders/volume_march.spv", volumeMarchLayout);
+    volumeCompositePipeline = createFluidGraphicsPipeline("../shaders/fullscreen_vert.spv", "../shaders/volume_composite_frag.spv",
+                                                          volumeCompositeLayout, renderPass, FLUID_INPUT_NONE, &compositeBlend, 1, NULL);
+
+    markCommandBuffersDirty(); // Cached command buffers may hold the particle draws
+    printf("Volume renderer created successfully (march at %ux%u%s)\n", extent.width, extent.height,
+           volumeHalfResolution ? " with temporal reprojection" : "");
+}
+
+// The 3D textures, cleared to the empty field the bricks are compared against, and the slot buffers
+static void createVolumeGrid()
+{
+    const SurfaceExtractor *extractor = &fluidExtractor;
+    uint32_t nodeCount = extractor->nodeDim[0] * extractor->nodeDim[1] * extractor->nodeDim[2];
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        volumeBrickDim[axis] = (extractor->nodeDim[axis] + VOLUME_BRICK_VOXELS - 1) / VOLUME_BRICK_VOXELS;
+    }
+
+    volumeBrickCount = volumeBrickDim[0] * volumeBrickDim[1] * volumeBrickDim[2];
+
+    VkExtent3D densityExtent = {extractor->nodeDim[0], extractor->nodeDim[1], extractor->nodeDim[2]};
+    VkExtent3D occupancyExtent = {volumeBrickDim[0], volumeBrickDim[1], volumeBrickDim[2]};
+
+    createFluidImage(&volumeDensity, VK_IMAGE_TYPE_3D, VK_FORMAT_R16_SFLOAT, densityExtent,
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+    createFluidImage(&volumeOccupancy, VK_IMAGE_TYPE_3D, VK_FORMAT_R16G16_SFLOAT, occupancyExtent,
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkImageMemoryBarrier barriers[2] = {};
+    VkImage images[2] = {volumeDensity.image, volumeOccupancy.image};
+
+    for (int i = 0; i < 2; i++)
+    {
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].srcAccessMask = 0;
+        barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barriers[i].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].image = images[i];
+        barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barriers[i].subresourceRange.levelCount = 1;
+        barriers[i].subresourceRange.layerCount = 1;
+    }
+
+    VkClearColorValue empty = {};
+    VkCommandBuffer setupBuffer = beginSingleTimeCommands();
+
+    vkCmdPipelineBarrier(setupBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 2, barriers);
+    vkCmdClearColorImage(setupBuffer, volumeDensity.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &empty, 1, &barriers[0].subresourceRange);
+    vkCmdClearColorImage(setupBuffer, volumeOccupancy.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &empty, 1, &barriers[1].subresourceRange);
+
+    for (int i = 0; i < 2; i++)
+    {
+        barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barriers[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+
+    vkCmdPipelineBarrier(setupBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 2, barriers);
+    endSingleTimeCommands(setupBuffer);
+
+    volumeUploadedField = calloc(nodeCount, sizeof(float));
+    volumeUploadedOccupancy = calloc(volumeBrickCount, sizeof(uint32_t));
+    volumeBrickChanged = calloc(volumeBrickCount, 1);
+    volumeOccupancyChanged = calloc(volumeBrickCount, 1);
+
+    if (!volumeUploadedField || !volumeUploadedOccupancy || !volumeBrickChanged || !volumeOccupancyChanged)
+    {
+        fprintf(stderr, "Failed to allocate volume brick memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDeviceSize stagingSize = (VkDeviceSize)volumeBrickCount * (VOLUME_BRICK_BYTES + sizeof(uint32_t));
+
+    for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+    {
+        VolumeSlot *volumeSlot = &volumeSlots[slot];
+
+        createMappedBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &volumeSlot->stagingBuffer, &volumeSlot->stagingMemory, (void **)&volumeSlot->staging);
+        createMappedBuffer(sizeof(VolumeUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &volumeSlot->uniformBuffer, &volumeSlot->uniformMemory, (void **)&volumeSlot->uniforms);
+
+        volumeSlot->densityRegions = malloc(volumeBrickCount * sizeof(VkBufferImageCopy));
+        volumeSlot->occupancyRegions = malloc(volumeBrickCount * sizeof(VkBufferImageCopy));
+        volumeSlot->densityRegionCount = 0;
+        volumeSlot->occupancyRegionCount = 0;
+
+        if (!volumeSlot->densityRegions || !volumeSlot->occupancyRegions)
+        {
+            fprintf(stderr, "Failed to allocate volume upload regions!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        VkDescriptorBufferInfo bufferInfo = {};
+        bufferInfo.buffer = volumeSlot->uniformBuffer;
+        bufferInfo.offset = 0;
+        bufferInfo.range = sizeof(VolumeUniforms);
+
+        VkWriteDescriptorSet write = {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = volumeSlot->marchSet;
+        write.dstBinding = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        write.pBufferInfo = &bufferInfo;
+
+        vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+
+        writeImageDescriptor(volumeSlot->marchSet, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &volumeDensity, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, volumeSampler);
+        writeImageDescriptor(volumeSlot->marchSet, 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &volumeOccupancy, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, volumeSampler);
+    }
+
+    markCommandBuffersDirty();
+    printf("Volume grid: %ux%ux%u voxels in %u bricks of %u^3\n", densityExtent.width, densityExtent.height, densityExtent.depth,
+           volumeBrickCount, VOLUME_BRICK_VOXELS);
+}
+
+// Round to nearest, values below the normal range of a half flush to zero
+static uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent <= 0)
+    {
+        return sign;
+    }
+
+    if (exponent >= 31)
+    {
+        return sign | 0x7bff; // Largest finite half
+    }
+
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+
+    // A carry out of the mantissa correctly moves to the next exponent
+    if (mantissa & 0x1000)
+    {
+        half++;
+    }
+
+    return sign | (uint16_t)(half < 0x7c00 ? half : 0x7bff);
+}
+
+static void volumeBrickRange(uint32_t brick, uint32_t begin[3], uint32_t end[3])
+{
+    uint32_t coordinates[3] = {
+        brick % volumeBrickDim[0],
+        brick / volumeBrickDim[0] % volumeBrickDim[1],
+        brick / (volumeBrickDim[0] * volumeBrickDim[1])};
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        begin[axis] = coordinates[axis] * VOLUME_BRICK_VOXELS;
+        end[axis] = begin[axis] + VOLUME_BRICK_VOXELS < fluidExtractor.nodeDim[axis] ? begin[axis] + VOLUME_BRICK_VOXELS : fluidExtractor.nodeDim[axis];
+    }
+}
+
+// Thread pool task: a brick whose field moved beyond the threshold is packed into the staging buffer
+static void updateVolumeBrick(void *context, uint32_t brick, uint32_t threadIndex)
+{
+    (void)context;
+    (void)threadIndex;
+
+    const SurfaceExtractor *extractor = &fluidExtractor;
+    uint32_t begin[3];
+    uint32_t end[3];
+    int changed = 0;
+
+    volumeBrickRange(brick, begin, end);
+
+    for (uint32_t z = begin[2]; z < end[2] && !changed; z++)
+    {
+        for (uint32_t y = begin[1]; y < end[1] && !changed; y++)
+        {
+            for (uint32_t x = begin[0]; x < end[0]; x++)
+            {
+                uint32_t node = x + extractor->nodeDim[0] * (y + extractor->nodeDim[1] * z);
+
+                if (fabsf(extractor->field[node] - volumeUploadedField[node]) > fluidMeshThreshold)
+                {
+                    changed = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    volumeBrickChanged[brick] = (uint8_t)changed;
+
+    if (!changed)
+    {
+        return;
+    }
+
+    // Packed as a full brick, the copy of a brick at the far faces only reads its part of every row
+    uint16_t *packed = (uint16_t *)(volumeUploadSlot->staging + (size_t)brick * VOLUME_BRICK_BYTES);
+
+    for (uint32_t z = begin[2]; z < end[2]; z++)
+    {
+        for (uint32_t y = begin[1]; y < end[1]; y++)
+        {
+            for (uint32_t x = begin[0]; x < end[0]; x++)
+            {
+                uint32_t node = x + extractor->nodeDim[0] * (y + extractor->nodeDim[1] * z);
+                uint32_t voxel = (x - begin[0]) + VOLUME_BRICK_VOXELS * ((y - begin[1]) + VOLUME_BRICK_VOXELS * (z - begin[2]));
+
+                packed[voxel] = floatToHalf(extractor->field[node]);
+                volumeUploadedField[node] = extractor->field[node];
+            }
+        }
+    }
+}
+
+// Thread pool task: the min and max of a brick cover the voxel around it, which trilinear samples
+// inside the brick also read. Only bricks next to a changed brick can have moved
+static void updateVolumeOccupancy(void *context, uint32_t brick, uint32_t threadIndex)
+{
+    (void)context;
+    (void)threadIndex;
+
+    const SurfaceExtractor *extractor = &fluidExtractor;
+    uint32_t begin[3];
+    uint32_t end[3];
+    int32_t coordinates[3] = {
+        (int32_t)(brick % volumeBrickDim[0]),
+        (int32_t)(brick / volumeBrickDim[0] % volumeBrickDim[1]),
+        (int32_t)(brick / (volumeBrickDim[0] * volumeBrickDim[1]))};
+    int neighborChanged = 0;
+
+    for (int32_t dz = -1; dz <= 1 && !neighborChanged; dz++)
+    {
+        for (int32_t dy = -1; dy <= 1 && !neighborChanged; dy++)
+        {
+            for (int32_t dx = -1; dx <= 1; dx++)
+            {
+                int32_t x = coordinates[0] + dx;
+                int32_t y = coordinates[1] + dy;
+                int32_t z = coordinates[2] + dz;
+
+                if (x >= 0 && y >= 0 && z >= 0 && x < (int32_t)volumeBrickDim[0] && y < (int32_t)volumeBrickDim[1] && z < (int32_t)volumeBrickDim[2] &&
+                    volumeBrickChanged[x + volumeBrickDim[0] * (y + volumeBrickDim[1] * z)])
+                {
+                    neighborChanged = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    volumeOccupancyChanged[brick] = 0;
+
+    if (!neighborChanged)
+    {
+        return;
+    }
+
+    volumeBrickRange(brick, begin, end);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        begin[axis] = begin[axis] > 0 ? begin[axis] - 1 : 0;
+        end[axis] = end[axis] < extractor->nodeDim[axis] ? end[axis] + 1 : end[axis];
+    }
+
+    float minimum = INFINITY;
+    float maximum = -INFINITY;
+
+    for (uint32_t z = begin[2]; z < end[2]; z++)
+    {
+        for (uint32_t y = begin[1]; y < end[1]; y++)
+        {
+            for (uint32_t x = begin[0]; x < end[0]; x++)
+            {
+                float value = volumeUploadedField[x + extractor->nodeDim[0] * (y + extractor->nodeDim[1] * z)];
+
+                minimum = value < minimum ? value : minimum;
+                maximum = value > maximum ? value : maximum;
+            }
+        }
+    }
+
+    uint32_t texel = (uint32_t)floatToHalf(minimum) | (uint32_t)floatToHalf(maximum) << 16;
+
+    if (texel != volumeUploadedOccupancy[brick])
+    {
+        uint8_t *occupancy = volumeUploadSlot->staging + (size_t)volumeBrickCount * VOLUME_BRICK_BYTES;
+
+        memcpy(occupancy + (size_t)brick * sizeof(uint32_t), &texel, sizeof(texel));
+        volumeUploadedOccupancy[brick] = texel;
+        volumeOccupancyChanged[brick] = 1;
+    }
+}
+
+static void prepareVolumeFrame(uint64_t frame)
+{
+    VolumeSlot *volumeSlot = &volumeSlots[frame % RECORD_FRAME_SLOTS];
+
+    volumeUploadSlot = volumeSlot;
+    threadPoolRun(updateVolumeBrick, NULL, volumeBrickCount);
+    threadPoolRun(updateVolumeOccupancy, NULL, volumeBrickCount);
+
+    volumeSlot->densityRegionCount = 0;
+    volumeSlot->occupancyRegionCount = 0;
+
+    for (uint32_t brick = 0; brick < volumeBrickCount; brick++)
+    {
+        uint32_t begin[3];
+        uint32_t end[3];
+
+        volumeBrickRange(brick, begin, end);
+
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+
+        if (volumeBrickChanged[brick])
+        {
+            region.bufferOffset = (VkDeviceSize)brick * VOLUME_BRICK_BYTES;
+            region.bufferRowLength = VOLUME_BRICK_VOXELS;
+            region.bufferImageHeight = VOLUME_BRICK_VOXELS;
+            region.imageOffset = (VkOffset3D){(int32_t)begin[0], (int32_t)begin[1], (int32_t)begin[2]};
+            region.imageExtent = (VkExtent3D){end[0] - begin[0], end[1] - begin[1], end[2] - begin[2]};
+            volumeSlot->densityRegions[volumeSlot->densityRegionCount++] = region;
+        }
+
+        if (volumeOccupancyChanged[brick])
+        {
+            region.bufferOffset = (VkDeviceSize)volumeBrickCount * VOLUME_BRICK_BYTES + (VkDeviceSize)brick * sizeof(uint32_t);
+            region.bufferRowLength = 0;
+            region.bufferImageHeight = 0;
+            region.imageOffset = (VkOffset3D){(int32_t)(begin[0] / VOLUME_BRICK_VOXELS), (int32_t)(begin[1] / VOLUME_BRICK_VOXELS), (int32_t)(begin[2] / VOLUME_BRICK_VOXELS)};
+            region.imageExtent = (VkExtent3D){1, 1, 1};
+            volumeSlot->occupancyRegions[volumeSlot->occupancyRegionCount++] = region;
+        }
+    }
+
+    volumeUploadedBricks += volumeSlot->densityRegionCount;
+    volumeUploadFrames++;
+
+    // The copies are recorded into the command buffer, a cached one would replay another frame's
+    // bricks. The first frame without uploads is recorded again to drop them
+    int uploads = volumeSlot->densityRegionCount + volumeSlot->occupancyRegionCount > 0;
+
+    if (uploads || volumeUploadsPending)
+    {
+        markCommandBuffersDirty();
+    }
+
+    volumeUploadsPending = uploads;
+
+    const SurfaceExtractor *extractor = &fluidExtractor;
+    VolumeUniforms *uniforms = volumeSlot->uniforms;
+    float aspect = (float)swapChainExtent.width / (float)swapChainExtent.height;
+    float viewProjection[16];
+
+    cameraViewProjection(&camera, aspect, viewProjection);
+    cameraInverseViewProjection(&camera, aspect, uniforms->inverseViewProjection);
+    memcpy(uniforms->previousViewProjection, volumeHistoryValid ? volumePreviousViewProjection : viewProjection, sizeof(viewProjection));
+    memcpy(volumePreviousViewProjection, viewProjection, sizeof(viewProjection));
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        uniforms->eye[axis] = camera.eye[axis];
+        uniforms->grid[axis] = extractor->origin[axis];
+        uniforms->gridSize[axis] = (float)extractor->nodeDim[axis];
+    }
+
+    uniforms->eye[3] = (float)(frame % 1024);
+    uniforms->grid[3] = extractor->cellSize;
+    uniforms->gridSize[3] = (float)VOLUME_BRICK_VOXELS;
+    uniforms->shading[0] = VOLUME_EXTINCTION;
+    uniforms->shading[1] = VOLUME_EMPTY_DENSITY;
+    uniforms->shading[2] = volumeHalfResolution && volumeHistoryValid ? VOLUME_HISTORY_WEIGHT : 0.0f;
+    uniforms->shading[3] = VOLUME_STEP_VOXELS;
+    uniforms->screen[0] = (float)volumeTargets[0].extent.width;
+    uniforms->screen[1] = (float)volumeTargets[0].extent.height;
+
+    volumeHistoryValid = 1;
+}
+
+void recordVolumePasses(VkCommandBuffer commandBuffer)
+{
+    const VolumeSlot *volumeSlot = &volumeSlots[currentFrame % RECORD_FRAME_SLOTS];
+
+    if (volumeSlot->densityRegionCount + volumeSlot->occupancyRegionCount > 0)
+    {
+        VkImageMemoryBarrier barriers[2] = {};
+        VkImage images[2] = {volumeDensity.image, volumeOccupancy.image};
+
+        // The previous frame's march read the textures
+        for (int i = 0; i < 2; i++)
+        {
+            barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barriers[i].srcAccessMask = 0;
+            barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].image = images[i];
+            barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            barriers[i].subresourceRange.levelCount = 1;
+            barriers[i].subresourceRange.layerCount = 1;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 2, barriers);
+
+        if (volumeSlot->densityRegionCount > 0)
+        {
+            vkCmdCopyBufferToImage(commandBuffer, volumeSlot->stagingBuffer, volumeDensity.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   volumeSlot->densityRegionCount, volumeSlot->densityRegions);
+        }
+
+        if (volumeSlot->occupancyRegionCount > 0)
+        {
+            vkCmdCopyBufferToImage(commandBuffer, volumeSlot->stagingBuffer, volumeOccupancy.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   volumeSlot->occupancyRegionCount, volumeSlot->occupancyRegions);
+        }
+
+        for (int i = 0; i < 2; i++)
+        {
+            barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 2, barriers);
+    }
+
+    // An earlier frame's composite read the target this frame writes
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+    VkExtent2D extent = volumeTargets[0].extent;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, volumeMarchPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, volumeMarchLayout, 0, 1, &volumeSlot->marchSet, 0, NULL);
+    vkCmdDispatch(commandBuffer,
+                  (extent.width + VOLUME_MARCH_GROUP_SIZE - 1) / VOLUME_MARCH_GROUP_SIZE,
+                  (extent.height + VOLUME_MARCH_GROUP_SIZE - 1) / VOLUME_MARCH_GROUP_SIZE, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+void recordVolumeComposite(VkCommandBuffer commandBuffer, const void *data)
+{
+    (void)data;
+
+    const VolumeSlot *volumeSlot = &volumeSlots[currentFrame % RECORD_FRAME_SLOTS];
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, volumeCompositePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, volumeCompositeLayout, 0, 1, &volumeSlot->compositeSet, 0, NULL);
+
+    // Fullscreen triangle, the vertex shader generates the positions
+    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
+
+static void destroyVolume()
+{
+    if (volumeMarchPipeline == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    if (volumeBrickCount > 0)
+    {
+        printf("Volume uploads: %llu bricks over %llu frames, %.1f%% of uploading the whole field\n",
+               (unsigned long long)volumeUploadedBricks, (unsigned long long)volumeUploadFrames,
+               volumeUploadFrames > 0 ? 100.0 * (double)volumeUploadedBricks / ((double)volumeUploadFrames * volumeBrickCount) : 0.0);
+
+        for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+        {
+            destroyMappedBuffer(&volumeSlots[slot].stagingBuffer, &volumeSlots[slot].stagingMemory);
+            destroyMappedBuffer(&volumeSlots[slot].uniformBuffer, &volumeSlots[slot].uniformMemory);
+            free(volumeSlots[slot].densityRegions);
+            free(volumeSlots[slot].occupancyRegions);
+        }
+
+        destroyFluidTarget(&volumeDensity);
+        destroyFluidTarget(&volumeOccupancy);
+
+        free(volumeUploadedField);
+        free(volumeUploadedOccupancy);
+        free(volumeBrickChanged);
+        free(volumeOccupancyChanged);
+        volumeBrickCount = 0;
+    }
+
+    vkDestroyPipeline(device, volumeMarchPipeline, NULL);
+    vkDestroyPipeline(device, volumeCompositePipeline, NULL);
+    vkDestroyPipelineLayout(device, volumeMarchLayout, NULL);
+    vkDestroyPipelineLayout(device, volumeCompositeLayout, NULL);
+    volumeMarchPipeline = VK_NULL_HANDLE;
+
+    vkDestroyDescriptorPool(device, volumeDescriptorPool, NULL); // Also frees the descriptor sets
+    vkDestroyDescriptorSetLayout(device, volumeMarchSetLayout, NULL);
+    vkDestroyDescriptorSetLayout(device, volumeCompositeSetLayout, NULL);
+    vkDestroySampler(device, volumeSampler, NULL);
+
+    for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+    {
+        destroyFluidTarget(&volumeTargets[slot]);
+    }
+
+    printf("Destroyed volume renderer\n");
+}
+
+void createFluidRenderer()
+{
+    if (renderMode == RENDER_MODE_VOLUME)
+    {
+        createVolumeRenderer();
+        return;
+    }
+
+    if (renderMode == RENDER_MODE_MESH)
+    {
+        createFluidMeshResources();
+
+        markCommandBuffersDirty();
+        printf("Fluid mesh renderer created successfully\n");
+        return;
+    }
+
+    VkFormat depthFormat = findDepthFormat();
+
+    createFluidTargets(depthFormat);
+    createFluidSplatPass(depthFormat);
+    createFluidDescriptors();
+    createFluidPipelines();
+
+    markCommandBuffersDirty(); // Cached command buffers may hold the particle draws
+    printf("Fluid renderer created successfully (depth filter at %ux%u)\n",
+           fluidTargets[FLUID_TARGET_FILTERED].extent.width, fluidTargets[FLUID_TARGET_FILTERED].extent.height);
+}
+
+static void updateFluidUniforms(VkCommandBuffer commandBuffer)
+{
+    float aspect = (float)swapChainExtent.width / (float)swapChainExtent.height;
+
+    cameraView(&camera, fluidUniforms.view);
+    cameraProjection(&camera, aspect, fluidUniforms.projection);
+
+    fluidUniforms.screen[0] = (float)swapChainExtent.width;
+    fluidUniforms.screen[1] = (float)swapChainExtent.height;
+    fluidUniforms.screen[2] = (float)fluidTargets[FLUID_TARGET_FILTERED].extent.width;
+    fluidUniforms.screen[3] = (float)fluidTargets[FLUID_TARGET_FILTERED].extent.height;
+
+    // Smooth over a few particles, but keep depth steps larger than a particle as edges
+    fluidUniforms.particle[0] = fluidParticleRadius;
+    fluidUniforms.particle[1] = 3.0f * fluidParticleRadius;
+    fluidUniforms.particle[2] = 2.0f * fluidParticleRadius;
+    fluidUniforms.particle[3] = 1.0f;
+
+    // Light thins out over about ten overlapping particles, red first
+    float absorptionScale = 1.0f / (10.0f * fluidParticleRadius);
+    fluidUniforms.absorption[0] = 0.6f * absorptionScale;
+    fluidUniforms.absorption[1] = 0.2f * absorptionScale;
+    fluidUniforms.absorption[2] = 0.05f * absorptionScale;
+
+    fluidUniforms.color[0] = 0.1f;
+    fluidUniforms.color[1] = 0.35f;
+    fluidUniforms.color[2] = 0.9f;
+
+    fluidUniforms.light[0] = 0.3f;
+    fluidUniforms.light[1] = 0.8f;
+    fluidUniforms.light[2] = 0.5f;
+
+    fluidUniforms.vertices[0] = gpuCulling ? 1.0f : 0.0f;
+
+    // The previous frame is done (inFlightFence), the barrier orders the update against this frame's reads
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, shaderStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+    vkCmdUpdateBuffer(commandBuffer, fluidUniformBuffer, 0, sizeof(FluidUniforms), &fluidUniforms);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, shaderStages, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+static void dispatchFluidFilter(VkCommandBuffer commandBuffer, uint32_t pass, int32_t sourceStride)
+{
+    FluidFilterPushConstants pushConstants = {};
+    pushConstants.direction[0] = pass == 0 ? 1 : 0;
+    pushConstants.direction[1] = pass == 0 ? 0 : 1;
+    pushConstants.sourceStride = sourceStride;
+    pushConstants.maxRadius = FLUID_FILTER_MAX_RADIUS;
+    pushConstants.images[0] = fluidFilterHandles[pass];
+    pushConstants.images[1] = fluidFilterHandles[pass + 1];
+
+    VkExtent2D extent = fluidTargets[FLUID_TARGET_FILTERED].extent;
+
+    // With the heap both passes share the set bound by recordFluidPasses(), only the handles change
+    if (!descriptorHeapSupported)
+    {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fluidFilterLayout, 1, 1, &fluidFilterSets[pass], 0, NULL);
+    }
+
+    vkCmdPushConstants(commandBuffer, fluidFilterLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer,
+                  (extent.width + FLUID_FILTER_GROUP_SIZE - 1) / FLUID_FILTER_GROUP_SIZE,
+                  (extent.height + FLUID_FILTER_GROUP_SIZE - 1) / FLUID_FILTER_GROUP_SIZE, 1);
+}
+
+// With GPU culling the particle buffer only holds the visible blocks, drawn by their indirect commands
+static void drawFluidParticles(VkCommandBuffer commandBuffer, uint32_t particleCount)
+{
+    if (gpuCulling)
+    {
+        recordCulledDraw(commandBuffer, currentFrame);
+    }
+    else
+    {
+        vkCmdDraw(commandBuffer, particleCount, 1, 0, 0);
+    }
+}
+
+void recordFluidPasses(VkCommandBuffer commandBuffer, VkBuffer particleBuffer, uint32_t particleCount)
+{
+    updateFluidUniforms(commandBuffer);
+
+    // Splat pass: nearest sphere depth and accumulated thickness
+    VkClearValue clearValues[3] = {};
+    clearValues[2].depthStencil.depth = 1.0f;
+
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = fluidSplatPass;
+    renderPassInfo.framebuffer = fluidSplatFramebuffer;
+    renderPassInfo.renderArea.extent = swapChainExtent;
+    renderPassInfo.clearValueCount = 3;
+    renderPassInfo.pClearValues = clearValues;
+
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    VkViewport viewport = {};
+    viewport.width = (float)swapChainExtent.width;
+    viewport.height = (float)swapChainExtent.height;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.extent = swapChainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &particleBuffer, offsets);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, fluidSplatLayout, 0, 1, &fluidUniformSet, 0, NULL);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, fluidDepthPipeline);
+    drawFluidParticles(commandBuffer, particleCount);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, fluidThicknessPipeline);
+    drawFluidParticles(commandBuffer, particleCount);
+
+    vkCmdEndRenderPass(commandBuffer);
+
+    // The previous frame read the filter targets in its composite pass
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fluidFilterPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fluidFilterLayout, 0, 1, &fluidUniformSet, 0, NULL);
+
+    if (descriptorHeapSupported)
+    {
+        descriptorHeapBind(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, fluidFilterLayout, 1);
+    }
+
+    // The horizontal pass also does the downsample, the vertical one already runs at filter resolution
+    dispatchFluidFilter(commandBuffer, 0, fluidHalfResolution ? 2 : 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+    dispatchFluidFilter(commandBuffer, 1, 1);
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+void recordFluidComposite(VkCommandBuffer commandBuffer, const void *data)
+{
+    (void)data;
+
+    VkDescriptorSet sets[2] = {fluidUniformSet, fluidCompositeSet};
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, fluidCompositePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, fluidCompositeLayout, 0, 2, sets, 0, NULL);
+
+    // Fullscreen triangle, the vertex shader generates the positions
+    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
+
+void fluidMeshInit(const SphParams *params)
+{
+    surfaceExtractorInit(&fluidExtractor, params, 0.0f, fluidMeshThreshold);
+
+    fluidMeshPositions = malloc((size_t)sphGpuParticleCount * 4 * sizeof(float));
+
+    if (!fluidMeshPositions)
+    {
+        fprintf(stderr, "Failed to allocate mesh particle memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fluidExtractorReady = 1;
+
+    if (renderMode == RENDER_MODE_VOLUME)
+    {
+        createVolumeGrid();
+    }
+}
+
+void prepareFluidFrame(uint64_t frame)
+{
+    if ((renderMode != RENDER_MODE_MESH && renderMode != RENDER_MODE_VOLUME) || !fluidExtractorReady)
+    {
+        return;
+    }
+
+    sphGpuReadRenderPositions(frame, fluidMeshPositions);
+    surfaceExtractorBuildField(&fluidExtractor, fluidMeshPositions, sphGpuParticleCount, 4);
+
+    if (renderMode == RENDER_MODE_VOLUME)
+    {
+        prepareVolumeFrame(frame);
+        return;
+    }
+
+    if (surfaceExtractorUpdate(&fluidExtractor) > 0 || fluidMeshVersion == 0)
+    {
+        fluidMeshVersion++;
+    }
+
+    // The previous frame that drew this slot has finished, its buffers can be rewritten
+    FluidMeshSlot *meshSlot = &fluidMeshSlots[frame % RECORD_FRAME_SLOTS];
+    const SurfaceMesh *mesh = &fluidExtractor.mesh;
+
+    if (meshSlot->version != fluidMeshVersion)
+    {
+        VkDeviceSize vertexSize = (VkDeviceSize)mesh->vertexCount * sizeof(SurfaceVertex);
+        VkDeviceSize indexSize = (VkDeviceSize)mesh->indexCount * sizeof(uint32_t);
+
+        reserveMeshBuffer(&meshSlot->vertexBuffer, &meshSlot->vertexMemory, &meshSlot->vertexMapped, &meshSlot->vertexCapacity, vertexSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        reserveMeshBuffer(&meshSlot->indexBuffer, &meshSlot->indexMemory, &meshSlot->indexMapped, &meshSlot->indexCapacity, indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+        memcpy(meshSlot->vertexMapped, mesh->vertices, (size_t)vertexSize);
+        memcpy(meshSlot->indexMapped, mesh->indices, (size_t)indexSize);
+        meshSlot->indirect->indexCount = mesh->indexCount;
+        meshSlot->version = fluidMeshVersion;
+    }
+
+    if (fluidMeshOutput != NULL)
+    {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/mesh_%06llu.ply", fluidMeshOutput, (unsigned long long)frame);
+
+        if (!surfaceMeshWritePly(mesh, path))
+        {
+            fprintf(stderr, "Failed to write %s\n", path);
+        }
+    }
+}
+
+void recordFluidMesh(VkCommandBuffer commandBuffer, const void *data)
+{
+    (void)data;
+
+    const FluidMeshSlot *meshSlot = &fluidMeshSlots[currentFrame % RECORD_FRAME_SLOTS];
+
+    FluidMeshPushConstants pushConstants = {};
+    cameraViewProjection(&camera, (float)swapChainExtent.width / (float)swapChainExtent.height, pushConstants.viewProjection);
+    pushConstants.eye[0] = camera.eye[0];
+    pushConstants.eye[1] = camera.eye[1];
+    pushConstants.eye[2] = camera.eye[2];
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, fluidMeshPipeline);
+    vkCmdPushConstants(commandBuffer, fluidMeshLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &meshSlot->vertexBuffer, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, meshSlot->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+    // The index count is read from the indirect buffer when the frame executes
+    vkCmdDrawIndexedIndirect(commandBuffer, meshSlot->indirectBuffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+static void destroyFluidMesh()
+{
+    if (fluidExtractorReady)
+    {
+        surfaceExtractorDestroy(&fluidExtractor);
+        free(fluidMeshPositions);
+        fluidMeshPositions = NULL;
+        fluidExtractorReady = 0;
+    }
+
+    if (fluidMeshPipeline == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    for (uint32_t slot = 0; slot < RECORD_FRAME_SLOTS; slot++)
+    {
+        FluidMeshSlot *meshSlot = &fluidMeshSlots[slot];
+
+        destroyMappedBuffer(&meshSlot->vertexBuffer, &meshSlot->vertexMemory);
+        destroyMappedBuffer(&meshSlot->indexBuffer, &meshSlot->indexMemory);
+        destroyMappedBuffer(&meshSlot->indirectBuffer, &meshSlot->indirectMemory);
+    }
+
+    vkDestroyPipeline(device, fluidMeshPipeline, NULL);
+    vkDestroyPipelineLayout(device, fluidMeshLayout, NULL);
+    fluidMeshPipeline = VK_NULL_HANDLE;
+
+    printf("Destroyed fluid mesh renderer\n");
+}
+
+void destroyFluidRenderer()
+{
+    destroyVolume();
+    destroyFluidMesh();
+
+    if (fluidSplatPass == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    vkDestroyPipeline(device, fluidDepthPipeline, NULL);
+    vkDestroyPipeline(device, fluidThicknessPipeline, NULL);
+    vkDestroyPipeline(device, fluidFilterPipeline, NULL);
+    vkDestroyPipeline(device, fluidCompositePipeline, NULL);
+
+    vkDestroyPipelineLayout(device, fluidSplatLayout, NULL);
+    vkDestroyPipelineLayout(device, fluidFilterLayout, NULL);
+    vkDestroyPipelineLayout(device, fluidCompositeLayout, NULL);
+
+    vkDestroyDescriptorPool(device, fluidDescriptorPool, NULL); // Also frees the descriptor sets
+    vkDestroyDescriptorSetLayout(device, fluidUniformSetLayout, NULL);
+    vkDestroyDescriptorSetLayout(device, fluidFilterSetLayout, NULL);
+    vkDestroyDescriptorSetLayout(device, fluidCompositeSetLayout, NULL);
+    vkDestroySampler(device, fluidSampler, NULL);
+
+    vkDestroyBuffer(device, fluidUniformBuffer, NULL);
+    vkFreeMemory(device, fluidUniformMemory, NULL);
+
+    for (int i = 0; i < 3; i++)
+    {
+        descriptorHeapRemoveImage(fluidFilterHandles[i]);
+        fluidFilterHandles[i] = DESCRIPTOR_HANDLE_NONE;
+    }
+
+    vkDestroyFramebuffer(device, fluidSplatFramebuffer, NULL);
+    vkDestroyRenderPass(device, fluidSplatPass, NULL);
+    fluidSplatPass = VK_NULL_HANDLE;
+
+    for (int i = 0; i < FLUID_TARGET_COUNT; i++)
+    {
+        destroyFluidTarget(&fluidTargets[i]);
+    }
+
+    printf("Destroyed fluid renderer\n");
+}
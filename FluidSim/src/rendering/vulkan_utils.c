@@ -1,14 +1,32 @@
 #include "vulkan_utils.h"
+#include "sph_gpu.h"
+#include "camera.h"
+#include "offscreen.h"
+#include "parallel_recording.h"
+#include "thread_pool.h"
+#include "renderer.h"
+#include "gpu_culling.h"
+#include "metrics.h"
+#include "frame_pacing.h"
+#include "descriptor_heap.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 
 VkInstance instance = VK_NULL_HANDLE;
 VkSurfaceKHR surface = VK_NULL_HANDLE;
 VkDevice device = VK_NULL_HANDLE;
 VkQueue graphicsQueue = VK_NULL_HANDLE;
 VkQueue presentQueue = VK_NULL_HANDLE;
+VkQueue computeQueue = VK_NULL_HANDLE;
+VkQueue transferQueue = VK_NULL_HANDLE;
 VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 QueueFamilyIndices indices;
+const char *gpuOverride = NULL;
+
+int headlessMode = 0;                     // Render into offscreen images, no window, surface or swapchain
+VkExtent2D offscreenExtent = {1920, 1080}; // Size of the offscreen images
 
 VkSwapchainKHR swapChain = VK_NULL_HANDLE;
 VkFormat swapChainImageFormat;
@@ -27,13 +45,36 @@ VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
 VkPipeline graphicsPipeline = VK_NULL_HANDLE;
 
 VkFramebuffer *swapChainFramebuffers = NULL;
+
+// Depth buffer of the main render pass, only created when it draws the surface mesh
+static VkImage depthImage = VK_NULL_HANDLE;
+static VkDeviceMemory depthImageMemory = VK_NULL_HANDLE;
+static VkImageView depthImageView = VK_NULL_HANDLE;
+static VkFormat depthImageFormat = VK_FORMAT_UNDEFINED;
 VkCommandPool commandPool = VK_NULL_HANDLE;
+VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+VkCommandPool transferCommandPool = VK_NULL_HANDLE;
 VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
 
+// Pre-recorded frame command buffers, one per swapchain image and frame slot (the frame slot picks
+// the simulation render buffer). An entry is re-recorded when its generation falls behind.
+int cacheCommandBuffers = 0;
+static VkCommandBuffer *cachedCommandBuffers = NULL; // [imageIndex * RECORD_FRAME_SLOTS + slot]
+static uint64_t *cachedGenerations = NULL;
+static uint64_t commandBufferGeneration = 1;
+
+float particlePointSize = 4.0f;
+int drawIndirectCountSupported = 0;
+
 VkSemaphore imageAvailableSemaphore;
 VkSemaphore renderFinishedSemaphore;
 VkFence inFlightFence;
 
+// Timeline semaphores between the compute (simulation) and graphics queues
+VkSemaphore simulationTimeline = VK_NULL_HANDLE; // Value = last finished simulation batch
+VkSemaphore renderTimeline = VK_NULL_HANDLE;     // Value = last finished frame
+uint64_t currentFrame = 0;                       // Frame being recorded, also the simulation batch it draws
+
 const int enableValidationLayers = 1; // Turn off for release
 
 unsigned int logicalDeviceExtensionCount = 1;
@@ -89,13 +130,18 @@ void baseSetupVulkan(SDL_Window *window)
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "Custom Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = VK_API_VERSION_1_2; // Timeline semaphores are core in 1.2
 
     unsigned int extensionCount = 0;
+    const char *const *extensions = NULL;
 
-    const char *const *extensions = SDL_Vulkan_GetInstanceExtensions(&extensionCount);
+    // Without a window there is no surface, so no instance extension is needed
+    if (!headlessMode)
+    {
+        extensions = SDL_Vulkan_GetInstanceExtensions(&extensionCount);
+    }
 
-    if (extensionCount == 0 || !extensions)
+    if (!headlessMode && (extensionCount == 0 || !extensions))
     {
         printf("Failed to get required Vulkan extensions: %s\n", SDL_GetError());
         exit(EXIT_FAILURE);
@@ -142,6 +188,8 @@ int isDeviceCompatible(VkPhysicalDevice device)
     // Reset indices
     indices.graphicsFamily = -1;
     indices.presentFamily = -1;
+    indices.computeFamily = -1;
+    indices.transferFamily = -1;
 
     // Find queue families
     indices = findQueueFamilies(device);
@@ -158,19 +206,31 @@ int isDeviceCompatible(VkPhysicalDevice device)
 
     printf("Testing GPU: %s\n", deviceProperties.deviceName);
 
-    if (deviceProperties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+    // Any device type is accepted (integrated GPUs, lavapipe...), rateDevice() ranks them
+
+    // The simulation and graphics queues are synchronized with timeline semaphores
+    if (deviceProperties.apiVersion < VK_API_VERSION_1_2)
     {
-        return 0; // Device is not a disrete GPU
+        return 0;
     }
 
-    // Query device features
-    VkPhysicalDeviceFeatures deviceFeatures;
-    vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+
+    VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+    deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures2.pNext = &vulkan12Features;
+    vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+
+    if (!vulkan12Features.timelineSemaphore)
+    {
+        return 0;
+    }
 
-    // Ensure the device supports necessary features
-    if (!deviceFeatures.geometryShader)
+    // Nothing is presented in headless mode, the swapchain requirements do not apply
+    if (headlessMode)
     {
-        return 0; // Geometry shader support is mandatory
+        return 1;
     }
 
     // Check for required extensions
@@ -223,6 +283,107 @@ int isDeviceCompatible(VkPhysicalDevice device)
     return 1; // Compatible
 }
 
+// Ranks a compatible device, the higher the better. The device type dominates, the memory
+// bonus is capped below the gap between two types so a large shared heap on an integrated
+// GPU never beats a discrete one. Returns -1 for devices we cannot run on.
+int rateDevice(VkPhysicalDevice device)
+{
+    if (!isDeviceCompatible(device))
+    {
+        return -1;
+    }
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(device, &deviceProperties);
+
+    int score = 0;
+
+    switch (deviceProperties.deviceType)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        score += 8000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        score += 6000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        score += 4000;
+        break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        score += 2000;
+        break;
+    default:
+        break;
+    }
+
+    // 100 points per GiB of the largest device local heap, up to 16 GiB
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+
+    VkDeviceSize largestHeap = 0;
+
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        if ((memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && memoryProperties.memoryHeaps[i].size > largestHeap)
+        {
+            largestHeap = memoryProperties.memoryHeaps[i].size;
+        }
+    }
+
+    VkDeviceSize heapGiB = largestHeap >> 30;
+    score += (int)(heapGiB < 16 ? heapGiB : 16) * 100;
+
+    // isDeviceCompatible() left the queue families of this device in indices
+    if (indices.computeFamily != indices.graphicsFamily)
+    {
+        score += 500; // Simulation runs on its own hardware queue
+    }
+    else if (indices.computeQueueIndex != 0)
+    {
+        score += 200; // Second queue of the graphics family
+    }
+
+    if (indices.transferFamily != indices.graphicsFamily && indices.transferFamily != indices.computeFamily)
+    {
+        score += 100; // DMA engine for the uploads
+    }
+
+    // Optional features
+    VkPhysicalDeviceFeatures deviceFeatures;
+    vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+
+    if (deviceFeatures.largePoints)
+    {
+        score += 50;
+    }
+
+    return score;
+}
+
+// Case insensitive substring search, used to match --gpu against device names
+static int deviceNameMatches(const char *deviceName, const char *pattern)
+{
+    size_t nameLength = strlen(deviceName);
+    size_t patternLength = strlen(pattern);
+
+    for (size_t start = 0; start + patternLength <= nameLength; start++)
+    {
+        size_t i = 0;
+
+        while (i < patternLength && tolower((unsigned char)deviceName[start + i]) == tolower((unsigned char)pattern[i]))
+        {
+            i++;
+        }
+
+        if (i == patternLength)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 VkPhysicalDevice selectGPU(VkInstance instance)
 {
     uint32_t deviceCount = 0;
@@ -237,7 +398,16 @@ VkPhysicalDevice selectGPU(VkInstance instance)
     VkPhysicalDevice *devices = malloc(sizeof(VkPhysicalDevice) * deviceCount);
     vkEnumeratePhysicalDevices(instance, &deviceCount, devices);
 
+    // An override given with --gpu is either a device index or part of a device name
+    int overrideIndex = -1;
+
+    if (gpuOverride != NULL && gpuOverride[0] != '\0' && strspn(gpuOverride, "0123456789") == strlen(gpuOverride))
+    {
+        overrideIndex = atoi(gpuOverride);
+    }
+
     VkPhysicalDevice selectedDevice = VK_NULL_HANDLE;
+    int bestScore = -1;
 
     for (uint32_t i = 0; i < deviceCount; i++)
     {
@@ -247,12 +417,32 @@ VkPhysicalDevice selectGPU(VkInstance instance)
         VkPhysicalDeviceProperties deviceProperties;
         vkGetPhysicalDeviceProperties(device, &deviceProperties);
 
-        // Check for suitable device
-        if (isDeviceCompatible(device))
+        int score = rateDevice(device);
+
+        printf("GPU %u: %s, score %d%s\n", i, deviceProperties.deviceName, score, score < 0 ? " (unsupported)" : "");
+
+        if (gpuOverride != NULL)
+        {
+            int requested = overrideIndex >= 0 ? (uint32_t)overrideIndex == i : deviceNameMatches(deviceProperties.deviceName, gpuOverride);
+
+            // The first device matching the override wins, whatever its score
+            if (requested && selectedDevice == VK_NULL_HANDLE)
+            {
+                if (score < 0)
+                {
+                    fprintf(stderr, "GPU %u (%s) was requested but does not support the simulation!\n", i, deviceProperties.deviceName);
+                    free(devices);
+                    return VK_NULL_HANDLE;
+                }
+
+                selectedDevice = device;
+                bestScore = score;
+            }
+        }
+        else if (score > bestScore)
         {
-            printf("Selected GPU: %s\n", deviceProperties.deviceName);
             selectedDevice = device;
-            break; // Stop searching if we found a discrete GPU that supports a geometry shader
+            bestScore = score;
         }
     }
 
@@ -260,15 +450,31 @@ VkPhysicalDevice selectGPU(VkInstance instance)
 
     if (selectedDevice == VK_NULL_HANDLE)
     {
-        fprintf(stderr, "Failed to find a suitable GPU!\n");
+        if (gpuOverride != NULL)
+        {
+            fprintf(stderr, "No GPU matches \"%s\"!\n", gpuOverride);
+        }
+        else
+        {
+            fprintf(stderr, "Failed to find a suitable GPU!\n");
+        }
+
+        return VK_NULL_HANDLE;
     }
 
+    VkPhysicalDeviceProperties selectedProperties;
+    vkGetPhysicalDeviceProperties(selectedDevice, &selectedProperties);
+    printf("Selected GPU: %s (score %d)\n", selectedProperties.deviceName, bestScore);
+
+    // Rating every device overwrote the queue family indices, keep the ones of the selection
+    indices = findQueueFamilies(selectedDevice);
+
     return selectedDevice;
 }
 
 QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device)
 {
-    QueueFamilyIndices indices = {-1, -1}; // Explicitly set to invalid values
+    QueueFamilyIndices indices = {-1, -1, -1, -1, 0, 0}; // Explicitly set to invalid values
 
     uint32_t queueFamilyCount = 0;
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
@@ -278,70 +484,161 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device)
 
     for (int i = 0; i < queueFamilyCount; i++)
     {
-        if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+
+        if (flags & VK_QUEUE_GRAPHICS_BIT)
         {
             indices.graphicsFamily = i;
 
             VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+
+            if (surface != VK_NULL_HANDLE)
+            {
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            }
+            else
+            {
+                presentSupport = true; // Headless: the present queue is never used, alias the graphics one
+            }
 
             if (presentSupport)
             {
                 indices.presentFamily = i;
             }
         }
+
+        // Async compute: a compute family without graphics runs beside the graphics queue
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && indices.computeFamily == -1)
+        {
+            indices.computeFamily = i;
+        }
+
+        // Dedicated transfer family (DMA engine), neither graphics nor compute
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && indices.transferFamily == -1)
+        {
+            indices.transferFamily = i;
+        }
+    }
+
+    // Without dedicated families, fall back to extra queues of the graphics family, or share its queue
+    if (indices.graphicsFamily != -1)
+    {
+        uint32_t graphicsQueueCount = queueFamilies[indices.graphicsFamily].queueCount;
+        uint32_t nextQueue = 1;
+
+        if (indices.computeFamily == -1)
+        {
+            indices.computeFamily = indices.graphicsFamily;
+            indices.computeQueueIndex = nextQueue < graphicsQueueCount ? nextQueue++ : 0;
+        }
+
+        if (indices.transferFamily == -1)
+        {
+            indices.transferFamily = indices.graphicsFamily;
+            indices.transferQueueIndex = nextQueue < graphicsQueueCount ? nextQueue++ : 0;
+        }
     }
 
     free(queueFamilies);
 
-    printf("Indices: %d, %d\n", indices.graphicsFamily, indices.presentFamily);
+    printf("Indices: graphics %d, present %d, compute %d (queue %u), transfer %d (queue %u)\n",
+           indices.graphicsFamily, indices.presentFamily,
+           indices.computeFamily, indices.computeQueueIndex,
+           indices.transferFamily, indices.transferQueueIndex);
 
     return indices;
 }
 
-void createLogicalDevice()
+// Distinct queue families used by the device, the buffers shared between queues list them
+uint32_t getUniqueQueueFamilies(uint32_t families[4])
 {
+    int candidates[4] = {indices.graphicsFamily, indices.presentFamily, indices.computeFamily, indices.transferFamily};
+    uint32_t uniqueCount = 0;
 
-    int uniqueQueueFamilies[2];
-    int uniqueCount = 0;
-
-    if (indices.graphicsFamily != indices.presentFamily)
-    {
-        uniqueQueueFamilies[0] = indices.graphicsFamily;
-        uniqueQueueFamilies[1] = indices.presentFamily;
-        uniqueCount = 2;
-    }
-    else
+    for (int i = 0; i < 4; i++)
     {
-        uniqueQueueFamilies[0] = indices.graphicsFamily;
-        uniqueCount = 1;
+        int duplicate = 0;
+
+        for (uint32_t j = 0; j < uniqueCount; j++)
+        {
+            if (families[j] == (uint32_t)candidates[i])
+            {
+                duplicate = 1;
+                break;
+            }
+        }
+
+        if (!duplicate && candidates[i] != -1)
+        {
+            families[uniqueCount++] = (uint32_t)candidates[i];
+        }
     }
 
-    // Priority of the queue
-    float queuePriority = 1.0f;
+    return uniqueCount;
+}
+
+void createLogicalDevice()
+{
+    uint32_t uniqueQueueFamilies[4];
+    uint32_t uniqueCount = getUniqueQueueFamilies(uniqueQueueFamilies);
 
-    // Create queue info for every queue we have
-    VkDeviceQueueCreateInfo queueCreateInfos[2] = {};
+    // Priority of the queues, compute/transfer queues may live in the graphics family
+    float queuePriorities[3] = {1.0f, 1.0f, 1.0f};
 
-    for (int i = 0; i < uniqueCount; i++)
+    // Create queue info for every queue family we have
+    VkDeviceQueueCreateInfo queueCreateInfos[4] = {};
+
+    for (uint32_t i = 0; i < uniqueCount; i++)
     {
+        uint32_t queueCount = 1;
+
+        if ((uint32_t)indices.computeFamily == uniqueQueueFamilies[i] && indices.computeQueueIndex + 1 > queueCount)
+        {
+            queueCount = indices.computeQueueIndex + 1;
+        }
+
+        if ((uint32_t)indices.transferFamily == uniqueQueueFamilies[i] && indices.transferQueueIndex + 1 > queueCount)
+        {
+            queueCount = indices.transferQueueIndex + 1;
+        }
+
         queueCreateInfos[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueCreateInfos[i].queueFamilyIndex = uniqueQueueFamilies[i];
-        queueCreateInfos[i].queueCount = 1;
-        queueCreateInfos[i].pQueuePriorities = &queuePriority;
+        queueCreateInfos[i].queueCount = queueCount;
+        queueCreateInfos[i].pQueuePriorities = queuePriorities;
     }
 
     // Features of the device
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
     VkPhysicalDeviceFeatures deviceFeatures = {};
+    deviceFeatures.largePoints = supportedFeatures.largePoints; // Particle sprites bigger than one pixel
+
+    VkPhysicalDeviceVulkan12Features supported12Features = {};
+    supported12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+
+    VkPhysicalDeviceFeatures2 supportedFeatures2 = {};
+    supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supportedFeatures2.pNext = &supported12Features;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+    vulkan12Features.timelineSemaphore = VK_TRUE;
+    vulkan12Features.drawIndirectCount = supported12Features.drawIndirectCount; // Culled draws skip the empty commands
+    drawIndirectCountSupported = supported12Features.drawIndirectCount;
+    descriptorHeapEnableFeatures(&supportedFeatures, &supported12Features, &deviceFeatures, &vulkan12Features);
 
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = &vulkan12Features;
     createInfo.pQueueCreateInfos = queueCreateInfos;
     createInfo.queueCreateInfoCount = uniqueCount;
     createInfo.pEnabledFeatures = &deviceFeatures;
 
     // Extensions needed for the swapchain
-    createInfo.enabledExtensionCount = logicalDeviceExtensionCount;
+    createInfo.enabledExtensionCount = headlessMode ? 0 : logicalDeviceExtensionCount;
     createInfo.ppEnabledExtensionNames = requiredExtensions;
 
     if (enableValidationLayers)
@@ -366,6 +663,10 @@ void createLogicalDevice()
     // Get present queue handles
     vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
 
+    // Get the simulation and upload queues, they alias the graphics queue when the device has no spare ones
+    vkGetDeviceQueue(device, indices.computeFamily, indices.computeQueueIndex, &computeQueue);
+    vkGetDeviceQueue(device, indices.transferFamily, indices.transferQueueIndex, &transferQueue);
+
     printf("Logical device created succesfully\n");
 }
 
@@ -422,15 +723,7 @@ VkSurfaceFormatKHR chooseSwapSurfaceFormat(const uint32_t availableFormatsCount,
 
 VkPresentModeKHR chooseSwapPresentMode(const uint32_t availablePresentModesCount, const VkPresentModeKHR *availablePresentModes)
 {
-    for (int i = 0; i < availablePresentModesCount; i++)
-    {
-        if (availablePresentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
-        {
-            return availablePresentModes[i];
-        }
-    }
-
-    return VK_PRESENT_MODE_FIFO_KHR;
+    return framePacingPresentMode(availablePresentModesCount, availablePresentModes);
 }
 
 VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR *capabilities, SDL_Window *window)
@@ -483,12 +776,10 @@ void createSwapChain(SDL_Window *window)
     // To ensure the image views use the same format
     swapChainImageFormat = surfaceFormat.format;
 
-    imageCount = swapChainSupport.capabilities.minImageCount + 1;
+    imageCount = framePacingImageCount(&swapChainSupport.capabilities);
 
-    if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
-    {
-        imageCount = swapChainSupport.capabilities.maxImageCount;
-    }
+    static const char *presentModeNames[] = {"IMMEDIATE", "MAILBOX", "FIFO", "FIFO_RELAXED"};
+    printf("Present mode %s with %u images\n", presentMode <= VK_PRESENT_MODE_FIFO_RELAXED_KHR ? presentModeNames[presentMode] : "other", imageCount);
 
     VkSwapchainCreateInfoKHR createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -638,73 +929,328 @@ VkShaderModule createShaderModule(VkDevice device, const char *shaderCode, size_
     return shaderModule; // Return the created shader module
 }
 
-void createRenderPass()
+VkShaderModule loadShaderModule(const char *filename)
 {
-    VkAttachmentDescription colorAttachment = {};
-    colorAttachment.format = swapChainImageFormat;
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    size_t codeSize = 0;
+    char *shaderCode = readFile(filename, &codeSize);
 
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    if (shaderCode == NULL)
+    {
+        fprintf(stderr, "Failed to load shader %s, compile the shaders with shaders/compile_shaders.sh!\n", filename);
+        exit(EXIT_FAILURE);
+    }
 
-    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    VkShaderModule shaderModule = createShaderModule(device, shaderCode, codeSize);
+    free(shaderCode);
 
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    return shaderModule;
+}
 
-    // Subpasses (one for now, maybe more for postprocessing in the future)
-    VkAttachmentReference colorAttachmentRef = {};
-    colorAttachmentRef.attachment = 0;
-    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
 
-    VkSubpassDescription subpass = {};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef; // The index of the attachment in this array is directly referenced from the fragment shader with the layout(location = 0) out vec4 outColor directive
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+    {
+        if ((typeFilter & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+        {
+            return i;
+        }
+    }
 
-    // Dependencies to make sure we do not write while the swap chain is reading from the image
+    fprintf(stderr, "Failed to find a suitable memory type!\n");
+    exit(EXIT_FAILURE);
+}
 
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+static void createBufferWithSharing(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, int shared, VkBuffer *buffer, VkDeviceMemory *bufferMemory)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    uint32_t queueFamilies[4];
+    uint32_t queueFamilyCount = getUniqueQueueFamilies(queueFamilies);
+
+    // Concurrent sharing avoids queue family ownership transfers between the graphics, compute and transfer queues
+    if (shared && queueFamilyCount > 1)
+    {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = queueFamilyCount;
+        bufferInfo.pQueueFamilyIndices = queueFamilies;
+    }
+
+    if (vkCreateBuffer(device, &bufferInfo, NULL, buffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(device, *buffer, &memoryRequirements);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memoryRequirements.size;
+    allocInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, properties);
+
+    if (vkAllocateMemory(device, &allocInfo, NULL, bufferMemory) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate buffer memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    vkBindBufferMemory(device, *buffer, *bufferMemory, 0);
+}
+
+void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *buffer, VkDeviceMemory *bufferMemory)
+{
+    createBufferWithSharing(size, usage, properties, 0, buffer, bufferMemory);
+}
+
+void createSharedBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *buffer, VkDeviceMemory *bufferMemory)
+{
+    createBufferWithSharing(size, usage, properties, 1, buffer, bufferMemory);
+}
+
+static VkCommandBuffer beginCommandsOnPool(VkCommandPool pool)
+{
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = pool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer singleTimeBuffer;
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, &singleTimeBuffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate single time command buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(singleTimeBuffer, &beginInfo);
+
+    return singleTimeBuffer;
+}
+
+static void endCommandsOnQueue(VkCommandBuffer singleTimeBuffer, VkQueue queue, VkCommandPool pool)
+{
+    vkEndCommandBuffer(singleTimeBuffer);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &singleTimeBuffer;
+
+    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to submit single time command buffer!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    vkQueueWaitIdle(queue);
+
+    vkFreeCommandBuffers(device, pool, 1, &singleTimeBuffer);
+}
+
+VkCommandBuffer beginSingleTimeCommands()
+{
+    return beginCommandsOnPool(commandPool);
+}
+
+void endSingleTimeCommands(VkCommandBuffer singleTimeBuffer)
+{
+    endCommandsOnQueue(singleTimeBuffer, graphicsQueue, commandPool);
+}
+
+// Uploads and readbacks go through the transfer queue, so they stay off the graphics and compute queues
+void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+{
+    VkCommandBuffer copyCommands = beginCommandsOnPool(transferCommandPool);
+
+    VkBufferCopy copyRegion = {};
+    copyRegion.srcOffset = 0;
+    copyRegion.dstOffset = 0;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(copyCommands, srcBuffer, dstBuffer, 1, &copyRegion);
+
+    endCommandsOnQueue(copyCommands, transferQueue, transferCommandPool);
+}
+
+VkPipeline createComputePipeline(const char *filename, VkPipelineLayout layout)
+{
+    VkShaderModule computeShaderModule = loadShaderModule(filename);
+
+    VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+    computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computeShaderStageInfo.module = computeShaderModule;
+    computeShaderStageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = computeShaderStageInfo;
+    pipelineInfo.layout = layout;
+
+    VkPipeline computePipeline;
+
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &computePipeline) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create compute pipeline %s!\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    vkDestroyShaderModule(device, computeShaderModule, NULL);
+
+    return computePipeline;
+}
+
+VkFormat findDepthFormat()
+{
+    VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT};
+
+    for (uint32_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++)
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, candidates[i], &properties);
+
+        if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+        {
+            return candidates[i];
+        }
+    }
+
+    fprintf(stderr, "Failed to find a depth format!\n");
+    exit(EXIT_FAILURE);
+}
+
+VkRenderPass createRenderPassWithAttachments(const VkAttachmentDescription *attachments, uint32_t colorCount, int hasDepth, const VkSubpassDependency *dependencies, uint32_t dependencyCount)
+{
+    // Attachment i is written by the fragment shader output with layout(location = i)
+    VkAttachmentReference colorAttachmentRefs[8];
+
+    if (colorCount > 8)
+    {
+        fprintf(stderr, "Too many color attachments!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < colorCount; i++)
+    {
+        colorAttachmentRefs[i].attachment = i;
+        colorAttachmentRefs[i].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = colorCount;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = colorCount;
+    subpass.pColorAttachments = colorAttachmentRefs;
+    subpass.pDepthStencilAttachment = hasDepth ? &depthAttachmentRef : NULL;
 
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.attachmentCount = colorCount + (hasDepth ? 1 : 0);
+    renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = dependencyCount;
+    renderPassInfo.pDependencies = dependencies;
 
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    VkRenderPass pass;
 
-    if (vkCreateRenderPass(device, &renderPassInfo, NULL, &renderPass) != VK_SUCCESS)
+    if (vkCreateRenderPass(device, &renderPassInfo, NULL, &pass) != VK_SUCCESS)
     {
         fprintf(stderr, "Failed to create render pass!\n");
         exit(EXIT_FAILURE);
     }
+
+    return pass;
+}
+
+void createRenderPass()
+{
+    VkAttachmentDescription colorAttachment = {};
+    colorAttachment.format = swapChainImageFormat;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachment.finalLayout = headlessMode ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    // Dependencies to make sure we do not write while the swap chain is reading from the image
+
+    VkSubpassDependency dependencies[2] = {};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[0].srcAccessMask = 0;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    // Offscreen images are copied to the readback buffer right after the pass
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    // The surface mesh is the only opaque geometry and the only user of a depth buffer
+    VkAttachmentDescription attachments[2] = {colorAttachment};
+    int hasDepth = renderMode == RENDER_MODE_MESH;
+
+    if (hasDepth)
+    {
+        depthImageFormat = findDepthFormat();
+
+        attachments[1].format = depthImageFormat;
+        attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        // The depth buffer is shared by every frame, the clear waits for the previous frame's tests
+        dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[0].dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependencies[0].dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    }
+
+    // One subpass writing the swapchain image, post processing passes get their own render passes
+    renderPass = createRenderPassWithAttachments(attachments, 1, hasDepth, dependencies, headlessMode ? 2 : 1);
 }
 
 void createGraphicsPipeline()
 {
     size_t vertShaderSize, fragShaderSize;
 
-    // Load the shader files
-    char *vertShaderCode = readFile("../shaders/vert.spv", &vertShaderSize);
+    // Load the shader files, the bindless variant reads the positions from the descriptor heap
+    char *vertShaderCode = readFile(descriptorHeapSupported ? "../shaders/vert_bindless.spv" : "../shaders/vert.spv", &vertShaderSize);
     char *fragShaderCode = readFile("../shaders/frag.spv", &fragShaderSize);
 
     // Check if shaders were loaded successfully
     if (vertShaderCode == NULL || fragShaderCode == NULL)
     {
-        fprintf(stderr, "failed to load shader files!\n");
-        free(vertShaderCode);
-        free(fragShaderCode);
-        return;
+        fprintf(stderr, "Failed to load the particle shaders, compile the shaders with shaders/compile_shaders.sh!\n");
+        exit(EXIT_FAILURE);
     }
 
     // Print the size of the loaded shaders to verify the file sizes
@@ -748,18 +1294,29 @@ void createGraphicsPipeline()
     dynamicState.dynamicStateCount = 2; // Sizeof(dynamicStates) at line 20
     dynamicState.pDynamicStates = dynamicStates;
 
-    // Vertex Input
+    // Vertex Input: one vec4 per particle, read straight from the buffer the SPH compute passes write
+    VkVertexInputBindingDescription bindingDescription = {};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = 4 * sizeof(float);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    VkVertexInputAttributeDescription attributeDescription = {};
+    attributeDescription.binding = 0;
+    attributeDescription.location = 0;
+    attributeDescription.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescription.offset = 0;
+
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 0;
-    vertexInputInfo.pVertexBindingDescriptions = NULL; // Optional
-    vertexInputInfo.vertexAttributeDescriptionCount = 0;
-    vertexInputInfo.pVertexAttributeDescriptions = NULL; // Optional
+    vertexInputInfo.vertexBindingDescriptionCount = descriptorHeapSupported ? 0 : 1;
+    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexAttributeDescriptionCount = descriptorHeapSupported ? 0 : 1;
+    vertexInputInfo.pVertexAttributeDescriptions = &attributeDescription;
 
     // How vertex data is used/parsed
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
     inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; // Modify in _LINE_STRIP to use last 2 vertices as the start of the third one
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST; // Every particle is drawn as a point sprite
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
     // Viewport
@@ -792,7 +1349,7 @@ void createGraphicsPipeline()
     rasterizer.rasterizerDiscardEnable = VK_FALSE;
     rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
     rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT; // TO DO: Read more about culling, this can be used to enable wireframe mode
+    rasterizer.cullMode = VK_CULL_MODE_NONE; // Points have no facing
     rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
     rasterizer.depthBiasEnable = VK_FALSE;
     rasterizer.depthBiasConstantFactor = 0.0f; // Optional
@@ -831,12 +1388,23 @@ void createGraphicsPipeline()
     colorBlending.blendConstants[2] = 0.0f; // Optional
     colorBlending.blendConstants[3] = 0.0f; // Optional
 
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_FALSE;
+    depthStencil.depthWriteEnable = VK_FALSE;
+
+    // View projection matrix, point shading parameters and the heap handles of the positions
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(ParticlePushConstants);
+
     VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 0;         // No descriptor sets
-    pipelineLayoutInfo.pSetLayouts = NULL;         // Pointer to descriptor set layouts (none here)
-    pipelineLayoutInfo.pushConstantRangeCount = 0; // No push constants
-    pipelineLayoutInfo.pPushConstantRanges = NULL; // Pointer to push constant ranges (none here)
+    pipelineLayoutInfo.setLayoutCount = descriptorHeapSupported ? 1 : 0; // Set 0 is the descriptor heap, no sets without it
+    pipelineLayoutInfo.pSetLayouts = &descriptorHeapSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &pipelineLayout) != VK_SUCCESS)
     {
@@ -855,7 +1423,7 @@ void createGraphicsPipeline()
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = NULL; // Optional
+    pipelineInfo.pDepthStencilState = &depthStencil; // Tests disabled, the main pass only has a depth buffer for the surface mesh
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = pipelineLayout;
@@ -876,22 +1444,84 @@ void createGraphicsPipeline()
     vkDestroyShaderModule(device, fragShaderModule, NULL);
     vkDestroyShaderModule(device, vertShaderModule, NULL);
 
+    markCommandBuffersDirty(); // Cached command buffers bind the old pipeline
     printf("Graphics pipeline created successfully\n");
 }
 
+static void createDepthResources()
+{
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = depthImageFormat;
+    imageInfo.extent.width = swapChainExtent.width;
+    imageInfo.extent.height = swapChainExtent.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (vkCreateImage(device, &imageInfo, NULL, &depthImage) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create depth image!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(device, depthImage, &memoryRequirements);
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memoryRequirements.size;
+    allocInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    if (vkAllocateMemory(device, &allocInfo, NULL, &depthImageMemory) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate depth image memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    vkBindImageMemory(device, depthImage, depthImageMemory, 0);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = depthImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = depthImageFormat;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(device, &viewInfo, NULL, &depthImageView) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create depth image view!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
 void createFrameBuffers()
 {
     swapChainFramebuffers = malloc(imageCount * sizeof(VkFramebuffer));
 
+    if (depthImageFormat != VK_FORMAT_UNDEFINED)
+    {
+        createDepthResources();
+    }
+
     for (int i = 0; i < imageCount; i++)
     {
         VkImageView attachments[] = {
-            swapChainImageViews[i]};
+            swapChainImageViews[i],
+            depthImageView};
 
         VkFramebufferCreateInfo framebufferInfo = {};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebufferInfo.renderPass = renderPass;
-        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.attachmentCount = depthImageView != VK_NULL_HANDLE ? 2 : 1;
         framebufferInfo.pAttachments = attachments;
         framebufferInfo.width = swapChainExtent.width;
         framebufferInfo.height = swapChainExtent.height;
@@ -904,23 +1534,35 @@ void createFrameBuffers()
         }
     }
 
+    markCommandBuffersDirty(); // Cached command buffers reference the old framebuffers and extent
     printf("Framebuffers created successfully\n");
 }
 
-void createCommandPool()
+static VkCommandPool createPoolForFamily(uint32_t queueFamilyIndex)
 {
     VkCommandPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    poolInfo.queueFamilyIndex = indices.graphicsFamily;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    VkCommandPool pool;
 
-    if (vkCreateCommandPool(device, &poolInfo, NULL, &commandPool) != VK_SUCCESS)
+    if (vkCreateCommandPool(device, &poolInfo, NULL, &pool) != VK_SUCCESS)
     {
         fprintf(stderr, "failed to create command pool!\n");
         exit(EXIT_FAILURE);
     }
 
-    printf("Command pool created successfully\n");
+    return pool;
+}
+
+void createCommandPool()
+{
+    commandPool = createPoolForFamily(indices.graphicsFamily);
+    computeCommandPool = createPoolForFamily(indices.computeFamily);
+    transferCommandPool = createPoolForFamily(indices.transferFamily);
+
+    printf("Command pools created successfully\n");
 }
 
 void createCommandBuffer()
@@ -937,9 +1579,102 @@ void createCommandBuffer()
         exit(EXIT_FAILURE);
     }
 
+    if (cacheCommandBuffers)
+    {
+        uint32_t cacheSize = imageCount * RECORD_FRAME_SLOTS;
+
+        cachedCommandBuffers = malloc(cacheSize * sizeof(VkCommandBuffer));
+        cachedGenerations = calloc(cacheSize, sizeof(uint64_t)); // 0: never recorded
+
+        allocInfo.commandBufferCount = cacheSize;
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, cachedCommandBuffers) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate cached command buffers!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     printf("Command buffer created successfully\n");
 }
 
+void markCommandBuffersDirty()
+{
+    commandBufferGeneration++;
+}
+
+VkCommandBuffer acquireFrameCommandBuffer(VkCommandBuffer fallback, uint32_t imageIndex)
+{
+    if (!cacheCommandBuffers)
+    {
+        vkResetCommandBuffer(fallback, 0);
+        recordCommandBuffer(fallback, imageIndex);
+
+        return fallback;
+    }
+
+    // The caller waited on the fence of the last frame that used this slot, so the entry is not pending
+    uint32_t entry = imageIndex * RECORD_FRAME_SLOTS + (uint32_t)(currentFrame % RECORD_FRAME_SLOTS);
+
+    if (cachedGenerations[entry] != commandBufferGeneration)
+    {
+        vkResetCommandBuffer(cachedCommandBuffers[entry], 0);
+        recordCommandBuffer(cachedCommandBuffers[entry], imageIndex);
+        cachedGenerations[entry] = commandBufferGeneration;
+    }
+
+    return cachedCommandBuffers[entry];
+}
+
+// Particles are drawn in chunks so every recording thread gets a share of the draw list
+#define PARTICLE_BATCH_MIN_VERTICES 16384
+#define MAX_DRAW_BATCHES 64
+
+typedef struct {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+} ParticleBatch;
+
+// Shared by every particle batch of the frame being recorded, written before the batches are recorded
+static ParticlePushConstants particleFrameConstants;
+static VkBuffer particleFrameBuffer;
+
+// Secondary command buffers inherit no state, so every batch binds the pipeline and its resources
+static void bindParticlePipeline(VkCommandBuffer commandBuffer)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(particleFrameConstants), &particleFrameConstants);
+
+    // With the heap the vertex shader fetches the positions by the handle in the push constants
+    if (descriptorHeapSupported)
+    {
+        descriptorHeapBind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0);
+        return;
+    }
+
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &particleFrameBuffer, offsets);
+}
+
+static void recordParticleBatch(VkCommandBuffer commandBuffer, const void *data)
+{
+    const ParticleBatch *batch = data;
+
+    bindParticlePipeline(commandBuffer);
+
+    // Draw command, second argument is the number of instances and the 3rd and 4th are the offsets for the instances
+    vkCmdDraw(commandBuffer, batch->vertexCount, 1, batch->firstVertex, 0);
+}
+
+static void recordCulledParticles(VkCommandBuffer commandBuffer, const void *data)
+{
+    (void)data;
+
+    bindParticlePipeline(commandBuffer);
+
+    recordCulledDraw(commandBuffer, currentFrame);
+}
+
 void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
 {
     VkCommandBufferBeginInfo beginInfo = {};
@@ -953,6 +1688,33 @@ void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
         exit(EXIT_FAILURE);
     }
 
+    // The simulation runs on the compute queue, this frame draws the positions of batch currentFrame
+    particleFrameBuffer = sphGpuRenderBuffer(currentFrame);
+    particleFrameConstants.handles[0] = sphGpuRenderBufferHandle(currentFrame);
+
+    cameraViewProjection(&camera, (float)swapChainExtent.width / (float)swapChainExtent.height, particleFrameConstants.viewProjection);
+    particleFrameConstants.shading[0] = particlePointSize;
+    particleFrameConstants.shading[1] = sphGpuRestDensity();
+    particleFrameConstants.shading[2] = gpuCulling ? 1.0f : 0.0f;
+
+    // The GPU decides what is drawn: only the particles of visible blocks reach the vertex stage
+    if (gpuCulling)
+    {
+        recordGpuCulling(commandBuffer, currentFrame, particleFrameConstants.viewProjection);
+        particleFrameBuffer = gpuCullVertexBuffer(currentFrame);
+        particleFrameConstants.handles[0] = gpuCullVertexHandle(currentFrame);
+    }
+
+    // The surface is splatted and filtered in its own passes, the main pass only shades it
+    if (renderMode == RENDER_MODE_SURFACE)
+    {
+        recordFluidPasses(commandBuffer, particleFrameBuffer, sphGpuParticleCount);
+    }
+    else if (renderMode == RENDER_MODE_VOLUME)
+    {
+        recordVolumePasses(commandBuffer);
+    }
+
     VkRenderPassBeginInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderPass;
@@ -962,35 +1724,83 @@ void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
     renderPassInfo.renderArea.offset.y = 0;
     renderPassInfo.renderArea.extent = swapChainExtent;
 
-    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}}; // Clear the screen using black as a color
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+    VkClearValue clearValues[2] = {};
+    clearValues[0].color.float32[3] = 1.0f; // Clear the screen using black as a color
+    clearValues[1].depthStencil.depth = 1.0f;
+    renderPassInfo.clearValueCount = depthImageView != VK_NULL_HANDLE ? 2 : 1;
+    renderPassInfo.pClearValues = clearValues;
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    // The draws are recorded into secondary command buffers by the thread pool, unless the
+    // buffer is cached: it is then recorded once and parallel recording would not pay off
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, cacheCommandBuffers ? VK_SUBPASS_CONTENTS_INLINE : VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-    // Viewport and scissors are dynamic, so we specify them here
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = swapChainExtent.width;   // Cast to float ?
-    viewport.height = swapChainExtent.height; // Cast to float ?
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    static ParticleBatch particleBatches[MAX_DRAW_BATCHES];
+    static DrawBatch drawBatches[MAX_DRAW_BATCHES];
+    uint32_t batchCount = threadPoolThreadCount();
 
-    VkRect2D scissor = {};
-    scissor.offset.x = 0;
-    scissor.offset.y = 0;
-    scissor.extent = swapChainExtent;
+    if (batchCount > MAX_DRAW_BATCHES)
+    {
+        batchCount = MAX_DRAW_BATCHES;
+    }
 
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    if (batchCount > 1 && sphGpuParticleCount / batchCount < PARTICLE_BATCH_MIN_VERTICES)
+    {
+        batchCount = sphGpuParticleCount / PARTICLE_BATCH_MIN_VERTICES > 1 ? sphGpuParticleCount / PARTICLE_BATCH_MIN_VERTICES : 1;
+    }
 
-    // Draw command, second argument is the number of instances and the 3rd and 4th are the offsets for the instances
-    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    for (uint32_t i = 0; i < batchCount; i++)
+    {
+        particleBatches[i].firstVertex = (uint32_t)((uint64_t)sphGpuParticleCount * i / batchCount);
+        particleBatches[i].vertexCount = (uint32_t)((uint64_t)sphGpuParticleCount * (i + 1) / batchCount) - particleBatches[i].firstVertex;
+
+        drawBatches[i].record = recordParticleBatch;
+        drawBatches[i].data = &particleBatches[i];
+    }
+
+    // One indirect draw covers every block, its cost does not depend on the particle count
+    if (gpuCulling)
+    {
+        drawBatches[0].record = recordCulledParticles;
+        drawBatches[0].data = NULL;
+        batchCount = 1;
+    }
+
+    // A single fullscreen draw, not worth splitting across threads
+    if (renderMode == RENDER_MODE_SURFACE)
+    {
+        drawBatches[0].record = recordFluidComposite;
+        drawBatches[0].data = NULL;
+        batchCount = 1;
+    }
+    else if (renderMode == RENDER_MODE_MESH)
+    {
+        drawBatches[0].record = recordFluidMesh;
+        drawBatches[0].data = NULL;
+        batchCount = 1;
+    }
+    else if (renderMode == RENDER_MODE_VOLUME)
+    {
+        drawBatches[0].record = recordVolumeComposite;
+        drawBatches[0].data = NULL;
+        batchCount = 1;
+    }
+
+    if (cacheCommandBuffers)
+    {
+        recordDrawBatchesInline(commandBuffer, drawBatches, batchCount);
+    }
+    else
+    {
+        recordDrawBatches(commandBuffer, imageIndex, currentFrame, drawBatches, batchCount);
+    }
 
     vkCmdEndRenderPass(commandBuffer);
 
+    if (headlessMode)
+    {
+        recordOffscreenReadback(commandBuffer, imageIndex);
+    }
+
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
     {
         fprintf(stderr, "Failed to record command buffer!\n");
@@ -1007,8 +1817,19 @@ void createSyncObjects()
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // Fence is signaled so we do not block the execution indefinitely
 
+    VkSemaphoreTypeCreateInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo timelineSemaphoreInfo = {};
+    timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    timelineSemaphoreInfo.pNext = &timelineInfo;
+
     if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &imageAvailableSemaphore) != VK_SUCCESS ||
         vkCreateSemaphore(device, &semaphoreInfo, NULL, &renderFinishedSemaphore) != VK_SUCCESS ||
+        vkCreateSemaphore(device, &timelineSemaphoreInfo, NULL, &simulationTimeline) != VK_SUCCESS ||
+        vkCreateSemaphore(device, &timelineSemaphoreInfo, NULL, &renderTimeline) != VK_SUCCESS ||
         vkCreateFence(device, &fenceInfo, NULL, &inFlightFence) != VK_SUCCESS)
     {
         fprintf(stderr, "Failed to create semaphores!\n");
@@ -1019,27 +1840,136 @@ void createSyncObjects()
 void initVulkan(SDL_Window *window)
 {
     baseSetupVulkan(window);
-    createSurface(window);
+
+    if (!headlessMode)
+    {
+        createSurface(window);
+    }
+
     physicalDevice = selectGPU(instance);
+
+    if (physicalDevice == VK_NULL_HANDLE)
+    {
+        exit(EXIT_FAILURE);
+    }
+
     createLogicalDevice();
-    createSwapChain(window);
+
+    if (headlessMode)
+    {
+        createOffscreenTargets(offscreenExtent.width, offscreenExtent.height);
+    }
+    else
+    {
+        createSwapChain(window);
+    }
+
     createImageViews();
     createRenderPass();
+    createDescriptorHeap(); // Before any pipeline layout or resource that uses it
     createGraphicsPipeline();
     createFrameBuffers();
     createCommandPool();
     createCommandBuffer();
     createSyncObjects();
+    createParallelRecording();
+
+    if (renderMode != RENDER_MODE_PARTICLES)
+    {
+        createFluidRenderer();
+    }
+
+    if (headlessMode)
+    {
+        createOffscreenReadback();
+    }
+}
+
+void collectGpuMetrics()
+{
+    static int budgetSupported = -1;
+
+    if (device == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    uint64_t finished = 0;
+
+    // The timelines count finished frames and batches, the counters the submitted ones
+    if (metricsGet(METRIC_FRAMES) > 0.0 && vkGetSemaphoreCounterValue(device, renderTimeline, &finished) == VK_SUCCESS)
+    {
+        double queued = metricsGet(METRIC_FRAMES) - (double)finished;
+        metricsSet(METRIC_FRAME_QUEUE, queued > 0.0 ? queued : 0.0);
+    }
+
+    if (metricsGet(METRIC_SIMULATION_BATCHES) > 0.0 && vkGetSemaphoreCounterValue(device, simulationTimeline, &finished) == VK_SUCCESS)
+    {
+        double queued = metricsGet(METRIC_SIMULATION_BATCHES) - (double)finished;
+        metricsSet(METRIC_SIMULATION_QUEUE, queued > 0.0 ? queued : 0.0);
+    }
+
+    if (budgetSupported < 0)
+    {
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, NULL);
+
+        VkExtensionProperties *extensions = malloc(extensionCount * sizeof(VkExtensionProperties));
+        budgetSupported = 0;
+
+        if (extensions && vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &extensionCount, extensions) == VK_SUCCESS)
+        {
+            for (uint32_t i = 0; i < extensionCount; i++)
+            {
+                budgetSupported |= strcmp(extensions[i].extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+            }
+        }
+
+        free(extensions);
+    }
+
+    if (!budgetSupported)
+    {
+        return;
+    }
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    properties.pNext = &budget;
+
+    vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+
+    double used = 0.0;
+
+    for (uint32_t heap = 0; heap < properties.memoryProperties.memoryHeapCount; heap++)
+    {
+        if (properties.memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        {
+            used += (double)budget.heapUsage[heap];
+        }
+    }
+
+    metricsSet(METRIC_GPU_MEMORY_BYTES, used);
 }
 
 void quitVulkan()
 {
+    metricsStop();
+
     if (device != VK_NULL_HANDLE)
     {
+        destroyParallelRecording();
+        destroyFluidRenderer();
+
         if (commandPool != VK_NULL_HANDLE)
         {
             vkDestroyCommandPool(device, commandPool, NULL); // Also destroyes commandbuffers
-            printf("Destroyed command pool\n");
+            vkDestroyCommandPool(device, computeCommandPool, NULL);
+            vkDestroyCommandPool(device, transferCommandPool, NULL);
+            printf("Destroyed command pools\n");
         }
 
         if (graphicsPipeline != VK_NULL_HANDLE)
@@ -1054,6 +1984,8 @@ void quitVulkan()
             printf("Destroyed pipeline layout\n");
         }
 
+        destroyDescriptorHeap();
+
         if (swapChainFramebuffers != NULL)
         {
             for (int i = 0; i < imageCount; i++)
@@ -1066,15 +1998,32 @@ void quitVulkan()
         free(swapChainFramebuffers);
         swapChainFramebuffers = NULL;
 
+        if (depthImage != VK_NULL_HANDLE)
+        {
+            vkDestroyImageView(device, depthImageView, NULL);
+            vkDestroyImage(device, depthImage, NULL);
+            vkFreeMemory(device, depthImageMemory, NULL);
+            depthImage = VK_NULL_HANDLE;
+            depthImageView = VK_NULL_HANDLE;
+            printf("Destroyed depth buffer\n");
+        }
+
         if (renderPass != VK_NULL_HANDLE)
         {
             vkDestroyRenderPass(device, renderPass, NULL);
             printf("Destroyed renderPass\n");
         }
 
+        if (headlessMode)
+        {
+            destroyOffscreen();
+        }
+
         vkDestroySemaphore(device, imageAvailableSemaphore, NULL);
         vkDestroySemaphore(device, renderFinishedSemaphore, NULL);
         vkDestroyFence(device, inFlightFence, NULL);
+        vkDestroySemaphore(device, simulationTimeline, NULL);
+        vkDestroySemaphore(device, renderTimeline, NULL);
 
         if (swapChain != VK_NULL_HANDLE)
         {
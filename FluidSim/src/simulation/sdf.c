@@ -0,0 +1,717 @@
+#include "sdf.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SDF_CACHE_ALIGNMENT 64
+#define SDF_CACHE_VERSION 1
+#define SDF_LEAF_TRIANGLES 4
+#define SDF_MEDIAN_DEPTH 40 // Deeper nodes split in half, bounding the depth for skewed meshes
+#define SDF_STACK_SIZE 128  // SDF_MEDIAN_DEPTH + log2 of any triangle count
+
+static const char sdfCacheMagic[8] = {'F', 'S', 'S', 'D', 'F', '\0', '\0', SDF_CACHE_VERSION};
+
+// Little endian, followed by the distances at distanceOffset
+typedef struct {
+    char magic[8];
+    uint64_t key; // Hash of the mesh and the SdfBakeInfo the field was baked with
+    uint32_t dim[4];
+    float origin[4];
+    float cellSize;
+    float bandWidth;
+    uint64_t distanceOffset;
+} SdfCacheHeader;
+
+typedef struct {
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t first; // First entry of a leaf in the triangle order, right child of an inner node (the left one follows it)
+    uint32_t count; // Triangles of a leaf, 0 for inner nodes
+} SdfBvhNode;
+
+typedef struct {
+    const SdfGrid *sdf;
+    const float *vertices;  // Placed mesh, xyz per vertex
+    const uint32_t *indices;
+    uint32_t *order;        // Triangles sorted into the BVH leaves
+    float *centroids;
+    SdfBvhNode *nodes;
+    uint32_t nodeCount;
+    float *distances;
+
+    // Per thread ray crossings of the row being signed, reused across rows
+    float **crossings;
+    uint32_t *crossingCapacity;
+} SdfBaker;
+
+static double elapsedMilliseconds(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)(now.tv_sec - start->tv_sec) * 1000.0 + (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void *allocateOrExit(size_t size)
+{
+    void *data = malloc(size);
+
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate SDF memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return data;
+}
+
+static const float *triangleVertex(const SdfBaker *baker, uint32_t triangle, uint32_t corner)
+{
+    return &baker->vertices[3 * (size_t)baker->indices[3 * (size_t)triangle + corner]];
+}
+
+static uint32_t buildNode(SdfBaker *baker, uint32_t first, uint32_t count, uint32_t depth)
+{
+    uint32_t nodeIndex = baker->nodeCount++;
+    SdfBvhNode *node = &baker->nodes[nodeIndex];
+    float centroidMin[3] = {INFINITY, INFINITY, INFINITY};
+    float centroidMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        node->boundsMin[axis] = INFINITY;
+        node->boundsMax[axis] = -INFINITY;
+    }
+
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        uint32_t triangle = baker->order[i];
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (uint32_t corner = 0; corner < 3; corner++)
+            {
+                float value = triangleVertex(baker, triangle, corner)[axis];
+                node->boundsMin[axis] = fminf(node->boundsMin[axis], value);
+                node->boundsMax[axis] = fmaxf(node->boundsMax[axis], value);
+            }
+
+            centroidMin[axis] = fminf(centroidMin[axis], baker->centroids[3 * triangle + axis]);
+            centroidMax[axis] = fmaxf(centroidMax[axis], baker->centroids[3 * triangle + axis]);
+        }
+    }
+
+    int splitAxis = 0;
+
+    for (int axis = 1; axis < 3; axis++)
+    {
+        if (centroidMax[axis] - centroidMin[axis] > centroidMax[splitAxis] - centroidMin[splitAxis])
+        {
+            splitAxis = axis;
+        }
+    }
+
+    if (count <= SDF_LEAF_TRIANGLES || centroidMax[splitAxis] <= centroidMin[splitAxis])
+    {
+        node->first = first;
+        node->count = count;
+        return nodeIndex;
+    }
+
+    // Split at the middle of the centroid bounds, or in half when every centroid lands on one side
+    float split = 0.5f * (centroidMin[splitAxis] + centroidMax[splitAxis]);
+    uint32_t middle = first;
+
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        if (baker->centroids[3 * baker->order[i] + splitAxis] < split)
+        {
+            uint32_t swap = baker->order[i];
+            baker->order[i] = baker->order[middle];
+            baker->order[middle++] = swap;
+        }
+    }
+
+    if (middle == first || middle == first + count || depth >= SDF_MEDIAN_DEPTH)
+    {
+        middle = first + count / 2;
+    }
+
+    buildNode(baker, first, middle - first, depth + 1);
+    uint32_t right = buildNode(baker, middle, first + count - middle, depth + 1);
+
+    // The node array may not move while children are added, it is allocated for the worst case up front
+    baker->nodes[nodeIndex].first = right;
+    baker->nodes[nodeIndex].count = 0;
+
+    return nodeIndex;
+}
+
+static float dot3(const float a[3], const float b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static float distanceSquared(const float a[3], const float b[3])
+{
+    float d[3] = {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+    return dot3(d, d);
+}
+
+// Closest point of triangle abc to p by Voronoi region (Ericson, Real-Time Collision Detection 5.1.5)
+static float triangleDistanceSquared(const float p[3], const float a[3], const float b[3], const float c[3])
+{
+    float ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float ap[3] = {p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+
+    float d1 = dot3(ab, ap);
+    float d2 = dot3(ac, ap);
+
+    if (d1 <= 0.0f && d2 <= 0.0f)
+    {
+        return distanceSquared(p, a);
+    }
+
+    float bp[3] = {p[0] - b[0], p[1] - b[1], p[2] - b[2]};
+    float d3 = dot3(ab, bp);
+    float d4 = dot3(ac, bp);
+
+    if (d3 >= 0.0f && d4 <= d3)
+    {
+        return distanceSquared(p, b);
+    }
+
+    float vc = d1 * d4 - d3 * d2;
+
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    {
+        float v = d1 / (d1 - d3);
+        float q[3] = {a[0] + v * ab[0], a[1] + v * ab[1], a[2] + v * ab[2]};
+        return distanceSquared(p, q);
+    }
+
+    float cp[3] = {p[0] - c[0], p[1] - c[1], p[2] - c[2]};
+    float d5 = dot3(ab, cp);
+    float d6 = dot3(ac, cp);
+
+    if (d6 >= 0.0f && d5 <= d6)
+    {
+        return distanceSquared(p, c);
+    }
+
+    float vb = d5 * d2 - d1 * d6;
+
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    {
+        float w = d2 / (d2 - d6);
+        float q[3] = {a[0] + w * ac[0], a[1] + w * ac[1], a[2] + w * ac[2]};
+        return distanceSquared(p, q);
+    }
+
+    float va = d3 * d6 - d5 * d4;
+
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+    {
+        float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        float q[3] = {b[0] + w * (c[0] - b[0]), b[1] + w * (c[1] - b[1]), b[2] + w * (c[2] - b[2])};
+        return distanceSquared(p, q);
+    }
+
+    float denominator = 1.0f / (va + vb + vc);
+    float v = vb * denominator;
+    float w = vc * denominator;
+    float q[3] = {a[0] + ab[0] * v + ac[0] * w, a[1] + ab[1] * v + ac[1] * w, a[2] + ab[2] * v + ac[2] * w};
+
+    return distanceSquared(p, q);
+}
+
+static float boxDistanceSquared(const SdfBvhNode *node, const float p[3])
+{
+    float result = 0.0f;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float outside = fmaxf(fmaxf(node->boundsMin[axis] - p[axis], p[axis] - node->boundsMax[axis]), 0.0f);
+        result += outside * outside;
+    }
+
+    return result;
+}
+
+// Squared distance to the closest triangle, or best when none is closer (the narrow band cutoff)
+static float closestDistanceSquared(const SdfBaker *baker, const float p[3], float best)
+{
+    uint32_t stack[SDF_STACK_SIZE];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const SdfBvhNode *node = &baker->nodes[stack[--stackSize]];
+
+        if (boxDistanceSquared(node, p) >= best)
+        {
+            continue;
+        }
+
+        if (node->count > 0)
+        {
+            for (uint32_t i = node->first; i < node->first + node->count; i++)
+            {
+                uint32_t triangle = baker->order[i];
+                float candidate = triangleDistanceSquared(p, triangleVertex(baker, triangle, 0), triangleVertex(baker, triangle, 1), triangleVertex(baker, triangle, 2));
+                best = fminf(best, candidate);
+            }
+
+            continue;
+        }
+
+        uint32_t left = (uint32_t)(node - baker->nodes) + 1;
+        uint32_t right = node->first;
+
+        // Nearer child last so it is visited first and tightens best for the other one
+        if (boxDistanceSquared(&baker->nodes[left], p) < boxDistanceSquared(&baker->nodes[right], p))
+        {
+            stack[stackSize++] = right;
+            stack[stackSize++] = left;
+        }
+        else
+        {
+            stack[stackSize++] = left;
+            stack[stackSize++] = right;
+        }
+    }
+
+    return best;
+}
+
+static int compareFloats(const void *a, const void *b)
+{
+    float x = *(const float *)a;
+    float y = *(const float *)b;
+
+    return (x > y) - (x < y);
+}
+
+// x of every crossing between the mesh and the line parallel to x through (y, z)
+static uint32_t gatherCrossings(SdfBaker *baker, uint32_t threadIndex, float y, float z)
+{
+    uint32_t stack[SDF_STACK_SIZE];
+    uint32_t stackSize = 0;
+    uint32_t crossingCount = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const SdfBvhNode *node = &baker->nodes[stack[--stackSize]];
+
+        if (y < node->boundsMin[1] || y > node->boundsMax[1] || z < node->boundsMin[2] || z > node->boundsMax[2])
+        {
+            continue;
+        }
+
+        if (node->count == 0)
+        {
+            stack[stackSize++] = (uint32_t)(node - baker->nodes) + 1;
+            stack[stackSize++] = node->first;
+            continue;
+        }
+
+        for (uint32_t i = node->first; i < node->first + node->count; i++)
+        {
+            uint32_t triangle = baker->order[i];
+            const float *a = triangleVertex(baker, triangle, 0);
+            const float *b = triangleVertex(baker, triangle, 1);
+            const float *c = triangleVertex(baker, triangle, 2);
+
+            // Barycentric weights of the line in the yz projection of the triangle
+            float wa = (b[1] - y) * (c[2] - z) - (b[2] - z) * (c[1] - y);
+            float wb = (c[1] - y) * (a[2] - z) - (c[2] - z) * (a[1] - y);
+            float wc = (a[1] - y) * (b[2] - z) - (a[2] - z) * (b[1] - y);
+            float sum = wa + wb + wc;
+
+            int inside = (wa >= 0.0f && wb >= 0.0f && wc >= 0.0f) || (wa <= 0.0f && wb <= 0.0f && wc <= 0.0f);
+
+            if (!inside || sum == 0.0f)
+            {
+                continue;
+            }
+
+            if (crossingCount == baker->crossingCapacity[threadIndex])
+            {
+                uint32_t capacity = crossingCount ? 2 * crossingCount : 64;
+                float *grown = realloc(baker->crossings[threadIndex], capacity * sizeof(float));
+
+                if (!grown)
+                {
+                    fprintf(stderr, "Failed to allocate SDF memory!\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                baker->crossings[threadIndex] = grown;
+                baker->crossingCapacity[threadIndex] = capacity;
+            }
+
+            baker->crossings[threadIndex][crossingCount++] = (wa * a[0] + wb * b[0] + wc * c[0]) / sum;
+        }
+    }
+
+    if (crossingCount > 1)
+    {
+        qsort(baker->crossings[threadIndex], crossingCount, sizeof(float), compareFloats);
+    }
+
+    return crossingCount;
+}
+
+// One z slice of the grid: the sign comes from the parity of the crossings left of a sample along
+// its row (a closed mesh is assumed), the magnitude from the closest triangle within the band
+static void bakeSliceTask(void *context, uint32_t z, uint32_t threadIndex)
+{
+    SdfBaker *baker = context;
+    const SdfGrid *sdf = baker->sdf;
+    float band = sdf->bandWidth;
+
+    for (uint32_t y = 0; y < sdf->dim[1]; y++)
+    {
+        float p[3];
+        p[1] = sdf->origin[1] + y * sdf->cellSize;
+        p[2] = sdf->origin[2] + z * sdf->cellSize;
+
+        // The parity ray is nudged off the sample row so it does not run exactly through the edges
+        // and vertices of meshes built on the same lattice
+        uint32_t crossingCount = gatherCrossings(baker, threadIndex, p[1] + 1.3e-4f * sdf->cellSize, p[2] + 2.9e-4f * sdf->cellSize);
+        const float *crossings = baker->crossings[threadIndex];
+        uint32_t crossed = 0;
+
+        for (uint32_t x = 0; x < sdf->dim[0]; x++)
+        {
+            p[0] = sdf->origin[0] + x * sdf->cellSize;
+
+            while (crossed < crossingCount && crossings[crossed] < p[0])
+            {
+                crossed++;
+            }
+
+            float distance = sqrtf(closestDistanceSquared(baker, p, band * band));
+            baker->distances[x + sdf->dim[0] * (y + (size_t)sdf->dim[1] * z)] = (crossed & 1) ? -distance : distance;
+        }
+    }
+}
+
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    // FNV-1a
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static uint64_t cacheKey(const ObjMesh *mesh, const SdfBakeInfo *info)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    hash = hashBytes(hash, info, sizeof(*info));
+    hash = hashBytes(hash, &mesh->vertexCount, sizeof(mesh->vertexCount));
+    hash = hashBytes(hash, &mesh->triangleCount, sizeof(mesh->triangleCount));
+    hash = hashBytes(hash, mesh->positions, (size_t)mesh->vertexCount * 3 * sizeof(float));
+    hash = hashBytes(hash, mesh->indices, (size_t)mesh->triangleCount * 3 * sizeof(uint32_t));
+
+    return hash;
+}
+
+static int mapCache(const char *cachePath, uint64_t key, SdfGrid *sdf)
+{
+    int file = open(cachePath, O_RDONLY);
+
+    if (file < 0)
+    {
+        return 0;
+    }
+
+    struct stat info;
+
+    if (fstat(file, &info) != 0 || (size_t)info.st_size < sizeof(SdfCacheHeader))
+    {
+        close(file);
+        return 0;
+    }
+
+    size_t size = (size_t)info.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (mapping == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    const SdfCacheHeader *header = mapping;
+    uint64_t sampleCount = (uint64_t)header->dim[0] * header->dim[1] * header->dim[2];
+
+    int valid = memcmp(header->magic, sdfCacheMagic, sizeof(sdfCacheMagic)) == 0 && header->key == key &&
+                header->distanceOffset % SDF_CACHE_ALIGNMENT == 0 && header->distanceOffset >= sizeof(SdfCacheHeader) &&
+                header->distanceOffset + sampleCount * sizeof(float) <= size;
+
+    if (!valid)
+    {
+        munmap(mapping, size);
+        return 0;
+    }
+
+    sdf->mapping = mapping;
+    sdf->mappingSize = size;
+    sdf->distances = (const float *)((const char *)mapping + header->distanceOffset);
+    sdf->cellSize = header->cellSize;
+    sdf->bandWidth = header->bandWidth;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        sdf->dim[axis] = header->dim[axis];
+        sdf->origin[axis] = header->origin[axis];
+    }
+
+    return 1;
+}
+
+// Written to a temporary file and renamed, like the mesh cache
+static void writeCache(const char *cachePath, uint64_t key, const SdfGrid *sdf)
+{
+    SdfCacheHeader header = {};
+    memcpy(header.magic, sdfCacheMagic, sizeof(header.magic));
+    header.key = key;
+    header.cellSize = sdf->cellSize;
+    header.bandWidth = sdf->bandWidth;
+    header.distanceOffset = (sizeof(header) + SDF_CACHE_ALIGNMENT - 1) & ~(uint64_t)(SDF_CACHE_ALIGNMENT - 1);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        header.dim[axis] = sdf->dim[axis];
+        header.origin[axis] = sdf->origin[axis];
+    }
+
+    char temporaryPath[4096];
+    int pathLength = snprintf(temporaryPath, sizeof(temporaryPath), "%s.%ld.tmp", cachePath, (long)getpid());
+
+    // A truncated name could be another file, the cache is only an optimization
+    if (pathLength < 0 || (size_t)pathLength >= sizeof(temporaryPath))
+    {
+        return;
+    }
+
+    FILE *file = fopen(temporaryPath, "wb");
+
+    if (!file)
+    {
+        return;
+    }
+
+    static const char zeros[SDF_CACHE_ALIGNMENT] = {0};
+    size_t padding = (size_t)(header.distanceOffset - sizeof(header));
+    size_t sampleCount = (size_t)sdf->dim[0] * sdf->dim[1] * sdf->dim[2];
+
+    int written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  (padding == 0 || fwrite(zeros, 1, padding, file) == padding) &&
+                  fwrite(sdf->distances, sizeof(float), sampleCount, file) == sampleCount;
+
+    if (fclose(file) != 0 || !written || rename(temporaryPath, cachePath) != 0)
+    {
+        fprintf(stderr, "Failed to write the SDF cache %s\n", cachePath);
+        remove(temporaryPath);
+    }
+}
+
+void sdfBake(const ObjMesh *mesh, const SdfBakeInfo *info, const char *cachePath, SdfGrid *sdf)
+{
+    memset(sdf, 0, sizeof(*sdf));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t key = cacheKey(mesh, info);
+
+    if (cachePath && mapCache(cachePath, key, sdf))
+    {
+        printf("Obstacle SDF mapped from %s: %ux%ux%u samples in %.1f ms\n", cachePath, sdf->dim[0], sdf->dim[1], sdf->dim[2], elapsedMilliseconds(&start));
+        return;
+    }
+
+    sdf->cellSize = info->cellSize;
+    sdf->bandWidth = info->bandWidth;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        sdf->origin[axis] = info->gridMin[axis];
+        sdf->dim[axis] = (uint32_t)ceilf((info->gridMax[axis] - info->gridMin[axis]) / info->cellSize) + 1;
+
+        if (sdf->dim[axis] < 2)
+        {
+            sdf->dim[axis] = 2;
+        }
+    }
+
+    // Uniform scale into the placement box, centered on x and z and standing on its floor
+    float scale = INFINITY;
+    float offset[3];
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float extent = mesh->boundsMax[axis] - mesh->boundsMin[axis];
+
+        if (extent > 0.0f)
+        {
+            scale = fminf(scale, (info->placementMax[axis] - info->placementMin[axis]) / extent);
+        }
+    }
+
+    scale = isfinite(scale) ? scale : 1.0f;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float center = 0.5f * (mesh->boundsMin[axis] + mesh->boundsMax[axis]);
+        offset[axis] = 0.5f * (info->placementMin[axis] + info->placementMax[axis]) - center * scale;
+    }
+
+    offset[1] = info->placementMin[1] - mesh->boundsMin[1] * scale;
+
+    SdfBaker baker = {};
+    uint32_t threadCount = threadPoolThreadCount();
+    float *vertices = allocateOrExit((size_t)mesh->vertexCount * 3 * sizeof(float));
+
+    for (size_t i = 0; i < (size_t)mesh->vertexCount * 3; i++)
+    {
+        vertices[i] = mesh->positions[i] * scale + offset[i % 3];
+    }
+
+    baker.sdf = sdf;
+    baker.vertices = vertices;
+    baker.indices = mesh->indices;
+    baker.order = allocateOrExit((size_t)mesh->triangleCount * sizeof(uint32_t));
+    baker.centroids = allocateOrExit((size_t)mesh->triangleCount * 3 * sizeof(float));
+    baker.nodes = allocateOrExit((2 * (size_t)mesh->triangleCount) * sizeof(SdfBvhNode));
+    baker.crossings = calloc(threadCount, sizeof(float *));
+    baker.crossingCapacity = calloc(threadCount, sizeof(uint32_t));
+    sdf->ownedDistances = allocateOrExit((size_t)sdf->dim[0] * sdf->dim[1] * sdf->dim[2] * sizeof(float));
+    baker.distances = sdf->ownedDistances;
+
+    if (!baker.crossings || !baker.crossingCapacity)
+    {
+        fprintf(stderr, "Failed to allocate SDF memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t triangle = 0; triangle < mesh->triangleCount; triangle++)
+    {
+        baker.order[triangle] = triangle;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            baker.centroids[3 * triangle + axis] = (triangleVertex(&baker, triangle, 0)[axis] + triangleVertex(&baker, triangle, 1)[axis] + triangleVertex(&baker, triangle, 2)[axis]) / 3.0f;
+        }
+    }
+
+    buildNode(&baker, 0, mesh->triangleCount, 0);
+
+    threadPoolRun(bakeSliceTask, &baker, sdf->dim[2]);
+
+    sdf->distances = sdf->ownedDistances;
+
+    for (uint32_t thread = 0; thread < threadCount; thread++)
+    {
+        free(baker.crossings[thread]);
+    }
+
+    free(baker.crossings);
+    free(baker.crossingCapacity);
+    free(baker.nodes);
+    free(baker.centroids);
+    free(baker.order);
+    free(vertices);
+
+    printf("Obstacle SDF baked: %ux%ux%u samples, %u BVH nodes in %.1f ms (%u threads)\n", sdf->dim[0], sdf->dim[1], sdf->dim[2], baker.nodeCount,
+           elapsedMilliseconds(&start), threadCount);
+
+    if (cachePath)
+    {
+        writeCache(cachePath, key, sdf);
+    }
+}
+
+float sdfSample(const SdfGrid *sdf, float x, float y, float z, float gradient[3])
+{
+    float position[3] = {x, y, z};
+    uint32_t cell[3];
+    float t[3];
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float coordinate = (position[axis] - sdf->origin[axis]) / sdf->cellSize;
+        coordinate = fminf(fmaxf(coordinate, 0.0f), (float)(sdf->dim[axis] - 1));
+
+        cell[axis] = (uint32_t)coordinate;
+
+        if (cell[axis] > sdf->dim[axis] - 2)
+        {
+            cell[axis] = sdf->dim[axis] - 2;
+        }
+
+        t[axis] = coordinate - (float)cell[axis];
+    }
+
+    size_t strideY = sdf->dim[0];
+    size_t strideZ = (size_t)sdf->dim[0] * sdf->dim[1];
+    const float *c = sdf->distances + cell[0] + strideY * cell[1] + strideZ * cell[2];
+
+    float c000 = c[0];
+    float c100 = c[1];
+    float c010 = c[strideY];
+    float c110 = c[strideY + 1];
+    float c001 = c[strideZ];
+    float c101 = c[strideZ + 1];
+    float c011 = c[strideZ + strideY];
+    float c111 = c[strideZ + strideY + 1];
+
+    // Edges along x, then faces along y, then the value along z
+    float c00 = c000 + (c100 - c000) * t[0];
+    float c10 = c010 + (c110 - c010) * t[0];
+    float c01 = c001 + (c101 - c001) * t[0];
+    float c11 = c011 + (c111 - c011) * t[0];
+    float c0 = c00 + (c10 - c00) * t[1];
+    float c1 = c01 + (c11 - c01) * t[1];
+
+    if (gradient)
+    {
+        float dx0 = (c100 - c000) + ((c110 - c010) - (c100 - c000)) * t[1];
+        float dx1 = (c101 - c001) + ((c111 - c011) - (c101 - c001)) * t[1];
+
+        gradient[0] = (dx0 + (dx1 - dx0) * t[2]) / sdf->cellSize;
+        gradient[1] = ((c10 - c00) + ((c11 - c01) - (c10 - c00)) * t[2]) / sdf->cellSize;
+        gradient[2] = (c1 - c0) / sdf->cellSize;
+    }
+
+    return c0 + (c1 - c0) * t[2];
+}
+
+void sdfDestroy(SdfGrid *sdf)
+{
+    if (sdf->mapping)
+    {
+        munmap(sdf->mapping, sdf->mappingSize);
+    }
+
+    free(sdf->ownedDistances);
+    memset(sdf, 0, sizeof(*sdf));
+}
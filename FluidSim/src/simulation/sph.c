@@ -0,0 +1,1009 @@
+#include "sph.h"
+#include "sdf.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define SPH_PI 3.14159265358979323846f
+
+static int clampCell(float value, float minimum, float cellSize, uint32_t dim)
+{
+    int cell = (int)floorf((value - minimum) / cellSize);
+
+    if (cell < 0)
+    {
+        return 0;
+    }
+
+    if (cell >= (int)dim)
+    {
+        return (int)dim - 1;
+    }
+
+    return cell;
+}
+
+static float *allocateFloats(uint32_t count)
+{
+    float *data = calloc(count, sizeof(float));
+
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate particle storage!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return data;
+}
+
+static uint32_t *allocateUints(uint32_t count)
+{
+    uint32_t *data = calloc(count, sizeof(uint32_t));
+
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate neighbor grid storage!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return data;
+}
+
+static int particleAlive(const SphSolver *solver, uint32_t i)
+{
+    return !solver->alive || solver->alive[i];
+}
+
+// Neighbor candidates of a particle as ranges of an index array: its Verlet list when the lists are in
+// use, otherwise the particles of the 3x3x3 grid cells around it, in the order the GPU walks them
+typedef struct {
+    const uint32_t *indices;
+    uint32_t rangeCount;
+    uint32_t begin[27];
+    uint32_t end[27];
+} NeighborRanges;
+
+static void neighborRanges(const SphSolver *solver, uint32_t i, NeighborRanges *ranges)
+{
+    const SphParams *params = &solver->params;
+
+    if (params->neighborSkin > 0.0f)
+    {
+        ranges->indices = solver->neighborList;
+        ranges->rangeCount = 1;
+        ranges->begin[0] = solver->neighborStart[i];
+        ranges->end[0] = solver->neighborStart[i + 1];
+        return;
+    }
+
+    float h = params->smoothingRadius;
+    int cx = clampCell(solver->posX[i], params->boundsMin[0], h, solver->gridDim[0]);
+    int cy = clampCell(solver->posY[i], params->boundsMin[1], h, solver->gridDim[1]);
+    int cz = clampCell(solver->posZ[i], params->boundsMin[2], h, solver->gridDim[2]);
+
+    ranges->indices = solver->sortedIndices;
+    ranges->rangeCount = 0;
+
+    for (int z = cz - 1; z <= cz + 1; z++)
+    {
+        if (z < 0 || z >= (int)solver->gridDim[2])
+        {
+            continue;
+        }
+
+        for (int y = cy - 1; y <= cy + 1; y++)
+        {
+            if (y < 0 || y >= (int)solver->gridDim[1])
+            {
+                continue;
+            }
+
+            for (int x = cx - 1; x <= cx + 1; x++)
+            {
+                if (x < 0 || x >= (int)solver->gridDim[0])
+                {
+                    continue;
+                }
+
+                uint32_t cell = (uint32_t)x + solver->gridDim[0] * ((uint32_t)y + solver->gridDim[1] * (uint32_t)z);
+
+                if (solver->cellStart[cell] < solver->cellEnd[cell])
+                {
+                    ranges->begin[ranges->rangeCount] = solver->cellStart[cell];
+                    ranges->end[ranges->rangeCount] = solver->cellEnd[cell];
+                    ranges->rangeCount++;
+                }
+            }
+        }
+    }
+}
+
+SphParams sphDefaultParams(uint32_t particleCount)
+{
+    SphParams params = {};
+
+    params.particleCount = particleCount;
+    params.smoothingRadius = 0.1f;
+    params.particleSpacing = 0.05f;
+    params.restDensity = 1000.0f;
+    params.stiffness = 1000.0f;
+    params.viscosity = 1.0f;
+    params.boundaryDamping = 0.3f;
+    params.timeStep = 0.0005f;
+    params.obstacleMargin = 0.5f * params.particleSpacing;
+    params.viscosityIterations = 0;
+    params.viscosityTolerance = 1e-4f;
+    params.neighborSkin = 0.0f;
+
+    params.gravity[0] = 0.0f;
+    params.gravity[1] = -9.81f;
+    params.gravity[2] = 0.0f;
+
+    // The particles start as a cube in a corner of the domain (dam break)
+    uint32_t side = (uint32_t)ceil(cbrt((double)particleCount));
+    float blockSize = side * params.particleSpacing;
+
+    params.boundsMin[0] = 0.0f;
+    params.boundsMin[1] = 0.0f;
+    params.boundsMin[2] = 0.0f;
+    params.boundsMax[0] = 2.5f * blockSize;
+    params.boundsMax[1] = 1.5f * blockSize;
+    params.boundsMax[2] = blockSize + params.particleSpacing;
+
+    // Pick the mass so that the seeded lattice sits exactly at the rest density
+    float h = params.smoothingRadius;
+    float poly6 = 315.0f / (64.0f * SPH_PI * powf(h, 9.0f));
+    float latticeSum = 0.0f;
+    int reach = (int)ceilf(h / params.particleSpacing);
+
+    for (int z = -reach; z <= reach; z++)
+    {
+        for (int y = -reach; y <= reach; y++)
+        {
+            for (int x = -reach; x <= reach; x++)
+            {
+                float r2 = (x * x + y * y + z * z) * params.particleSpacing * params.particleSpacing;
+
+                if (r2 < h * h)
+                {
+                    float diff = h * h - r2;
+                    latticeSum += poly6 * diff * diff * diff;
+                }
+            }
+        }
+    }
+
+    params.particleMass = params.restDensity / latticeSum;
+
+    return params;
+}
+
+void sphInit(SphSolver *solver, const SphParams *params)
+{
+    memset(solver, 0, sizeof(*solver));
+
+    solver->params = *params;
+    solver->count = params->particleCount;
+
+    uint32_t count = solver->count;
+
+    solver->posX = allocateFloats(count);
+    solver->posY = allocateFloats(count);
+    solver->posZ = allocateFloats(count);
+    solver->velX = allocateFloats(count);
+    solver->velY = allocateFloats(count);
+    solver->velZ = allocateFloats(count);
+    solver->accX = allocateFloats(count);
+    solver->accY = allocateFloats(count);
+    solver->accZ = allocateFloats(count);
+    solver->density = allocateFloats(count);
+    solver->pressure = allocateFloats(count);
+
+    float h = params->smoothingRadius;
+    solver->poly6 = 315.0f / (64.0f * SPH_PI * powf(h, 9.0f));
+    solver->spikyGradient = -45.0f / (SPH_PI * powf(h, 6.0f));
+    solver->viscosityLaplacian = 45.0f / (SPH_PI * powf(h, 6.0f));
+
+    solver->cellCount = 1;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float extent = params->boundsMax[axis] - params->boundsMin[axis];
+        uint32_t dim = (uint32_t)ceilf(extent / h);
+
+        solver->gridDim[axis] = dim > 0 ? dim : 1;
+        solver->cellCount *= solver->gridDim[axis];
+    }
+
+    solver->cellKeys = allocateUints(count);
+    solver->sortedIndices = allocateUints(count);
+    solver->cellStart = allocateUints(solver->cellCount);
+    solver->cellEnd = allocateUints(solver->cellCount);
+
+    if (params->viscosityIterations > 0)
+    {
+        solver->viscositySolution = allocateFloats(3 * count);
+        solver->viscosityResidual = allocateFloats(3 * count);
+        solver->viscosityDirection = allocateFloats(3 * count);
+        solver->viscosityProduct = allocateFloats(3 * count);
+        solver->viscosityDiagonal = allocateFloats(count);
+    }
+
+    if (params->neighborSkin > 0.0f)
+    {
+        // About the neighbors within h + skin at the seeded spacing, grown by the builds when short
+        float radius = (h + params->neighborSkin) / params->particleSpacing;
+
+        solver->neighborCapacity = count * (uint32_t)ceilf(4.0f / 3.0f * SPH_PI * radius * radius * radius);
+        solver->neighborStart = allocateUints(count + 1);
+        solver->neighborList = allocateUints(solver->neighborCapacity);
+        solver->buildX = allocateFloats(count);
+        solver->buildY = allocateFloats(count);
+        solver->buildZ = allocateFloats(count);
+        solver->maxDisplacement2 = INFINITY;
+    }
+
+    printf("SPH solver: %u particles, grid %ux%ux%u\n", count, solver->gridDim[0], solver->gridDim[1], solver->gridDim[2]);
+}
+
+void sphSeedDamBreak(SphSolver *solver)
+{
+    const SphParams *params = &solver->params;
+    uint32_t side = (uint32_t)ceil(cbrt((double)solver->count));
+    float spacing = params->particleSpacing;
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        uint32_t x = i % side;
+        uint32_t z = (i / side) % side;
+        uint32_t y = i / (side * side);
+
+        solver->posX[i] = params->boundsMin[0] + (x + 0.5f) * spacing;
+        solver->posY[i] = params->boundsMin[1] + (y + 0.5f) * spacing;
+        solver->posZ[i] = params->boundsMin[2] + (z + 0.5f) * spacing;
+
+        solver->velX[i] = 0.0f;
+        solver->velY[i] = 0.0f;
+        solver->velZ[i] = 0.0f;
+        solver->density[i] = params->restDensity;
+    }
+}
+
+uint32_t sphCellKey(const SphSolver *solver, float x, float y, float z)
+{
+    const SphParams *params = &solver->params;
+    float h = params->smoothingRadius;
+
+    int cx = clampCell(x, params->boundsMin[0], h, solver->gridDim[0]);
+    int cy = clampCell(y, params->boundsMin[1], h, solver->gridDim[1]);
+    int cz = clampCell(z, params->boundsMin[2], h, solver->gridDim[2]);
+
+    return (uint32_t)cx + solver->gridDim[0] * ((uint32_t)cy + solver->gridDim[1] * (uint32_t)cz);
+}
+
+void sphBuildGrid(SphSolver *solver)
+{
+    // Counting sort by cell key, stable so it produces the same order as the GPU radix sort
+    memset(solver->cellStart, 0, solver->cellCount * sizeof(uint32_t));
+    memset(solver->cellEnd, 0, solver->cellCount * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        if (!particleAlive(solver, i))
+        {
+            continue;
+        }
+
+        uint32_t key = sphCellKey(solver, solver->posX[i], solver->posY[i], solver->posZ[i]);
+        solver->cellKeys[i] = key;
+        solver->cellEnd[key]++;
+    }
+
+    uint32_t offset = 0;
+
+    for (uint32_t cell = 0; cell < solver->cellCount; cell++)
+    {
+        uint32_t cellSize = solver->cellEnd[cell];
+        solver->cellStart[cell] = offset;
+        solver->cellEnd[cell] = offset;
+        offset += cellSize;
+    }
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        if (!particleAlive(solver, i))
+        {
+            continue;
+        }
+
+        uint32_t key = solver->cellKeys[i];
+        solver->sortedIndices[solver->cellEnd[key]++] = i;
+    }
+}
+
+// Lists every particle within h + skin of each particle, walking as many grid cells around it as the
+// larger radius needs
+static void buildNeighborLists(SphSolver *solver)
+{
+    const SphParams *params = &solver->params;
+    float h = params->smoothingRadius;
+    float radius = h + params->neighborSkin;
+    float radius2 = radius * radius;
+    int reach = (int)ceilf(radius / h);
+    uint32_t size = 0;
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        float xi = solver->posX[i];
+        float yi = solver->posY[i];
+        float zi = solver->posZ[i];
+
+        int cx = clampCell(xi, params->boundsMin[0], h, solver->gridDim[0]);
+        int cy = clampCell(yi, params->boundsMin[1], h, solver->gridDim[1]);
+        int cz = clampCell(zi, params->boundsMin[2], h, solver->gridDim[2]);
+
+        solver->neighborStart[i] = size;
+
+        // Dead slots get an empty list, the others never see them since they are not in the grid
+        if (!particleAlive(solver, i))
+        {
+            continue;
+        }
+
+        for (int z = cz - reach > 0 ? cz - reach : 0; z <= cz + reach && z < (int)solver->gridDim[2]; z++)
+        {
+            for (int y = cy - reach > 0 ? cy - reach : 0; y <= cy + reach && y < (int)solver->gridDim[1]; y++)
+            {
+                for (int x = cx - reach > 0 ? cx - reach : 0; x <= cx + reach && x < (int)solver->gridDim[0]; x++)
+                {
+                    uint32_t cell = (uint32_t)x + solver->gridDim[0] * ((uint32_t)y + solver->gridDim[1] * (uint32_t)z);
+
+                    for (uint32_t k = solver->cellStart[cell]; k < solver->cellEnd[cell]; k++)
+                    {
+                        uint32_t j = solver->sortedIndices[k];
+
+                        float dx = xi - solver->posX[j];
+                        float dy = yi - solver->posY[j];
+                        float dz = zi - solver->posZ[j];
+
+                        if (dx * dx + dy * dy + dz * dz >= radius2)
+                        {
+                            continue;
+                        }
+
+                        if (size == solver->neighborCapacity)
+                        {
+                            uint32_t *grown = realloc(solver->neighborList, 2 * (size_t)solver->neighborCapacity * sizeof(uint32_t));
+
+                            if (!grown)
+                            {
+                                fprintf(stderr, "Failed to grow the neighbor lists!\n");
+                                exit(EXIT_FAILURE);
+                            }
+
+                            solver->neighborList = grown;
+                            solver->neighborCapacity *= 2;
+                        }
+
+                        solver->neighborList[size++] = j;
+                    }
+                }
+            }
+        }
+    }
+
+    solver->neighborStart[solver->count] = size;
+}
+
+void sphUpdateNeighbors(SphSolver *solver)
+{
+    float skin = solver->params.neighborSkin;
+
+    solver->neighborUpdates++;
+
+    // Two particles that each moved half the skin towards each other can just have come within h
+    if (4.0f * solver->maxDisplacement2 <= skin * skin)
+    {
+        return;
+    }
+
+    sphBuildGrid(solver);
+    buildNeighborLists(solver);
+
+    memcpy(solver->buildX, solver->posX, solver->count * sizeof(float));
+    memcpy(solver->buildY, solver->posY, solver->count * sizeof(float));
+    memcpy(solver->buildZ, solver->posZ, solver->count * sizeof(float));
+
+    solver->maxDisplacement2 = 0.0f;
+    solver->neighborBuilds++;
+}
+
+void sphComputeDensity(SphSolver *solver)
+{
+    const SphParams *params = &solver->params;
+    float h = params->smoothingRadius;
+    float h2 = h * h;
+    float mass = params->particleMass;
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        if (!particleAlive(solver, i))
+        {
+            continue;
+        }
+
+        float xi = solver->posX[i];
+        float yi = solver->posY[i];
+        float zi = solver->posZ[i];
+
+        NeighborRanges ranges;
+        neighborRanges(solver, i, &ranges);
+
+        float density = 0.0f;
+
+        for (uint32_t range = 0; range < ranges.rangeCount; range++)
+        {
+            for (uint32_t k = ranges.begin[range]; k < ranges.end[range]; k++)
+            {
+                uint32_t j = ranges.indices[k];
+
+                float dx = xi - solver->posX[j];
+                float dy = yi - solver->posY[j];
+                float dz = zi - solver->posZ[j];
+                float r2 = dx * dx + dy * dy + dz * dz;
+
+                if (r2 < h2)
+                {
+                    float diff = h2 - r2;
+                    density += mass * solver->poly6 * diff * diff * diff;
+                }
+            }
+        }
+
+        solver->density[i] = density;
+        solver->pressure[i] = fmaxf(params->stiffness * (density - params->restDensity), 0.0f);
+    }
+}
+
+void sphComputeForces(SphSolver *solver)
+{
+    const SphParams *params = &solver->params;
+    float h = params->smoothingRadius;
+    float h2 = h * h;
+    float mass = params->particleMass;
+    float viscosity = params->viscosityIterations > 0 ? 0.0f : params->viscosity; // Solved by sphSolveViscosity
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        if (!particleAlive(solver, i))
+        {
+            continue;
+        }
+
+        float xi = solver->posX[i];
+        float yi = solver->posY[i];
+        float zi = solver->posZ[i];
+        float pi = solver->pressure[i];
+        float rhoi = solver->density[i];
+
+        NeighborRanges ranges;
+        neighborRanges(solver, i, &ranges);
+
+        float pressureForce[3] = {0.0f, 0.0f, 0.0f};
+        float viscosityForce[3] = {0.0f, 0.0f, 0.0f};
+
+        for (uint32_t range = 0; range < ranges.rangeCount; range++)
+        {
+            for (uint32_t k = ranges.begin[range]; k < ranges.end[range]; k++)
+            {
+                uint32_t j = ranges.indices[k];
+
+                if (j == i)
+                {
+                    continue;
+                }
+
+                float dx = xi - solver->posX[j];
+                float dy = yi - solver->posY[j];
+                float dz = zi - solver->posZ[j];
+                float r2 = dx * dx + dy * dy + dz * dz;
+
+                if (r2 >= h2 || r2 < 1e-12f)
+                {
+                    continue;
+                }
+
+                float r = sqrtf(r2);
+                float diff = h - r;
+                float rhoj = solver->density[j];
+
+                // Symmetric pressure term, spiky kernel gradient along the direction to the neighbor
+                float pressureScale = -mass * (pi + solver->pressure[j]) / (2.0f * rhoj) * solver->spikyGradient * diff * diff / r;
+                pressureForce[0] += pressureScale * dx;
+                pressureForce[1] += pressureScale * dy;
+                pressureForce[2] += pressureScale * dz;
+
+                float viscosityScale = mass * solver->viscosityLaplacian * diff / rhoj;
+                viscosityForce[0] += viscosityScale * (solver->velX[j] - solver->velX[i]);
+                viscosityForce[1] += viscosityScale * (solver->velY[j] - solver->velY[i]);
+                viscosityForce[2] += viscosityScale * (solver->velZ[j] - solver->velZ[i]);
+            }
+        }
+
+        solver->accX[i] = (pressureForce[0] + viscosity * viscosityForce[0]) / rhoi + params->gravity[0];
+        solver->accY[i] = (pressureForce[1] + viscosity * viscosityForce[1]) / rhoi + params->gravity[1];
+        solver->accZ[i] = (pressureForce[2] + viscosity * viscosityForce[2]) / rhoi + params->gravity[2];
+    }
+}
+
+// output = (I - dt L) input for the three components, L v_i = sum_j w_ij (v_j - v_i) with the symmetric
+// weights w_ij = viscosity * m * laplacian W_ij / (rho_i rho_j) of the explicit viscosity force, so the
+// matrix is symmetric positive definite. Walks the neighbors on every call instead of storing the matrix.
+// diagonal, when not NULL, receives 1 + dt sum_j w_ij
+static void applyViscosityOperator(SphSolver *solver, const float *input, float *output, float *diagonal)
+{
+    const SphParams *params = &solver->params;
+    float h = params->smoothingRadius;
+    float h2 = h * h;
+    float scale = params->timeStep * params->viscosity * params->particleMass * solver->viscosityLaplacian;
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        float xi = solver->posX[i];
+        float yi = solver->posY[i];
+        float zi = solver->posZ[i];
+        float rhoi = solver->density[i];
+
+        NeighborRanges ranges;
+        neighborRanges(solver, i, &ranges);
+
+        float sum[3] = {0.0f, 0.0f, 0.0f};
+        float weightSum = 0.0f;
+
+        // A dead slot is an identity row, its residual stays 0 and it adds nothing to the dot products
+        if (!particleAlive(solver, i))
+        {
+            ranges.rangeCount = 0;
+        }
+
+        for (uint32_t range = 0; range < ranges.rangeCount; range++)
+        {
+            for (uint32_t k = ranges.begin[range]; k < ranges.end[range]; k++)
+            {
+                uint32_t j = ranges.indices[k];
+
+                if (j == i)
+                {
+                    continue;
+                }
+
+                float dx = xi - solver->posX[j];
+                float dy = yi - solver->posY[j];
+                float dz = zi - solver->posZ[j];
+                float r2 = dx * dx + dy * dy + dz * dz;
+
+                if (r2 >= h2 || r2 < 1e-12f)
+                {
+                    continue;
+                }
+
+                float weight = scale * (h - sqrtf(r2)) / (rhoi * solver->density[j]);
+
+                weightSum += weight;
+
+                if (input)
+                {
+                    sum[0] += weight * (input[3 * i + 0] - input[3 * j + 0]);
+                    sum[1] += weight * (input[3 * i + 1] - input[3 * j + 1]);
+                    sum[2] += weight * (input[3 * i + 2] - input[3 * j + 2]);
+                }
+            }
+        }
+
+        if (input)
+        {
+            output[3 * i + 0] = input[3 * i + 0] + sum[0];
+            output[3 * i + 1] = input[3 * i + 1] + sum[1];
+            output[3 * i + 2] = input[3 * i + 2] + sum[2];
+        }
+
+        if (diagonal)
+        {
+            diagonal[i] = 1.0f + weightSum;
+        }
+    }
+}
+
+void sphSolveViscosity(SphSolver *solver)
+{
+    const SphParams *params = &solver->params;
+    float dt = params->timeStep;
+    float tolerance2 = params->viscosityTolerance * params->viscosityTolerance;
+    float *x = solver->viscositySolution;
+    float *r = solver->viscosityResidual;
+    float *p = solver->viscosityDirection;
+    float *q = solver->viscosityProduct;
+    float *diagonal = solver->viscosityDiagonal;
+    uint32_t n = 3 * solver->count;
+
+    // Right hand side: the velocities the other forces lead to, which also start the iteration
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        x[3 * i + 0] = solver->velX[i] + solver->accX[i] * dt;
+        x[3 * i + 1] = solver->velY[i] + solver->accY[i] * dt;
+        x[3 * i + 2] = solver->velZ[i] + solver->accZ[i] * dt;
+    }
+
+    applyViscosityOperator(solver, x, q, diagonal);
+
+    // The three components are independent systems with the same matrix, each with its own step sizes
+    double rz[3] = {0.0, 0.0, 0.0};
+
+    for (uint32_t k = 0; k < n; k++)
+    {
+        r[k] = x[k] - q[k];
+        p[k] = r[k] / diagonal[k / 3];
+        rz[k % 3] += (double)r[k] * p[k];
+    }
+
+    double initial[3] = {rz[0], rz[1], rz[2]};
+
+    solver->viscosityIterationsUsed = 0;
+
+    for (uint32_t iteration = 0; iteration < params->viscosityIterations; iteration++)
+    {
+        applyViscosityOperator(solver, p, q, NULL);
+
+        double pq[3] = {0.0, 0.0, 0.0};
+
+        for (uint32_t k = 0; k < n; k++)
+        {
+            pq[k % 3] += (double)p[k] * q[k];
+        }
+
+        // A converged component gets a zero step, the GPU solver runs its fixed iteration count that way
+        float alpha[3];
+        int active = 0;
+
+        for (int c = 0; c < 3; c++)
+        {
+            alpha[c] = rz[c] > tolerance2 * initial[c] && pq[c] > 0.0 ? (float)(rz[c] / pq[c]) : 0.0f;
+            active |= alpha[c] != 0.0f;
+        }
+
+        if (!active)
+        {
+            break;
+        }
+
+        double rzNext[3] = {0.0, 0.0, 0.0};
+
+        for (uint32_t k = 0; k < n; k++)
+        {
+            x[k] += alpha[k % 3] * p[k];
+            r[k] -= alpha[k % 3] * q[k];
+            rzNext[k % 3] += (double)r[k] * r[k] / diagonal[k / 3];
+        }
+
+        float beta[3];
+
+        for (int c = 0; c < 3; c++)
+        {
+            beta[c] = alpha[c] != 0.0f ? (float)(rzNext[c] / rz[c]) : 0.0f;
+            rz[c] = rzNext[c];
+        }
+
+        for (uint32_t k = 0; k < n; k++)
+        {
+            p[k] = r[k] / diagonal[k / 3] + beta[k % 3] * p[k];
+        }
+
+        solver->viscosityIterationsUsed = iteration + 1;
+    }
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        solver->accX[i] = (x[3 * i + 0] - solver->velX[i]) / dt;
+        solver->accY[i] = (x[3 * i + 1] - solver->velY[i]) / dt;
+        solver->accZ[i] = (x[3 * i + 2] - solver->velZ[i]) / dt;
+    }
+}
+
+float sphViscousTimeStepLimit(const SphParams *params)
+{
+    // Gershgorin bound of the viscosity operator: the weights sum to about 15 viscosity / (rho h^2)
+    // over a full neighborhood, explicit Euler needs dt times that below 1 (2 for the real extreme
+    // eigenvalue, the margin covers denser than rest neighborhoods)
+    float h = params->smoothingRadius;
+
+    return params->viscosity > 0.0f ? params->restDensity * h * h / (15.0f * params->viscosity) : INFINITY;
+}
+
+static void resolveBoundary(float *position, float *velocity, float minimum, float maximum, float damping)
+{
+    if (*position < minimum)
+    {
+        *position = minimum;
+
+        if (*velocity < 0.0f)
+        {
+            *velocity *= -damping;
+        }
+    }
+    else if (*position > maximum)
+    {
+        *position = maximum;
+
+        if (*velocity > 0.0f)
+        {
+            *velocity *= -damping;
+        }
+    }
+}
+
+// Pushes a particle out of the obstacle to obstacleMargin along the SDF gradient and reflects the
+// approaching normal velocity with the wall damping. Runs before the walls, which get the last word
+static void resolveObstacle(const SphParams *params, float *x, float *y, float *z, float *vx, float *vy, float *vz)
+{
+    float gradient[3];
+    float distance = sdfSample(params->obstacle, *x, *y, *z, gradient);
+
+    if (distance >= params->obstacleMargin)
+    {
+        return;
+    }
+
+    float length = sqrtf(gradient[0] * gradient[0] + gradient[1] * gradient[1] + gradient[2] * gradient[2]);
+
+    if (length < 1e-6f)
+    {
+        return;
+    }
+
+    float normal[3] = {gradient[0] / length, gradient[1] / length, gradient[2] / length};
+    float push = params->obstacleMargin - distance;
+
+    *x += normal[0] * push;
+    *y += normal[1] * push;
+    *z += normal[2] * push;
+
+    float normalVelocity = *vx * normal[0] + *vy * normal[1] + *vz * normal[2];
+
+    if (normalVelocity < 0.0f)
+    {
+        float change = (1.0f + params->boundaryDamping) * normalVelocity;
+
+        *vx -= change * normal[0];
+        *vy -= change * normal[1];
+        *vz -= change * normal[2];
+    }
+}
+
+void sphIntegrate(SphSolver *solver)
+{
+    const SphParams *params = &solver->params;
+    float dt = params->timeStep;
+    float maxDisplacement2 = solver->maxDisplacement2;
+
+    // Semi-implicit Euler: velocity first, then position with the new velocity
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        if (!particleAlive(solver, i))
+        {
+            continue;
+        }
+
+        solver->velX[i] += solver->accX[i] * dt;
+        solver->velY[i] += solver->accY[i] * dt;
+        solver->velZ[i] += solver->accZ[i] * dt;
+
+        solver->posX[i] += solver->velX[i] * dt;
+        solver->posY[i] += solver->velY[i] * dt;
+        solver->posZ[i] += solver->velZ[i] * dt;
+
+        if (params->obstacle)
+        {
+            resolveObstacle(params, &solver->posX[i], &solver->posY[i], &solver->posZ[i], &solver->velX[i], &solver->velY[i], &solver->velZ[i]);
+        }
+
+        resolveBoundary(&solver->posX[i], &solver->velX[i], params->boundsMin[0], params->boundsMax[0], params->boundaryDamping);
+        resolveBoundary(&solver->posY[i], &solver->velY[i], params->boundsMin[1], params->boundsMax[1], params->boundaryDamping);
+        resolveBoundary(&solver->posZ[i], &solver->velZ[i], params->boundsMin[2], params->boundsMax[2], params->boundaryDamping);
+
+        // Tracked while the positions are at hand, so deciding on a list rebuild is free
+        if (params->neighborSkin > 0.0f)
+        {
+            float dx = solver->posX[i] - solver->buildX[i];
+            float dy = solver->posY[i] - solver->buildY[i];
+            float dz = solver->posZ[i] - solver->buildZ[i];
+
+            maxDisplacement2 = fmaxf(maxDisplacement2, dx * dx + dy * dy + dz * dz);
+        }
+    }
+
+    solver->maxDisplacement2 = maxDisplacement2;
+}
+
+// Adds the time since mark to a phase of the metrics and moves the mark to now
+static void publishPhase(MetricPhase phase, struct timespec *mark)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    metricsAddPhaseTime(phase, (double)(now.tv_sec - mark->tv_sec) + (double)(now.tv_nsec - mark->tv_nsec) / 1e9);
+    *mark = now;
+}
+
+void sphStep(SphSolver *solver)
+{
+    // Only timed while the metrics are served, the flag is read once so a step is timed whole or not at all
+    int timed = metricsActive;
+    struct timespec mark;
+
+    if (timed)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &mark);
+    }
+
+    if (solver->params.neighborSkin > 0.0f)
+    {
+        sphUpdateNeighbors(solver);
+    }
+    else
+    {
+        sphBuildGrid(solver);
+    }
+
+    if (timed)
+    {
+        publishPhase(METRIC_PHASE_NEIGHBORS, &mark);
+    }
+
+    sphComputeDensity(solver);
+
+    if (timed)
+    {
+        publishPhase(METRIC_PHASE_DENSITY, &mark);
+    }
+
+    sphComputeForces(solver);
+
+    if (timed)
+    {
+        publishPhase(METRIC_PHASE_FORCES, &mark);
+    }
+
+    if (solver->params.viscosityIterations > 0)
+    {
+        sphSolveViscosity(solver);
+
+        if (timed)
+        {
+            publishPhase(METRIC_PHASE_VISCOSITY, &mark);
+        }
+    }
+
+    sphIntegrate(solver);
+
+    if (timed)
+    {
+        publishPhase(METRIC_PHASE_INTEGRATE, &mark);
+
+        metricsAdd(METRIC_STEPS, 1.0);
+        metricsSet(METRIC_PARTICLES, solver->count);
+        metricsSet(METRIC_TIME_STEP, solver->params.timeStep);
+        metricsSet(METRIC_SOLVER_ITERATIONS, solver->params.viscosityIterations > 0 ? solver->viscosityIterationsUsed : 0);
+    }
+}
+
+static double elapsedMilliseconds(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)(now.tv_sec - start->tv_sec) * 1000.0 + (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+void sphNeighborReport(const SphParams *params, uint32_t stepCount)
+{
+    SphParams listParams = *params;
+    SphParams gridParams = *params;
+    SphSolver lists;
+    SphSolver grid;
+
+    if (listParams.neighborSkin <= 0.0f)
+    {
+        listParams.neighborSkin = 0.2f * params->smoothingRadius;
+    }
+
+    gridParams.neighborSkin = 0.0f;
+
+    sphInit(&lists, &listParams);
+    sphSeedDamBreak(&lists);
+    sphInit(&grid, &gridParams);
+    sphSeedDamBreak(&grid);
+
+    double listMilliseconds = 0.0;
+    double gridMilliseconds = 0.0;
+    uint32_t reportInterval = stepCount / 10 > 0 ? stepCount / 10 : 1;
+    uint32_t lastBuilds = 0;
+
+    for (uint32_t step = 1; step <= stepCount; step++)
+    {
+        struct timespec start;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        sphStep(&lists);
+        listMilliseconds += elapsedMilliseconds(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        sphStep(&grid);
+        gridMilliseconds += elapsedMilliseconds(&start);
+
+        if (step % reportInterval == 0 || step == stepCount)
+        {
+            uint32_t builds = lists.neighborBuilds - lastBuilds;
+            lastBuilds = lists.neighborBuilds;
+
+            printf("Neighbor step %u: %u rebuilds in the last %u steps, %.1f neighbors per particle, max displacement %.2f skin\n",
+                   step, builds, step % reportInterval == 0 ? reportInterval : step % reportInterval,
+                   (double)lists.neighborStart[lists.count] / lists.count, sqrtf(lists.maxDisplacement2) / listParams.neighborSkin);
+        }
+    }
+
+    float maxDifference = 0.0f;
+
+    for (uint32_t i = 0; i < lists.count; i++)
+    {
+        float dx = lists.posX[i] - grid.posX[i];
+        float dy = lists.posY[i] - grid.posY[i];
+        float dz = lists.posZ[i] - grid.posZ[i];
+
+        maxDifference = fmaxf(maxDifference, sqrtf(dx * dx + dy * dy + dz * dz));
+    }
+
+    size_t listBytes = ((size_t)lists.neighborCapacity + lists.count + 1) * sizeof(uint32_t) + 3 * (size_t)lists.count * sizeof(float);
+
+    printf("Neighbor lists with skin %g (%.2f h): rebuilt every %.1f steps on average, %.2f MB of lists and build positions\n",
+           listParams.neighborSkin, listParams.neighborSkin / params->smoothingRadius, (double)lists.neighborUpdates / lists.neighborBuilds,
+           (double)listBytes / (1024.0 * 1024.0));
+    printf("Neighbor step time: %.3f ms with lists, %.3f ms walking the grid, largest position difference %g\n",
+           listMilliseconds / stepCount, gridMilliseconds / stepCount, maxDifference);
+
+    sphDestroy(&lists);
+    sphDestroy(&grid);
+}
+
+void sphDestroy(SphSolver *solver)
+{
+    free(solver->posX);
+    free(solver->posY);
+    free(solver->posZ);
+    free(solver->velX);
+    free(solver->velY);
+    free(solver->velZ);
+    free(solver->accX);
+    free(solver->accY);
+    free(solver->accZ);
+    free(solver->density);
+    free(solver->pressure);
+    free(solver->cellKeys);
+    free(solver->sortedIndices);
+    free(solver->cellStart);
+    free(solver->cellEnd);
+    free(solver->viscositySolution);
+    free(solver->viscosityResidual);
+    free(solver->viscosityDirection);
+    free(solver->viscosityProduct);
+    free(solver->viscosityDiagonal);
+    free(solver->neighborStart);
+    free(solver->neighborList);
+    free(solver->buildX);
+    free(solver->buildY);
+    free(solver->buildZ);
+
+    memset(solver, 0, sizeof(*solver));
+}
@@ -0,0 +1,803 @@
+#include "sph_adaptive.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define SPH_PI 3.14159265358979323846f
+
+// Particles per thread pool task of the density, force and classification passes
+#define SPH_ADAPTIVE_TASK_PARTICLES 256
+
+// Reduction over the uniform particle count the adaptive resolution is meant to reach
+#define SPH_ADAPTIVE_TARGET_MIN 3.0
+#define SPH_ADAPTIVE_TARGET_MAX 5.0
+
+static void *allocateZeroed(uint32_t count, size_t size)
+{
+    void *data = calloc(count, size);
+
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate adaptive particle storage!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return data;
+}
+
+static int levelIndex(int8_t level)
+{
+    return level - SPH_ADAPTIVE_MIN_LEVEL;
+}
+
+static int gridCoord(float value, float minimum, float cellSize, uint32_t dim)
+{
+    int cell = (int)floorf((value - minimum) / cellSize);
+
+    return cell < 0 ? 0 : cell >= (int)dim ? (int)dim - 1 : cell;
+}
+
+// Cells of the 3x3x3 stencil around a position, clipped to the grid
+static void stencil(const SphAdaptive *adaptive, float x, float y, float z, int low[3], int high[3])
+{
+    const SphParams *params = &adaptive->solver->params;
+    float position[3] = {x, y, z};
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int cell = gridCoord(position[axis], params->boundsMin[axis], adaptive->cellSize, adaptive->gridDim[axis]);
+
+        low[axis] = cell > 0 ? cell - 1 : 0;
+        high[axis] = cell + 1 < (int)adaptive->gridDim[axis] ? cell + 1 : (int)adaptive->gridDim[axis] - 1;
+    }
+}
+
+static uint32_t cellIndex(const SphAdaptive *adaptive, int x, int y, int z)
+{
+    return (uint32_t)x + adaptive->gridDim[0] * ((uint32_t)y + adaptive->gridDim[1] * (uint32_t)z);
+}
+
+void sphAdaptiveInit(SphAdaptive *adaptive, SphSolver *solver)
+{
+    memset(adaptive, 0, sizeof(*adaptive));
+
+    const SphParams *params = &solver->params;
+
+    adaptive->solver = solver;
+    adaptive->capacity = solver->count;
+    adaptive->level = allocateZeroed(solver->count, sizeof(int8_t));
+    adaptive->mass = allocateZeroed(solver->count, sizeof(float));
+    adaptive->refine = allocateZeroed(solver->count, sizeof(uint8_t));
+    adaptive->vorticity = allocateZeroed(solver->count, sizeof(float));
+    adaptive->target = allocateZeroed(solver->count, sizeof(int8_t));
+    adaptive->gradedTarget = allocateZeroed(solver->count, sizeof(int8_t));
+    adaptive->densityOffset = allocateZeroed(solver->count, sizeof(float));
+    adaptive->densityBefore = allocateZeroed(solver->count, sizeof(float));
+    adaptive->claimed = allocateZeroed(solver->count, sizeof(uint8_t));
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        adaptive->mass[i] = params->particleMass;
+    }
+
+    for (int level = SPH_ADAPTIVE_MIN_LEVEL; level <= 0; level++)
+    {
+        adaptive->smoothing[levelIndex((int8_t)level)] = params->smoothingRadius * powf(2.0f, -level / 3.0f);
+    }
+
+    for (int a = 0; a < SPH_ADAPTIVE_LEVEL_COUNT; a++)
+    {
+        for (int b = 0; b < SPH_ADAPTIVE_LEVEL_COUNT; b++)
+        {
+            float h = 0.5f * (adaptive->smoothing[a] + adaptive->smoothing[b]);
+
+            adaptive->pairH[a][b] = h;
+            adaptive->pairPoly6[a][b] = 315.0f / (64.0f * SPH_PI * powf(h, 9.0f));
+            adaptive->pairSpiky[a][b] = -45.0f / (SPH_PI * powf(h, 6.0f));
+            adaptive->pairViscosity[a][b] = 45.0f / (SPH_PI * powf(h, 6.0f));
+        }
+    }
+
+    // The finest grid the smoothing lengths can ask for is the one of the seeded resolution
+    adaptive->cellCount = 1;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        uint32_t dim = (uint32_t)ceilf((params->boundsMax[axis] - params->boundsMin[axis]) / params->smoothingRadius);
+        adaptive->cellCount *= dim > 0 ? dim : 1;
+    }
+
+    adaptive->cellKeys = allocateZeroed(solver->count, sizeof(uint32_t));
+    adaptive->sortedIndices = allocateZeroed(solver->count, sizeof(uint32_t));
+    adaptive->cellStart = allocateZeroed(adaptive->cellCount, sizeof(uint32_t));
+    adaptive->cellEnd = allocateZeroed(adaptive->cellCount, sizeof(uint32_t));
+
+    adaptive->surfaceDensityRatio = 0.9f;
+    adaptive->vorticityThreshold = 15.0f;
+    adaptive->vorticityRatio = 3.0f;
+    adaptive->adaptInterval = 10;
+    adaptive->offsetDecay = 0.99f;
+}
+
+// Counting sort into cells as wide as the coarsest level present
+static void buildGrid(SphAdaptive *adaptive)
+{
+    SphSolver *solver = adaptive->solver;
+    const SphParams *params = &solver->params;
+    int8_t coarsest = 0;
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        coarsest = adaptive->level[i] < coarsest ? adaptive->level[i] : coarsest;
+    }
+
+    adaptive->cellSize = adaptive->smoothing[levelIndex(coarsest)];
+    uint32_t cellCount = 1;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        uint32_t dim = (uint32_t)ceilf((params->boundsMax[axis] - params->boundsMin[axis]) / adaptive->cellSize);
+        adaptive->gridDim[axis] = dim > 0 ? dim : 1;
+        cellCount *= adaptive->gridDim[axis];
+    }
+
+    memset(adaptive->cellStart, 0, cellCount * sizeof(uint32_t));
+    memset(adaptive->cellEnd, 0, cellCount * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        int x = gridCoord(solver->posX[i], params->boundsMin[0], adaptive->cellSize, adaptive->gridDim[0]);
+        int y = gridCoord(solver->posY[i], params->boundsMin[1], adaptive->cellSize, adaptive->gridDim[1]);
+        int z = gridCoord(solver->posZ[i], params->boundsMin[2], adaptive->cellSize, adaptive->gridDim[2]);
+        uint32_t key = cellIndex(adaptive, x, y, z);
+
+        adaptive->cellKeys[i] = key;
+        adaptive->cellEnd[key]++;
+    }
+
+    uint32_t offset = 0;
+
+    for (uint32_t cell = 0; cell < cellCount; cell++)
+    {
+        uint32_t size = adaptive->cellEnd[cell];
+        adaptive->cellStart[cell] = offset;
+        adaptive->cellEnd[cell] = offset;
+        offset += size;
+    }
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        uint32_t key = adaptive->cellKeys[i];
+        adaptive->sortedIndices[adaptive->cellEnd[key]++] = i;
+    }
+}
+
+// Share of the poly6 kernel mass beyond a plane at distance u * h from its center: the kernel
+// projected on the plane normal is 315/256 (1 - x^2)^4, integrated from u to 1
+static float kernelBeyondPlane(float u)
+{
+    if (u >= 1.0f)
+    {
+        return 0.0f;
+    }
+
+    float u2 = u * u;
+    float integral = u * (1.0f + u2 * (-4.0f / 3.0f + u2 * (6.0f / 5.0f + u2 * (-4.0f / 7.0f + u2 / 9.0f))));
+
+    return 0.5f - 315.0f / 256.0f * integral;
+}
+
+// Density a particle with a full neighborhood would have next to the walls of the domain, which
+// cut off part of its kernel like a free surface does
+static float wallDensity(const SphAdaptive *adaptive, uint32_t i, float h)
+{
+    const SphSolver *solver = adaptive->solver;
+    const SphParams *params = &solver->params;
+    float position[3] = {solver->posX[i], solver->posY[i], solver->posZ[i]};
+    float support = 1.0f;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        support *= 1.0f - kernelBeyondPlane((position[axis] - params->boundsMin[axis]) / h);
+        support *= 1.0f - kernelBeyondPlane((params->boundsMax[axis] - position[axis]) / h);
+    }
+
+    return support * params->restDensity;
+}
+
+static void densityTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    SphAdaptive *adaptive = context;
+    SphSolver *solver = adaptive->solver;
+    const SphParams *params = &solver->params;
+    uint32_t end = (taskIndex + 1) * SPH_ADAPTIVE_TASK_PARTICLES;
+
+    for (uint32_t i = taskIndex * SPH_ADAPTIVE_TASK_PARTICLES; i < end && i < solver->count; i++)
+    {
+        int a = levelIndex(adaptive->level[i]);
+        int low[3];
+        int high[3];
+        float density = 0.0f;
+
+        stencil(adaptive, solver->posX[i], solver->posY[i], solver->posZ[i], low, high);
+
+        for (int z = low[2]; z <= high[2]; z++)
+        {
+            for (int y = low[1]; y <= high[1]; y++)
+            {
+                for (int x = low[0]; x <= high[0]; x++)
+                {
+                    uint32_t cell = cellIndex(adaptive, x, y, z);
+
+                    for (uint32_t k = adaptive->cellStart[cell]; k < adaptive->cellEnd[cell]; k++)
+                    {
+                        uint32_t j = adaptive->sortedIndices[k];
+                        int b = levelIndex(adaptive->level[j]);
+                        float h = adaptive->pairH[a][b];
+
+                        float dx = solver->posX[i] - solver->posX[j];
+                        float dy = solver->posY[i] - solver->posY[j];
+                        float dz = solver->posZ[i] - solver->posZ[j];
+                        float r2 = dx * dx + dy * dy + dz * dz;
+
+                        if (r2 < h * h)
+                        {
+                            float diff = h * h - r2;
+                            density += adaptive->mass[j] * adaptive->pairPoly6[a][b] * diff * diff * diff;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Missing neighbors at the free surface lower the density. Those behind a wall do too, but the
+        // layer along the walls is bulk, so it is compared with what the walls leave of the kernel. The
+        // vorticity is the one of the last force pass
+        adaptive->refine[i] = density < adaptive->surfaceDensityRatio * wallDensity(adaptive, i, adaptive->smoothing[a]) ||
+                              adaptive->vorticity[i] > fmaxf(adaptive->vorticityThreshold, adaptive->vorticityRatio * adaptive->meanVorticity);
+
+        solver->density[i] = density;
+        solver->pressure[i] = fmaxf(params->stiffness * (density - adaptive->densityOffset[i] - params->restDensity), 0.0f);
+    }
+}
+
+// Same pressure and viscosity terms as sphComputeForces with the neighbor's mass and the pair's
+// kernel, plus the vorticity the next density pass classifies the particle with
+static void forcesTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    SphAdaptive *adaptive = context;
+    SphSolver *solver = adaptive->solver;
+    const SphParams *params = &solver->params;
+    uint32_t end = (taskIndex + 1) * SPH_ADAPTIVE_TASK_PARTICLES;
+
+    for (uint32_t i = taskIndex * SPH_ADAPTIVE_TASK_PARTICLES; i < end && i < solver->count; i++)
+    {
+        int a = levelIndex(adaptive->level[i]);
+        float pi = solver->pressure[i];
+        float rhoi = solver->density[i];
+        float pressureForce[3] = {0.0f, 0.0f, 0.0f};
+        float viscosityForce[3] = {0.0f, 0.0f, 0.0f};
+        float curl[3] = {0.0f, 0.0f, 0.0f};
+        int low[3];
+        int high[3];
+
+        stencil(adaptive, solver->posX[i], solver->posY[i], solver->posZ[i], low, high);
+
+        for (int z = low[2]; z <= high[2]; z++)
+        {
+            for (int y = low[1]; y <= high[1]; y++)
+            {
+                for (int x = low[0]; x <= high[0]; x++)
+                {
+                    uint32_t cell = cellIndex(adaptive, x, y, z);
+
+                    for (uint32_t k = adaptive->cellStart[cell]; k < adaptive->cellEnd[cell]; k++)
+                    {
+                        uint32_t j = adaptive->sortedIndices[k];
+
+                        if (j == i)
+                        {
+                            continue;
+                        }
+
+                        int b = levelIndex(adaptive->level[j]);
+                        float h = adaptive->pairH[a][b];
+
+                        float dx = solver->posX[i] - solver->posX[j];
+                        float dy = solver->posY[i] - solver->posY[j];
+                        float dz = solver->posZ[i] - solver->posZ[j];
+                        float r2 = dx * dx + dy * dy + dz * dz;
+
+                        if (r2 >= h * h || r2 < 1e-12f)
+                        {
+                            continue;
+                        }
+
+                        float r = sqrtf(r2);
+                        float diff = h - r;
+                        float rhoj = solver->density[j];
+                        float mj = adaptive->mass[j];
+
+                        float gradientScale = adaptive->pairSpiky[a][b] * diff * diff / r;
+                        float pressureScale = -mj * (pi + solver->pressure[j]) / (2.0f * rhoj) * gradientScale;
+                        pressureForce[0] += pressureScale * dx;
+                        pressureForce[1] += pressureScale * dy;
+                        pressureForce[2] += pressureScale * dz;
+
+                        float du = solver->velX[j] - solver->velX[i];
+                        float dv = solver->velY[j] - solver->velY[i];
+                        float dw = solver->velZ[j] - solver->velZ[i];
+
+                        float viscosityScale = mj * adaptive->pairViscosity[a][b] * diff / rhoj;
+                        viscosityForce[0] += viscosityScale * du;
+                        viscosityForce[1] += viscosityScale * dv;
+                        viscosityForce[2] += viscosityScale * dw;
+
+                        // curl v = sum m_j / rho_j (v_j - v_i) x grad W
+                        float weight = mj / rhoj * gradientScale;
+                        curl[0] += weight * (dv * dz - dw * dy);
+                        curl[1] += weight * (dw * dx - du * dz);
+                        curl[2] += weight * (du * dy - dv * dx);
+                    }
+                }
+            }
+        }
+
+        solver->accX[i] = (pressureForce[0] + params->viscosity * viscosityForce[0]) / rhoi + params->gravity[0];
+        solver->accY[i] = (pressureForce[1] + params->viscosity * viscosityForce[1]) / rhoi + params->gravity[1];
+        solver->accZ[i] = (pressureForce[2] + params->viscosity * viscosityForce[2]) / rhoi + params->gravity[2];
+
+        adaptive->vorticity[i] = sqrtf(curl[0] * curl[0] + curl[1] * curl[1] + curl[2] * curl[2]);
+    }
+}
+
+// Classified particles keep the seeded resolution, everything else starts at the coarsest level and is
+// pulled up by gradeTask()
+static void targetTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    SphAdaptive *adaptive = context;
+    uint32_t end = (taskIndex + 1) * SPH_ADAPTIVE_TASK_PARTICLES;
+
+    for (uint32_t i = taskIndex * SPH_ADAPTIVE_TASK_PARTICLES; i < end && i < adaptive->solver->count; i++)
+    {
+        adaptive->target[i] = adaptive->refine[i] ? 0 : SPH_ADAPTIVE_MIN_LEVEL;
+    }
+}
+
+// One grading pass: a particle wants to be at most one level coarser than any neighbor within the pair's
+// smoothing length. Each pass moves the grading one ring further from the refined particles, so the levels
+// drop with the distance from the surface and the rings get wider as the particles get coarser
+static void gradeTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    SphAdaptive *adaptive = context;
+    SphSolver *solver = adaptive->solver;
+    uint32_t end = (taskIndex + 1) * SPH_ADAPTIVE_TASK_PARTICLES;
+
+    for (uint32_t i = taskIndex * SPH_ADAPTIVE_TASK_PARTICLES; i < end && i < solver->count; i++)
+    {
+        int a = levelIndex(adaptive->level[i]);
+        int8_t graded = adaptive->target[i];
+        int low[3];
+        int high[3];
+
+        stencil(adaptive, solver->posX[i], solver->posY[i], solver->posZ[i], low, high);
+
+        for (int z = low[2]; z <= high[2]; z++)
+        {
+            for (int y = low[1]; y <= high[1]; y++)
+            {
+                for (int x = low[0]; x <= high[0]; x++)
+                {
+                    uint32_t cell = cellIndex(adaptive, x, y, z);
+
+                    for (uint32_t k = adaptive->cellStart[cell]; k < adaptive->cellEnd[cell]; k++)
+                    {
+                        uint32_t j = adaptive->sortedIndices[k];
+                        float h = adaptive->pairH[a][levelIndex(adaptive->level[j])];
+
+                        float dx = solver->posX[i] - solver->posX[j];
+                        float dy = solver->posY[i] - solver->posY[j];
+                        float dz = solver->posZ[i] - solver->posZ[j];
+
+                        if (adaptive->target[j] - 1 > graded && dx * dx + dy * dy + dz * dz < h * h)
+                        {
+                            graded = (int8_t)(adaptive->target[j] - 1);
+                        }
+                    }
+                }
+            }
+        }
+
+        adaptive->gradedTarget[i] = graded;
+    }
+}
+
+static void copyParticle(SphAdaptive *adaptive, uint32_t to, uint32_t from)
+{
+    SphSolver *solver = adaptive->solver;
+
+    solver->posX[to] = solver->posX[from];
+    solver->posY[to] = solver->posY[from];
+    solver->posZ[to] = solver->posZ[from];
+    solver->velX[to] = solver->velX[from];
+    solver->velY[to] = solver->velY[from];
+    solver->velZ[to] = solver->velZ[from];
+    solver->accX[to] = solver->accX[from];
+    solver->accY[to] = solver->accY[from];
+    solver->accZ[to] = solver->accZ[from];
+    solver->density[to] = solver->density[from];
+    solver->pressure[to] = solver->pressure[from];
+
+    adaptive->level[to] = adaptive->level[from];
+    adaptive->mass[to] = adaptive->mass[from];
+    adaptive->refine[to] = adaptive->refine[from];
+    adaptive->vorticity[to] = adaptive->vorticity[from];
+    adaptive->target[to] = adaptive->target[from];
+    adaptive->densityOffset[to] = adaptive->densityOffset[from];
+}
+
+static void totals(const SphAdaptive *adaptive, double *mass, double momentum[3])
+{
+    const SphSolver *solver = adaptive->solver;
+
+    *mass = 0.0;
+    momentum[0] = momentum[1] = momentum[2] = 0.0;
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        *mass += adaptive->mass[i];
+        momentum[0] += (double)adaptive->mass[i] * solver->velX[i];
+        momentum[1] += (double)adaptive->mass[i] * solver->velY[i];
+        momentum[2] += (double)adaptive->mass[i] * solver->velZ[i];
+    }
+}
+
+// Merges pairs of close particles of one level that both want to be coarser into their center of mass
+// with their summed mass and momentum, then splits particles that want to be finer into two halves
+// placed symmetrically around the parent with its velocity. Both keep mass, momentum and center of mass.
+static void splitAndMerge(SphAdaptive *adaptive)
+{
+    SphSolver *solver = adaptive->solver;
+    const SphParams *params = &solver->params;
+    double massBefore;
+    double momentumBefore[3];
+
+    totals(adaptive, &massBefore, momentumBefore);
+
+    uint32_t taskCount = (solver->count + SPH_ADAPTIVE_TASK_PARTICLES - 1) / SPH_ADAPTIVE_TASK_PARTICLES;
+
+    threadPoolRun(targetTask, adaptive, taskCount);
+
+    // Level -1 next to the refined particles needs one pass, every coarser level one more
+    for (int pass = 1; pass < -SPH_ADAPTIVE_MIN_LEVEL; pass++)
+    {
+        threadPoolRun(gradeTask, adaptive, taskCount);
+
+        int8_t *graded = adaptive->gradedTarget;
+        adaptive->gradedTarget = adaptive->target;
+        adaptive->target = graded;
+    }
+
+    adaptive->splits = 0;
+    adaptive->merges = 0;
+    memset(adaptive->claimed, 0, solver->count);
+
+    // Serial and in index order, so the pairing is deterministic
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        if (adaptive->claimed[i] || adaptive->target[i] >= adaptive->level[i] || adaptive->level[i] <= SPH_ADAPTIVE_MIN_LEVEL)
+        {
+            continue;
+        }
+
+        int a = levelIndex(adaptive->level[i]);
+        float h = adaptive->pairH[a][a];
+        float closest = h * h;
+        uint32_t partner = UINT32_MAX;
+        int low[3];
+        int high[3];
+
+        stencil(adaptive, solver->posX[i], solver->posY[i], solver->posZ[i], low, high);
+
+        for (int z = low[2]; z <= high[2]; z++)
+        {
+            for (int y = low[1]; y <= high[1]; y++)
+            {
+                for (int x = low[0]; x <= high[0]; x++)
+                {
+                    uint32_t cell = cellIndex(adaptive, x, y, z);
+
+                    for (uint32_t k = adaptive->cellStart[cell]; k < adaptive->cellEnd[cell]; k++)
+                    {
+                        uint32_t j = adaptive->sortedIndices[k];
+
+                        if (j == i || adaptive->claimed[j] || adaptive->level[j] != adaptive->level[i] || adaptive->target[j] >= adaptive->level[j])
+                        {
+                            continue;
+                        }
+
+                        float dx = solver->posX[i] - solver->posX[j];
+                        float dy = solver->posY[i] - solver->posY[j];
+                        float dz = solver->posZ[i] - solver->posZ[j];
+                        float r2 = dx * dx + dy * dy + dz * dz;
+
+                        if (r2 < closest)
+                        {
+                            closest = r2;
+                            partner = j;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (partner == UINT32_MAX)
+        {
+            continue;
+        }
+
+        float mi = adaptive->mass[i];
+        float mj = adaptive->mass[partner];
+        float m = mi + mj;
+
+        solver->posX[i] = (mi * solver->posX[i] + mj * solver->posX[partner]) / m;
+        solver->posY[i] = (mi * solver->posY[i] + mj * solver->posY[partner]) / m;
+        solver->posZ[i] = (mi * solver->posZ[i] + mj * solver->posZ[partner]) / m;
+        solver->velX[i] = (mi * solver->velX[i] + mj * solver->velX[partner]) / m;
+        solver->velY[i] = (mi * solver->velY[i] + mj * solver->velY[partner]) / m;
+        solver->velZ[i] = (mi * solver->velZ[i] + mj * solver->velZ[partner]) / m;
+
+        adaptive->mass[i] = m;
+        adaptive->level[i]--;
+        adaptive->claimed[i] = 1;
+        adaptive->claimed[partner] = 2;
+        adaptive->merges++;
+
+        // Neighbors of the merged pair wait for the next pass: merging a whole region at once leaves it
+        // too disordered for the pressure to settle without a burst of kinetic energy
+        for (int z = low[2]; z <= high[2]; z++)
+        {
+            for (int y = low[1]; y <= high[1]; y++)
+            {
+                for (int x = low[0]; x <= high[0]; x++)
+                {
+                    uint32_t cell = cellIndex(adaptive, x, y, z);
+
+                    for (uint32_t k = adaptive->cellStart[cell]; k < adaptive->cellEnd[cell]; k++)
+                    {
+                        uint32_t j = adaptive->sortedIndices[k];
+                        float dx = solver->posX[i] - solver->posX[j];
+                        float dy = solver->posY[i] - solver->posY[j];
+                        float dz = solver->posZ[i] - solver->posZ[j];
+
+                        if (adaptive->claimed[j] == 0 && dx * dx + dy * dy + dz * dz < h * h)
+                        {
+                            adaptive->claimed[j] = 3;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Drop the merged partners, keeping the order of the others
+    uint32_t live = 0;
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        if (adaptive->claimed[i] != 2)
+        {
+            if (live != i)
+            {
+                copyParticle(adaptive, live, i);
+            }
+
+            live++;
+        }
+    }
+
+    solver->count = live;
+
+    // Every particle carries at least the seeded mass, so the seeded count is never exceeded
+    uint32_t parents = solver->count;
+
+    for (uint32_t i = 0; i < parents && solver->count < adaptive->capacity; i++)
+    {
+        if (adaptive->target[i] <= adaptive->level[i])
+        {
+            continue;
+        }
+
+        uint32_t child = solver->count++;
+        copyParticle(adaptive, child, i);
+
+        adaptive->level[i]++;
+        adaptive->level[child]++;
+        adaptive->mass[i] *= 0.5f;
+        adaptive->mass[child] = adaptive->mass[i];
+
+        // Half the child spacing apart, along a direction hashed from the particle and the step
+        uint32_t hash = (i * 2654435761u) ^ (adaptive->stepIndex * 2246822519u);
+        hash = (hash ^ (hash >> 15)) * 2246822519u;
+        hash ^= hash >> 13;
+
+        float theta = (float)(hash & 0xFFFFu) / 65536.0f * 2.0f * SPH_PI;
+        float cosPhi = (float)(hash >> 16) / 65536.0f * 2.0f - 1.0f;
+        float sinPhi = sqrtf(fmaxf(1.0f - cosPhi * cosPhi, 0.0f));
+        float offset = 0.5f * params->particleSpacing * powf(2.0f, -adaptive->level[i] / 3.0f);
+        float direction[3] = {sinPhi * cosf(theta), sinPhi * sinf(theta), cosPhi};
+        float *positions[3] = {solver->posX, solver->posY, solver->posZ};
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            // The pair is moved together if a wall would cut it, so the center of mass stays put
+            float reach = offset * fabsf(direction[axis]);
+            float center = fminf(fmaxf(positions[axis][i], params->boundsMin[axis] + reach), params->boundsMax[axis] - reach);
+
+            positions[axis][i] = center + offset * direction[axis];
+            positions[axis][child] = center - offset * direction[axis];
+        }
+
+        adaptive->splits++;
+    }
+
+    double massAfter;
+    double momentumAfter[3];
+
+    totals(adaptive, &massAfter, momentumAfter);
+
+    double momentumScale = sqrt(momentumBefore[0] * momentumBefore[0] + momentumBefore[1] * momentumBefore[1] + momentumBefore[2] * momentumBefore[2]) + massBefore;
+    double dpx = momentumAfter[0] - momentumBefore[0];
+    double dpy = momentumAfter[1] - momentumBefore[1];
+    double dpz = momentumAfter[2] - momentumBefore[2];
+
+    adaptive->massError = (float)(fabs(massAfter - massBefore) / massBefore);
+    adaptive->momentumError = (float)(sqrt(dpx * dpx + dpy * dpy + dpz * dpz) / momentumScale);
+}
+
+void sphAdaptiveStep(SphAdaptive *adaptive)
+{
+    SphSolver *solver = adaptive->solver;
+    uint32_t taskCount = (solver->count + SPH_ADAPTIVE_TASK_PARTICLES - 1) / SPH_ADAPTIVE_TASK_PARTICLES;
+
+    buildGrid(adaptive);
+    threadPoolRun(densityTask, adaptive, taskCount);
+    threadPoolRun(forcesTask, adaptive, taskCount);
+    sphIntegrate(solver);
+
+    double vorticitySum = 0.0;
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        adaptive->densityOffset[i] *= adaptive->offsetDecay;
+        vorticitySum += adaptive->vorticity[i];
+    }
+
+    adaptive->meanVorticity = solver->count > 0 ? (float)(vorticitySum / solver->count) : 0.0f;
+
+    adaptive->stepIndex++;
+
+    if (adaptive->stepIndex % adaptive->adaptInterval == 0)
+    {
+        buildGrid(adaptive); // The pairs are looked up at the integrated positions
+        threadPoolRun(densityTask, adaptive, taskCount);
+        splitAndMerge(adaptive);
+
+        // Split and merged particles carry their parent's density along
+        memcpy(adaptive->densityBefore, solver->density, solver->count * sizeof(float));
+
+        // The kernel sums of the new particles are off from a settled distribution, mostly upwards.
+        // The jump goes into the density offset so the pressure builds up over the following steps
+        // instead of kicking the particles apart in one
+        buildGrid(adaptive);
+        threadPoolRun(densityTask, adaptive, (solver->count + SPH_ADAPTIVE_TASK_PARTICLES - 1) / SPH_ADAPTIVE_TASK_PARTICLES);
+
+        for (uint32_t i = 0; i < solver->count; i++)
+        {
+            adaptive->densityOffset[i] += solver->density[i] - adaptive->densityBefore[i];
+        }
+    }
+}
+
+void sphAdaptiveReport(const SphParams *params, uint32_t stepCount)
+{
+    SphSolver solver;
+    SphAdaptive adaptive;
+
+    sphInit(&solver, params);
+    sphSeedDamBreak(&solver);
+    sphAdaptiveInit(&adaptive, &solver);
+
+    float worstMassError = 0.0f;
+    float worstMomentumError = 0.0f;
+    double particleSteps = 0.0;
+    uint32_t reportInterval = stepCount / 10 > 0 ? stepCount / 10 : 1;
+
+    for (uint32_t step = 1; step <= stepCount; step++)
+    {
+        sphAdaptiveStep(&adaptive);
+        particleSteps += solver.count;
+
+        if (adaptive.stepIndex % adaptive.adaptInterval == 0)
+        {
+            worstMassError = fmaxf(worstMassError, adaptive.massError);
+            worstMomentumError = fmaxf(worstMomentumError, adaptive.momentumError);
+        }
+
+        if (step % reportInterval == 0 || step == stepCount)
+        {
+            uint32_t histogram[SPH_ADAPTIVE_LEVEL_COUNT] = {};
+            uint32_t refined = 0;
+
+            for (uint32_t i = 0; i < solver.count; i++)
+            {
+                histogram[levelIndex(adaptive.level[i])]++;
+                refined += adaptive.refine[i];
+            }
+
+            // Levels from 0 down to the coarsest, separated by slashes
+            char levels[SPH_ADAPTIVE_LEVEL_COUNT * 12];
+            int length = 0;
+
+            for (int level = 0; level >= SPH_ADAPTIVE_MIN_LEVEL; level--)
+            {
+                length += snprintf(levels + length, sizeof(levels) - length, level < 0 ? "/%u" : "%u", histogram[levelIndex((int8_t)level)]);
+            }
+
+            printf("Adaptive step %u: %u particles (%.2fx fewer than uniform), levels 0 to %d: %s, %u at the surface or in vortices, last pass %u splits %u merges\n",
+                   step, solver.count, (double)adaptive.capacity / solver.count, SPH_ADAPTIVE_MIN_LEVEL, levels, refined, adaptive.splits, adaptive.merges);
+        }
+    }
+
+    // The refined particles stay at the seeded resolution, so even with the rest merged down to the
+    // coarsest level the reduction cannot go past capacity / (refined + rest / 2^-SPH_ADAPTIVE_MIN_LEVEL)
+    uint32_t refined = 0;
+
+    for (uint32_t i = 0; i < solver.count; i++)
+    {
+        refined += adaptive.refine[i];
+    }
+
+    double coarsest = (double)(1u << -SPH_ADAPTIVE_MIN_LEVEL);
+    double average = particleSteps / stepCount;
+
+    double reduction = adaptive.capacity / average;
+
+    printf("Adaptive run: %.0f particles on average, %.2fx fewer than the uniform %u, at most %.2fx with %u particles at the surface or in vortices\n",
+           average, reduction, adaptive.capacity, adaptive.capacity / (refined + (adaptive.capacity - refined) / coarsest), refined);
+    printf("Target of %.0f-%.0fx fewer particles: %s\n", SPH_ADAPTIVE_TARGET_MIN, SPH_ADAPTIVE_TARGET_MAX,
+           reduction >= SPH_ADAPTIVE_TARGET_MIN ? "met" : "NOT met");
+    printf("Split and merge conservation: max relative mass error %g, max relative momentum error %g\n", worstMassError, worstMomentumError);
+
+    sphAdaptiveDestroy(&adaptive);
+    sphDestroy(&solver);
+}
+
+void sphAdaptiveDestroy(SphAdaptive *adaptive)
+{
+    free(adaptive->level);
+    free(adaptive->mass);
+    free(adaptive->refine);
+    free(adaptive->vorticity);
+    free(adaptive->target);
+    free(adaptive->gradedTarget);
+    free(adaptive->densityOffset);
+    free(adaptive->densityBefore);
+    free(adaptive->claimed);
+    free(adaptive->cellKeys);
+    free(adaptive->sortedIndices);
+    free(adaptive->cellStart);
+    free(adaptive->cellEnd);
+
+    memset(adaptive, 0, sizeof(*adaptive));
+}
@@ -0,0 +1,721 @@
+#include "sph_domain.h"
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+// Steps between two rebalances of the slab edges
+#define SPH_DOMAIN_REBALANCE_INTERVAL 50
+
+// Fraction of the way to the evenly loaded edges a rebalance moves, so one noisy measurement does not
+// throw the slabs around
+#define SPH_DOMAIN_REBALANCE_RATE 0.5f
+
+// What travels between ranks for a ghost or a migrating particle
+typedef struct {
+    uint32_t id;
+    float position[3];
+    float velocity[3];
+} DomainParticle;
+
+// What every rank reports to rank 0 at a rebalance
+typedef struct {
+    double computeSeconds;
+    uint32_t owned;
+    uint32_t ghosts;
+} DomainLoad;
+
+static void *growBuffer(void *buffer, size_t *capacity, size_t size)
+{
+    if (size <= *capacity)
+    {
+        return buffer;
+    }
+
+    size_t grown = *capacity * 2 > size ? *capacity * 2 : size;
+    void *data = realloc(buffer, grown);
+
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate domain exchange buffers!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *capacity = grown;
+
+    return data;
+}
+
+static void growArray(void **array, uint32_t count, size_t size)
+{
+    void *data = realloc(*array, (size_t)count * size);
+
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate domain particle storage!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *array = data;
+}
+
+// Makes room for count owned and ghost particles in the solver arrays
+static void reserveParticles(SphDomain *domain, uint32_t count)
+{
+    if (count <= domain->capacity)
+    {
+        return;
+    }
+
+    SphSolver *solver = &domain->solver;
+    uint32_t capacity = domain->capacity * 2 > count ? domain->capacity * 2 : count;
+    float **arrays[] = {&solver->posX, &solver->posY, &solver->posZ, &solver->velX, &solver->velY, &solver->velZ,
+                        &solver->accX, &solver->accY, &solver->accZ, &solver->density, &solver->pressure};
+
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++)
+    {
+        growArray((void**)arrays[i], capacity, sizeof(float));
+    }
+
+    growArray((void**)&solver->cellKeys, capacity, sizeof(uint32_t));
+    growArray((void**)&solver->sortedIndices, capacity, sizeof(uint32_t));
+    growArray((void**)&domain->ids, capacity, sizeof(uint32_t));
+
+    domain->capacity = capacity;
+}
+
+static void packParticle(const SphDomain *domain, uint32_t index, DomainParticle *particle)
+{
+    const SphSolver *solver = &domain->solver;
+
+    particle->id = domain->ids[index];
+    particle->position[0] = solver->posX[index];
+    particle->position[1] = solver->posY[index];
+    particle->position[2] = solver->posZ[index];
+    particle->velocity[0] = solver->velX[index];
+    particle->velocity[1] = solver->velY[index];
+    particle->velocity[2] = solver->velZ[index];
+}
+
+static void unpackParticle(SphDomain *domain, uint32_t index, const DomainParticle *particle)
+{
+    SphSolver *solver = &domain->solver;
+
+    domain->ids[index] = particle->id;
+    solver->posX[index] = particle->position[0];
+    solver->posY[index] = particle->position[1];
+    solver->posZ[index] = particle->position[2];
+    solver->velX[index] = particle->velocity[0];
+    solver->velY[index] = particle->velocity[1];
+    solver->velZ[index] = particle->velocity[2];
+}
+
+// Sends sendCount[side] items from sendBuffer[side] to the left (0) and right (1) neighbor and receives
+// their items into receiveBuffer[side]. A rank talks to its left neighbor first, receiving before it
+// sends, and to its right neighbor second, sending before it receives. Along the chain of slabs every
+// blocking send then has its receiver waiting, however large the messages are
+static void exchangeWithNeighbors(SphDomain *domain, const uint32_t sendCount[2], size_t itemSize, uint32_t receiveCount[2])
+{
+    DomainTransport *transport = domain->transport;
+    uint32_t rank = transport->rank;
+
+    receiveCount[0] = 0;
+    receiveCount[1] = 0;
+
+    for (int side = 0; side < 2; side++)
+    {
+        if ((side == 0 && rank == 0) || (side == 1 && rank + 1 == transport->rankCount))
+        {
+            continue;
+        }
+
+        uint32_t peer = side == 0 ? rank - 1 : rank + 1;
+
+        if (side == 1)
+        {
+            transport->send(transport, peer, &sendCount[side], sizeof(uint32_t));
+            transport->send(transport, peer, domain->sendBuffer[side], sendCount[side] * itemSize);
+        }
+
+        transport->receive(transport, peer, &receiveCount[side], sizeof(uint32_t));
+        domain->receiveBuffer[side] = growBuffer(domain->receiveBuffer[side], &domain->receiveCapacity[side], receiveCount[side] * itemSize);
+        transport->receive(transport, peer, domain->receiveBuffer[side], receiveCount[side] * itemSize);
+
+        if (side == 0)
+        {
+            transport->send(transport, peer, &sendCount[side], sizeof(uint32_t));
+            transport->send(transport, peer, domain->sendBuffer[side], sendCount[side] * itemSize);
+        }
+    }
+}
+
+// Hands owned particles outside the slab to the neighbor on that side. One round moves a particle by
+// one slab, which is all a step can move it; after a rebalance the edges may have moved further
+static void migrate(SphDomain *domain, uint32_t rounds)
+{
+    SphSolver *solver = &domain->solver;
+    uint32_t rank = domain->transport->rank;
+    uint32_t rankCount = domain->transport->rankCount;
+
+    domain->migrated = 0;
+
+    for (uint32_t round = 0; round < rounds; round++)
+    {
+        float low = domain->boundaries[rank];
+        float high = domain->boundaries[rank + 1];
+        uint32_t sendCount[2] = {0, 0};
+        uint32_t kept = 0;
+
+        for (uint32_t i = 0; i < domain->ownedCount; i++)
+        {
+            int side = rank > 0 && solver->posX[i] < low ? 0 : rank + 1 < rankCount && solver->posX[i] >= high ? 1 : -1;
+
+            if (side < 0)
+            {
+                if (kept != i)
+                {
+                    DomainParticle particle;
+                    packParticle(domain, i, &particle);
+                    unpackParticle(domain, kept, &particle);
+                }
+
+                kept++;
+                continue;
+            }
+
+            domain->sendBuffer[side] = growBuffer(domain->sendBuffer[side], &domain->sendCapacity[side], (sendCount[side] + 1) * sizeof(DomainParticle));
+            packParticle(domain, i, (DomainParticle*)domain->sendBuffer[side] + sendCount[side]++);
+        }
+
+        uint32_t receiveCount[2];
+        exchangeWithNeighbors(domain, sendCount, sizeof(DomainParticle), receiveCount);
+
+        domain->ownedCount = kept;
+        reserveParticles(domain, kept + receiveCount[0] + receiveCount[1]);
+
+        for (int side = 0; side < 2; side++)
+        {
+            for (uint32_t k = 0; k < receiveCount[side]; k++)
+            {
+                unpackParticle(domain, domain->ownedCount++, (DomainParticle*)domain->receiveBuffer[side] + k);
+            }
+        }
+
+        domain->migrated += sendCount[0] + sendCount[1];
+    }
+
+    solver->count = domain->ownedCount;
+}
+
+// Appends copies of the neighbors' particles within h of the slab edges after the owned particles
+static void exchangeGhosts(SphDomain *domain)
+{
+    SphSolver *solver = &domain->solver;
+    uint32_t rank = domain->transport->rank;
+    uint32_t rankCount = domain->transport->rankCount;
+    float h = solver->params.smoothingRadius;
+    float low = domain->boundaries[rank] + h;
+    float high = domain->boundaries[rank + 1] - h;
+
+    domain->sentGhosts[0] = 0;
+    domain->sentGhosts[1] = 0;
+
+    for (uint32_t i = 0; i < domain->ownedCount; i++)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            int inLayer = side == 0 ? rank > 0 && solver->posX[i] < low : rank + 1 < rankCount && solver->posX[i] >= high;
+
+            if (!inLayer)
+            {
+                continue;
+            }
+
+            uint32_t sent = domain->sentGhosts[side]++;
+
+            if (sent == domain->ghostSourceCapacity[side])
+            {
+                domain->ghostSourceCapacity[side] = sent > 0 ? sent * 2 : 256;
+                growArray((void**)&domain->ghostSources[side], domain->ghostSourceCapacity[side], sizeof(uint32_t));
+            }
+
+            domain->ghostSources[side][sent] = i;
+            domain->sendBuffer[side] = growBuffer(domain->sendBuffer[side], &domain->sendCapacity[side], (sent + 1) * sizeof(DomainParticle));
+            packParticle(domain, i, (DomainParticle*)domain->sendBuffer[side] + sent);
+        }
+    }
+
+    exchangeWithNeighbors(domain, domain->sentGhosts, sizeof(DomainParticle), domain->receivedGhosts);
+
+    uint32_t count = domain->ownedCount;
+    reserveParticles(domain, count + domain->receivedGhosts[0] + domain->receivedGhosts[1]);
+
+    for (int side = 0; side < 2; side++)
+    {
+        for (uint32_t k = 0; k < domain->receivedGhosts[side]; k++)
+        {
+            unpackParticle(domain, count++, (DomainParticle*)domain->receiveBuffer[side] + k);
+        }
+    }
+
+    solver->count = count;
+}
+
+// The ghosts' own densities are short of the neighbors beyond them, the owner's are complete
+static void exchangeGhostDensities(SphDomain *domain)
+{
+    SphSolver *solver = &domain->solver;
+    const SphParams *params = &solver->params;
+
+    for (int side = 0; side < 2; side++)
+    {
+        domain->sendBuffer[side] = growBuffer(domain->sendBuffer[side], &domain->sendCapacity[side], domain->sentGhosts[side] * sizeof(float));
+
+        for (uint32_t k = 0; k < domain->sentGhosts[side]; k++)
+        {
+            ((float*)domain->sendBuffer[side])[k] = solver->density[domain->ghostSources[side][k]];
+        }
+    }
+
+    uint32_t receiveCount[2];
+    exchangeWithNeighbors(domain, domain->sentGhosts, sizeof(float), receiveCount);
+
+    uint32_t ghost = domain->ownedCount;
+
+    for (int side = 0; side < 2; side++)
+    {
+        if (receiveCount[side] != domain->receivedGhosts[side])
+        {
+            fprintf(stderr, "Domain neighbor sent %u ghost densities for %u ghosts!\n", receiveCount[side], domain->receivedGhosts[side]);
+            exit(EXIT_FAILURE);
+        }
+
+        for (uint32_t k = 0; k < receiveCount[side]; k++, ghost++)
+        {
+            float density = ((float*)domain->receiveBuffer[side])[k];
+
+            solver->density[ghost] = density;
+            solver->pressure[ghost] = fmaxf(params->stiffness * (density - params->restDensity), 0.0f);
+        }
+    }
+}
+
+// Moves the slab edges so every slab gets the same share of the measured compute time, assuming the
+// time of a slab is spread evenly over its width
+static void balanceBoundaries(float *boundaries, const DomainLoad *loads, uint32_t rankCount, float minimumWidth)
+{
+    double total = 0.0;
+
+    for (uint32_t r = 0; r < rankCount; r++)
+    {
+        total += loads[r].computeSeconds;
+    }
+
+    if (total <= 0.0)
+    {
+        return;
+    }
+
+    float *balanced = malloc((rankCount + 1) * sizeof(float));
+
+    if (!balanced)
+    {
+        fprintf(stderr, "Failed to allocate domain slab edges!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    balanced[0] = boundaries[0];
+    balanced[rankCount] = boundaries[rankCount];
+
+    uint32_t slab = 0;
+    double before = 0.0; // Time of the slabs left of slab
+
+    for (uint32_t edge = 1; edge < rankCount; edge++)
+    {
+        double share = total * edge / rankCount;
+
+        while (slab + 1 < rankCount && before + loads[slab].computeSeconds < share)
+        {
+            before += loads[slab].computeSeconds;
+            slab++;
+        }
+
+        double fraction = loads[slab].computeSeconds > 0.0 ? (share - before) / loads[slab].computeSeconds : 0.0;
+        fraction = fraction < 0.0 ? 0.0 : fraction > 1.0 ? 1.0 : fraction;
+
+        float even = boundaries[slab] + (float)fraction * (boundaries[slab + 1] - boundaries[slab]);
+        balanced[edge] = boundaries[edge] + SPH_DOMAIN_REBALANCE_RATE * (even - boundaries[edge]);
+    }
+
+    // Keep every slab at least minimumWidth wide, from both walls inwards
+    for (uint32_t edge = 1; edge < rankCount; edge++)
+    {
+        balanced[edge] = fmaxf(balanced[edge], balanced[edge - 1] + minimumWidth);
+    }
+
+    for (uint32_t edge = rankCount - 1; edge > 0; edge--)
+    {
+        balanced[edge] = fminf(balanced[edge], balanced[edge + 1] - minimumWidth);
+    }
+
+    memcpy(boundaries, balanced, (rankCount + 1) * sizeof(float));
+    free(balanced);
+}
+
+// Rank 0 collects the loads, moves the edges and sends them back, then the particles follow the edges
+static void rebalance(SphDomain *domain)
+{
+    DomainTransport *transport = domain->transport;
+    uint32_t rankCount = transport->rankCount;
+    DomainLoad load = {domain->computeSeconds, domain->ownedCount, domain->receivedGhosts[0] + domain->receivedGhosts[1]};
+
+    if (transport->rank == 0)
+    {
+        DomainLoad *loads = malloc(rankCount * sizeof(DomainLoad));
+
+        if (!loads)
+        {
+            fprintf(stderr, "Failed to allocate domain loads!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        loads[0] = load;
+
+        for (uint32_t peer = 1; peer < rankCount; peer++)
+        {
+            transport->receive(transport, peer, &loads[peer], sizeof(DomainLoad));
+        }
+
+        printf("Domain step %u:", domain->stepIndex);
+
+        for (uint32_t r = 0; r < rankCount; r++)
+        {
+            printf(" [%.2f, %.2f) %u+%u particles %.3f ms/step%s", domain->boundaries[r], domain->boundaries[r + 1], loads[r].owned, loads[r].ghosts,
+                   loads[r].computeSeconds * 1000.0 / domain->rebalanceInterval, r + 1 < rankCount ? "," : "\n");
+        }
+
+        balanceBoundaries(domain->boundaries, loads, rankCount, domain->minimumWidth);
+        free(loads);
+
+        for (uint32_t peer = 1; peer < rankCount; peer++)
+        {
+            transport->send(transport, peer, domain->boundaries, (rankCount + 1) * sizeof(float));
+        }
+    }
+    else
+    {
+        transport->send(transport, 0, &load, sizeof(DomainLoad));
+        transport->receive(transport, 0, domain->boundaries, (rankCount + 1) * sizeof(float));
+    }
+
+    domain->computeSeconds = 0.0;
+
+    migrate(domain, rankCount - 1);
+}
+
+void sphDomainInit(SphDomain *domain, DomainTransport *transport, const SphSolver *seeded)
+{
+    memset(domain, 0, sizeof(*domain));
+
+    const SphParams *params = &seeded->params;
+    uint32_t rank = transport->rank;
+    uint32_t rankCount = transport->rankCount;
+    float width = params->boundsMax[0] - params->boundsMin[0];
+
+    domain->transport = transport;
+    domain->minimumWidth = 2.0f * params->smoothingRadius;
+    domain->rebalanceInterval = SPH_DOMAIN_REBALANCE_INTERVAL;
+
+    // The solve would need its dot products and matrix products across the slabs every iteration
+    if (params->viscosityIterations > 0)
+    {
+        fprintf(stderr, "The domain decomposition only supports the explicit viscosity!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (width < rankCount * domain->minimumWidth)
+    {
+        fprintf(stderr, "The domain is too narrow for %u slabs!\n", rankCount);
+        exit(EXIT_FAILURE);
+    }
+
+    domain->boundaries = malloc((rankCount + 1) * sizeof(float));
+
+    if (!domain->boundaries)
+    {
+        fprintf(stderr, "Failed to allocate domain slab edges!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t edge = 0; edge <= rankCount; edge++)
+    {
+        domain->boundaries[edge] = params->boundsMin[0] + width * edge / rankCount;
+    }
+
+    // Start with room for an even share plus the ghost layers
+    SphParams localParams = *params;
+    localParams.particleCount = seeded->count / rankCount + seeded->count / 4 + 1;
+    localParams.neighborSkin = 0.0f; // Ghosts and migrants change every step, the slabs walk the grid
+
+    sphInit(&domain->solver, &localParams);
+    domain->capacity = localParams.particleCount;
+    domain->ids = malloc(domain->capacity * sizeof(uint32_t));
+
+    if (!domain->ids)
+    {
+        fprintf(stderr, "Failed to allocate domain particle storage!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < seeded->count; i++)
+    {
+        float x = seeded->posX[i];
+
+        if ((rank > 0 && x < domain->boundaries[rank]) || (rank + 1 < rankCount && x >= domain->boundaries[rank + 1]))
+        {
+            continue;
+        }
+
+        DomainParticle particle = {i, {seeded->posX[i], seeded->posY[i], seeded->posZ[i]}, {seeded->velX[i], seeded->velY[i], seeded->velZ[i]}};
+
+        reserveParticles(domain, domain->ownedCount + 1);
+        unpackParticle(domain, domain->ownedCount++, &particle);
+    }
+
+    domain->solver.count = domain->ownedCount;
+}
+
+static double secondsSince(const struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void sphDomainStep(SphDomain *domain)
+{
+    SphSolver *solver = &domain->solver;
+    struct timespec start;
+
+    exchangeGhosts(domain);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sphBuildGrid(solver);
+    sphComputeDensity(solver);
+    domain->computeSeconds += secondsSince(&start);
+
+    exchangeGhostDensities(domain);
+
+    // Forces of the ghosts are computed too and thrown away, only the owned particles move
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sphComputeForces(solver);
+    solver->count = domain->ownedCount;
+    sphIntegrate(solver);
+    domain->computeSeconds += secondsSince(&start);
+
+    migrate(domain, 1);
+
+    domain->stepIndex++;
+
+    if (domain->stepIndex % domain->rebalanceInterval == 0)
+    {
+        rebalance(domain);
+    }
+}
+
+void sphDomainGather(SphDomain *domain, SphSolver *solver)
+{
+    DomainTransport *transport = domain->transport;
+
+    domain->sendBuffer[0] = growBuffer(domain->sendBuffer[0], &domain->sendCapacity[0], domain->ownedCount * sizeof(DomainParticle));
+
+    for (uint32_t i = 0; i < domain->ownedCount; i++)
+    {
+        packParticle(domain, i, (DomainParticle*)domain->sendBuffer[0] + i);
+    }
+
+    if (transport->rank != 0)
+    {
+        transport->send(transport, 0, &domain->ownedCount, sizeof(uint32_t));
+        transport->send(transport, 0, domain->sendBuffer[0], domain->ownedCount * sizeof(DomainParticle));
+        return;
+    }
+
+    for (uint32_t peer = 0; peer < transport->rankCount; peer++)
+    {
+        uint32_t count = domain->ownedCount;
+        const DomainParticle *particles = domain->sendBuffer[0];
+
+        if (peer > 0)
+        {
+            transport->receive(transport, peer, &count, sizeof(uint32_t));
+            domain->receiveBuffer[0] = growBuffer(domain->receiveBuffer[0], &domain->receiveCapacity[0], count * sizeof(DomainParticle));
+            transport->receive(transport, peer, domain->receiveBuffer[0], count * sizeof(DomainParticle));
+            particles = domain->receiveBuffer[0];
+        }
+
+        for (uint32_t k = 0; k < count; k++)
+        {
+            uint32_t id = particles[k].id;
+
+            if (id >= solver->count)
+            {
+                fprintf(stderr, "Domain rank %u sent particle %u of %u!\n", peer, id, solver->count);
+                exit(EXIT_FAILURE);
+            }
+
+            solver->posX[id] = particles[k].position[0];
+            solver->posY[id] = particles[k].position[1];
+            solver->posZ[id] = particles[k].position[2];
+            solver->velX[id] = particles[k].velocity[0];
+            solver->velY[id] = particles[k].velocity[1];
+            solver->velZ[id] = particles[k].velocity[2];
+        }
+    }
+}
+
+void sphDomainDestroy(SphDomain *domain)
+{
+    sphDestroy(&domain->solver);
+
+    free(domain->ids);
+    free(domain->boundaries);
+
+    for (int side = 0; side < 2; side++)
+    {
+        free(domain->ghostSources[side]);
+        free(domain->sendBuffer[side]);
+        free(domain->receiveBuffer[side]);
+    }
+
+    memset(domain, 0, sizeof(*domain));
+}
+
+// Rank 0 runs in the calling process, the others in forked children that only touch the CPU solver
+static double runRank(const char *directory, uint32_t rank, uint32_t rankCount, const SphSolver *seeded, uint32_t stepCount, SphSolver *gathered)
+{
+    DomainTransport transport;
+    SphDomain domain;
+    struct timespec start;
+
+    domainTransportInitUnix(&transport, directory, rank, rankCount);
+    sphDomainInit(&domain, &transport, seeded);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t step = 0; step < stepCount; step++)
+    {
+        sphDomainStep(&domain);
+    }
+
+    double seconds = secondsSince(&start);
+
+    sphDomainGather(&domain, gathered);
+    sphDomainDestroy(&domain);
+    transport.destroy(&transport);
+
+    return seconds;
+}
+
+int sphDomainReport(const SphParams *params, uint32_t rankCount, uint32_t stepCount)
+{
+    SphSolver reference;
+    SphSolver gathered;
+
+    sphInit(&reference, params);
+    sphSeedDamBreak(&reference);
+    sphInit(&gathered, params);
+
+    char directory[] = "/tmp/fluidsim-domain-XXXXXX";
+
+    if (!mkdtemp(directory))
+    {
+        fprintf(stderr, "Failed to create a directory for the domain sockets!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t *children = calloc(rankCount, sizeof(pid_t));
+
+    if (!children)
+    {
+        fprintf(stderr, "Failed to allocate domain ranks!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Buffered output would be written once by every child
+    fflush(stdout);
+    fflush(stderr);
+
+    for (uint32_t rank = 1; rank < rankCount; rank++)
+    {
+        children[rank] = fork();
+
+        if (children[rank] < 0)
+        {
+            fprintf(stderr, "Failed to fork domain rank %u!\n", rank);
+            exit(EXIT_FAILURE);
+        }
+
+        if (children[rank] == 0)
+        {
+            runRank(directory, rank, rankCount, &reference, stepCount, NULL);
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    double domainSeconds = runRank(directory, 0, rankCount, &reference, stepCount, &gathered);
+    int ranksSucceeded = 1;
+
+    for (uint32_t rank = 1; rank < rankCount; rank++)
+    {
+        int status = 0;
+
+        if (waitpid(children[rank], &status, 0) != children[rank] || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Domain rank %u failed\n", rank);
+            ranksSucceeded = 0;
+        }
+    }
+
+    free(children);
+    rmdir(directory);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t step = 0; step < stepCount; step++)
+    {
+        sphStep(&reference);
+    }
+
+    double referenceSeconds = secondsSince(&start);
+
+    // The ranks sum the neighbors in a different order, the rounding differences grow with the steps
+    float worstDifference = 0.0f;
+
+    for (uint32_t i = 0; i < reference.count; i++)
+    {
+        float dx = gathered.posX[i] - reference.posX[i];
+        float dy = gathered.posY[i] - reference.posY[i];
+        float dz = gathered.posZ[i] - reference.posZ[i];
+
+        worstDifference = fmaxf(worstDifference, sqrtf(dx * dx + dy * dy + dz * dz));
+    }
+
+    float tolerance = 0.1f * params->smoothingRadius;
+    int passed = ranksSucceeded && worstDifference <= tolerance;
+
+    printf("Domain decomposition: %u ranks %.3f ms/step, single process %.3f ms/step (%.2fx), max position difference %g (tolerance %g): %s\n",
+           rankCount, domainSeconds * 1000.0 / stepCount, referenceSeconds * 1000.0 / stepCount, referenceSeconds / domainSeconds, worstDifference, tolerance,
+           passed ? "PASSED" : "FAILED");
+
+    sphDestroy(&reference);
+    sphDestroy(&gathered);
+
+    return passed;
+}
@@ -0,0 +1,1524 @@
+#include "sph_gpu.h"
+#include "sph_pool.h"
+#include "vulkan_utils.h"
+#include "sdf.h"
+#include "frame_bench.h"
+#include "metrics.h"
+#include "descriptor_heap.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define SPH_WORKGROUP_SIZE 256
+#define SPH_RADIX_BITS 8
+
+// Steps between the compactions the pool verification forces, and the stride of the slots it removes
+// before the last one
+#define SPH_POOL_VERIFY_COMPACT_INTERVAL 100
+#define SPH_POOL_VERIFY_KILL_STRIDE 64
+
+// Order matches the bindings declared in sph_common.glsl
+typedef enum {
+    SPH_BUFFER_PARAMS,
+    SPH_BUFFER_POSITIONS,
+    SPH_BUFFER_VELOCITIES,
+    SPH_BUFFER_ACCELERATIONS,
+    SPH_BUFFER_DENSITIES,
+    SPH_BUFFER_KEYS_A,
+    SPH_BUFFER_VALUES_A,
+    SPH_BUFFER_KEYS_B,
+    SPH_BUFFER_VALUES_B,
+    SPH_BUFFER_HISTOGRAM,
+    SPH_BUFFER_CELL_START,
+    SPH_BUFFER_CELL_END,
+    SPH_BUFFER_RENDER_POSITIONS,     // Render slot 0, binding 12
+    SPH_BUFFER_LOD_CELLS,            // Render slot 0, binding 13
+    SPH_BUFFER_OBSTACLE,             // Obstacle SDF distances, binding 14
+    SPH_BUFFER_VISCOSITY_SOLUTION,   // Implicit viscosity solve, bindings 15 to 19
+    SPH_BUFFER_VISCOSITY_RESIDUAL,
+    SPH_BUFFER_VISCOSITY_DIRECTION,
+    SPH_BUFFER_VISCOSITY_PRODUCT,
+    SPH_BUFFER_VISCOSITY_REDUCTION,
+    SPH_BUFFER_LIVE,                 // Live mask of the particle slots, binding 20
+    SPH_BUFFER_RENDER_POSITIONS_ALT, // Render slot 1, bound to binding 12 by the odd frame sets
+    SPH_BUFFER_LOD_CELLS_ALT,        // Render slot 1, bound to binding 13 by the odd frame sets
+    SPH_BUFFER_COUNT
+} SphBufferId;
+
+#define SPH_BINDING_COUNT (SPH_BUFFER_LIVE + 1)
+#define SPH_RENDER_SLOTS 2
+
+typedef enum {
+    SPH_KERNEL_HASH,
+    SPH_KERNEL_HISTOGRAM,
+    SPH_KERNEL_SCAN,
+    SPH_KERNEL_SCATTER,
+    SPH_KERNEL_CELLS,
+    SPH_KERNEL_DENSITY,
+    SPH_KERNEL_FORCES,
+    SPH_KERNEL_INTEGRATE,
+    SPH_KERNEL_LOD,
+    SPH_KERNEL_VISCOSITY_SETUP,
+    SPH_KERNEL_VISCOSITY_REDUCE,
+    SPH_KERNEL_VISCOSITY_PRODUCT,
+    SPH_KERNEL_VISCOSITY_UPDATE,
+    SPH_KERNEL_VISCOSITY_DIRECTION,
+    SPH_KERNEL_VISCOSITY_APPLY,
+    SPH_KERNEL_COUNT
+} SphKernelId;
+
+static const char *kernelPaths[SPH_KERNEL_COUNT] = {
+    "../shaders/sph_hash.spv",
+    "../shaders/radix_histogram.spv",
+    "../shaders/radix_scan.spv",
+    "../shaders/radix_scatter.spv",
+    "../shaders/sph_cells.spv",
+    "../shaders/sph_density.spv",
+    "../shaders/sph_forces.spv",
+    "../shaders/sph_integrate.spv",
+    "../shaders/sph_lod.spv",
+    "../shaders/sph_viscosity_setup.spv",
+    "../shaders/sph_viscosity_reduce.spv",
+    "../shaders/sph_viscosity_product.spv",
+    "../shaders/sph_viscosity_update.spv",
+    "../shaders/sph_viscosity_direction.spv",
+    "../shaders/sph_viscosity_apply.spv"};
+
+// Variants of the kernels touching the particle state, built with SPH_COMPACT_STORAGE
+static const char *compactKernelPaths[SPH_KERNEL_COUNT] = {
+    [SPH_KERNEL_HASH] = "../shaders/sph_hash_compact.spv",
+    [SPH_KERNEL_DENSITY] = "../shaders/sph_density_compact.spv",
+    [SPH_KERNEL_FORCES] = "../shaders/sph_forces_compact.spv",
+    [SPH_KERNEL_INTEGRATE] = "../shaders/sph_integrate_compact.spv",
+    [SPH_KERNEL_VISCOSITY_SETUP] = "../shaders/sph_viscosity_setup_compact.spv",
+    [SPH_KERNEL_VISCOSITY_PRODUCT] = "../shaders/sph_viscosity_product_compact.spv",
+    [SPH_KERNEL_VISCOSITY_APPLY] = "../shaders/sph_viscosity_apply_compact.spv"};
+
+// Fixed point steps per axis of a compact position, matches POSITION_QUANTA in sph_common.glsl
+#define SPH_POSITION_QUANTA 2097151.0f
+
+// Pool steps in flight before sphGpuBeginPoolStep() waits for the oldest one
+#define SPH_UPDATE_SEGMENTS 3
+
+typedef struct {
+    uint32_t shift;
+    uint32_t groupCount;
+} SphPushConstants;
+
+uint32_t sphGpuParticleCount = 0;
+uint32_t sphStepsPerFrame = 4;
+int sphCompactStorage = 0;
+
+static VkBuffer sphBuffers[SPH_BUFFER_COUNT];
+static VkDeviceMemory sphMemories[SPH_BUFFER_COUNT];
+static VkDeviceSize sphBufferSizes[SPH_BUFFER_COUNT];
+static uint32_t sphRenderHandles[SPH_RENDER_SLOTS] = {DESCRIPTOR_HANDLE_NONE, DESCRIPTOR_HANDLE_NONE}; // Slots in the descriptor heap
+
+static VkDescriptorSetLayout sphDescriptorSetLayout = VK_NULL_HANDLE;
+static VkDescriptorPool sphDescriptorPool = VK_NULL_HANDLE;
+static VkDescriptorSet sphDescriptorSets[2 * SPH_RENDER_SLOTS]; // [slot * 2 + 0] sorts A -> B, [slot * 2 + 1] sorts B -> A
+static VkCommandBuffer sphStepCommandBuffers[SPH_RENDER_SLOTS];   // Pre-recorded batches for the compute queue
+static VkPipelineLayout sphPipelineLayout = VK_NULL_HANDLE;
+static VkPipeline sphPipelines[SPH_KERNEL_COUNT];
+
+static SphGpuParams sphParams;
+
+// Persistently mapped copy target of sphGpuReadRenderPositions(), created on first use
+static VkBuffer sphReadbackBuffer = VK_NULL_HANDLE;
+static VkDeviceMemory sphReadbackMemory = VK_NULL_HANDLE;
+static void *sphReadbackMapped = NULL;
+// Persistently mapped staging ring of the pool slot updates, created by the first sphGpuBeginPoolStep(). Pool
+// step N records into segment and command buffer N % SPH_UPDATE_SEGMENTS and signals N on sphUpdateTimeline
+static VkBuffer sphUpdateBuffer = VK_NULL_HANDLE;
+static VkDeviceMemory sphUpdateMemory = VK_NULL_HANDLE;
+static uint8_t *sphUpdateMapped = NULL;
+static VkDeviceSize sphUpdateSegmentBytes = 0;
+static VkDeviceSize sphUpdateFill = 0; // Bytes of the current segment already packed
+static VkBufferCopy *sphUpdateRegions = NULL;
+static VkCommandBuffer sphUpdateCommandBuffers[SPH_UPDATE_SEGMENTS];
+static VkSemaphore sphUpdateTimeline = VK_NULL_HANDLE;
+static uint64_t sphUpdateSubmitted = 0;
+
+static uint32_t sphGroupCount = 0;
+static uint32_t sphCellGroupCount = 0;
+static uint32_t sphRadixPasses = 0;
+static uint32_t sphViscosityIterations = 0; // Conjugate gradient iterations recorded per step, 0 = explicit viscosity
+
+static void uploadToBuffer(VkBuffer dstBuffer, const void *data, VkDeviceSize size)
+{
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingMemory;
+
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingMemory);
+
+    void *mapped;
+    vkMapMemory(device, stagingMemory, 0, size, 0, &mapped);
+    memcpy(mapped, data, (size_t)size);
+    vkUnmapMemory(device, stagingMemory);
+
+    copyBuffer(stagingBuffer, dstBuffer, size);
+
+    vkDestroyBuffer(device, stagingBuffer, NULL);
+    vkFreeMemory(device, stagingMemory, NULL);
+}
+
+static void downloadFromBuffer(VkBuffer srcBuffer, void *data, VkDeviceSize size)
+{
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingMemory;
+
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingMemory);
+
+    copyBuffer(srcBuffer, stagingBuffer, size);
+
+    void *mapped;
+    vkMapMemory(device, stagingMemory, 0, size, 0, &mapped);
+    memcpy(data, mapped, (size_t)size);
+    vkUnmapMemory(device, stagingMemory);
+
+    vkDestroyBuffer(device, stagingBuffer, NULL);
+    vkFreeMemory(device, stagingMemory, NULL);
+}
+
+// IEEE half precision, rounded to nearest even like packHalf2x16 on common hardware
+static uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xFFu) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+
+    if (exponent >= 31)
+    {
+        return (uint16_t)(sign | 0x7C00u | (((bits >> 23) & 0xFFu) == 0xFFu && mantissa ? 0x200u : 0u));
+    }
+
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+        {
+            return (uint16_t)sign;
+        }
+
+        mantissa |= 0x800000u;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+
+        half += remainder > midpoint || (remainder == midpoint && (half & 1u));
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1FFFu;
+
+    // A carry into the exponent is the correct rounding, up to infinity
+    half += remainder > 0x1000u || (remainder == 0x1000u && (half & 1u));
+    return (uint16_t)(sign | half);
+}
+
+static float halfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000u) << 16;
+    uint32_t exponent = (half >> 10) & 0x1Fu;
+    uint32_t mantissa = half & 0x3FFu;
+    uint32_t bits;
+
+    if (exponent == 0)
+    {
+        float value = ldexpf((float)mantissa, -24);
+        return sign ? -value : value;
+    }
+
+    if (exponent == 31)
+    {
+        bits = sign | 0x7F800000u | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+// Host side of storePosition() and storeVelocity() in sph_common.glsl
+static void packCompactState(const SphSolver *source, uint32_t i, uint32_t position[2], uint32_t velocity[2])
+{
+    const float *boundsMin = sphParams.boundsMin;
+    const float *boundsMax = sphParams.boundsMax;
+    float coordinates[3] = {source->posX[i], source->posY[i], source->posZ[i]};
+    uint32_t quantized[3];
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float normalized = (coordinates[axis] - boundsMin[axis]) / (boundsMax[axis] - boundsMin[axis]);
+        quantized[axis] = (uint32_t)roundf(fminf(fmaxf(normalized, 0.0f), 1.0f) * SPH_POSITION_QUANTA);
+    }
+
+    position[0] = quantized[0] | (quantized[1] << 21);
+    position[1] = (quantized[1] >> 11) | (quantized[2] << 10);
+
+    float relativeDensity = source->density[i] / sphParams.material[0] - 1.0f;
+
+    velocity[0] = floatToHalf(source->velX[i]) | ((uint32_t)floatToHalf(source->velY[i]) << 16);
+    velocity[1] = floatToHalf(source->velZ[i]) | ((uint32_t)floatToHalf(relativeDensity) << 16);
+}
+
+static void unpackCompactState(SphSolver *target, uint32_t i, const uint32_t position[2], const uint32_t velocity[2])
+{
+    uint32_t quantized[3] = {position[0] & 0x1FFFFFu, (position[0] >> 21) | ((position[1] & 0x3FFu) << 11), position[1] >> 10};
+    float *coordinates[3] = {&target->posX[i], &target->posY[i], &target->posZ[i]};
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        *coordinates[axis] = sphParams.boundsMin[axis] + (float)quantized[axis] * ((sphParams.boundsMax[axis] - sphParams.boundsMin[axis]) / SPH_POSITION_QUANTA);
+    }
+
+    target->velX[i] = halfToFloat((uint16_t)(velocity[0] & 0xFFFFu));
+    target->velY[i] = halfToFloat((uint16_t)(velocity[0] >> 16));
+    target->velZ[i] = halfToFloat((uint16_t)(velocity[1] & 0xFFFFu));
+    target->density[i] = (halfToFloat((uint16_t)(velocity[1] >> 16)) + 1.0f) * sphParams.material[0];
+}
+
+static void createSphBuffers(uint32_t cellCount, const SdfGrid *obstacle)
+{
+    VkDeviceSize particleCount = sphGpuParticleCount;
+
+    sphBufferSizes[SPH_BUFFER_PARAMS] = sizeof(SphGpuParams);
+    sphBufferSizes[SPH_BUFFER_POSITIONS] = particleCount * 4 * sizeof(float);
+    sphBufferSizes[SPH_BUFFER_VELOCITIES] = particleCount * 4 * sizeof(float);
+    sphBufferSizes[SPH_BUFFER_ACCELERATIONS] = particleCount * 4 * sizeof(float);
+    sphBufferSizes[SPH_BUFFER_DENSITIES] = particleCount * sizeof(float);
+
+    // Two uints per position and two per velocity, the density travels with the velocity
+    if (sphCompactStorage)
+    {
+        sphBufferSizes[SPH_BUFFER_POSITIONS] = particleCount * 2 * sizeof(uint32_t);
+        sphBufferSizes[SPH_BUFFER_VELOCITIES] = particleCount * 2 * sizeof(uint32_t);
+        sphBufferSizes[SPH_BUFFER_DENSITIES] = sizeof(float);
+    }
+    sphBufferSizes[SPH_BUFFER_KEYS_A] = particleCount * sizeof(uint32_t);
+    sphBufferSizes[SPH_BUFFER_VALUES_A] = particleCount * sizeof(uint32_t);
+    sphBufferSizes[SPH_BUFFER_KEYS_B] = particleCount * sizeof(uint32_t);
+    sphBufferSizes[SPH_BUFFER_VALUES_B] = particleCount * sizeof(uint32_t);
+    sphBufferSizes[SPH_BUFFER_HISTOGRAM] = (VkDeviceSize)(1u << SPH_RADIX_BITS) * sphGroupCount * sizeof(uint32_t);
+    sphBufferSizes[SPH_BUFFER_CELL_START] = (VkDeviceSize)cellCount * sizeof(uint32_t);
+    sphBufferSizes[SPH_BUFFER_CELL_END] = (VkDeviceSize)cellCount * sizeof(uint32_t);
+    sphBufferSizes[SPH_BUFFER_RENDER_POSITIONS] = particleCount * 4 * sizeof(float);
+    sphBufferSizes[SPH_BUFFER_RENDER_POSITIONS_ALT] = particleCount * 4 * sizeof(float);
+    sphBufferSizes[SPH_BUFFER_LOD_CELLS] = (VkDeviceSize)cellCount * sizeof(SphLodCell);
+    sphBufferSizes[SPH_BUFFER_LOD_CELLS_ALT] = (VkDeviceSize)cellCount * sizeof(SphLodCell);
+
+    // Bound even without an obstacle, a single placeholder sample keeps the descriptor valid
+    sphBufferSizes[SPH_BUFFER_OBSTACLE] = obstacle ? (VkDeviceSize)obstacle->dim[0] * obstacle->dim[1] * obstacle->dim[2] * sizeof(float) : sizeof(float);
+
+    // The solver vectors only exist with the implicit viscosity, placeholders keep the descriptors valid
+    VkDeviceSize solverVector = sphViscosityIterations > 0 ? particleCount * 4 * sizeof(float) : 4 * sizeof(float);
+    sphBufferSizes[SPH_BUFFER_VISCOSITY_SOLUTION] = solverVector;
+    sphBufferSizes[SPH_BUFFER_VISCOSITY_RESIDUAL] = solverVector;
+    sphBufferSizes[SPH_BUFFER_VISCOSITY_DIRECTION] = solverVector;
+    sphBufferSizes[SPH_BUFFER_VISCOSITY_PRODUCT] = solverVector;
+    sphBufferSizes[SPH_BUFFER_VISCOSITY_REDUCTION] = (VkDeviceSize)(sphGroupCount + 4) * 4 * sizeof(float); // Partial sums, then 4 scalars
+    sphBufferSizes[SPH_BUFFER_LIVE] = particleCount * sizeof(uint32_t);
+
+    for (int i = 0; i < SPH_BUFFER_COUNT; i++)
+    {
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+        if (i == SPH_BUFFER_PARAMS)
+        {
+            usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        }
+        else if (i == SPH_BUFFER_RENDER_POSITIONS || i == SPH_BUFFER_RENDER_POSITIONS_ALT)
+        {
+            usage |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        }
+
+        // Written on the compute queue, uploaded on the transfer queue and drawn on the graphics queue
+        createSharedBuffer(sphBufferSizes[i], usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &sphBuffers[i], &sphMemories[i]);
+    }
+
+    // The particle pipeline reads the positions through the descriptor heap when the device has one
+    sphRenderHandles[0] = descriptorHeapAddBuffer(sphBuffers[SPH_BUFFER_RENDER_POSITIONS], 0, VK_WHOLE_SIZE);
+    sphRenderHandles[1] = descriptorHeapAddBuffer(sphBuffers[SPH_BUFFER_RENDER_POSITIONS_ALT], 0, VK_WHOLE_SIZE);
+}
+
+// Buffer behind a binding for a given sort direction and render slot
+static SphBufferId bufferForBinding(uint32_t binding, uint32_t sortParity, uint32_t slot)
+{
+    if (sortParity == 1)
+    {
+        switch (binding)
+        {
+        case SPH_BUFFER_KEYS_A:
+            return SPH_BUFFER_KEYS_B;
+        case SPH_BUFFER_VALUES_A:
+            return SPH_BUFFER_VALUES_B;
+        case SPH_BUFFER_KEYS_B:
+            return SPH_BUFFER_KEYS_A;
+        case SPH_BUFFER_VALUES_B:
+            return SPH_BUFFER_VALUES_A;
+        default:
+            break;
+        }
+    }
+
+    if (binding == SPH_BUFFER_RENDER_POSITIONS && slot == 1)
+    {
+        return SPH_BUFFER_RENDER_POSITIONS_ALT;
+    }
+
+    if (binding == SPH_BUFFER_LOD_CELLS && slot == 1)
+    {
+        return SPH_BUFFER_LOD_CELLS_ALT;
+    }
+
+    return (SphBufferId)binding;
+}
+
+static void createSphDescriptors()
+{
+    VkDescriptorSetLayoutBinding bindings[SPH_BINDING_COUNT] = {};
+
+    for (uint32_t i = 0; i < SPH_BINDING_COUNT; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i == SPH_BUFFER_PARAMS ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = SPH_BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &sphDescriptorSetLayout) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create SPH descriptor set layout!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const uint32_t setCount = 2 * SPH_RENDER_SLOTS;
+
+    VkDescriptorPoolSize poolSizes[2] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = setCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = setCount * (SPH_BINDING_COUNT - 1);
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = setCount;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, NULL, &sphDescriptorPool) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create SPH descriptor pool!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorSetLayout setLayouts[2 * SPH_RENDER_SLOTS];
+
+    for (uint32_t set = 0; set < setCount; set++)
+    {
+        setLayouts[set] = sphDescriptorSetLayout;
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = sphDescriptorPool;
+    allocInfo.descriptorSetCount = setCount;
+    allocInfo.pSetLayouts = setLayouts;
+
+    if (vkAllocateDescriptorSets(device, &allocInfo, sphDescriptorSets) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate SPH descriptor sets!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The sets only differ in which key/value pair is the sort input and which render slot receives the positions
+    for (uint32_t set = 0; set < setCount; set++)
+    {
+        VkDescriptorBufferInfo bufferInfos[SPH_BINDING_COUNT];
+        VkWriteDescriptorSet writes[SPH_BINDING_COUNT] = {};
+
+        for (uint32_t i = 0; i < SPH_BINDING_COUNT; i++)
+        {
+            bufferInfos[i].buffer = sphBuffers[bufferForBinding(i, set & 1, set / 2)];
+            bufferInfos[i].offset = 0;
+            bufferInfos[i].range = VK_WHOLE_SIZE;
+
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = sphDescriptorSets[set];
+            writes[i].dstBinding = i;
+            writes[i].dstArrayElement = 0;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = bindings[i].descriptorType;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+
+        vkUpdateDescriptorSets(device, SPH_BINDING_COUNT, writes, 0, NULL);
+    }
+}
+
+static void createSphPipelines()
+{
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(SphPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &sphDescriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &sphPipelineLayout) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create SPH pipeline layout!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < SPH_KERNEL_COUNT; i++)
+    {
+        const char *path = sphCompactStorage && compactKernelPaths[i] ? compactKernelPaths[i] : kernelPaths[i];
+        sphPipelines[i] = createComputePipeline(path, sphPipelineLayout);
+    }
+}
+
+// Positions, velocities and densities, the state every step reads and writes at full resolution
+static VkDeviceSize sphStateBytes()
+{
+    return sphBufferSizes[SPH_BUFFER_POSITIONS] + sphBufferSizes[SPH_BUFFER_VELOCITIES] + sphBufferSizes[SPH_BUFFER_DENSITIES];
+}
+
+void sphGpuInit(const SphSolver *source)
+{
+    const SphParams *params = &source->params;
+
+    // One slot per particle the solver has room for, a particle pool fills them over time
+    sphGpuParticleCount = params->particleCount;
+
+    // Fixed for the run on the GPU: the time step, and the iteration count every implicit solve records
+    if (metricsActive)
+    {
+        metricsSet(METRIC_PARTICLES, source->count);
+        metricsSet(METRIC_TIME_STEP, params->timeStep);
+        metricsSet(METRIC_SOLVER_ITERATIONS, params->viscosityIterations);
+    }
+    sphGroupCount = (sphGpuParticleCount + SPH_WORKGROUP_SIZE - 1) / SPH_WORKGROUP_SIZE;
+    sphCellGroupCount = (source->cellCount + SPH_WORKGROUP_SIZE - 1) / SPH_WORKGROUP_SIZE;
+
+    // Only sort as many digits as the largest cell key needs, dead slots get the key cellCount and sort last
+    uint32_t keyBits = 0;
+
+    while (keyBits < 32 && (source->cellCount >> keyBits) != 0)
+    {
+        keyBits++;
+    }
+
+    sphRadixPasses = (keyBits + SPH_RADIX_BITS - 1) / SPH_RADIX_BITS;
+
+    if (sphRadixPasses == 0)
+    {
+        sphRadixPasses = 1;
+    }
+
+    float h = params->smoothingRadius;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        sphParams.boundsMin[axis] = params->boundsMin[axis];
+        sphParams.boundsMax[axis] = params->boundsMax[axis];
+        sphParams.gravity[axis] = params->gravity[axis];
+        sphParams.gridDim[axis] = source->gridDim[axis];
+    }
+
+    sphParams.boundsMin[3] = h;
+    sphParams.boundsMax[3] = params->timeStep;
+    sphParams.gravity[3] = params->particleMass;
+    sphParams.material[0] = params->restDensity;
+    sphParams.material[1] = params->stiffness;
+    sphParams.material[2] = params->viscosityIterations > 0 ? 0.0f : params->viscosity; // Explicit viscosity in the force kernel
+    sphParams.material[3] = params->boundaryDamping;
+    sphParams.kernels[0] = source->poly6;
+    sphParams.kernels[1] = source->spikyGradient;
+    sphParams.kernels[2] = source->viscosityLaplacian;
+    sphParams.kernels[3] = h * h;
+    sphParams.gridDim[3] = sphGpuParticleCount;
+
+    const SdfGrid *obstacle = params->obstacle;
+
+    if (obstacle)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            sphParams.obstacleOrigin[axis] = obstacle->origin[axis];
+            sphParams.obstacleDim[axis] = obstacle->dim[axis];
+        }
+
+        sphParams.obstacleOrigin[3] = obstacle->cellSize;
+        sphParams.obstacleMargin[0] = params->obstacleMargin;
+        sphParams.obstacleDim[3] = 1;
+    }
+    else
+    {
+        sphParams.obstacleDim[3] = 0;
+    }
+
+    sphViscosityIterations = params->viscosityIterations;
+    sphParams.viscositySolver[0] = params->viscosityTolerance * params->viscosityTolerance;
+    sphParams.viscositySolver[1] = params->viscosity;
+
+    createSphBuffers(source->cellCount, obstacle);
+    createSphDescriptors();
+    createSphPipelines();
+
+    // Initial state, interleaved into vec4s
+    float *positions = malloc(sphBufferSizes[SPH_BUFFER_POSITIONS]);
+    float *velocities = malloc(sphBufferSizes[SPH_BUFFER_VELOCITIES]);
+    uint32_t *live = malloc(sphBufferSizes[SPH_BUFFER_LIVE]);
+
+    if (!positions || !velocities || !live)
+    {
+        fprintf(stderr, "Failed to allocate SPH upload memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < sphGpuParticleCount && sphCompactStorage; i++)
+    {
+        uint32_t *packedPositions = (uint32_t *)positions;
+        uint32_t *packedVelocities = (uint32_t *)velocities;
+
+        packCompactState(source, i, &packedPositions[2 * i], &packedVelocities[2 * i]);
+    }
+
+    for (uint32_t i = 0; i < sphGpuParticleCount && !sphCompactStorage; i++)
+    {
+        positions[4 * i + 0] = source->posX[i];
+        positions[4 * i + 1] = source->posY[i];
+        positions[4 * i + 2] = source->posZ[i];
+        positions[4 * i + 3] = source->density[i];
+
+        velocities[4 * i + 0] = source->velX[i];
+        velocities[4 * i + 1] = source->velY[i];
+        velocities[4 * i + 2] = source->velZ[i];
+        velocities[4 * i + 3] = 0.0f;
+    }
+
+    for (uint32_t i = 0; i < sphGpuParticleCount; i++)
+    {
+        live[i] = i < source->count && (!source->alive || source->alive[i]);
+    }
+
+    uploadToBuffer(sphBuffers[SPH_BUFFER_PARAMS], &sphParams, sizeof(sphParams));
+    uploadToBuffer(sphBuffers[SPH_BUFFER_POSITIONS], positions, sphBufferSizes[SPH_BUFFER_POSITIONS]);
+    uploadToBuffer(sphBuffers[SPH_BUFFER_VELOCITIES], velocities, sphBufferSizes[SPH_BUFFER_VELOCITIES]);
+    uploadToBuffer(sphBuffers[SPH_BUFFER_LIVE], live, sphBufferSizes[SPH_BUFFER_LIVE]);
+
+    if (obstacle)
+    {
+        uploadToBuffer(sphBuffers[SPH_BUFFER_OBSTACLE], obstacle->distances, sphBufferSizes[SPH_BUFFER_OBSTACLE]);
+    }
+
+    free(positions);
+    free(velocities);
+    free(live);
+
+    // The batches never change, so they are recorded once per render slot and resubmitted
+    VkCommandBufferAllocateInfo commandAllocInfo = {};
+    commandAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandAllocInfo.commandPool = computeCommandPool;
+    commandAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandAllocInfo.commandBufferCount = SPH_RENDER_SLOTS;
+
+    if (vkAllocateCommandBuffers(device, &commandAllocInfo, sphStepCommandBuffers) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate SPH command buffers!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t slot = 0; slot < SPH_RENDER_SLOTS; slot++)
+    {
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+        if (vkBeginCommandBuffer(sphStepCommandBuffers[slot], &beginInfo) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to begin recording SPH command buffer!\n");
+            exit(EXIT_FAILURE);
+        }
+
+        sphGpuRecordStep(sphStepCommandBuffers[slot], sphStepsPerFrame, slot);
+
+        if (vkEndCommandBuffer(sphStepCommandBuffers[slot]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to record SPH command buffer!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    markCommandBuffersDirty(); // New particle count and render buffers
+    printf("SPH compute backend created: %u particles, %u radix passes, %s particle state: %.1f MiB\n", sphGpuParticleCount, sphRadixPasses,
+           sphCompactStorage ? "compact" : "fp32", (double)sphStateBytes() / (1024.0 * 1024.0));
+}
+
+static void memoryBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+static void computeBarrier(VkCommandBuffer commandBuffer)
+{
+    memoryBarrier(commandBuffer,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+static void dispatchKernel(VkCommandBuffer commandBuffer, SphKernelId kernel, uint32_t groupCount)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sphPipelines[kernel]);
+    vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
+
+static void dispatchViscosityReduce(VkCommandBuffer commandBuffer, SphPushConstants *pushConstants, uint32_t phase)
+{
+    pushConstants->shift = phase;
+    vkCmdPushConstants(commandBuffer, sphPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(*pushConstants), pushConstants);
+    dispatchKernel(commandBuffer, SPH_KERNEL_VISCOSITY_REDUCE, 1);
+    computeBarrier(commandBuffer);
+}
+
+// Conjugate gradients on the implicit viscosity system, a fixed number of iterations since the
+// convergence test runs on the GPU: once a component converged its step sizes are zero
+static void recordViscositySolve(VkCommandBuffer commandBuffer, SphPushConstants *pushConstants)
+{
+    dispatchKernel(commandBuffer, SPH_KERNEL_VISCOSITY_SETUP, sphGroupCount);
+    computeBarrier(commandBuffer);
+    dispatchViscosityReduce(commandBuffer, pushConstants, 0);
+
+    for (uint32_t iteration = 0; iteration < sphViscosityIterations; iteration++)
+    {
+        dispatchKernel(commandBuffer, SPH_KERNEL_VISCOSITY_PRODUCT, sphGroupCount);
+        computeBarrier(commandBuffer);
+        dispatchViscosityReduce(commandBuffer, pushConstants, 1);
+        dispatchKernel(commandBuffer, SPH_KERNEL_VISCOSITY_UPDATE, sphGroupCount);
+        computeBarrier(commandBuffer);
+        dispatchViscosityReduce(commandBuffer, pushConstants, 2);
+        dispatchKernel(commandBuffer, SPH_KERNEL_VISCOSITY_DIRECTION, sphGroupCount);
+        computeBarrier(commandBuffer);
+    }
+
+    dispatchKernel(commandBuffer, SPH_KERNEL_VISCOSITY_APPLY, sphGroupCount);
+    computeBarrier(commandBuffer);
+}
+
+void sphGpuRecordStep(VkCommandBuffer commandBuffer, uint32_t stepCount, uint32_t slot)
+{
+    SphPushConstants pushConstants = {0, sphGroupCount};
+    VkDescriptorSet *slotSets = &sphDescriptorSets[2 * (slot % SPH_RENDER_SLOTS)];
+    uint32_t sortedSet = sphRadixPasses & 1;
+
+    for (uint32_t step = 0; step < stepCount; step++)
+    {
+        // The previous step (or batch) read the cell ranges we are about to clear. Only compute and
+        // transfer stages appear here, the batches are recorded for a compute-only queue
+        memoryBarrier(commandBuffer,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+        vkCmdFillBuffer(commandBuffer, sphBuffers[SPH_BUFFER_CELL_START], 0, VK_WHOLE_SIZE, 0);
+        vkCmdFillBuffer(commandBuffer, sphBuffers[SPH_BUFFER_CELL_END], 0, VK_WHOLE_SIZE, 0);
+
+        // Cell keys
+        pushConstants.shift = 0;
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sphPipelineLayout, 0, 1, &slotSets[0], 0, NULL);
+        vkCmdPushConstants(commandBuffer, sphPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+        dispatchKernel(commandBuffer, SPH_KERNEL_HASH, sphGroupCount);
+        computeBarrier(commandBuffer);
+
+        // Radix sort of the (key, particle index) pairs, ping-ponging between the A and B buffers
+        for (uint32_t pass = 0; pass < sphRadixPasses; pass++)
+        {
+            pushConstants.shift = pass * SPH_RADIX_BITS;
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sphPipelineLayout, 0, 1, &slotSets[pass & 1], 0, NULL);
+            vkCmdPushConstants(commandBuffer, sphPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+            dispatchKernel(commandBuffer, SPH_KERNEL_HISTOGRAM, sphGroupCount);
+            computeBarrier(commandBuffer);
+            dispatchKernel(commandBuffer, SPH_KERNEL_SCAN, 1);
+            computeBarrier(commandBuffer);
+            dispatchKernel(commandBuffer, SPH_KERNEL_SCATTER, sphGroupCount);
+            computeBarrier(commandBuffer);
+        }
+
+        // The sorted pairs are now the "in" buffers of the set matching the pass count parity
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, sphPipelineLayout, 0, 1, &slotSets[sortedSet], 0, NULL);
+
+        memoryBarrier(commandBuffer,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+        dispatchKernel(commandBuffer, SPH_KERNEL_CELLS, sphGroupCount);
+        computeBarrier(commandBuffer);
+        dispatchKernel(commandBuffer, SPH_KERNEL_DENSITY, sphGroupCount);
+        computeBarrier(commandBuffer);
+        dispatchKernel(commandBuffer, SPH_KERNEL_FORCES, sphGroupCount);
+        computeBarrier(commandBuffer);
+
+        if (sphViscosityIterations > 0)
+        {
+            recordViscositySolve(commandBuffer, &pushConstants);
+        }
+
+        dispatchKernel(commandBuffer, SPH_KERNEL_INTEGRATE, sphGroupCount);
+    }
+
+    // Level of detail aggregates of the positions the renderer gets, built from the cell ranges
+    // the last step already sorted instead of binning the particles again
+    computeBarrier(commandBuffer);
+    dispatchKernel(commandBuffer, SPH_KERNEL_LOD, sphCellGroupCount);
+
+    // Readbacks copy the results; the graphics queue gets its visibility from the timeline semaphore wait
+    memoryBarrier(commandBuffer,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+}
+
+void sphGpuSubmitStep(uint64_t batch)
+{
+    uint32_t slot = (uint32_t)(batch % SPH_RENDER_SLOTS);
+
+    // The command buffer of this slot was last submitted for batch - 2, it must have left the pending state
+    if (batch > SPH_RENDER_SLOTS)
+    {
+        uint64_t previousBatch = batch - SPH_RENDER_SLOTS;
+
+        VkSemaphoreWaitInfo waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &simulationTimeline;
+        waitInfo.pValues = &previousBatch;
+
+        vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+    }
+
+    // The frame that drew this render slot (batch - 2) has to be done before it is overwritten,
+    // the frame drawing batch - 1 keeps running while this batch computes
+    uint64_t waitValue = batch > SPH_RENDER_SLOTS ? batch - SPH_RENDER_SLOTS : 0;
+    uint64_t signalValue = batch;
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &waitValue;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &renderTimeline;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    VkCommandBuffer commandBuffers[3] = {sphStepCommandBuffers[slot]};
+    submitInfo.commandBufferCount = frameBenchActive ? frameBenchWrapCompute(batch, sphStepCommandBuffers[slot], commandBuffers) : 1;
+    submitInfo.pCommandBuffers = commandBuffers;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &simulationTimeline;
+
+    if (vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to submit SPH step!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (metricsActive)
+    {
+        metricsAdd(METRIC_SIMULATION_BATCHES, 1.0);
+        metricsAdd(METRIC_STEPS, sphStepsPerFrame);
+    }
+}
+
+VkBuffer sphGpuRenderBuffer(uint64_t batch)
+{
+    return batch % SPH_RENDER_SLOTS == 0 ? sphBuffers[SPH_BUFFER_RENDER_POSITIONS] : sphBuffers[SPH_BUFFER_RENDER_POSITIONS_ALT];
+}
+
+uint32_t sphGpuRenderBufferHandle(uint64_t batch)
+{
+    return sphRenderHandles[batch % SPH_RENDER_SLOTS];
+}
+
+VkBuffer sphGpuLodBuffer(uint64_t batch)
+{
+    return batch % SPH_RENDER_SLOTS == 0 ? sphBuffers[SPH_BUFFER_LOD_CELLS] : sphBuffers[SPH_BUFFER_LOD_CELLS_ALT];
+}
+
+void sphGpuGridDim(uint32_t gridDim[3])
+{
+    gridDim[0] = sphParams.gridDim[0];
+    gridDim[1] = sphParams.gridDim[1];
+    gridDim[2] = sphParams.gridDim[2];
+}
+
+void sphGpuReadRenderPositions(uint64_t batch, float *positions)
+{
+    VkDeviceSize size = sphBufferSizes[SPH_BUFFER_RENDER_POSITIONS];
+
+    if (sphReadbackBuffer == VK_NULL_HANDLE)
+    {
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &sphReadbackBuffer, &sphReadbackMemory);
+        vkMapMemory(device, sphReadbackMemory, 0, size, 0, &sphReadbackMapped);
+    }
+
+    // The render slot of this batch is only overwritten once the frame drawing it is done, which
+    // cannot happen before the caller submits that frame
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &simulationTimeline;
+    waitInfo.pValues = &batch;
+
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+
+    copyBuffer(sphGpuRenderBuffer(batch), sphReadbackBuffer, size);
+    memcpy(positions, sphReadbackMapped, (size_t)size);
+}
+
+void sphGpuDownload(SphSolver *target)
+{
+    float *positions = malloc(sphBufferSizes[SPH_BUFFER_POSITIONS]);
+    float *velocities = malloc(sphBufferSizes[SPH_BUFFER_VELOCITIES]);
+
+    if (!positions || !velocities)
+    {
+        fprintf(stderr, "Failed to allocate SPH readback memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    downloadFromBuffer(sphBuffers[SPH_BUFFER_POSITIONS], positions, sphBufferSizes[SPH_BUFFER_POSITIONS]);
+    downloadFromBuffer(sphBuffers[SPH_BUFFER_VELOCITIES], velocities, sphBufferSizes[SPH_BUFFER_VELOCITIES]);
+
+    uint32_t count = target->count < sphGpuParticleCount ? target->count : sphGpuParticleCount;
+
+    for (uint32_t i = 0; i < count && sphCompactStorage; i++)
+    {
+        unpackCompactState(target, i, (const uint32_t *)&positions[2 * i], (const uint32_t *)&velocities[2 * i]);
+    }
+
+    for (uint32_t i = 0; i < count && !sphCompactStorage; i++)
+    {
+        target->posX[i] = positions[4 * i + 0];
+        target->posY[i] = positions[4 * i + 1];
+        target->posZ[i] = positions[4 * i + 2];
+        target->density[i] = positions[4 * i + 3];
+
+        target->velX[i] = velocities[4 * i + 0];
+        target->velY[i] = velocities[4 * i + 1];
+        target->velZ[i] = velocities[4 * i + 2];
+    }
+
+    free(positions);
+    free(velocities);
+}
+
+// Copy regions of stride bytes moving slot source[k] (k itself when source is NULL, a packed staging
+// buffer) to slot target[k]. Runs of consecutive slots become one region
+static uint32_t slotRegions(const uint32_t *source, const uint32_t *target, uint32_t count, VkDeviceSize stride, VkDeviceSize sourceBase, VkBufferCopy *regions)
+{
+    uint32_t regionCount = 0;
+
+    for (uint32_t k = 0; k < count; k++)
+    {
+        uint32_t from = source ? source[k] : k;
+
+        if (regionCount > 0 && k > 0 && target[k] == target[k - 1] + 1 && from == (source ? source[k - 1] : k - 1) + 1)
+        {
+            regions[regionCount - 1].size += stride;
+            continue;
+        }
+
+        regions[regionCount].srcOffset = sourceBase + from * stride;
+        regions[regionCount].dstOffset = target[k] * stride;
+        regions[regionCount].size = stride;
+        regionCount++;
+    }
+
+    return regionCount;
+}
+
+// Bytes of a slot in the position, velocity and density buffers, the compact storage has no densities
+static void slotStrides(VkDeviceSize strides[3])
+{
+    strides[0] = sphCompactStorage ? 2 * sizeof(uint32_t) : 4 * sizeof(float);
+    strides[1] = sphCompactStorage ? 2 * sizeof(uint32_t) : 4 * sizeof(float);
+    strides[2] = sphCompactStorage ? 0 : sizeof(float);
+}
+
+// Creates the staging ring of the pool updates on the first pool step: SPH_UPDATE_SEGMENTS persistently mapped
+// segments, each big enough for every slot, since a pool step changes a slot at most once
+static void createUpdateRing()
+{
+    VkDeviceSize strides[3];
+    slotStrides(strides);
+
+    sphUpdateSegmentBytes = (VkDeviceSize)sphGpuParticleCount * (strides[0] + strides[1] + strides[2] + sizeof(uint32_t));
+
+    createBuffer(SPH_UPDATE_SEGMENTS * sphUpdateSegmentBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 &sphUpdateBuffer, &sphUpdateMemory);
+    vkMapMemory(device, sphUpdateMemory, 0, VK_WHOLE_SIZE, 0, (void **)&sphUpdateMapped);
+
+    sphUpdateRegions = malloc(sphGpuParticleCount * sizeof(VkBufferCopy));
+
+    if (!sphUpdateRegions)
+    {
+        fprintf(stderr, "Failed to allocate SPH update regions!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkCommandBufferAllocateInfo commandAllocInfo = {};
+    commandAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandAllocInfo.commandPool = computeCommandPool;
+    commandAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandAllocInfo.commandBufferCount = SPH_UPDATE_SEGMENTS;
+
+    if (vkAllocateCommandBuffers(device, &commandAllocInfo, sphUpdateCommandBuffers) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate SPH update command buffers!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkSemaphoreTypeCreateInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &timelineInfo;
+
+    if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &sphUpdateTimeline) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create SPH update semaphore!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sphUpdateSubmitted = 0;
+}
+
+static void waitUpdateTimeline(uint64_t value)
+{
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &sphUpdateTimeline;
+    waitInfo.pValues = &value;
+
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+}
+
+VkCommandBuffer sphGpuBeginPoolStep()
+{
+    if (sphUpdateBuffer == VK_NULL_HANDLE)
+    {
+        createUpdateRing();
+    }
+
+    // The segment and command buffer of this step were last used SPH_UPDATE_SEGMENTS steps ago, that step
+    // has to be done before the segment is overwritten. Later steps keep running
+    uint64_t step = sphUpdateSubmitted + 1;
+
+    if (step > SPH_UPDATE_SEGMENTS)
+    {
+        waitUpdateTimeline(step - SPH_UPDATE_SEGMENTS);
+    }
+
+    VkCommandBuffer commandBuffer = sphUpdateCommandBuffers[step % SPH_UPDATE_SEGMENTS];
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to begin recording SPH pool step!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sphUpdateFill = 0;
+
+    return commandBuffer;
+}
+
+void sphGpuSubmitPoolStep(VkCommandBuffer commandBuffer)
+{
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to record SPH pool step!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t signalValue = ++sphUpdateSubmitted;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &sphUpdateTimeline;
+
+    if (vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to submit SPH pool step!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void sphGpuWaitPoolSteps()
+{
+    if (sphUpdateSubmitted > 0)
+    {
+        waitUpdateTimeline(sphUpdateSubmitted);
+    }
+}
+
+VkDeviceSize sphGpuRecordUpdateSlots(VkCommandBuffer commandBuffer, const SphSolver *source, const uint32_t *slots, uint32_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    VkDeviceSize strides[3];
+    slotStrides(strides);
+
+    // Layout within the segment: the positions of every slot, then the velocities, densities and live flags
+    VkDeviceSize segmentBase = (sphUpdateSubmitted + 1) % SPH_UPDATE_SEGMENTS * sphUpdateSegmentBytes;
+    VkDeviceSize bases[4];
+    bases[0] = segmentBase + sphUpdateFill;
+    bases[1] = bases[0] + count * strides[0];
+    bases[2] = bases[1] + count * strides[1];
+    bases[3] = bases[2] + count * strides[2];
+
+    VkDeviceSize size = bases[3] + count * sizeof(uint32_t) - bases[0];
+
+    if (sphUpdateFill + size > sphUpdateSegmentBytes)
+    {
+        fprintf(stderr, "SPH pool step changed more slots than the update ring holds!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sphUpdateFill += size;
+
+    for (uint32_t k = 0; k < count; k++)
+    {
+        uint32_t i = slots[k];
+        uint8_t *staging = sphUpdateMapped;
+        uint32_t live = i < source->count && (!source->alive || source->alive[i]);
+
+        if (sphCompactStorage)
+        {
+            packCompactState(source, i, (uint32_t *)(staging + bases[0] + k * strides[0]), (uint32_t *)(staging + bases[1] + k * strides[1]));
+        }
+        else
+        {
+            float position[4] = {source->posX[i], source->posY[i], source->posZ[i], source->density[i]};
+            float velocity[4] = {source->velX[i], source->velY[i], source->velZ[i], 0.0f};
+
+            memcpy(staging + bases[0] + k * strides[0], position, sizeof(position));
+            memcpy(staging + bases[1] + k * strides[1], velocity, sizeof(velocity));
+            memcpy(staging + bases[2] + k * strides[2], &source->density[i], sizeof(float));
+        }
+
+        memcpy(staging + bases[3] + k * sizeof(uint32_t), &live, sizeof(live));
+    }
+
+    // The step or the moves recorded before wrote the slots these copies overwrite
+    memoryBarrier(commandBuffer,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    SphBufferId targets[4] = {SPH_BUFFER_POSITIONS, SPH_BUFFER_VELOCITIES, SPH_BUFFER_DENSITIES, SPH_BUFFER_LIVE};
+    VkDeviceSize targetStrides[4] = {strides[0], strides[1], strides[2], sizeof(uint32_t)};
+
+    for (int buffer = 0; buffer < 4; buffer++)
+    {
+        if (targetStrides[buffer] == 0)
+        {
+            continue;
+        }
+
+        uint32_t regionCount = slotRegions(NULL, slots, count, targetStrides[buffer], bases[buffer], sphUpdateRegions);
+        vkCmdCopyBuffer(commandBuffer, sphUpdateBuffer, sphBuffers[targets[buffer]], regionCount, sphUpdateRegions);
+    }
+
+    return size;
+}
+
+void sphGpuRecordMoveSlots(VkCommandBuffer commandBuffer, const uint32_t *from, const uint32_t *to, uint32_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    VkDeviceSize strides[3];
+    slotStrides(strides);
+
+    // The previous step or the slot updates recorded before wrote the slots these copies read
+    memoryBarrier(commandBuffer,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    SphBufferId targets[3] = {SPH_BUFFER_POSITIONS, SPH_BUFFER_VELOCITIES, SPH_BUFFER_DENSITIES};
+
+    // Sources and targets of a compaction never overlap, so every region copies within its own buffer
+    for (int buffer = 0; buffer < 3; buffer++)
+    {
+        if (strides[buffer] == 0)
+        {
+            continue;
+        }
+
+        uint32_t regionCount = slotRegions(from, to, count, strides[buffer], 0, sphUpdateRegions);
+        vkCmdCopyBuffer(commandBuffer, sphBuffers[targets[buffer]], sphBuffers[targets[buffer]], regionCount, sphUpdateRegions);
+    }
+
+    // The live flags are written, not copied: the targets come alive and the sources die
+    uint32_t regionCount = slotRegions(from, to, count, sizeof(uint32_t), 0, sphUpdateRegions);
+
+    for (uint32_t region = 0; region < regionCount; region++)
+    {
+        vkCmdFillBuffer(commandBuffer, sphBuffers[SPH_BUFFER_LIVE], sphUpdateRegions[region].dstOffset, sphUpdateRegions[region].size, 1);
+        vkCmdFillBuffer(commandBuffer, sphBuffers[SPH_BUFFER_LIVE], sphUpdateRegions[region].srcOffset, sphUpdateRegions[region].size, 0);
+    }
+}
+
+float sphGpuRestDensity()
+{
+    return sphParams.material[0];
+}
+
+int sphGpuVerify(const SphParams *params, uint32_t stepCount)
+{
+    SphSolver reference;
+    sphInit(&reference, params);
+    sphSeedDamBreak(&reference);
+
+    sphGpuInit(&reference);
+
+    VkCommandBuffer stepCommands = beginSingleTimeCommands();
+    sphGpuRecordStep(stepCommands, stepCount, 0);
+    endSingleTimeCommands(stepCommands);
+
+    for (uint32_t step = 0; step < stepCount; step++)
+    {
+        sphStep(&reference);
+    }
+
+    SphSolver result;
+    sphInit(&result, params);
+    sphGpuDownload(&result);
+
+    float maxPositionError = 0.0f;
+    float maxDensityError = 0.0f;
+
+    for (uint32_t i = 0; i < reference.count; i++)
+    {
+        float dx = fabsf(result.posX[i] - reference.posX[i]);
+        float dy = fabsf(result.posY[i] - reference.posY[i]);
+        float dz = fabsf(result.posZ[i] - reference.posZ[i]);
+        float positionError = fmaxf(dx, fmaxf(dy, dz));
+        float densityError = fabsf(result.density[i] - reference.density[i]) / params->restDensity;
+
+        maxPositionError = fmaxf(maxPositionError, positionError);
+        maxDensityError = fmaxf(maxDensityError, densityError);
+    }
+
+    // Summation order matches, so only rounding differences (FMA, reassociation) are expected
+    float positionTolerance = 1e-2f * params->smoothingRadius;
+    float densityTolerance = 1e-3f;
+    int passed = maxPositionError <= positionTolerance && maxDensityError <= densityTolerance;
+
+    printf("GPU verification after %u steps: max position error %g (tolerance %g), max relative density error %g (tolerance %g): %s\n",
+           stepCount, maxPositionError, positionTolerance, maxDensityError, densityTolerance, passed ? "PASSED" : "FAILED");
+
+    sphDestroy(&result);
+    sphDestroy(&reference);
+
+    return passed;
+}
+
+int sphGpuVerifyPool(const SphParams *params, uint32_t stepCount)
+{
+    SphSolver reference;
+    SphPool pool;
+
+    sphPoolInitScene(&pool, &reference, params);
+    sphGpuInit(&reference);
+
+    VkDeviceSize uploadedBytes = 0;
+    VkDeviceSize stepBytes = sphStateBytes() + sphBufferSizes[SPH_BUFFER_LIVE]; // What a full re-upload would send per step
+    uint32_t movedSlots = 0;
+    float compactThreshold = pool.compactThreshold;
+
+    // The GPU follows the pool: the moves of its compaction before the step, its sinks and emitters after it
+    for (uint32_t step = 0; step < stepCount; step++)
+    {
+        // The scene only passes the threshold a few times once the drain empties the dam break. A zero
+        // threshold now and then makes the step compact whatever holes there are, so short runs move slots too
+        pool.compactThreshold = step % SPH_POOL_VERIFY_COMPACT_INTERVAL == SPH_POOL_VERIFY_COMPACT_INTERVAL - 1 ? 0.0f : compactThreshold;
+
+        sphPoolStep(&pool);
+
+        VkCommandBuffer stepCommands = sphGpuBeginPoolStep();
+
+        sphGpuRecordMoveSlots(stepCommands, pool.moveFrom, pool.moveTo, pool.moveCount);
+        movedSlots += pool.moveCount;
+
+        sphGpuRecordStep(stepCommands, 1, 0);
+        uploadedBytes += sphGpuRecordUpdateSlots(stepCommands, &reference, pool.changedSlots, pool.changedCount);
+
+        sphGpuSubmitPoolStep(stepCommands);
+    }
+
+    // A last compaction, so the comparison below also checks a packed pool: every slot below the live
+    // count in use on both sides and every slot above it dead. The removed slots make sure it has holes
+    // to fill, even when the last forced compaction just emptied every hole
+    for (uint32_t i = 0; i < reference.count; i += SPH_POOL_VERIFY_KILL_STRIDE)
+    {
+        sphPoolKill(&pool, i);
+    }
+
+    VkCommandBuffer finalCommands = sphGpuBeginPoolStep();
+    uploadedBytes += sphGpuRecordUpdateSlots(finalCommands, &reference, pool.changedSlots, pool.changedCount);
+
+    sphPoolCompact(&pool);
+    sphGpuRecordMoveSlots(finalCommands, pool.moveFrom, pool.moveTo, pool.moveCount);
+    movedSlots += pool.moveCount;
+
+    sphGpuSubmitPoolStep(finalCommands);
+    sphGpuWaitPoolSteps();
+
+    int packed = reference.count == pool.liveCount;
+
+    for (uint32_t i = 0; i < reference.count; i++)
+    {
+        packed &= pool.alive[i];
+    }
+
+    SphSolver result;
+    sphInit(&result, params);
+    result.count = reference.count;
+    sphGpuDownload(&result);
+
+    uint32_t *live = malloc(sphBufferSizes[SPH_BUFFER_LIVE]);
+
+    if (!live)
+    {
+        fprintf(stderr, "Failed to allocate SPH readback memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    downloadFromBuffer(sphBuffers[SPH_BUFFER_LIVE], live, sphBufferSizes[SPH_BUFFER_LIVE]);
+
+    // Hundreds of steps of splashing let the rounding differences grow chaotically in a few particles, so
+    // the positions are compared by their RMS error. The live masks have to match exactly
+    uint32_t maskErrors = 0;
+    double squaredError = 0.0;
+
+    for (uint32_t i = 0; i < sphGpuParticleCount; i++)
+    {
+        uint32_t expected = i < reference.count && pool.alive[i];
+
+        maskErrors += live[i] != expected;
+
+        if (expected)
+        {
+            float dx = result.posX[i] - reference.posX[i];
+            float dy = result.posY[i] - reference.posY[i];
+            float dz = result.posZ[i] - reference.posZ[i];
+
+            squaredError += dx * dx + dy * dy + dz * dz;
+        }
+    }
+
+    float rmsError = pool.liveCount > 0 ? (float)sqrt(squaredError / pool.liveCount) : 0.0f;
+    float tolerance = 5e-2f * params->smoothingRadius;
+    int passed = maskErrors == 0 && rmsError <= tolerance && packed && movedSlots > 0;
+
+    printf("Pool mirror: %llu emitted, %llu removed, %u compactions moving %u slots, %.1f KiB uploaded instead of %.1f MiB of full uploads\n",
+           (unsigned long long)pool.totalEmitted, (unsigned long long)pool.totalRemoved, pool.compactions, movedSlots, (double)uploadedBytes / 1024.0,
+           (double)stepBytes * stepCount / (1024.0 * 1024.0));
+    printf("GPU pool verification after %u steps: %u live mask errors, RMS position error %g (tolerance %g), %s, %s: %s\n",
+           stepCount, maskErrors, rmsError, tolerance, packed ? "packed" : "not packed after the last compaction",
+           movedSlots > 0 ? "compactions replayed" : "no compaction moved a slot", passed ? "PASSED" : "FAILED");
+
+    free(live);
+    sphDestroy(&result);
+    sphPoolDestroy(&pool);
+    sphDestroy(&reference);
+
+    return passed;
+}
+
+void sphGpuCompareStorage(const SphParams *params, uint32_t stepCount)
+{
+    int requestedStorage = sphCompactStorage;
+    VkDeviceSize stateBytes[2];
+    double stepMilliseconds[2];
+
+    for (int compact = 0; compact < 2; compact++)
+    {
+        sphCompactStorage = compact;
+
+        SphSolver initialState;
+        sphInit(&initialState, params);
+        sphSeedDamBreak(&initialState);
+        sphGpuInit(&initialState);
+        sphDestroy(&initialState);
+
+        stateBytes[compact] = sphStateBytes();
+
+        // One warm-up step, then every step of the run in one submission on an idle queue
+        VkCommandBuffer warmUp = beginSingleTimeCommands();
+        sphGpuRecordStep(warmUp, 1, 0);
+        endSingleTimeCommands(warmUp);
+
+        struct timespec start;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        VkCommandBuffer stepCommands = beginSingleTimeCommands();
+        sphGpuRecordStep(stepCommands, stepCount, 0);
+        endSingleTimeCommands(stepCommands);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double elapsed = (double)(end.tv_sec - start.tv_sec) * 1000.0 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+        stepMilliseconds[compact] = elapsed / stepCount;
+
+        sphGpuDestroy();
+    }
+
+    sphCompactStorage = requestedStorage;
+
+    printf("Particle state: fp32 %.2f MiB, compact %.2f MiB (%.0f%% saved)\n", (double)stateBytes[0] / (1024.0 * 1024.0), (double)stateBytes[1] / (1024.0 * 1024.0),
+           100.0 * (1.0 - (double)stateBytes[1] / (double)stateBytes[0]));
+    printf("Step time over %u steps: fp32 %.3f ms, compact %.3f ms (%+.1f%%)\n", stepCount, stepMilliseconds[0], stepMilliseconds[1],
+           100.0 * (stepMilliseconds[1] / stepMilliseconds[0] - 1.0));
+}
+
+void sphGpuDestroy()
+{
+    if (device == VK_NULL_HANDLE)
+    {
+        return;
+    }
+
+    if (sphStepCommandBuffers[0] != VK_NULL_HANDLE)
+    {
+        vkFreeCommandBuffers(device, computeCommandPool, SPH_RENDER_SLOTS, sphStepCommandBuffers);
+        memset(sphStepCommandBuffers, 0, sizeof(sphStepCommandBuffers));
+    }
+
+    for (int i = 0; i < SPH_KERNEL_COUNT; i++)
+    {
+        if (sphPipelines[i] != VK_NULL_HANDLE)
+        {
+            vkDestroyPipeline(device, sphPipelines[i], NULL);
+            sphPipelines[i] = VK_NULL_HANDLE;
+        }
+    }
+
+    if (sphPipelineLayout != VK_NULL_HANDLE)
+    {
+        vkDestroyPipelineLayout(device, sphPipelineLayout, NULL);
+        sphPipelineLayout = VK_NULL_HANDLE;
+    }
+
+    if (sphDescriptorPool != VK_NULL_HANDLE)
+    {
+        vkDestroyDescriptorPool(device, sphDescriptorPool, NULL); // Also frees the descriptor sets
+        sphDescriptorPool = VK_NULL_HANDLE;
+    }
+
+    if (sphDescriptorSetLayout != VK_NULL_HANDLE)
+    {
+        vkDestroyDescriptorSetLayout(device, sphDescriptorSetLayout, NULL);
+        sphDescriptorSetLayout = VK_NULL_HANDLE;
+    }
+
+    for (uint32_t slot = 0; slot < SPH_RENDER_SLOTS; slot++)
+    {
+        descriptorHeapRemoveBuffer(sphRenderHandles[slot]);
+        sphRenderHandles[slot] = DESCRIPTOR_HANDLE_NONE;
+    }
+
+    for (int i = 0; i < SPH_BUFFER_COUNT; i++)
+    {
+        if (sphBuffers[i] != VK_NULL_HANDLE)
+        {
+            vkDestroyBuffer(device, sphBuffers[i], NULL);
+            vkFreeMemory(device, sphMemories[i], NULL);
+            sphBuffers[i] = VK_NULL_HANDLE;
+            sphMemories[i] = VK_NULL_HANDLE;
+        }
+    }
+
+    if (sphUpdateBuffer != VK_NULL_HANDLE)
+    {
+        vkFreeCommandBuffers(device, computeCommandPool, SPH_UPDATE_SEGMENTS, sphUpdateCommandBuffers);
+        vkDestroySemaphore(device, sphUpdateTimeline, NULL);
+        vkUnmapMemory(device, sphUpdateMemory);
+        vkDestroyBuffer(device, sphUpdateBuffer, NULL);
+        vkFreeMemory(device, sphUpdateMemory, NULL);
+        free(sphUpdateRegions);
+        memset(sphUpdateCommandBuffers, 0, sizeof(sphUpdateCommandBuffers));
+        sphUpdateTimeline = VK_NULL_HANDLE;
+        sphUpdateBuffer = VK_NULL_HANDLE;
+        sphUpdateMemory = VK_NULL_HANDLE;
+        sphUpdateMapped = NULL;
+        sphUpdateRegions = NULL;
+        sphUpdateSubmitted = 0;
+    }
+
+    if (sphReadbackBuffer != VK_NULL_HANDLE)
+    {
+        vkUnmapMemory(device, sphReadbackMemory);
+        vkDestroyBuffer(device, sphReadbackBuffer, NULL);
+        vkFreeMemory(device, sphReadbackMemory, NULL);
+        sphReadbackBuffer = VK_NULL_HANDLE;
+        sphReadbackMemory = VK_NULL_HANDLE;
+    }
+
+    sphGpuParticleCount = 0;
+
+    printf("Destroyed SPH compute backend\n");
+}
@@ -0,0 +1,804 @@
+#include "sph_hybrid.h"
+#include "sdf.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Particles per thread pool task of the grid to particle transfer and advection
+#define SPH_HYBRID_TASK_PARTICLES 256
+
+// Face passes, one task per z slice of every velocity component
+typedef enum {
+    FACE_TRANSFER,   // Particle to grid gather
+    FACE_GRAVITY,
+    FACE_PROJECT,    // Subtracts the pressure gradient
+    FACE_EXTRAPOLATE // Fills one layer of the faces without a velocity from their valid neighbors
+} FacePhase;
+
+// Pressure passes, one task per z slice of cells. Each task leaves its sum (or maximum) in partialSums
+typedef enum {
+    CELL_SETUP,      // Right hand side from the divergence, first residual and direction
+    CELL_PRODUCT,    // Laplacian of the direction
+    CELL_UPDATE,     // Pressure and residual step
+    CELL_DIRECTION,
+    CELL_DIVERGENCE  // Largest divergence left after the projection
+} CellPhase;
+
+typedef struct {
+    SphHybrid *hybrid;
+    int phase;
+    float dt;
+    float alpha;
+    float beta;
+} HybridJob;
+
+static void *allocateZeroed(uint32_t count, size_t size)
+{
+    void *data = calloc(count, size);
+
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate hybrid solver storage!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return data;
+}
+
+static double elapsedSeconds(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint32_t cellIndex(const SphHybrid *hybrid, int x, int y, int z)
+{
+    return (uint32_t)x + hybrid->gridDim[0] * ((uint32_t)y + hybrid->gridDim[1] * (uint32_t)z);
+}
+
+static uint32_t faceIndex(const SphHybrid *hybrid, int axis, int x, int y, int z)
+{
+    const uint32_t *dim = hybrid->faceDim[axis];
+
+    return (uint32_t)x + dim[0] * ((uint32_t)y + dim[1] * (uint32_t)z);
+}
+
+// Everything outside the grid is wall
+static int cellTypeAt(const SphHybrid *hybrid, int x, int y, int z)
+{
+    if (x < 0 || y < 0 || z < 0 || x >= (int)hybrid->gridDim[0] || y >= (int)hybrid->gridDim[1] || z >= (int)hybrid->gridDim[2])
+    {
+        return SPH_HYBRID_SOLID;
+    }
+
+    return hybrid->cellType[cellIndex(hybrid, x, y, z)];
+}
+
+// Trilinear interpolation of one velocity component and, when gradient is not NULL, the gradient of the
+// interpolant. Positions outside the faces take the value of the closest ones
+static float sampleFaces(const SphHybrid *hybrid, const float *field, int axis, const float position[3], float gradient[3])
+{
+    const float *minimum = hybrid->solver->params.boundsMin;
+    const uint32_t *dim = hybrid->faceDim[axis];
+    int base[3];
+    float fraction[3];
+
+    for (int b = 0; b < 3; b++)
+    {
+        float coordinate = (position[b] - minimum[b]) / hybrid->cellSize - (b == axis ? 0.0f : 0.5f);
+        int last = (int)dim[b] - 2;
+        int cell = (int)floorf(coordinate);
+
+        base[b] = cell < 0 ? 0 : cell > last ? last : cell;
+        fraction[b] = fminf(fmaxf(coordinate - base[b], 0.0f), 1.0f);
+    }
+
+    float value = 0.0f;
+
+    if (gradient)
+    {
+        gradient[0] = gradient[1] = gradient[2] = 0.0f;
+    }
+
+    for (int corner = 0; corner < 8; corner++)
+    {
+        int offset[3] = {corner & 1, (corner >> 1) & 1, (corner >> 2) & 1};
+        float sample = field[faceIndex(hybrid, axis, base[0] + offset[0], base[1] + offset[1], base[2] + offset[2])];
+        float weights[3];
+
+        for (int b = 0; b < 3; b++)
+        {
+            weights[b] = offset[b] ? fraction[b] : 1.0f - fraction[b];
+        }
+
+        value += sample * weights[0] * weights[1] * weights[2];
+
+        if (gradient)
+        {
+            for (int b = 0; b < 3; b++)
+            {
+                float slope = (offset[b] ? 1.0f : -1.0f) / hybrid->cellSize;
+
+                gradient[b] += sample * slope * weights[(b + 1) % 3] * weights[(b + 2) % 3];
+            }
+        }
+    }
+
+    return value;
+}
+
+// Weighted mean of the particle velocities (plus the affine part with APIC) around a face. The trilinear
+// weight reaches one cell to each side, so the particles come from 2 cells along the axis and 3 across it.
+// Only this face is written, which makes the transfer race free without atomics
+static float transferFace(const SphHybrid *hybrid, int axis, const int face[3], float *weightSum)
+{
+    const SphSolver *solver = hybrid->solver;
+    const float *minimum = solver->params.boundsMin;
+    const float *velocities[3] = {solver->velX, solver->velY, solver->velZ};
+    float facePosition[3];
+    int low[3];
+    int high[3];
+
+    for (int b = 0; b < 3; b++)
+    {
+        facePosition[b] = minimum[b] + (face[b] + (b == axis ? 0.0f : 0.5f)) * hybrid->cellSize;
+        low[b] = face[b] > 0 ? face[b] - 1 : 0;
+        high[b] = b == axis ? face[b] : face[b] + 1;
+        high[b] = high[b] < (int)hybrid->gridDim[b] ? high[b] : (int)hybrid->gridDim[b] - 1;
+    }
+
+    float sum = 0.0f;
+    *weightSum = 0.0f;
+
+    for (int z = low[2]; z <= high[2]; z++)
+    {
+        for (int y = low[1]; y <= high[1]; y++)
+        {
+            for (int x = low[0]; x <= high[0]; x++)
+            {
+                uint32_t cell = cellIndex(hybrid, x, y, z);
+
+                for (uint32_t s = solver->cellStart[cell]; s < solver->cellEnd[cell]; s++)
+                {
+                    uint32_t i = solver->sortedIndices[s];
+                    float offset[3] = {facePosition[0] - solver->posX[i], facePosition[1] - solver->posY[i], facePosition[2] - solver->posZ[i]};
+                    float weight = 1.0f;
+
+                    for (int b = 0; b < 3 && weight > 0.0f; b++)
+                    {
+                        weight *= fmaxf(1.0f - fabsf(offset[b]) / hybrid->cellSize, 0.0f);
+                    }
+
+                    if (weight <= 0.0f)
+                    {
+                        continue;
+                    }
+
+                    float value = velocities[axis][i];
+
+                    if (hybrid->apic)
+                    {
+                        const float *row = hybrid->affine + 9 * i + 3 * axis;
+                        value += row[0] * offset[0] + row[1] * offset[1] + row[2] * offset[2];
+                    }
+
+                    sum += weight * value;
+                    *weightSum += weight;
+                }
+            }
+        }
+    }
+
+    return *weightSum > 0.0f ? sum / *weightSum : 0.0f;
+}
+
+static void faceTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    HybridJob *job = context;
+    SphHybrid *hybrid = job->hybrid;
+    int axis = 0;
+
+    while (taskIndex >= hybrid->faceDim[axis][2])
+    {
+        taskIndex -= hybrid->faceDim[axis][2];
+        axis++;
+    }
+
+    const uint32_t *dim = hybrid->faceDim[axis];
+    float *velocity = hybrid->velocity[axis];
+    uint8_t *valid = hybrid->valid[axis];
+    int z = (int)taskIndex;
+
+    for (int y = 0; y < (int)dim[1]; y++)
+    {
+        for (int x = 0; x < (int)dim[0]; x++)
+        {
+            uint32_t face = faceIndex(hybrid, axis, x, y, z);
+
+            if (hybrid->fixed[axis][face])
+            {
+                if (job->phase == FACE_EXTRAPOLATE)
+                {
+                    hybrid->validNext[axis][face] = 0;
+                }
+                else
+                {
+                    velocity[face] = 0.0f;
+                    valid[face] = 0;
+                }
+
+                continue;
+            }
+
+            int position[3] = {x, y, z};
+
+            switch (job->phase)
+            {
+            case FACE_TRANSFER:
+            {
+                float weightSum;
+
+                velocity[face] = transferFace(hybrid, axis, position, &weightSum);
+                valid[face] = weightSum > 0.0f;
+                break;
+            }
+            case FACE_GRAVITY:
+                velocity[face] += hybrid->solver->params.gravity[axis] * job->dt;
+                break;
+            case FACE_PROJECT:
+            {
+                int lowType = cellTypeAt(hybrid, x - (axis == 0), y - (axis == 1), z - (axis == 2));
+                int highType = cellTypeAt(hybrid, x, y, z);
+
+                // Air keeps pressure 0, faces between two air cells are extrapolated afterwards
+                if (lowType == SPH_HYBRID_FLUID || highType == SPH_HYBRID_FLUID)
+                {
+                    float lowPressure = lowType == SPH_HYBRID_FLUID ? hybrid->pressure[cellIndex(hybrid, x - (axis == 0), y - (axis == 1), z - (axis == 2))] : 0.0f;
+                    float highPressure = highType == SPH_HYBRID_FLUID ? hybrid->pressure[cellIndex(hybrid, x, y, z)] : 0.0f;
+
+                    velocity[face] -= highPressure - lowPressure;
+                    valid[face] = 1;
+                }
+                else
+                {
+                    valid[face] = 0;
+                }
+                break;
+            }
+            case FACE_EXTRAPOLATE:
+            {
+                // Reads valid faces only and writes invalid ones, so the slices do not race
+                if (valid[face])
+                {
+                    hybrid->validNext[axis][face] = 1;
+                    break;
+                }
+
+                float sum = 0.0f;
+                uint32_t count = 0;
+
+                for (int neighbor = 0; neighbor < 6; neighbor++)
+                {
+                    int next[3] = {x, y, z};
+                    next[neighbor / 2] += neighbor % 2 ? 1 : -1;
+
+                    if (next[0] < 0 || next[1] < 0 || next[2] < 0 || next[0] >= (int)dim[0] || next[1] >= (int)dim[1] || next[2] >= (int)dim[2])
+                    {
+                        continue;
+                    }
+
+                    uint32_t other = faceIndex(hybrid, axis, next[0], next[1], next[2]);
+
+                    if (valid[other])
+                    {
+                        sum += velocity[other];
+                        count++;
+                    }
+                }
+
+                if (count > 0)
+                {
+                    velocity[face] = sum / count;
+                }
+
+                hybrid->validNext[axis][face] = count > 0;
+                break;
+            }
+            }
+        }
+    }
+}
+
+// Face velocity differences around a cell, the divergence times the cell size
+static float cellDivergence(const SphHybrid *hybrid, int x, int y, int z)
+{
+    float divergence = 0.0f;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float *velocity = hybrid->velocity[axis];
+
+        divergence += velocity[faceIndex(hybrid, axis, x + (axis == 0), y + (axis == 1), z + (axis == 2))] - velocity[faceIndex(hybrid, axis, x, y, z)];
+    }
+
+    return divergence;
+}
+
+// Pressure Laplacian with free surface (p = 0 in air) and wall (no flux) boundaries. The diagonal counts
+// the neighbors that are not solid, the off diagonal -1 entries the fluid ones. Returns the diagonal
+static float applyLaplacian(const SphHybrid *hybrid, const float *input, int x, int y, int z, float *output)
+{
+    float diagonal = 0.0f;
+    float result = 0.0f;
+
+    for (int neighbor = 0; neighbor < 6; neighbor++)
+    {
+        int next[3] = {x, y, z};
+        next[neighbor / 2] += neighbor % 2 ? 1 : -1;
+
+        int type = cellTypeAt(hybrid, next[0], next[1], next[2]);
+
+        if (type == SPH_HYBRID_SOLID)
+        {
+            continue;
+        }
+
+        diagonal += 1.0f;
+
+        if (type == SPH_HYBRID_FLUID && output)
+        {
+            result -= input[cellIndex(hybrid, next[0], next[1], next[2])];
+        }
+    }
+
+    if (output)
+    {
+        *output = result + diagonal * input[cellIndex(hybrid, x, y, z)];
+    }
+
+    return diagonal;
+}
+
+static void cellTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    HybridJob *job = context;
+    SphHybrid *hybrid = job->hybrid;
+    int z = (int)taskIndex;
+    double sum = 0.0;
+
+    for (int y = 0; y < (int)hybrid->gridDim[1]; y++)
+    {
+        for (int x = 0; x < (int)hybrid->gridDim[0]; x++)
+        {
+            uint32_t cell = cellIndex(hybrid, x, y, z);
+
+            if (hybrid->cellType[cell] != SPH_HYBRID_FLUID)
+            {
+                hybrid->pressure[cell] = 0.0f;
+                continue;
+            }
+
+            float diagonal;
+
+            switch (job->phase)
+            {
+            case CELL_SETUP:
+                diagonal = applyLaplacian(hybrid, NULL, x, y, z, NULL);
+
+                // With p = 0 the residual is the right hand side, A p = -divergence
+                hybrid->pressure[cell] = 0.0f;
+                hybrid->residual[cell] = -cellDivergence(hybrid, x, y, z);
+                hybrid->preconditioned[cell] = diagonal > 0.0f ? hybrid->residual[cell] / diagonal : 0.0f;
+                hybrid->direction[cell] = hybrid->preconditioned[cell];
+                sum += (double)hybrid->residual[cell] * hybrid->preconditioned[cell];
+                break;
+            case CELL_PRODUCT:
+                applyLaplacian(hybrid, hybrid->direction, x, y, z, &hybrid->product[cell]);
+                sum += (double)hybrid->direction[cell] * hybrid->product[cell];
+                break;
+            case CELL_UPDATE:
+                diagonal = applyLaplacian(hybrid, NULL, x, y, z, NULL);
+
+                hybrid->pressure[cell] += job->alpha * hybrid->direction[cell];
+                hybrid->residual[cell] -= job->alpha * hybrid->product[cell];
+                hybrid->preconditioned[cell] = diagonal > 0.0f ? hybrid->residual[cell] / diagonal : 0.0f;
+                sum += (double)hybrid->residual[cell] * hybrid->preconditioned[cell];
+                break;
+            case CELL_DIRECTION:
+                hybrid->direction[cell] = hybrid->preconditioned[cell] + job->beta * hybrid->direction[cell];
+                break;
+            case CELL_DIVERGENCE:
+                sum = fmax(sum, fabsf(cellDivergence(hybrid, x, y, z)));
+                break;
+            }
+        }
+    }
+
+    hybrid->partialSums[z] = sum;
+}
+
+static double runCellPass(SphHybrid *hybrid, HybridJob *job, int phase)
+{
+    job->phase = phase;
+    threadPoolRun(cellTask, job, hybrid->gridDim[2]);
+
+    double total = 0.0;
+
+    for (uint32_t z = 0; z < hybrid->gridDim[2]; z++)
+    {
+        total = phase == CELL_DIVERGENCE ? fmax(total, hybrid->partialSums[z]) : total + hybrid->partialSums[z];
+    }
+
+    return total;
+}
+
+static void solvePressure(SphHybrid *hybrid, HybridJob *job)
+{
+    double rz = runCellPass(hybrid, job, CELL_SETUP);
+    double threshold = (double)hybrid->pressureTolerance * hybrid->pressureTolerance * rz;
+
+    hybrid->iterationsUsed = 0;
+
+    while (hybrid->iterationsUsed < hybrid->pressureIterations && rz > threshold && rz > 0.0)
+    {
+        double pq = runCellPass(hybrid, job, CELL_PRODUCT);
+
+        if (pq <= 0.0)
+        {
+            break;
+        }
+
+        job->alpha = (float)(rz / pq);
+
+        double rzNext = runCellPass(hybrid, job, CELL_UPDATE);
+
+        job->beta = (float)(rzNext / rz);
+        rz = rzNext;
+        hybrid->iterationsUsed++;
+
+        runCellPass(hybrid, job, CELL_DIRECTION);
+    }
+}
+
+static void extrapolate(SphHybrid *hybrid, HybridJob *job, uint32_t faceTasks)
+{
+    job->phase = FACE_EXTRAPOLATE;
+
+    for (uint32_t layer = 0; layer < hybrid->extrapolationLayers; layer++)
+    {
+        threadPoolRun(faceTask, job, faceTasks);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            uint8_t *swap = hybrid->valid[axis];
+            hybrid->valid[axis] = hybrid->validNext[axis];
+            hybrid->validNext[axis] = swap;
+        }
+    }
+}
+
+// Grid to particle transfer, then midpoint advection through the projected grid velocity. Every
+// particle is read and written by one task only
+static void particleTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    HybridJob *job = context;
+    SphHybrid *hybrid = job->hybrid;
+    SphSolver *solver = hybrid->solver;
+    const SphParams *params = &solver->params;
+    float *positions[3] = {solver->posX, solver->posY, solver->posZ};
+    float *velocities[3] = {solver->velX, solver->velY, solver->velZ};
+    uint32_t begin = taskIndex * SPH_HYBRID_TASK_PARTICLES;
+    uint32_t end = begin + SPH_HYBRID_TASK_PARTICLES < solver->count ? begin + SPH_HYBRID_TASK_PARTICLES : solver->count;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        float position[3] = {solver->posX[i], solver->posY[i], solver->posZ[i]};
+        float gridVelocity[3];
+        float midpoint[3];
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float *gradient = hybrid->apic ? hybrid->affine + 9 * i + 3 * axis : NULL;
+
+            gridVelocity[axis] = sampleFaces(hybrid, hybrid->velocity[axis], axis, position, gradient);
+
+            float change = gridVelocity[axis] - sampleFaces(hybrid, hybrid->transferred[axis], axis, position, NULL);
+
+            velocities[axis][i] = (1.0f - hybrid->flipRatio) * gridVelocity[axis] + hybrid->flipRatio * (velocities[axis][i] + change);
+            midpoint[axis] = position[axis] + 0.5f * job->dt * gridVelocity[axis];
+        }
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            positions[axis][i] += job->dt * sampleFaces(hybrid, hybrid->velocity[axis], axis, midpoint, NULL);
+        }
+
+        // The grid keeps the fluid out of walls and the obstacle, this only catches what the interpolation
+        // lets through: the particle is pushed out and loses the velocity that would take it back in
+        if (params->obstacle)
+        {
+            float gradient[3];
+            float distance = sdfSample(params->obstacle, solver->posX[i], solver->posY[i], solver->posZ[i], gradient);
+            float length = sqrtf(gradient[0] * gradient[0] + gradient[1] * gradient[1] + gradient[2] * gradient[2]);
+
+            if (distance < params->obstacleMargin && length > 1e-6f)
+            {
+                float normalVelocity = (velocities[0][i] * gradient[0] + velocities[1][i] * gradient[1] + velocities[2][i] * gradient[2]) / length;
+
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    positions[axis][i] += gradient[axis] / length * (params->obstacleMargin - distance);
+
+                    if (normalVelocity < 0.0f)
+                    {
+                        velocities[axis][i] -= normalVelocity * gradient[axis] / length;
+                    }
+                }
+            }
+        }
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (positions[axis][i] < params->boundsMin[axis])
+            {
+                positions[axis][i] = params->boundsMin[axis];
+                velocities[axis][i] = fmaxf(velocities[axis][i], 0.0f);
+            }
+            else if (positions[axis][i] > params->boundsMax[axis])
+            {
+                positions[axis][i] = params->boundsMax[axis];
+                velocities[axis][i] = fminf(velocities[axis][i], 0.0f);
+            }
+        }
+    }
+}
+
+void sphHybridInit(SphHybrid *hybrid, SphSolver *solver, int apic)
+{
+    memset(hybrid, 0, sizeof(*hybrid));
+
+    const SphParams *params = &solver->params;
+
+    hybrid->solver = solver;
+    hybrid->apic = apic;
+    hybrid->flipRatio = apic ? 0.0f : 0.95f;
+    hybrid->affine = apic ? allocateZeroed(9 * solver->count, sizeof(float)) : NULL;
+
+    // The MAC cells are the cells of the neighbor grid, so sphBuildGrid() sorts the particles for the gather
+    hybrid->cellSize = params->smoothingRadius;
+    hybrid->cellCount = solver->cellCount;
+    memcpy(hybrid->gridDim, solver->gridDim, sizeof(hybrid->gridDim));
+
+    if (hybrid->gridDim[0] < 2 || hybrid->gridDim[1] < 2 || hybrid->gridDim[2] < 2)
+    {
+        fprintf(stderr, "The hybrid solver needs at least two grid cells per axis!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    hybrid->cellType = allocateZeroed(hybrid->cellCount, sizeof(uint8_t));
+
+    if (params->obstacle)
+    {
+        for (int z = 0; z < (int)hybrid->gridDim[2]; z++)
+        {
+            for (int y = 0; y < (int)hybrid->gridDim[1]; y++)
+            {
+                for (int x = 0; x < (int)hybrid->gridDim[0]; x++)
+                {
+                    float center[3] = {params->boundsMin[0] + (x + 0.5f) * hybrid->cellSize, params->boundsMin[1] + (y + 0.5f) * hybrid->cellSize,
+                                       params->boundsMin[2] + (z + 0.5f) * hybrid->cellSize};
+
+                    if (sdfSample(params->obstacle, center[0], center[1], center[2], NULL) < 0.0f)
+                    {
+                        hybrid->cellType[cellIndex(hybrid, x, y, z)] = SPH_HYBRID_SOLID;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int b = 0; b < 3; b++)
+        {
+            hybrid->faceDim[axis][b] = hybrid->gridDim[b] + (b == axis);
+        }
+
+        hybrid->faceCount[axis] = hybrid->faceDim[axis][0] * hybrid->faceDim[axis][1] * hybrid->faceDim[axis][2];
+        hybrid->velocity[axis] = allocateZeroed(hybrid->faceCount[axis], sizeof(float));
+        hybrid->transferred[axis] = allocateZeroed(hybrid->faceCount[axis], sizeof(float));
+        hybrid->fixed[axis] = allocateZeroed(hybrid->faceCount[axis], sizeof(uint8_t));
+        hybrid->valid[axis] = allocateZeroed(hybrid->faceCount[axis], sizeof(uint8_t));
+        hybrid->validNext[axis] = allocateZeroed(hybrid->faceCount[axis], sizeof(uint8_t));
+
+        for (int z = 0; z < (int)hybrid->faceDim[axis][2]; z++)
+        {
+            for (int y = 0; y < (int)hybrid->faceDim[axis][1]; y++)
+            {
+                for (int x = 0; x < (int)hybrid->faceDim[axis][0]; x++)
+                {
+                    int lowType = cellTypeAt(hybrid, x - (axis == 0), y - (axis == 1), z - (axis == 2));
+                    int highType = cellTypeAt(hybrid, x, y, z);
+
+                    hybrid->fixed[axis][faceIndex(hybrid, axis, x, y, z)] = lowType == SPH_HYBRID_SOLID || highType == SPH_HYBRID_SOLID;
+                }
+            }
+        }
+    }
+
+    hybrid->pressure = allocateZeroed(hybrid->cellCount, sizeof(float));
+    hybrid->residual = allocateZeroed(hybrid->cellCount, sizeof(float));
+    hybrid->preconditioned = allocateZeroed(hybrid->cellCount, sizeof(float));
+    hybrid->direction = allocateZeroed(hybrid->cellCount, sizeof(float));
+    hybrid->product = allocateZeroed(hybrid->cellCount, sizeof(float));
+    hybrid->partialSums = allocateZeroed(hybrid->gridDim[2], sizeof(double));
+
+    hybrid->extrapolationLayers = 2; // Enough for the midpoint of a step of up to one cell
+    hybrid->pressureIterations = 200;
+    hybrid->pressureTolerance = 1e-4f;
+    hybrid->cflNumber = 1.0f;
+    hybrid->maxTimeStep = 10.0f * params->timeStep;
+
+    printf("Hybrid solver: %s transfer, MAC grid %ux%ux%u\n", apic ? "APIC" : "FLIP/PIC", hybrid->gridDim[0], hybrid->gridDim[1], hybrid->gridDim[2]);
+}
+
+void sphHybridStep(SphHybrid *hybrid)
+{
+    SphSolver *solver = hybrid->solver;
+    HybridJob job = {.hybrid = hybrid};
+    uint32_t faceTasks = hybrid->faceDim[0][2] + hybrid->faceDim[1][2] + hybrid->faceDim[2][2];
+    float maxSpeed = 0.0f;
+
+    for (uint32_t i = 0; i < solver->count; i++)
+    {
+        maxSpeed = fmaxf(maxSpeed, solver->velX[i] * solver->velX[i] + solver->velY[i] * solver->velY[i] + solver->velZ[i] * solver->velZ[i]);
+    }
+
+    maxSpeed = sqrtf(maxSpeed);
+    hybrid->timeStep = hybrid->maxTimeStep;
+
+    if (maxSpeed * hybrid->timeStep > hybrid->cflNumber * hybrid->cellSize)
+    {
+        hybrid->timeStep = hybrid->cflNumber * hybrid->cellSize / maxSpeed;
+    }
+
+    job.dt = hybrid->timeStep;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    sphBuildGrid(solver);
+    hybrid->fluidCells = 0;
+
+    for (uint32_t cell = 0; cell < hybrid->cellCount; cell++)
+    {
+        if (hybrid->cellType[cell] != SPH_HYBRID_SOLID)
+        {
+            hybrid->cellType[cell] = solver->cellEnd[cell] > solver->cellStart[cell] ? SPH_HYBRID_FLUID : SPH_HYBRID_AIR;
+            hybrid->fluidCells += hybrid->cellType[cell] == SPH_HYBRID_FLUID;
+        }
+    }
+
+    job.phase = FACE_TRANSFER;
+    threadPoolRun(faceTask, &job, faceTasks);
+    extrapolate(hybrid, &job, faceTasks);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        memcpy(hybrid->transferred[axis], hybrid->velocity[axis], hybrid->faceCount[axis] * sizeof(float));
+    }
+
+    hybrid->transferSeconds = elapsedSeconds(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    job.phase = FACE_GRAVITY;
+    threadPoolRun(faceTask, &job, faceTasks);
+
+    solvePressure(hybrid, &job);
+
+    job.phase = FACE_PROJECT;
+    threadPoolRun(faceTask, &job, faceTasks);
+
+    hybrid->maxDivergence = (float)(runCellPass(hybrid, &job, CELL_DIVERGENCE) / hybrid->cellSize);
+    extrapolate(hybrid, &job, faceTasks);
+
+    hybrid->projectionSeconds = elapsedSeconds(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    threadPoolRun(particleTask, &job, (solver->count + SPH_HYBRID_TASK_PARTICLES - 1) / SPH_HYBRID_TASK_PARTICLES);
+
+    hybrid->advectionSeconds = elapsedSeconds(&start);
+    hybrid->time += hybrid->timeStep;
+    hybrid->stepIndex++;
+}
+
+void sphHybridReport(const SphParams *params, int apic, float flipRatio, uint32_t stepCount)
+{
+    SphSolver solver;
+    SphHybrid hybrid;
+
+    sphInit(&solver, params);
+    sphSeedDamBreak(&solver);
+    sphHybridInit(&hybrid, &solver, apic);
+
+    if (flipRatio >= 0.0f)
+    {
+        hybrid.flipRatio = fminf(flipRatio, 1.0f);
+    }
+
+    printf("Hybrid FLIP ratio %.2f, time step up to %g s at CFL %.1f\n", hybrid.flipRatio, hybrid.maxTimeStep, hybrid.cflNumber);
+
+    double transferSeconds = 0.0;
+    double projectionSeconds = 0.0;
+    double advectionSeconds = 0.0;
+    uint32_t reportInterval = stepCount / 10 > 0 ? stepCount / 10 : 1;
+
+    for (uint32_t step = 1; step <= stepCount; step++)
+    {
+        sphHybridStep(&hybrid);
+
+        transferSeconds += hybrid.transferSeconds;
+        projectionSeconds += hybrid.projectionSeconds;
+        advectionSeconds += hybrid.advectionSeconds;
+
+        if (step % reportInterval == 0 || step == stepCount)
+        {
+            double energy = 0.0;
+            double height = 0.0;
+
+            for (uint32_t i = 0; i < solver.count; i++)
+            {
+                energy += 0.5 * params->particleMass * (solver.velX[i] * solver.velX[i] + solver.velY[i] * solver.velY[i] + solver.velZ[i] * solver.velZ[i]);
+                height += solver.posY[i] - params->boundsMin[1];
+            }
+
+            printf("Hybrid step %u: t %.3f s, dt %.2f ms, %u fluid cells, %u pressure iterations, max divergence %.2e 1/s, kinetic energy %g J, mean height %.3f m\n",
+                   step, hybrid.time, hybrid.timeStep * 1000.0, hybrid.fluidCells, hybrid.iterationsUsed, hybrid.maxDivergence, energy, height / solver.count);
+        }
+    }
+
+    double totalSeconds = transferSeconds + projectionSeconds + advectionSeconds;
+
+    printf("Hybrid cost per step: %.3f ms particle to grid, %.3f ms projection, %.3f ms grid to particle and advection\n",
+           transferSeconds * 1000.0 / stepCount, projectionSeconds * 1000.0 / stepCount, advectionSeconds * 1000.0 / stepCount);
+    printf("Hybrid simulated %.3f s in %.3f s, the SPH solver needs %.0f steps of %g s for the same time\n",
+           hybrid.time, totalSeconds, ceil(hybrid.time / params->timeStep), params->timeStep);
+
+    sphHybridDestroy(&hybrid);
+    sphDestroy(&solver);
+}
+
+void sphHybridDestroy(SphHybrid *hybrid)
+{
+    free(hybrid->affine);
+    free(hybrid->cellType);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        free(hybrid->velocity[axis]);
+        free(hybrid->transferred[axis]);
+        free(hybrid->fixed[axis]);
+        free(hybrid->valid[axis]);
+        free(hybrid->validNext[axis]);
+    }
+
+    free(hybrid->pressure);
+    free(hybrid->residual);
+    free(hybrid->preconditioned);
+    free(hybrid->direction);
+    free(hybrid->product);
+    free(hybrid->partialSums);
+
+    memset(hybrid, 0, sizeof(*hybrid));
+}
@@ -0,0 +1,493 @@
+#include "sph_pool.h"
+#include "thread_pool.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Slots per thread pool task of the compaction
+#define SPH_POOL_TASK_SLOTS 4096
+
+static void *allocateZeroed(uint32_t count, size_t size)
+{
+    void *data = calloc(count, size);
+
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate particle pool storage!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return data;
+}
+
+static void markChanged(SphPool *pool, uint32_t slot)
+{
+    if (!pool->changedFlag[slot])
+    {
+        pool->changedFlag[slot] = 1;
+        pool->changedSlots[pool->changedCount++] = slot;
+    }
+}
+
+static void clearChanges(SphPool *pool)
+{
+    for (uint32_t k = 0; k < pool->changedCount; k++)
+    {
+        pool->changedFlag[pool->changedSlots[k]] = 0;
+    }
+
+    pool->changedCount = 0;
+    pool->moveCount = 0;
+}
+
+void sphPoolInit(SphPool *pool, SphSolver *solver)
+{
+    memset(pool, 0, sizeof(*pool));
+
+    pool->solver = solver;
+    pool->capacity = solver->params.particleCount;
+    pool->blockCount = (pool->capacity + SPH_POOL_TASK_SLOTS - 1) / SPH_POOL_TASK_SLOTS;
+
+    pool->alive = allocateZeroed(pool->capacity, sizeof(uint8_t));
+    pool->freeSlots = allocateZeroed(pool->capacity, sizeof(uint32_t));
+    pool->changedSlots = allocateZeroed(pool->capacity, sizeof(uint32_t));
+    pool->changedFlag = allocateZeroed(pool->capacity, sizeof(uint8_t));
+    pool->moveFrom = allocateZeroed(pool->capacity, sizeof(uint32_t));
+    pool->moveTo = allocateZeroed(pool->capacity, sizeof(uint32_t));
+    pool->blockHoles = allocateZeroed(pool->blockCount, sizeof(uint32_t));
+    pool->blockMovers = allocateZeroed(pool->blockCount, sizeof(uint32_t));
+
+    memset(pool->alive, 1, solver->count);
+    pool->liveCount = solver->count;
+    pool->compactThreshold = 0.25f;
+
+    solver->alive = pool->alive;
+}
+
+void sphPoolAddEmitter(SphPool *pool, const float center[3], const float velocity[3], float radius)
+{
+    if (pool->emitterCount == SPH_POOL_MAX_EMITTERS)
+    {
+        fprintf(stderr, "Too many particle emitters!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    SphEmitter *emitter = &pool->emitters[pool->emitterCount++];
+
+    memset(emitter, 0, sizeof(*emitter));
+    memcpy(emitter->center, center, sizeof(emitter->center));
+    memcpy(emitter->velocity, velocity, sizeof(emitter->velocity));
+    emitter->radius = radius;
+    emitter->travelled = pool->solver->params.particleSpacing; // The first layer leaves right away
+}
+
+void sphPoolAddSink(SphPool *pool, const float boundsMin[3], const float boundsMax[3])
+{
+    if (pool->sinkCount == SPH_POOL_MAX_SINKS)
+    {
+        fprintf(stderr, "Too many particle sinks!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    SphSink *sink = &pool->sinks[pool->sinkCount++];
+
+    memset(sink, 0, sizeof(*sink));
+    memcpy(sink->boundsMin, boundsMin, sizeof(sink->boundsMin));
+    memcpy(sink->boundsMax, boundsMax, sizeof(sink->boundsMax));
+}
+
+uint32_t sphPoolSpawn(SphPool *pool, const float position[3], const float velocity[3])
+{
+    SphSolver *solver = pool->solver;
+    uint32_t slot;
+
+    if (pool->freeCount > 0)
+    {
+        slot = pool->freeSlots[--pool->freeCount];
+    }
+    else if (solver->count < pool->capacity)
+    {
+        slot = solver->count++;
+    }
+    else
+    {
+        pool->starved++;
+        return UINT32_MAX;
+    }
+
+    solver->posX[slot] = position[0];
+    solver->posY[slot] = position[1];
+    solver->posZ[slot] = position[2];
+    solver->velX[slot] = velocity[0];
+    solver->velY[slot] = velocity[1];
+    solver->velZ[slot] = velocity[2];
+    solver->accX[slot] = 0.0f;
+    solver->accY[slot] = 0.0f;
+    solver->accZ[slot] = 0.0f;
+    solver->density[slot] = solver->params.restDensity;
+    solver->pressure[slot] = 0.0f;
+
+    pool->alive[slot] = 1;
+    pool->liveCount++;
+    pool->emitted++;
+    markChanged(pool, slot);
+
+    // The Verlet lists do not know the particle yet
+    solver->maxDisplacement2 = INFINITY;
+
+    return slot;
+}
+
+void sphPoolKill(SphPool *pool, uint32_t slot)
+{
+    if (slot >= pool->solver->count || !pool->alive[slot])
+    {
+        return;
+    }
+
+    pool->alive[slot] = 0;
+    pool->freeSlots[pool->freeCount++] = slot;
+    pool->liveCount--;
+    pool->removed++;
+    markChanged(pool, slot);
+
+    // Other particles still list it as a neighbor
+    pool->solver->maxDisplacement2 = INFINITY;
+}
+
+// Counts the holes (dead slots below the packed count) and the movers (live slots at or above it) of a block
+static void countTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    SphPool *pool = context;
+    uint32_t begin = taskIndex * SPH_POOL_TASK_SLOTS;
+    uint32_t end = begin + SPH_POOL_TASK_SLOTS < pool->solver->count ? begin + SPH_POOL_TASK_SLOTS : pool->solver->count;
+    uint32_t holes = 0;
+    uint32_t movers = 0;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        if (i < pool->compactCount)
+        {
+            holes += !pool->alive[i];
+        }
+        else
+        {
+            movers += pool->alive[i];
+        }
+    }
+
+    pool->blockHoles[taskIndex] = holes;
+    pool->blockMovers[taskIndex] = movers;
+}
+
+// Lists the holes and movers of a block from the offsets of the scan, both lists end up ascending
+static void listTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    SphPool *pool = context;
+    uint32_t begin = taskIndex * SPH_POOL_TASK_SLOTS;
+    uint32_t end = begin + SPH_POOL_TASK_SLOTS < pool->solver->count ? begin + SPH_POOL_TASK_SLOTS : pool->solver->count;
+    uint32_t hole = pool->blockHoles[taskIndex];
+    uint32_t mover = pool->blockMovers[taskIndex];
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        if (i < pool->compactCount && !pool->alive[i])
+        {
+            pool->moveTo[hole++] = i;
+        }
+        else if (i >= pool->compactCount && pool->alive[i])
+        {
+            pool->moveFrom[mover++] = i;
+        }
+    }
+}
+
+// Moves a block of the listed particles, every source lies above every target so the moves are independent
+static void moveTask(void *context, uint32_t taskIndex, uint32_t threadIndex)
+{
+    (void)threadIndex;
+
+    SphPool *pool = context;
+    SphSolver *solver = pool->solver;
+    uint32_t begin = taskIndex * SPH_POOL_TASK_SLOTS;
+    uint32_t end = begin + SPH_POOL_TASK_SLOTS < pool->moveCount ? begin + SPH_POOL_TASK_SLOTS : pool->moveCount;
+
+    for (uint32_t k = begin; k < end; k++)
+    {
+        uint32_t from = pool->moveFrom[k];
+        uint32_t to = pool->moveTo[k];
+
+        solver->posX[to] = solver->posX[from];
+        solver->posY[to] = solver->posY[from];
+        solver->posZ[to] = solver->posZ[from];
+        solver->velX[to] = solver->velX[from];
+        solver->velY[to] = solver->velY[from];
+        solver->velZ[to] = solver->velZ[from];
+        solver->accX[to] = solver->accX[from];
+        solver->accY[to] = solver->accY[from];
+        solver->accZ[to] = solver->accZ[from];
+        solver->density[to] = solver->density[from];
+        solver->pressure[to] = solver->pressure[from];
+
+        pool->alive[to] = 1;
+        pool->alive[from] = 0;
+    }
+}
+
+void sphPoolCompact(SphPool *pool)
+{
+    SphSolver *solver = pool->solver;
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint32_t blockCount = (solver->count + SPH_POOL_TASK_SLOTS - 1) / SPH_POOL_TASK_SLOTS;
+
+    pool->compactCount = pool->liveCount;
+    threadPoolRun(countTask, pool, blockCount);
+
+    // Exclusive scan of the per block counts, there are as many movers as holes
+    uint32_t holes = 0;
+    uint32_t movers = 0;
+
+    for (uint32_t block = 0; block < blockCount; block++)
+    {
+        uint32_t blockHoles = pool->blockHoles[block];
+        uint32_t blockMovers = pool->blockMovers[block];
+
+        pool->blockHoles[block] = holes;
+        pool->blockMovers[block] = movers;
+        holes += blockHoles;
+        movers += blockMovers;
+    }
+
+    threadPoolRun(listTask, pool, blockCount);
+
+    pool->moveCount = holes;
+    threadPoolRun(moveTask, pool, (holes + SPH_POOL_TASK_SLOTS - 1) / SPH_POOL_TASK_SLOTS);
+
+    solver->count = pool->liveCount;
+    pool->freeCount = 0;
+    pool->compactions++;
+    pool->compactMoved += holes;
+
+    solver->maxDisplacement2 = INFINITY;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pool->compactSeconds += (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void runSinks(SphPool *pool)
+{
+    SphSolver *solver = pool->solver;
+
+    for (uint32_t s = 0; s < pool->sinkCount; s++)
+    {
+        SphSink *sink = &pool->sinks[s];
+
+        for (uint32_t i = 0; i < solver->count; i++)
+        {
+            if (!pool->alive[i] ||
+                solver->posX[i] < sink->boundsMin[0] || solver->posX[i] > sink->boundsMax[0] ||
+                solver->posY[i] < sink->boundsMin[1] || solver->posY[i] > sink->boundsMax[1] ||
+                solver->posZ[i] < sink->boundsMin[2] || solver->posZ[i] > sink->boundsMax[2])
+            {
+                continue;
+            }
+
+            sphPoolKill(pool, i);
+            sink->removed++;
+        }
+    }
+}
+
+// Emits a layer of the disc lattice whenever the last one moved a spacing away from the emitter. The new
+// layer starts behind the disc by what the emitter travelled past the spacing, so the layers stay evenly spaced
+static void runEmitters(SphPool *pool)
+{
+    const SphParams *params = &pool->solver->params;
+    float spacing = params->particleSpacing;
+
+    for (uint32_t e = 0; e < pool->emitterCount; e++)
+    {
+        SphEmitter *emitter = &pool->emitters[e];
+        const float *v = emitter->velocity;
+        float speed = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+
+        if (speed < 1e-6f)
+        {
+            continue;
+        }
+
+        // Two axes spanning the disc
+        float normal[3] = {v[0] / speed, v[1] / speed, v[2] / speed};
+        float reference[3] = {fabsf(normal[0]) < 0.9f ? 1.0f : 0.0f, fabsf(normal[0]) < 0.9f ? 0.0f : 1.0f, 0.0f};
+        float u[3] = {reference[1] * normal[2] - reference[2] * normal[1], reference[2] * normal[0] - reference[0] * normal[2],
+                      reference[0] * normal[1] - reference[1] * normal[0]};
+        float length = sqrtf(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+
+        u[0] /= length;
+        u[1] /= length;
+        u[2] /= length;
+
+        float w[3] = {normal[1] * u[2] - normal[2] * u[1], normal[2] * u[0] - normal[0] * u[2], normal[0] * u[1] - normal[1] * u[0]};
+        int reach = (int)floorf(emitter->radius / spacing);
+
+        emitter->travelled += speed * params->timeStep;
+
+        while (emitter->travelled >= spacing)
+        {
+            emitter->travelled -= spacing;
+
+            float offset = emitter->travelled;
+
+            for (int b = -reach; b <= reach; b++)
+            {
+                for (int a = -reach; a <= reach; a++)
+                {
+                    if ((float)(a * a + b * b) * spacing * spacing > emitter->radius * emitter->radius)
+                    {
+                        continue;
+                    }
+
+                    float position[3];
+
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        position[axis] = emitter->center[axis] + spacing * (a * u[axis] + b * w[axis]) + offset * normal[axis];
+                    }
+
+                    if (sphPoolSpawn(pool, position, v) != UINT32_MAX)
+                    {
+                        emitter->emitted++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void sphPoolStep(SphPool *pool)
+{
+    SphSolver *solver = pool->solver;
+
+    clearChanges(pool);
+    pool->emitted = 0;
+    pool->removed = 0;
+
+    if (solver->count > 0 && (float)(solver->count - pool->liveCount) > pool->compactThreshold * solver->count)
+    {
+        sphPoolCompact(pool);
+    }
+
+    sphStep(solver);
+
+    runSinks(pool);
+    runEmitters(pool);
+
+    pool->totalEmitted += pool->emitted;
+    pool->totalRemoved += pool->removed;
+
+    // sphStep published the slots in use, the dead ones among them do not count
+    if (metricsActive)
+    {
+        metricsSet(METRIC_PARTICLES, pool->liveCount);
+    }
+}
+
+void sphPoolInitScene(SphPool *pool, SphSolver *solver, const SphParams *params)
+{
+    sphInit(solver, params);
+
+    // Half the slots start as the dam break, the rest is headroom for the inlet
+    solver->count = params->particleCount / 2;
+    sphSeedDamBreak(solver);
+    sphPoolInit(pool, solver);
+
+    float spacing = params->particleSpacing;
+    const float *boundsMin = params->boundsMin;
+    const float *boundsMax = params->boundsMax;
+    float extent[3] = {boundsMax[0] - boundsMin[0], boundsMax[1] - boundsMin[1], boundsMax[2] - boundsMin[2]};
+
+    float center[3] = {boundsMin[0] + 0.6f * extent[0], boundsMin[1] + 0.85f * extent[1], boundsMin[2] + 0.5f * extent[2]};
+    float velocity[3] = {0.0f, -2.0f, 0.0f};
+
+    sphPoolAddEmitter(pool, center, velocity, fminf(4.0f * spacing, 0.25f * extent[2]));
+
+    float drainMin[3] = {boundsMin[0], boundsMin[1], boundsMin[2]};
+    float drainMax[3] = {boundsMin[0] + 0.15f * extent[0], boundsMin[1] + 2.0f * spacing, boundsMax[2]};
+
+    sphPoolAddSink(pool, drainMin, drainMax);
+}
+
+void sphPoolReport(const SphParams *params, uint32_t stepCount)
+{
+    SphSolver solver;
+    SphPool pool;
+
+    sphPoolInitScene(&pool, &solver, params);
+
+    uint32_t reportInterval = stepCount / 10 > 0 ? stepCount / 10 : 1;
+    uint64_t emittedBefore = 0;
+    uint64_t removedBefore = 0;
+    double stepSeconds = 0.0;
+
+    for (uint32_t step = 1; step <= stepCount; step++)
+    {
+        struct timespec start;
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        sphPoolStep(&pool);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        stepSeconds += (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+        if (step % reportInterval == 0 || step == stepCount)
+        {
+            printf("Pool step %u: %u live of %u slots in use (%u free), %llu emitted and %llu removed since the last report, %u compactions\n",
+                   step, pool.liveCount, solver.count, pool.freeCount, (unsigned long long)(pool.totalEmitted - emittedBefore),
+                   (unsigned long long)(pool.totalRemoved - removedBefore), pool.compactions);
+
+            emittedBefore = pool.totalEmitted;
+            removedBefore = pool.totalRemoved;
+        }
+    }
+
+    printf("Particle pool: %llu emitted, %llu removed, %u not emitted for lack of slots, capacity %u\n",
+           (unsigned long long)pool.totalEmitted, (unsigned long long)pool.totalRemoved, pool.starved, pool.capacity);
+    printf("Pool step time %.3f ms, %u compactions moving %llu particles at %.3f ms each, %.1f ns per moved particle (%.4f%% of the run)\n",
+           1000.0 * stepSeconds / stepCount, pool.compactions, (unsigned long long)pool.compactMoved,
+           pool.compactions > 0 ? 1000.0 * pool.compactSeconds / pool.compactions : 0.0,
+           pool.compactMoved > 0 ? 1e9 * pool.compactSeconds / pool.compactMoved : 0.0, stepSeconds > 0.0 ? 100.0 * pool.compactSeconds / stepSeconds : 0.0);
+
+    sphPoolDestroy(&pool);
+    sphDestroy(&solver);
+}
+
+void sphPoolDestroy(SphPool *pool)
+{
+    if (pool->solver && pool->solver->alive == pool->alive)
+    {
+        pool->solver->alive = NULL;
+    }
+
+    free(pool->alive);
+    free(pool->freeSlots);
+    free(pool->changedSlots);
+    free(pool->changedFlag);
+    free(pool->moveFrom);
+    free(pool->moveTo);
+    free(pool->blockHoles);
+    free(pool->blockMovers);
+
+    memset(pool, 0, sizeof(*pool));
+}
@@ -0,0 +1,1192 @@
+#include "sph_stream.h"
+#include "metrics.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+// Steps between two lines of brick traffic in the report
+#define SPH_STREAM_REPORT_INTERVAL 50
+
+// Room of a new brick for each state, relative to the particles it holds at rest density. A brick that
+// fills up anyway, such as fluid piling against a wall, doubles its own room
+#define SPH_STREAM_CAPACITY_FACTOR 2
+
+static int streamCell(float value, float minimum, float cellSize, uint32_t dim)
+{
+    int cell = (int)floorf((value - minimum) / cellSize);
+
+    if (cell < 0)
+    {
+        return 0;
+    }
+
+    if (cell >= (int)dim)
+    {
+        return (int)dim - 1;
+    }
+
+    return cell;
+}
+
+// Brick of a position, clamped into the domain like the cells of the neighbor grid
+static uint32_t brickOf(const SphStream *stream, float x, float y, float z)
+{
+    const SphParams *params = &stream->params;
+    float h = params->smoothingRadius;
+    uint32_t bx = (uint32_t)streamCell(x, params->boundsMin[0], h, stream->gridDim[0]) / stream->brickCells;
+    uint32_t by = (uint32_t)streamCell(y, params->boundsMin[1], h, stream->gridDim[1]) / stream->brickCells;
+    uint32_t bz = (uint32_t)streamCell(z, params->boundsMin[2], h, stream->gridDim[2]) / stream->brickCells;
+
+    return bx + stream->brickDim[0] * (by + stream->brickDim[1] * bz);
+}
+
+static void brickCoords(const SphStream *stream, uint32_t brick, uint32_t coords[3])
+{
+    coords[0] = brick % stream->brickDim[0];
+    coords[1] = (brick / stream->brickDim[0]) % stream->brickDim[1];
+    coords[2] = brick / (stream->brickDim[0] * stream->brickDim[1]);
+}
+
+// The brick and its neighbors inside the domain, the brick first
+static uint32_t brickNeighbors(const SphStream *stream, uint32_t brick, uint32_t neighbors[27])
+{
+    uint32_t coords[3];
+    uint32_t count = 0;
+
+    brickCoords(stream, brick, coords);
+    neighbors[count++] = brick;
+
+    for (int z = (int)coords[2] - 1; z <= (int)coords[2] + 1; z++)
+    {
+        for (int y = (int)coords[1] - 1; y <= (int)coords[1] + 1; y++)
+        {
+            for (int x = (int)coords[0] - 1; x <= (int)coords[0] + 1; x++)
+            {
+                if (x < 0 || y < 0 || z < 0 || x >= (int)stream->brickDim[0] || y >= (int)stream->brickDim[1] || z >= (int)stream->brickDim[2])
+                {
+                    continue;
+                }
+
+                uint32_t neighbor = (uint32_t)x + stream->brickDim[0] * ((uint32_t)y + stream->brickDim[1] * (uint32_t)z);
+
+                if (neighbor != brick)
+                {
+                    neighbors[count++] = neighbor;
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
+static StreamParticle *brickRecords(const SphStream *stream, uint32_t brick, uint32_t parity)
+{
+    return stream->bricks[brick].records + (size_t)parity * stream->bricks[brick].capacity;
+}
+
+// Bytes of a brick holding capacity particles in each state, whole pages so every brick maps on its own
+static size_t brickBytes(uint32_t capacity)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    return (2 * (size_t)capacity * sizeof(StreamParticle) + page - 1) / page * page;
+}
+
+static double secondsSince(const struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Keeps the page reads of touchRecords from being optimized away
+static volatile unsigned char touchSink;
+
+// Reads one byte of every page so the mapping is faulted in on the I/O thread, not by the solver
+static size_t touchRecords(const StreamParticle *records, uint32_t count)
+{
+    const volatile unsigned char *bytes = (const volatile unsigned char*)records;
+    size_t size = (size_t)count * sizeof(StreamParticle);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    unsigned char sum = 0;
+
+    for (size_t offset = 0; offset < size; offset += page)
+    {
+        sum += bytes[offset];
+    }
+
+    touchSink = sum;
+
+    return size;
+}
+
+static void *ioLoop(void *argument)
+{
+    SphStream *stream = argument;
+
+    pthread_mutex_lock(&stream->lock);
+
+    for (;;)
+    {
+        while (!stream->stopRequested && stream->queueCount == 0)
+        {
+            pthread_cond_wait(&stream->work, &stream->lock);
+        }
+
+        // Whatever is queued is still carried out, so the file holds every written particle
+        if (stream->queueCount == 0)
+        {
+            break;
+        }
+
+        uint32_t index = stream->queue[stream->queueHead];
+        stream->queueHead = (stream->queueHead + 1) % stream->brickCount;
+        stream->queueCount--;
+
+        StreamBrick *brick = &stream->bricks[index];
+        off_t offset = brick->offset;
+        uint32_t capacity = brick->capacity;
+        size_t bytes = brickBytes(capacity);
+
+        if (brick->state == STREAM_BRICK_LOADING)
+        {
+            uint32_t counts[2] = {brick->count[0], brick->count[1]};
+            pthread_mutex_unlock(&stream->lock);
+
+            StreamParticle *records = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, stream->file, offset);
+
+            if (records == MAP_FAILED)
+            {
+                fprintf(stderr, "Failed to map brick %u!\n", index);
+                exit(EXIT_FAILURE);
+            }
+
+            // Only the used records, the rest of the brick is a hole of the sparse file
+            size_t touched = touchRecords(records, counts[0]) + touchRecords(records + capacity, counts[1]);
+
+            pthread_mutex_lock(&stream->lock);
+            brick->records = records;
+            brick->state = STREAM_BRICK_RESIDENT;
+            stream->bytesTouched += touched;
+        }
+        else
+        {
+            StreamParticle *records = brick->records;
+            pthread_mutex_unlock(&stream->lock);
+
+            // The write back is only started, waiting for it would hold up the loads queued behind. The
+            // pages it already cleaned are dropped from the page cache, the kernel writes back the rest
+            msync(records, bytes, MS_ASYNC);
+            munmap(records, bytes);
+            posix_fadvise(stream->file, offset, (off_t)bytes, POSIX_FADV_DONTNEED);
+
+            pthread_mutex_lock(&stream->lock);
+            brick->records = NULL;
+            brick->state = STREAM_BRICK_EVICTED;
+        }
+
+        pthread_cond_broadcast(&stream->changed);
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+
+    return NULL;
+}
+
+// The LRU list and the queue are only touched with the lock held
+static void lruRemove(SphStream *stream, uint32_t index)
+{
+    StreamBrick *brick = &stream->bricks[index];
+
+    if (brick->older >= 0)
+    {
+        stream->bricks[brick->older].newer = brick->newer;
+    }
+    else
+    {
+        stream->oldest = brick->newer;
+    }
+
+    if (brick->newer >= 0)
+    {
+        stream->bricks[brick->newer].older = brick->older;
+    }
+    else
+    {
+        stream->newest = brick->older;
+    }
+
+    brick->older = -1;
+    brick->newer = -1;
+}
+
+static void lruPushNewest(SphStream *stream, uint32_t index)
+{
+    StreamBrick *brick = &stream->bricks[index];
+
+    brick->older = stream->newest;
+    brick->newer = -1;
+
+    if (stream->newest >= 0)
+    {
+        stream->bricks[stream->newest].newer = (int32_t)index;
+    }
+    else
+    {
+        stream->oldest = (int32_t)index;
+    }
+
+    stream->newest = (int32_t)index;
+    brick->lastUse = ++stream->clock;
+}
+
+static void queuePush(SphStream *stream, uint32_t index)
+{
+    stream->queue[(stream->queueHead + stream->queueCount) % stream->brickCount] = index;
+    stream->queueCount++;
+
+    pthread_cond_signal(&stream->work);
+}
+
+// Hands the least recently used unpinned brick to the I/O thread. A prefetch never evicts a brick used
+// since the current sweep position started, that is the halo being swept or an earlier prefetch
+static int evictOldest(SphStream *stream, int demand)
+{
+    for (int32_t index = stream->oldest; index >= 0; index = stream->bricks[index].newer)
+    {
+        StreamBrick *brick = &stream->bricks[index];
+
+        if (!demand && brick->lastUse >= stream->windowStamp)
+        {
+            return 0;
+        }
+
+        if (brick->pins > 0 || brick->state != STREAM_BRICK_RESIDENT)
+        {
+            continue;
+        }
+
+        lruRemove(stream, (uint32_t)index);
+
+        stream->wastedPrefetches += brick->prefetched ? 1 : 0;
+        stream->evictions++;
+        stream->residentCount--;
+        brick->prefetched = 0;
+        brick->state = STREAM_BRICK_EVICTING;
+
+        queuePush(stream, (uint32_t)index);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+// Queues a brick to be mapped unless it already is. A demand load may go over the resident limit when
+// every mapped brick is pinned, a prefetch gives up instead and returns 0. Both evict until the count is
+// back below the limit, so it recovers from the demand loads that went over it
+static int requestLoad(SphStream *stream, uint32_t index, int demand)
+{
+    StreamBrick *brick = &stream->bricks[index];
+
+    if (brick->state == STREAM_BRICK_LOADING || brick->state == STREAM_BRICK_RESIDENT)
+    {
+        lruRemove(stream, index);
+        lruPushNewest(stream, index);
+        return 1;
+    }
+
+    if (!demand && brick->state == STREAM_BRICK_EVICTING)
+    {
+        return 0;
+    }
+
+    while (stream->residentCount >= stream->residentLimit && evictOldest(stream, demand))
+    {
+    }
+
+    if (!demand && stream->residentCount >= stream->residentLimit)
+    {
+        return 0;
+    }
+
+    // Mapping it again before the write back finished would read stale pages
+    while (brick->state == STREAM_BRICK_EVICTING)
+    {
+        pthread_cond_wait(&stream->changed, &stream->lock);
+    }
+
+    brick->state = STREAM_BRICK_LOADING;
+    brick->prefetched = !demand;
+    stream->residentCount++;
+    stream->peakResident = stream->residentCount > stream->peakResident ? stream->residentCount : stream->peakResident;
+    stream->demandLoads += demand ? 1 : 0;
+    stream->prefetchLoads += demand ? 0 : 1;
+
+    lruPushNewest(stream, index);
+    queuePush(stream, index);
+
+    return 1;
+}
+
+// Evicts the least recently used unpinned bricks until no more than limit are mapped
+static void setResidentLimit(SphStream *stream, uint32_t limit)
+{
+    pthread_mutex_lock(&stream->lock);
+
+    stream->residentLimit = limit;
+
+    while (stream->residentCount > stream->residentLimit && evictOldest(stream, 1))
+    {
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+}
+
+static void pinBrick(SphStream *stream, uint32_t index)
+{
+    StreamBrick *brick = &stream->bricks[index];
+
+    if (brick->prefetched && brick->state == STREAM_BRICK_RESIDENT)
+    {
+        stream->prefetchHits++;
+    }
+
+    brick->prefetched = 0;
+    requestLoad(stream, index, 1);
+    brick->pins++;
+
+    if (stream->pinnedCount == stream->pinnedCapacity)
+    {
+        stream->pinnedCapacity *= 2;
+        stream->pinned = realloc(stream->pinned, stream->pinnedCapacity * sizeof(uint32_t));
+
+        if (!stream->pinned)
+        {
+            fprintf(stderr, "Failed to allocate pinned bricks!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    stream->pinned[stream->pinnedCount++] = index;
+}
+
+// Waits with the lock held until the brick is mapped, adding the wait to the stall time
+static void waitForBrick(SphStream *stream, uint32_t index)
+{
+    StreamBrick *brick = &stream->bricks[index];
+
+    if (brick->state == STREAM_BRICK_RESIDENT)
+    {
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (brick->state != STREAM_BRICK_RESIDENT)
+    {
+        pthread_cond_wait(&stream->changed, &stream->lock);
+    }
+
+    stream->stallSeconds += secondsSince(&start);
+}
+
+static void waitForPinned(SphStream *stream)
+{
+    for (uint32_t i = 0; i < stream->pinnedCount; i++)
+    {
+        waitForBrick(stream, stream->pinned[i]);
+    }
+}
+
+// Pins the brick a particle moved into when the sweep position did not: it held no particles yet, or
+// the particle went past the halo in one step
+static void pinExtra(SphStream *stream, uint32_t index)
+{
+    pthread_mutex_lock(&stream->lock);
+
+    pinBrick(stream, index);
+    waitForBrick(stream, index);
+
+    pthread_mutex_unlock(&stream->lock);
+}
+
+// Next position of the sweep with particles in the current state after position, wrapping around into
+// the next sweep. Returns position itself when no other brick holds particles
+static uint32_t nextPosition(const SphStream *stream, uint32_t position)
+{
+    for (uint32_t step = 1; step < stream->brickCount; step++)
+    {
+        uint32_t next = (position + step) % stream->brickCount;
+
+        if (stream->bricks[next].count[stream->parity] > 0)
+        {
+            return next;
+        }
+    }
+
+    return position;
+}
+
+// Pins the bricks with particles in the halo of position, queues the prefetches of the positions after
+// it and waits until the pinned bricks are mapped
+static void beginPosition(SphStream *stream, uint32_t position)
+{
+    uint32_t neighbors[27];
+    uint32_t parity = stream->parity;
+
+    pthread_mutex_lock(&stream->lock);
+
+    stream->windowStamp = stream->clock + 1;
+
+    uint32_t neighborCount = brickNeighbors(stream, position, neighbors);
+
+    for (uint32_t i = 0; i < neighborCount; i++)
+    {
+        if (stream->bricks[neighbors[i]].count[parity] > 0)
+        {
+            pinBrick(stream, neighbors[i]);
+        }
+    }
+
+    uint32_t ahead = position;
+
+    for (uint32_t distance = 0; distance < stream->prefetchDistance; distance++)
+    {
+        ahead = nextPosition(stream, ahead);
+
+        if (ahead == position)
+        {
+            break;
+        }
+
+        neighborCount = brickNeighbors(stream, ahead, neighbors);
+
+        for (uint32_t i = 0; i < neighborCount; i++)
+        {
+            if (stream->bricks[neighbors[i]].count[parity] > 0 && !requestLoad(stream, neighbors[i], 0))
+            {
+                distance = stream->prefetchDistance; // Out of room, the rest waits for the next position
+                break;
+            }
+        }
+    }
+
+    waitForPinned(stream);
+
+    pthread_mutex_unlock(&stream->lock);
+}
+
+static void endPosition(SphStream *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+
+    for (uint32_t i = 0; i < stream->pinnedCount; i++)
+    {
+        stream->bricks[stream->pinned[i]].pins--;
+    }
+
+    stream->pinnedCount = 0;
+
+    pthread_mutex_unlock(&stream->lock);
+}
+
+// Moves a full brick into a region of twice its capacity appended to the file, both states included.
+// The brick is pinned, so it stays mapped and the I/O thread leaves it alone. Its old region is not
+// reused, a brick that once filled up is likely to again
+static void growBrick(SphStream *stream, uint32_t index)
+{
+    StreamBrick *brick = &stream->bricks[index];
+    uint32_t capacity = brick->capacity * 2;
+    size_t bytes = brickBytes(capacity);
+    off_t offset = stream->fileSize;
+
+    if (ftruncate(stream->file, offset + (off_t)bytes) != 0)
+    {
+        fprintf(stderr, "Failed to grow brick %u to %u particles!\n", index, capacity);
+        exit(EXIT_FAILURE);
+    }
+
+    StreamParticle *records = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, stream->file, offset);
+
+    if (records == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map brick %u!\n", index);
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(records, brick->records, (size_t)brick->count[0] * sizeof(StreamParticle));
+    memcpy(records + capacity, brick->records + brick->capacity, (size_t)brick->count[1] * sizeof(StreamParticle));
+
+    size_t oldBytes = brickBytes(brick->capacity);
+
+    munmap(brick->records, oldBytes);
+    posix_fadvise(stream->file, brick->offset, (off_t)oldBytes, POSIX_FADV_DONTNEED);
+
+    pthread_mutex_lock(&stream->lock);
+
+    brick->records = records;
+    brick->capacity = capacity;
+    brick->offset = offset;
+    stream->fileSize += (off_t)bytes;
+    stream->grownBricks++;
+
+    pthread_mutex_unlock(&stream->lock);
+}
+
+static void growArray(void **array, uint32_t count, size_t size)
+{
+    void *data = realloc(*array, (size_t)count * size);
+
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate stream window storage!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *array = data;
+}
+
+// Makes room for count owned and halo particles in the window
+static void reserveWindow(SphStream *stream, uint32_t count)
+{
+    if (count <= stream->windowCapacity)
+    {
+        return;
+    }
+
+    SphSolver *window = &stream->window;
+    uint32_t capacity = stream->windowCapacity * 2 > count ? stream->windowCapacity * 2 : count;
+    float **arrays[] = {&window->posX, &window->posY, &window->posZ, &window->velX, &window->velY, &window->velZ,
+                        &window->accX, &window->accY, &window->accZ, &window->density, &window->pressure};
+
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++)
+    {
+        growArray((void**)arrays[i], capacity, sizeof(float));
+    }
+
+    growArray((void**)&window->cellKeys, capacity, sizeof(uint32_t));
+    growArray((void**)&window->sortedIndices, capacity, sizeof(uint32_t));
+    growArray((void**)&stream->windowIds, capacity, sizeof(uint32_t));
+
+    stream->windowCapacity = capacity;
+}
+
+static void appendToWindow(SphStream *stream, const StreamParticle *particle)
+{
+    SphSolver *window = &stream->window;
+    uint32_t i = window->count++;
+
+    reserveWindow(stream, window->count);
+
+    stream->windowIds[i] = particle->id;
+    window->posX[i] = particle->position[0];
+    window->posY[i] = particle->position[1];
+    window->posZ[i] = particle->position[2];
+    window->velX[i] = particle->velocity[0];
+    window->velY[i] = particle->velocity[1];
+    window->velZ[i] = particle->velocity[2];
+    window->density[i] = particle->density;
+}
+
+// Loads the owned particles of a pinned brick and the particles within h of it from its pinned
+// neighbors. The window grid starts one cell before the brick
+static void gatherWindow(SphStream *stream, uint32_t brick)
+{
+    SphSolver *window = &stream->window;
+    float h = stream->params.smoothingRadius;
+    uint32_t parity = stream->parity;
+    uint32_t coords[3];
+    float low[3];
+    float high[3];
+
+    brickCoords(stream, brick, coords);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float brickMin = stream->params.boundsMin[axis] + (float)(coords[axis] * stream->brickCells) * h;
+
+        window->params.boundsMin[axis] = brickMin - h;
+        window->params.boundsMax[axis] = brickMin + (float)(stream->brickCells + 1) * h;
+        low[axis] = window->params.boundsMin[axis];
+        high[axis] = window->params.boundsMax[axis];
+    }
+
+    window->count = 0;
+
+    const StreamParticle *owned = brickRecords(stream, brick, parity);
+
+    for (uint32_t k = 0; k < stream->bricks[brick].count[parity]; k++)
+    {
+        appendToWindow(stream, &owned[k]);
+    }
+
+    stream->windowOwned = window->count;
+
+    uint32_t neighbors[27];
+    uint32_t neighborCount = brickNeighbors(stream, brick, neighbors);
+
+    for (uint32_t i = 1; i < neighborCount; i++)
+    {
+        uint32_t count = stream->bricks[neighbors[i]].count[parity];
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        const StreamParticle *records = brickRecords(stream, neighbors[i], parity);
+
+        for (uint32_t k = 0; k < count; k++)
+        {
+            const float *p = records[k].position;
+
+            if (p[0] >= low[0] && p[0] < high[0] && p[1] >= low[1] && p[1] < high[1] && p[2] >= low[2] && p[2] < high[2])
+            {
+                appendToWindow(stream, &records[k]);
+            }
+        }
+    }
+}
+
+static void densitySweep(SphStream *stream)
+{
+    SphSolver *window = &stream->window;
+    uint32_t parity = stream->parity;
+
+    for (uint32_t brick = 0; brick < stream->brickCount; brick++)
+    {
+        if (stream->bricks[brick].count[parity] == 0)
+        {
+            continue;
+        }
+
+        beginPosition(stream, brick);
+        gatherWindow(stream, brick);
+
+        // The halo's own densities miss the particles beyond it, only the owned ones are kept
+        sphBuildGrid(window);
+        sphComputeDensity(window);
+
+        StreamParticle *owned = brickRecords(stream, brick, parity);
+
+        for (uint32_t i = 0; i < stream->windowOwned; i++)
+        {
+            owned[i].density = window->density[i];
+        }
+
+        endPosition(stream);
+    }
+}
+
+// Integrates the owned particles of every brick and writes them into the other state of the brick they
+// moved to. The state being read is left alone, the neighbors swept later still read it as their halo
+static void forceSweep(SphStream *stream)
+{
+    SphSolver *window = &stream->window;
+    const SphParams *params = &stream->params;
+    uint32_t parity = stream->parity;
+    uint32_t next = parity ^ 1;
+
+    for (uint32_t brick = 0; brick < stream->brickCount; brick++)
+    {
+        if (stream->bricks[brick].count[parity] == 0)
+        {
+            continue;
+        }
+
+        beginPosition(stream, brick);
+        gatherWindow(stream, brick);
+
+        for (uint32_t i = 0; i < window->count; i++)
+        {
+            window->pressure[i] = fmaxf(params->stiffness * (window->density[i] - params->restDensity), 0.0f);
+        }
+
+        // Forces of the halo are computed too and thrown away, only the owned particles move
+        sphBuildGrid(window);
+        sphComputeForces(window);
+
+        // The walls are the ones of the domain, not of the window
+        memcpy(window->params.boundsMin, params->boundsMin, sizeof(params->boundsMin));
+        memcpy(window->params.boundsMax, params->boundsMax, sizeof(params->boundsMax));
+        window->count = stream->windowOwned;
+        sphIntegrate(window);
+
+        for (uint32_t i = 0; i < stream->windowOwned; i++)
+        {
+            uint32_t target = brickOf(stream, window->posX[i], window->posY[i], window->posZ[i]);
+            StreamBrick *targetBrick = &stream->bricks[target];
+
+            if (targetBrick->pins == 0)
+            {
+                pinExtra(stream, target);
+            }
+
+            if (targetBrick->count[next] == targetBrick->capacity)
+            {
+                growBrick(stream, target);
+            }
+
+            StreamParticle *particle = &brickRecords(stream, target, next)[targetBrick->count[next]++];
+
+            particle->id = stream->windowIds[i];
+            particle->position[0] = window->posX[i];
+            particle->position[1] = window->posY[i];
+            particle->position[2] = window->posZ[i];
+            particle->velocity[0] = window->velX[i];
+            particle->velocity[1] = window->velY[i];
+            particle->velocity[2] = window->velZ[i];
+            particle->density = window->density[i];
+        }
+
+        endPosition(stream);
+    }
+}
+
+void sphStreamInit(SphStream *stream, const SphParams *params, const SphStreamInfo *info)
+{
+    memset(stream, 0, sizeof(*stream));
+
+    float h = params->smoothingRadius;
+
+    // The solve would need its dot products and matrix products over every brick each iteration
+    if (params->viscosityIterations > 0)
+    {
+        fprintf(stderr, "The out-of-core solver only supports the explicit viscosity!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (info->brickCells == 0)
+    {
+        fprintf(stderr, "Bricks need at least one grid cell!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    stream->params = *params;
+    stream->params.neighborSkin = 0.0f; // The window changes every sweep position, it walks the grid
+    stream->particleCount = params->particleCount;
+    stream->brickCells = info->brickCells;
+    stream->brickCount = 1;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        uint32_t dim = (uint32_t)ceilf((params->boundsMax[axis] - params->boundsMin[axis]) / h);
+
+        stream->gridDim[axis] = dim > 0 ? dim : 1;
+        stream->brickDim[axis] = (stream->gridDim[axis] + info->brickCells - 1) / info->brickCells;
+        stream->brickCount *= stream->brickDim[axis];
+    }
+
+    uint32_t edge = (uint32_t)ceilf(info->brickCells * h / params->particleSpacing);
+
+    stream->brickCapacity = SPH_STREAM_CAPACITY_FACTOR * edge * edge * edge;
+    stream->brickStride = brickBytes(stream->brickCapacity);
+    stream->fileSize = (off_t)stream->brickCount * (off_t)stream->brickStride;
+
+    // The halo of the swept brick, and the row of 9 bricks every prefetched position along x adds to it
+    stream->prefetchDistance = info->prefetchDistance;
+    stream->residentLimit = info->residentLimit > 0 ? info->residentLimit : 27 + 9 * stream->prefetchDistance;
+    stream->residentLimit = stream->residentLimit > 27 ? stream->residentLimit : 27;
+
+    stream->bricks = calloc(stream->brickCount, sizeof(StreamBrick));
+    stream->queue = malloc(stream->brickCount * sizeof(uint32_t));
+    stream->pinnedCapacity = 32;
+    stream->pinned = malloc(stream->pinnedCapacity * sizeof(uint32_t));
+
+    if (!stream->bricks || !stream->queue || !stream->pinned)
+    {
+        fprintf(stderr, "Failed to allocate the brick directory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < stream->brickCount; i++)
+    {
+        stream->bricks[i].capacity = stream->brickCapacity;
+        stream->bricks[i].offset = (off_t)i * (off_t)stream->brickStride;
+        stream->bricks[i].older = -1;
+        stream->bricks[i].newer = -1;
+    }
+
+    stream->oldest = -1;
+    stream->newest = -1;
+
+    // The window grid is the brick plus one cell around it, its origin is set for every brick
+    SphParams windowParams = stream->params;
+    windowParams.particleCount = stream->brickCapacity;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        windowParams.boundsMin[axis] = 0.0f;
+        windowParams.boundsMax[axis] = (info->brickCells + 1.5f) * h;
+    }
+
+    sphInit(&stream->window, &windowParams);
+    stream->window.count = 0;
+    stream->windowCapacity = stream->brickCapacity;
+    stream->windowIds = malloc(stream->windowCapacity * sizeof(uint32_t));
+
+    if (!stream->windowIds)
+    {
+        fprintf(stderr, "Failed to allocate stream window storage!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Sparse: only the pages of written particles take up disk space. Created last, so only the steps
+    // below have to close it when they fail
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/fluidsim-bricks-XXXXXX", info->directory ? info->directory : "/tmp");
+
+    stream->file = mkstemp(path);
+
+    if (stream->file < 0)
+    {
+        fprintf(stderr, "Failed to create the brick file %s!\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    unlink(path); // Gone with the descriptor, even when the run is killed
+
+    if (ftruncate(stream->file, stream->fileSize) != 0)
+    {
+        close(stream->file);
+        fprintf(stderr, "Failed to size the brick file to %u bricks!\n", stream->brickCount);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->work, NULL);
+    pthread_cond_init(&stream->changed, NULL);
+
+    if (pthread_create(&stream->ioThread, NULL, ioLoop, stream) != 0)
+    {
+        close(stream->file);
+        fprintf(stderr, "Failed to create the brick I/O thread!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Out-of-core solver: %u bricks (%ux%ux%u) of %u³ cells, %u particles each, %.1f MiB file, about %u mapped (%.1f MiB)\n",
+           stream->brickCount, stream->brickDim[0], stream->brickDim[1], stream->brickDim[2], stream->brickCells, stream->brickCapacity,
+           (double)stream->brickCount * stream->brickStride / (1024.0 * 1024.0), stream->residentLimit,
+           (double)stream->residentLimit * stream->brickStride / (1024.0 * 1024.0));
+}
+
+void sphStreamSeedDamBreak(SphStream *stream)
+{
+    const SphParams *params = &stream->params;
+    uint32_t side = (uint32_t)ceil(cbrt((double)stream->particleCount));
+    float spacing = params->particleSpacing;
+    float h = params->smoothingRadius;
+
+    for (uint32_t brick = 0; brick < stream->brickCount; brick++)
+    {
+        uint32_t coords[3];
+        uint32_t first[3];
+        uint32_t last[3];
+        int empty = 0;
+
+        brickCoords(stream, brick, coords);
+
+        // Lattice points near the brick, one more on each side so rounding never loses one
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float low = (coords[axis] * stream->brickCells) * h / spacing - 0.5f;
+            float high = ((coords[axis] + 1) * stream->brickCells) * h / spacing - 0.5f;
+            int begin = (int)floorf(low) - 1;
+            int end = (int)ceilf(high) + 1;
+
+            begin = begin > 0 ? begin : 0;
+            end = end < (int)side - 1 ? end : (int)side - 1;
+            empty |= begin > end;
+            first[axis] = (uint32_t)(begin > 0 ? begin : 0);
+            last[axis] = (uint32_t)(end > 0 ? end : 0);
+        }
+
+        if (empty)
+        {
+            continue;
+        }
+
+        int pinned = 0;
+
+        // The id and the position of lattice point (x, y, z) as in sphSeedDamBreak
+        for (uint32_t y = first[1]; y <= last[1]; y++)
+        {
+            for (uint32_t z = first[2]; z <= last[2]; z++)
+            {
+                for (uint32_t x = first[0]; x <= last[0]; x++)
+                {
+                    uint64_t id = x + (uint64_t)side * (z + (uint64_t)side * y);
+                    float position[3] = {params->boundsMin[0] + (x + 0.5f) * spacing, params->boundsMin[1] + (y + 0.5f) * spacing,
+                                         params->boundsMin[2] + (z + 0.5f) * spacing};
+
+                    if (id >= stream->particleCount || brickOf(stream, position[0], position[1], position[2]) != brick)
+                    {
+                        continue;
+                    }
+
+                    if (!pinned)
+                    {
+                        pthread_mutex_lock(&stream->lock);
+                        stream->windowStamp = stream->clock + 1;
+                        pinBrick(stream, brick);
+                        waitForPinned(stream);
+                        pthread_mutex_unlock(&stream->lock);
+                        pinned = 1;
+                    }
+
+                    StreamBrick *target = &stream->bricks[brick];
+
+                    if (target->count[0] == target->capacity)
+                    {
+                        growBrick(stream, brick);
+                    }
+
+                    StreamParticle *particle = &brickRecords(stream, brick, 0)[target->count[0]++];
+
+                    particle->id = (uint32_t)id;
+                    memcpy(particle->position, position, sizeof(position));
+                    memset(particle->velocity, 0, sizeof(particle->velocity));
+                    particle->density = params->restDensity;
+                }
+            }
+        }
+
+        if (pinned)
+        {
+            endPosition(stream);
+        }
+    }
+
+    stream->parity = 0;
+}
+
+void sphStreamStep(SphStream *stream)
+{
+    uint32_t next = stream->parity ^ 1;
+
+    // Every brick receives its particles anew, from itself and from the neighbors they moved in from
+    pthread_mutex_lock(&stream->lock);
+
+    for (uint32_t brick = 0; brick < stream->brickCount; brick++)
+    {
+        stream->bricks[brick].count[next] = 0;
+    }
+
+    pthread_mutex_unlock(&stream->lock);
+
+    densitySweep(stream);
+    forceSweep(stream);
+
+    stream->parity = next;
+    stream->stepIndex++;
+
+    if (metricsActive)
+    {
+        metricsAdd(METRIC_STEPS, 1.0);
+        metricsSet(METRIC_PARTICLES, stream->particleCount);
+        metricsSet(METRIC_TIME_STEP, stream->params.timeStep);
+    }
+}
+
+void sphStreamGather(SphStream *stream, SphSolver *solver)
+{
+    uint32_t parity = stream->parity;
+
+    for (uint32_t brick = 0; brick < stream->brickCount; brick++)
+    {
+        uint32_t count = stream->bricks[brick].count[parity];
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        stream->windowStamp = stream->clock + 1;
+        pinBrick(stream, brick);
+        waitForPinned(stream);
+        pthread_mutex_unlock(&stream->lock);
+
+        const StreamParticle *records = brickRecords(stream, brick, parity);
+
+        for (uint32_t k = 0; k < count; k++)
+        {
+            uint32_t id = records[k].id;
+
+            if (id >= solver->count)
+            {
+                fprintf(stderr, "Brick %u holds particle %u of %u!\n", brick, id, solver->count);
+                exit(EXIT_FAILURE);
+            }
+
+            solver->posX[id] = records[k].position[0];
+            solver->posY[id] = records[k].position[1];
+            solver->posZ[id] = records[k].position[2];
+            solver->velX[id] = records[k].velocity[0];
+            solver->velY[id] = records[k].velocity[1];
+            solver->velZ[id] = records[k].velocity[2];
+            solver->density[id] = records[k].density;
+        }
+
+        endPosition(stream);
+    }
+}
+
+void sphStreamDestroy(SphStream *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->stopRequested = 1;
+    pthread_cond_signal(&stream->work);
+    pthread_mutex_unlock(&stream->lock);
+
+    pthread_join(stream->ioThread, NULL);
+
+    for (uint32_t i = 0; i < stream->brickCount; i++)
+    {
+        if (stream->bricks[i].records)
+        {
+            munmap(stream->bricks[i].records, brickBytes(stream->bricks[i].capacity));
+        }
+    }
+
+    close(stream->file);
+
+    pthread_cond_destroy(&stream->changed);
+    pthread_cond_destroy(&stream->work);
+    pthread_mutex_destroy(&stream->lock);
+
+    sphDestroy(&stream->window);
+    free(stream->windowIds);
+    free(stream->bricks);
+    free(stream->queue);
+    free(stream->pinned);
+
+    memset(stream, 0, sizeof(*stream));
+}
+
+static uint32_t occupiedBricks(const SphStream *stream)
+{
+    uint32_t occupied = 0;
+
+    for (uint32_t brick = 0; brick < stream->brickCount; brick++)
+    {
+        occupied += stream->bricks[brick].count[stream->parity] > 0 ? 1 : 0;
+    }
+
+    return occupied;
+}
+
+static void printTraffic(const SphStream *stream)
+{
+    uint32_t occupied = occupiedBricks(stream);
+
+    printf("Stream step %u: %u of %u bricks hold particles, %u mapped (peak %u), loads %llu on demand + %llu prefetched (%llu in time, %llu evicted unused), "
+           "%llu evictions, %u bricks grown, %.1f MiB read, %.1f ms stalled\n",
+           stream->stepIndex, occupied, stream->brickCount, stream->residentCount, stream->peakResident, (unsigned long long)stream->demandLoads,
+           (unsigned long long)stream->prefetchLoads, (unsigned long long)stream->prefetchHits, (unsigned long long)stream->wastedPrefetches,
+           (unsigned long long)stream->evictions, stream->grownBricks, (double)stream->bytesTouched / (1024.0 * 1024.0), stream->stallSeconds * 1000.0);
+}
+
+int sphStreamReport(const SphParams *params, const SphStreamInfo *info, uint32_t stepCount)
+{
+    SphStream stream;
+    struct timespec start;
+
+    sphStreamInit(&stream, params, info);
+    sphStreamSeedDamBreak(&stream);
+
+    // A default limit that holds every brick with particles would never evict or prefetch, and the
+    // comparison below would not cover the out-of-core path. Three quarters of them are kept instead,
+    // unless they are no more than the 27 a sweep position may need
+    uint32_t occupied = occupiedBricks(&stream);
+
+    if (info->residentLimit == 0 && occupied <= stream.residentLimit && occupied > 27)
+    {
+        uint32_t limit = occupied * 3 / 4;
+
+        setResidentLimit(&stream, limit > 27 ? limit : 27);
+        printf("Out-of-core solver: all %u bricks with particles fit, at most %u stay mapped so bricks are evicted\n", occupied, stream.residentLimit);
+    }
+    else if (occupied <= 27)
+    {
+        printf("Out-of-core solver: only %u bricks hold particles, nothing is evicted, use a smaller --stream-brick\n", occupied);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t step = 0; step < stepCount; step++)
+    {
+        sphStreamStep(&stream);
+
+        if (stream.stepIndex % SPH_STREAM_REPORT_INTERVAL == 0 || step + 1 == stepCount)
+        {
+            printTraffic(&stream);
+        }
+    }
+
+    double streamSeconds = secondsSince(&start);
+
+    // The in-memory solver and the gathered copy, skipped for the runs the out-of-core mode is meant for
+    double referenceBytes = 2.0 * ((double)params->particleCount * 13.0 * sizeof(float) + (double)stream.gridDim[0] * stream.gridDim[1] * stream.gridDim[2] * 2.0 * sizeof(uint32_t));
+    double physicalBytes = (double)sysconf(_SC_PHYS_PAGES) * (double)sysconf(_SC_PAGESIZE);
+
+    if (referenceBytes > 0.5 * physicalBytes)
+    {
+        printf("Out-of-core solver: %.3f ms/step, the in-memory comparison would need %.1f GiB and is skipped\n",
+               streamSeconds * 1000.0 / stepCount, referenceBytes / (1024.0 * 1024.0 * 1024.0));
+
+        sphStreamDestroy(&stream);
+
+        return 1;
+    }
+
+    SphSolver reference;
+    SphSolver gathered;
+
+    sphInit(&reference, params);
+    sphSeedDamBreak(&reference);
+    sphInit(&gathered, params);
+    sphStreamGather(&stream, &gathered);
+    sphStreamDestroy(&stream);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t step = 0; step < stepCount; step++)
+    {
+        sphStep(&reference);
+    }
+
+    double referenceSeconds = secondsSince(&start);
+
+    // The windows sum the neighbors in a different order, the rounding differences grow with the steps
+    float worstDifference = 0.0f;
+
+    for (uint32_t i = 0; i < reference.count; i++)
+    {
+        float dx = gathered.posX[i] - reference.posX[i];
+        float dy = gathered.posY[i] - reference.posY[i];
+        float dz = gathered.posZ[i] - reference.posZ[i];
+
+        worstDifference = fmaxf(worstDifference, sqrtf(dx * dx + dy * dy + dz * dz));
+    }
+
+    float tolerance = 0.1f * params->smoothingRadius;
+    int passed = worstDifference <= tolerance;
+
+    printf("Out-of-core solver: %.3f ms/step, in memory %.3f ms/step, max position difference %g (tolerance %g): %s\n",
+           streamSeconds * 1000.0 / stepCount, referenceSeconds * 1000.0 / stepCount, worstDifference, tolerance, passed ? "PASSED" : "FAILED");
+
+    sphDestroy(&reference);
+    sphDestroy(&gathered);
+
+    return passed;
+}
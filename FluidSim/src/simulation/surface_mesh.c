@@ -0,0 +1,851 @@
+#include "surface_mesh.h"
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// Corner c of a cell sits at (c & 1, (c >> 1) & 1, (c >> 2) & 1). Edges 0-3 run along x, 4-7 along y
+// and 8-11 along z, edgeCorners holds the corner at the lower end of each edge.
+static const uint8_t edgeCorners[12] = {0, 2, 4, 6, 0, 1, 4, 5, 0, 1, 2, 3};
+
+// Triangles (edge triplets) of every corner case, bit c of the case is set when corner c is inside.
+// Ambiguous faces always separate the inside corners, which is what keeps neighbouring cells and
+// blocks watertight without a lookup of the face neighbour.
+static const int8_t triangleTable[256][16] = {
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {4, 9, 5, 4, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 10, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 10, 8, 0, 1, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 1, 10, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 9, 5, 1, 8, 9, 1, 10, 8, -1, -1, -1, -1, -1, -1, -1},
+    {1, 5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 1, 5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 1, 0, 9, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 9, 11, 1, 8, 9, 1, 4, 8, -1, -1, -1, -1, -1, -1, -1},
+    {4, 11, 10, 4, 5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 10, 8, 0, 11, 10, 0, 5, 11, -1, -1, -1, -1, -1, -1, -1},
+    {0, 10, 4, 0, 11, 10, 0, 9, 11, -1, -1, -1, -1, -1, -1, -1},
+    {8, 11, 10, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {2, 8, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 2, 0, 4, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 2, 8, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {2, 4, 6, 2, 5, 4, 2, 9, 5, -1, -1, -1, -1, -1, -1, -1},
+    {1, 10, 4, 2, 8, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 2, 0, 10, 6, 0, 1, 10, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 1, 10, 4, 2, 8, 6, -1, -1, -1, -1, -1, -1, -1},
+    {1, 9, 5, 1, 2, 9, 1, 6, 2, 1, 10, 6, -1, -1, -1, -1},
+    {1, 5, 11, 2, 8, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 2, 0, 4, 6, 1, 5, 11, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 1, 0, 9, 11, 2, 8, 6, -1, -1, -1, -1, -1, -1, -1},
+    {1, 9, 11, 1, 2, 9, 1, 6, 2, 1, 4, 6, -1, -1, -1, -1},
+    {2, 8, 6, 4, 11, 10, 4, 5, 11, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 2, 0, 10, 6, 0, 11, 10, 0, 5, 11, -1, -1, -1, -1},
+    {0, 10, 4, 0, 11, 10, 0, 9, 11, 2, 8, 6, -1, -1, -1, -1},
+    {2, 10, 6, 2, 11, 10, 2, 9, 11, -1, -1, -1, -1, -1, -1, -1},
+    {2, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 2, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 5, 0, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {2, 4, 8, 2, 5, 4, 2, 7, 5, -1, -1, -1, -1, -1, -1, -1},
+    {1, 10, 4, 2, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 10, 8, 0, 1, 10, 2, 7, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 5, 0, 2, 7, 1, 10, 4, -1, -1, -1, -1, -1, -1, -1},
+    {1, 7, 5, 1, 2, 7, 1, 8, 2, 1, 10, 8, -1, -1, -1, -1},
+    {1, 5, 11, 2, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 1, 5, 11, 2, 7, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 1, 0, 7, 11, 0, 2, 7, -1, -1, -1, -1, -1, -1, -1},
+    {1, 7, 11, 1, 2, 7, 1, 8, 2, 1, 4, 8, -1, -1, -1, -1},
+    {2, 7, 9, 4, 11, 10, 4, 5, 11, -1, -1, -1, -1, -1, -1, -1},
+    {0, 10, 8, 0, 11, 10, 0, 5, 11, 2, 7, 9, -1, -1, -1, -1},
+    {0, 10, 4, 0, 11, 10, 0, 7, 11, 0, 2, 7, -1, -1, -1, -1},
+    {2, 10, 8, 2, 11, 10, 2, 7, 11, -1, -1, -1, -1, -1, -1, -1},
+    {6, 9, 8, 6, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 9, 0, 6, 7, 0, 4, 6, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 5, 0, 6, 7, 0, 8, 6, -1, -1, -1, -1, -1, -1, -1},
+    {4, 7, 5, 4, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 10, 4, 6, 9, 8, 6, 7, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 9, 0, 6, 7, 0, 10, 6, 0, 1, 10, -1, -1, -1, -1},
+    {0, 7, 5, 0, 6, 7, 0, 8, 6, 1, 10, 4, -1, -1, -1, -1},
+    {1, 7, 5, 1, 6, 7, 1, 10, 6, -1, -1, -1, -1, -1, -1, -1},
+    {1, 5, 11, 6, 9, 8, 6, 7, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 9, 0, 6, 7, 0, 4, 6, 1, 5, 11, -1, -1, -1, -1},
+    {0, 11, 1, 0, 7, 11, 0, 6, 7, 0, 8, 6, -1, -1, -1, -1},
+    {1, 7, 11, 1, 6, 7, 1, 4, 6, -1, -1, -1, -1, -1, -1, -1},
+    {4, 11, 10, 4, 5, 11, 6, 9, 8, 6, 7, 9, -1, -1, -1, -1},
+    {0, 7, 9, 0, 6, 7, 0, 10, 6, 0, 11, 10, 0, 5, 11, -1},
+    {0, 10, 4, 0, 11, 10, 0, 7, 11, 0, 6, 7, 0, 8, 6, -1},
+    {6, 11, 10, 6, 7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {3, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 3, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 3, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {3, 6, 10, 4, 9, 5, 4, 8, 9, -1, -1, -1, -1, -1, -1, -1},
+    {1, 6, 4, 1, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 8, 0, 3, 6, 0, 1, 3, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 1, 6, 4, 1, 3, 6, -1, -1, -1, -1, -1, -1, -1},
+    {1, 9, 5, 1, 8, 9, 1, 6, 8, 1, 3, 6, -1, -1, -1, -1},
+    {1, 5, 11, 3, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 1, 5, 11, 3, 6, 10, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 1, 0, 9, 11, 3, 6, 10, -1, -1, -1, -1, -1, -1, -1},
+    {1, 9, 11, 1, 8, 9, 1, 4, 8, 3, 6, 10, -1, -1, -1, -1},
+    {3, 5, 11, 3, 4, 5, 3, 6, 4, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 8, 0, 3, 6, 0, 11, 3, 0, 5, 11, -1, -1, -1, -1},
+    {0, 6, 4, 0, 3, 6, 0, 11, 3, 0, 9, 11, -1, -1, -1, -1},
+    {3, 9, 11, 3, 8, 9, 3, 6, 8, -1, -1, -1, -1, -1, -1, -1},
+    {2, 10, 3, 2, 8, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 3, 2, 0, 10, 3, 0, 4, 10, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 2, 10, 3, 2, 8, 10, -1, -1, -1, -1, -1, -1, -1},
+    {2, 10, 3, 2, 4, 10, 2, 5, 4, 2, 9, 5, -1, -1, -1, -1},
+    {1, 8, 4, 1, 2, 8, 1, 3, 2, -1, -1, -1, -1, -1, -1, -1},
+    {0, 3, 2, 0, 1, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 1, 8, 4, 1, 2, 8, 1, 3, 2, -1, -1, -1, -1},
+    {1, 9, 5, 1, 2, 9, 1, 3, 2, -1, -1, -1, -1, -1, -1, -1},
+    {1, 5, 11, 2, 10, 3, 2, 8, 10, -1, -1, -1, -1, -1, -1, -1},
+    {0, 3, 2, 0, 10, 3, 0, 4, 10, 1, 5, 11, -1, -1, -1, -1},
+    {0, 11, 1, 0, 9, 11, 2, 10, 3, 2, 8, 10, -1, -1, -1, -1},
+    {1, 9, 11, 1, 2, 9, 1, 3, 2, 1, 10, 3, 1, 4, 10, -1},
+    {2, 11, 3, 2, 5, 11, 2, 4, 5, 2, 8, 4, -1, -1, -1, -1},
+    {0, 3, 2, 0, 11, 3, 0, 5, 11, -1, -1, -1, -1, -1, -1, -1},
+    {0, 8, 4, 0, 2, 8, 0, 3, 2, 0, 11, 3, 0, 9, 11, -1},
+    {2, 11, 3, 2, 9, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {2, 7, 9, 3, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 2, 7, 9, 3, 6, 10, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 5, 0, 2, 7, 3, 6, 10, -1, -1, -1, -1, -1, -1, -1},
+    {2, 4, 8, 2, 5, 4, 2, 7, 5, 3, 6, 10, -1, -1, -1, -1},
+    {1, 6, 4, 1, 3, 6, 2, 7, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 8, 0, 3, 6, 0, 1, 3, 2, 7, 9, -1, -1, -1, -1},
+    {0, 7, 5, 0, 2, 7, 1, 6, 4, 1, 3, 6, -1, -1, -1, -1},
+    {1, 7, 5, 1, 2, 7, 1, 8, 2, 1, 6, 8, 1, 3, 6, -1},
+    {1, 5, 11, 2, 7, 9, 3, 6, 10, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 1, 5, 11, 2, 7, 9, 3, 6, 10, -1, -1, -1, -1},
+    {0, 11, 1, 0, 7, 11, 0, 2, 7, 3, 6, 10, -1, -1, -1, -1},
+    {1, 7, 11, 1, 2, 7, 1, 8, 2, 1, 4, 8, 3, 6, 10, -1},
+    {2, 7, 9, 3, 5, 11, 3, 4, 5, 3, 6, 4, -1, -1, -1, -1},
+    {0, 6, 8, 0, 3, 6, 0, 11, 3, 0, 5, 11, 2, 7, 9, -1},
+    {0, 6, 4, 0, 3, 6, 0, 11, 3, 0, 7, 11, 0, 2, 7, -1},
+    {2, 6, 8, 2, 3, 6, 2, 11, 3, 2, 7, 11, -1, -1, -1, -1},
+    {3, 8, 10, 3, 9, 8, 3, 7, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 9, 0, 3, 7, 0, 10, 3, 0, 4, 10, -1, -1, -1, -1},
+    {0, 7, 5, 0, 3, 7, 0, 10, 3, 0, 8, 10, -1, -1, -1, -1},
+    {3, 4, 10, 3, 5, 4, 3, 7, 5, -1, -1, -1, -1, -1, -1, -1},
+    {1, 8, 4, 1, 9, 8, 1, 7, 9, 1, 3, 7, -1, -1, -1, -1},
+    {0, 7, 9, 0, 3, 7, 0, 1, 3, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 5, 0, 3, 7, 0, 1, 3, 0, 4, 1, 0, 8, 4, -1},
+    {1, 7, 5, 1, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 5, 11, 3, 8, 10, 3, 9, 8, 3, 7, 9, -1, -1, -1, -1},
+    {0, 7, 9, 0, 3, 7, 0, 10, 3, 0, 4, 10, 1, 5, 11, -1},
+    {0, 11, 1, 0, 7, 11, 0, 3, 7, 0, 10, 3, 0, 8, 10, -1},
+    {1, 7, 11, 1, 3, 7, 1, 10, 3, 1, 4, 10, -1, -1, -1, -1},
+    {3, 5, 11, 3, 4, 5, 3, 8, 4, 3, 9, 8, 3, 7, 9, -1},
+    {0, 7, 9, 0, 3, 7, 0, 11, 3, 0, 5, 11, -1, -1, -1, -1},
+    {0, 8, 4, 3, 7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {3, 7, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {3, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 3, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 3, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {3, 11, 7, 4, 9, 5, 4, 8, 9, -1, -1, -1, -1, -1, -1, -1},
+    {1, 10, 4, 3, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 10, 8, 0, 1, 10, 3, 11, 7, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 1, 10, 4, 3, 11, 7, -1, -1, -1, -1, -1, -1, -1},
+    {1, 9, 5, 1, 8, 9, 1, 10, 8, 3, 11, 7, -1, -1, -1, -1},
+    {1, 7, 3, 1, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 1, 7, 3, 1, 5, 7, -1, -1, -1, -1, -1, -1, -1},
+    {0, 3, 1, 0, 7, 3, 0, 9, 7, -1, -1, -1, -1, -1, -1, -1},
+    {1, 7, 3, 1, 9, 7, 1, 8, 9, 1, 4, 8, -1, -1, -1, -1},
+    {3, 5, 7, 3, 4, 5, 3, 10, 4, -1, -1, -1, -1, -1, -1, -1},
+    {0, 10, 8, 0, 3, 10, 0, 7, 3, 0, 5, 7, -1, -1, -1, -1},
+    {0, 10, 4, 0, 3, 10, 0, 7, 3, 0, 9, 7, -1, -1, -1, -1},
+    {3, 9, 7, 3, 8, 9, 3, 10, 8, -1, -1, -1, -1, -1, -1, -1},
+    {2, 8, 6, 3, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 2, 0, 4, 6, 3, 11, 7, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 2, 8, 6, 3, 11, 7, -1, -1, -1, -1, -1, -1, -1},
+    {2, 4, 6, 2, 5, 4, 2, 9, 5, 3, 11, 7, -1, -1, -1, -1},
+    {1, 10, 4, 2, 8, 6, 3, 11, 7, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 2, 0, 10, 6, 0, 1, 10, 3, 11, 7, -1, -1, -1, -1},
+    {0, 9, 5, 1, 10, 4, 2, 8, 6, 3, 11, 7, -1, -1, -1, -1},
+    {1, 9, 5, 1, 2, 9, 1, 6, 2, 1, 10, 6, 3, 11, 7, -1},
+    {1, 7, 3, 1, 5, 7, 2, 8, 6, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 2, 0, 4, 6, 1, 7, 3, 1, 5, 7, -1, -1, -1, -1},
+    {0, 3, 1, 0, 7, 3, 0, 9, 7, 2, 8, 6, -1, -1, -1, -1},
+    {1, 7, 3, 1, 9, 7, 1, 2, 9, 1, 6, 2, 1, 4, 6, -1},
+    {2, 8, 6, 3, 5, 7, 3, 4, 5, 3, 10, 4, -1, -1, -1, -1},
+    {0, 6, 2, 0, 10, 6, 0, 3, 10, 0, 7, 3, 0, 5, 7, -1},
+    {0, 10, 4, 0, 3, 10, 0, 7, 3, 0, 9, 7, 2, 8, 6, -1},
+    {2, 10, 6, 2, 3, 10, 2, 7, 3, 2, 9, 7, -1, -1, -1, -1},
+    {2, 11, 9, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 2, 11, 9, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 5, 0, 3, 11, 0, 2, 3, -1, -1, -1, -1, -1, -1, -1},
+    {2, 4, 8, 2, 5, 4, 2, 11, 5, 2, 3, 11, -1, -1, -1, -1},
+    {1, 10, 4, 2, 11, 9, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
+    {0, 10, 8, 0, 1, 10, 2, 11, 9, 2, 3, 11, -1, -1, -1, -1},
+    {0, 11, 5, 0, 3, 11, 0, 2, 3, 1, 10, 4, -1, -1, -1, -1},
+    {1, 11, 5, 1, 3, 11, 1, 2, 3, 1, 8, 2, 1, 10, 8, -1},
+    {1, 2, 3, 1, 9, 2, 1, 5, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 1, 2, 3, 1, 9, 2, 1, 5, 9, -1, -1, -1, -1},
+    {0, 3, 1, 0, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 2, 3, 1, 8, 2, 1, 4, 8, -1, -1, -1, -1, -1, -1, -1},
+    {2, 5, 9, 2, 4, 5, 2, 10, 4, 2, 3, 10, -1, -1, -1, -1},
+    {0, 10, 8, 0, 3, 10, 0, 2, 3, 0, 9, 2, 0, 5, 9, -1},
+    {0, 10, 4, 0, 3, 10, 0, 2, 3, -1, -1, -1, -1, -1, -1, -1},
+    {2, 10, 8, 2, 3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {3, 8, 6, 3, 9, 8, 3, 11, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 9, 0, 3, 11, 0, 6, 3, 0, 4, 6, -1, -1, -1, -1},
+    {0, 11, 5, 0, 3, 11, 0, 6, 3, 0, 8, 6, -1, -1, -1, -1},
+    {3, 4, 6, 3, 5, 4, 3, 11, 5, -1, -1, -1, -1, -1, -1, -1},
+    {1, 10, 4, 3, 8, 6, 3, 9, 8, 3, 11, 9, -1, -1, -1, -1},
+    {0, 11, 9, 0, 3, 11, 0, 6, 3, 0, 10, 6, 0, 1, 10, -1},
+    {0, 11, 5, 0, 3, 11, 0, 6, 3, 0, 8, 6, 1, 10, 4, -1},
+    {1, 11, 5, 1, 3, 11, 1, 6, 3, 1, 10, 6, -1, -1, -1, -1},
+    {1, 6, 3, 1, 8, 6, 1, 9, 8, 1, 5, 9, -1, -1, -1, -1},
+    {0, 5, 9, 0, 1, 5, 0, 3, 1, 0, 6, 3, 0, 4, 6, -1},
+    {0, 3, 1, 0, 6, 3, 0, 8, 6, -1, -1, -1, -1, -1, -1, -1},
+    {1, 6, 3, 1, 4, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {3, 8, 6, 3, 9, 8, 3, 5, 9, 3, 4, 5, 3, 10, 4, -1},
+    {0, 5, 9, 3, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 10, 4, 0, 3, 10, 0, 6, 3, 0, 8, 6, -1, -1, -1, -1},
+    {3, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {6, 11, 7, 6, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 6, 11, 7, 6, 10, 11, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 6, 11, 7, 6, 10, 11, -1, -1, -1, -1, -1, -1, -1},
+    {4, 9, 5, 4, 8, 9, 6, 11, 7, 6, 10, 11, -1, -1, -1, -1},
+    {1, 6, 4, 1, 7, 6, 1, 11, 7, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 8, 0, 7, 6, 0, 11, 7, 0, 1, 11, -1, -1, -1, -1},
+    {0, 9, 5, 1, 6, 4, 1, 7, 6, 1, 11, 7, -1, -1, -1, -1},
+    {1, 9, 5, 1, 8, 9, 1, 6, 8, 1, 7, 6, 1, 11, 7, -1},
+    {1, 6, 10, 1, 7, 6, 1, 5, 7, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 1, 6, 10, 1, 7, 6, 1, 5, 7, -1, -1, -1, -1},
+    {0, 10, 1, 0, 6, 10, 0, 7, 6, 0, 9, 7, -1, -1, -1, -1},
+    {1, 6, 10, 1, 7, 6, 1, 9, 7, 1, 8, 9, 1, 4, 8, -1},
+    {4, 7, 6, 4, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 8, 0, 7, 6, 0, 5, 7, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 4, 0, 7, 6, 0, 9, 7, -1, -1, -1, -1, -1, -1, -1},
+    {6, 9, 7, 6, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {2, 11, 7, 2, 10, 11, 2, 8, 10, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 2, 0, 11, 7, 0, 10, 11, 0, 4, 10, -1, -1, -1, -1},
+    {0, 9, 5, 2, 11, 7, 2, 10, 11, 2, 8, 10, -1, -1, -1, -1},
+    {2, 11, 7, 2, 10, 11, 2, 4, 10, 2, 5, 4, 2, 9, 5, -1},
+    {1, 8, 4, 1, 2, 8, 1, 7, 2, 1, 11, 7, -1, -1, -1, -1},
+    {0, 7, 2, 0, 11, 7, 0, 1, 11, -1, -1, -1, -1, -1, -1, -1},
+    {0, 9, 5, 1, 8, 4, 1, 2, 8, 1, 7, 2, 1, 11, 7, -1},
+    {1, 9, 5, 1, 2, 9, 1, 7, 2, 1, 11, 7, -1, -1, -1, -1},
+    {1, 8, 10, 1, 2, 8, 1, 7, 2, 1, 5, 7, -1, -1, -1, -1},
+    {0, 7, 2, 0, 5, 7, 0, 1, 5, 0, 10, 1, 0, 4, 10, -1},
+    {0, 10, 1, 0, 8, 10, 0, 2, 8, 0, 7, 2, 0, 9, 7, -1},
+    {1, 4, 10, 2, 9, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {2, 5, 7, 2, 4, 5, 2, 8, 4, -1, -1, -1, -1, -1, -1, -1},
+    {0, 7, 2, 0, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 8, 4, 0, 2, 8, 0, 7, 2, 0, 9, 7, -1, -1, -1, -1},
+    {2, 9, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {2, 11, 9, 2, 10, 11, 2, 6, 10, -1, -1, -1, -1, -1, -1, -1},
+    {0, 4, 8, 2, 11, 9, 2, 10, 11, 2, 6, 10, -1, -1, -1, -1},
+    {0, 11, 5, 0, 10, 11, 0, 6, 10, 0, 2, 6, -1, -1, -1, -1},
+    {2, 4, 8, 2, 5, 4, 2, 11, 5, 2, 10, 11, 2, 6, 10, -1},
+    {1, 6, 4, 1, 2, 6, 1, 9, 2, 1, 11, 9, -1, -1, -1, -1},
+    {0, 6, 8, 0, 2, 6, 0, 9, 2, 0, 11, 9, 0, 1, 11, -1},
+    {0, 11, 5, 0, 1, 11, 0, 4, 1, 0, 6, 4, 0, 2, 6, -1},
+    {1, 11, 5, 2, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 6, 10, 1, 2, 6, 1, 9, 2, 1, 5, 9, -1, -1, -1, -1},
+    {0, 4, 8, 1, 6, 10, 1, 2, 6, 1, 9, 2, 1, 5, 9, -1},
+    {0, 10, 1, 0, 6, 10, 0, 2, 6, -1, -1, -1, -1, -1, -1, -1},
+    {1, 6, 10, 1, 2, 6, 1, 8, 2, 1, 4, 8, -1, -1, -1, -1},
+    {2, 5, 9, 2, 4, 5, 2, 6, 4, -1, -1, -1, -1, -1, -1, -1},
+    {0, 6, 8, 0, 2, 6, 0, 9, 2, 0, 5, 9, -1, -1, -1, -1},
+    {0, 6, 4, 0, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {2, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {8, 11, 9, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 9, 0, 10, 11, 0, 4, 10, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 5, 0, 10, 11, 0, 8, 10, -1, -1, -1, -1, -1, -1, -1},
+    {4, 11, 5, 4, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 8, 4, 1, 9, 8, 1, 11, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 9, 0, 1, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 11, 5, 0, 1, 11, 0, 4, 1, 0, 8, 4, -1, -1, -1, -1},
+    {1, 11, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 8, 10, 1, 9, 8, 1, 5, 9, -1, -1, -1, -1, -1, -1, -1},
+    {0, 5, 9, 0, 1, 5, 0, 10, 1, 0, 4, 10, -1, -1, -1, -1},
+    {0, 10, 1, 0, 8, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {1, 4, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {4, 9, 8, 4, 5, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 5, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {0, 8, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}
+};
+
+#define EDGE_CACHE_SIZE ((SURFACE_BLOCK_CELLS + 1) * (SURFACE_BLOCK_CELLS + 1) * (SURFACE_BLOCK_CELLS + 1) * 3)
+
+static uint32_t divideRoundUp(uint32_t value, uint32_t divisor)
+{
+    return (value + divisor - 1) / divisor;
+}
+
+static void reserveMesh(SurfaceMesh *mesh, uint32_t vertexCount, uint32_t indexCount)
+{
+    if (vertexCount > mesh->vertexCapacity)
+    {
+        uint32_t capacity = mesh->vertexCapacity == 0 ? 256 : mesh->vertexCapacity;
+
+        while (capacity < vertexCount)
+        {
+            capacity *= 2;
+        }
+
+        mesh->vertices = realloc(mesh->vertices, capacity * sizeof(SurfaceVertex));
+        mesh->vertexCapacity = capacity;
+    }
+
+    if (indexCount > mesh->indexCapacity)
+    {
+        uint32_t capacity = mesh->indexCapacity == 0 ? 768 : mesh->indexCapacity;
+
+        while (capacity < indexCount)
+        {
+            capacity *= 2;
+        }
+
+        mesh->indices = realloc(mesh->indices, capacity * sizeof(uint32_t));
+        mesh->indexCapacity = capacity;
+    }
+
+    if ((vertexCount > 0 && !mesh->vertices) || (indexCount > 0 && !mesh->indices))
+    {
+        fprintf(stderr, "Failed to allocate surface mesh memory!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static float kernelWeight(float r2, float radius2)
+{
+    float t = 1.0f - r2 / radius2;
+    return t * t * t;
+}
+
+void surfaceExtractorInit(SurfaceExtractor *extractor, const SphParams *params, float cellSize, float changeThreshold)
+{
+    memset(extractor, 0, sizeof(*extractor));
+
+    extractor->cellSize = cellSize > 0.0f ? cellSize : params->particleSpacing;
+    extractor->isoLevel = 0.5f;
+    extractor->changeThreshold = changeThreshold;
+    extractor->kernelRadius = 2.0f * params->particleSpacing;
+
+    // One cell of padding around the domain, so fluid touching a wall still gets a closed surface
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float extent = params->boundsMax[axis] - params->boundsMin[axis];
+
+        extractor->origin[axis] = params->boundsMin[axis] - extractor->cellSize;
+        extractor->cellDim[axis] = (uint32_t)ceilf(extent / extractor->cellSize) + 2;
+        extractor->nodeDim[axis] = extractor->cellDim[axis] + 1;
+        extractor->blockDim[axis] = divideRoundUp(extractor->cellDim[axis], SURFACE_BLOCK_CELLS);
+        extractor->binDim[axis] = (uint32_t)ceilf(extent / extractor->kernelRadius) + 1;
+    }
+
+    // Kernel sum at a node inside the seeded lattice, the field is 1 there and the surface sits at half of it
+    float radius2 = extractor->kernelRadius * extractor->kernelRadius;
+    int reach = (int)ceilf(extractor->kernelRadius / params->particleSpacing);
+    float latticeSum = 0.0f;
+
+    for (int z = -reach; z <= reach; z++)
+    {
+        for (int y = -reach; y <= reach; y++)
+        {
+            for (int x = -reach; x <= reach; x++)
+            {
+                float r2 = (x * x + y * y + z * z) * params->particleSpacing * params->particleSpacing;
+
+                if (r2 < radius2)
+                {
+                    latticeSum += kernelWeight(r2, radius2);
+                }
+            }
+        }
+    }
+
+    extractor->fieldScale = 1.0f / latticeSum;
+
+    size_t nodeCount = (size_t)extractor->nodeDim[0] * extractor->nodeDim[1] * extractor->nodeDim[2];
+
+    extractor->blockCount = extractor->blockDim[0] * extractor->blockDim[1] * extractor->blockDim[2];
+    extractor->binCount = extractor->binDim[0] * extractor->binDim[1] * extractor->binDim[2];
+
+    extractor->field = calloc(nodeCount, sizeof(float));
+    extractor->meshedField = calloc(nodeCount, sizeof(float));
+    extractor->blockChanged = calloc(extractor->blockCount, 1);
+    extractor->blockDirty = calloc(extractor->blockCount, 1);
+    extractor->blockMeshes = calloc(extractor->blockCount, sizeof(SurfaceMesh));
+    extractor->binStart = calloc(extractor->binCount, sizeof(uint32_t));
+    extractor->binEnd = calloc(extractor->binCount, sizeof(uint32_t));
+
+    uint32_t threadCount = threadPoolThreadCount();
+    extractor->edgeCaches = calloc(threadCount, sizeof(int32_t *));
+
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        extractor->edgeCaches[i] = malloc(EDGE_CACHE_SIZE * sizeof(int32_t));
+    }
+
+    if (!extractor->field || !extractor->meshedField || !extractor->blockChanged || !extractor->blockDirty ||
+        !extractor->blockMeshes || !extractor->binStart || !extractor->binEnd || !extractor->edgeCaches[threadCount - 1])
+    {
+        fprintf(stderr, "Failed to allocate surface extractor memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Nothing has been meshed yet, every block has to be
+    memset(extractor->blockChanged, 1, extractor->blockCount);
+
+    printf("Surface extractor created: %ux%ux%u cells in %u blocks\n",
+           extractor->cellDim[0], extractor->cellDim[1], extractor->cellDim[2], extractor->blockCount);
+}
+
+static uint32_t binCoordinate(const SurfaceExtractor *extractor, float position, int axis)
+{
+    // The bins start at the domain, one cell inside the padded grid
+    float relative = (position - extractor->origin[axis] - extractor->cellSize) / extractor->kernelRadius;
+    int32_t bin = (int32_t)floorf(relative);
+
+    if (bin < 0)
+    {
+        return 0;
+    }
+
+    return (uint32_t)bin >= extractor->binDim[axis] ? extractor->binDim[axis] - 1 : (uint32_t)bin;
+}
+
+static void blockNodeRange(const SurfaceExtractor *extractor, uint32_t block, uint32_t start[3], uint32_t end[3])
+{
+    uint32_t coordinates[3] = {
+        block % extractor->blockDim[0],
+        (block / extractor->blockDim[0]) % extractor->blockDim[1],
+        block / (extractor->blockDim[0] * extractor->blockDim[1])};
+
+    // A block owns the nodes at the low corner of its cells, the last block also the far boundary
+    for (int axis = 0; axis < 3; axis++)
+    {
+        start[axis] = coordinates[axis] * SURFACE_BLOCK_CELLS;
+        end[axis] = coordinates[axis] == extractor->blockDim[axis] - 1 ? extractor->nodeDim[axis] : start[axis] + SURFACE_BLOCK_CELLS;
+    }
+}
+
+static void sampleBlockTask(void *context, uint32_t block, uint32_t threadIndex)
+{
+    SurfaceExtractor *extractor = context;
+    (void)threadIndex;
+
+    uint32_t start[3], end[3];
+    blockNodeRange(extractor, block, start, end);
+
+    float radius2 = extractor->kernelRadius * extractor->kernelRadius;
+    float maxChange = 0.0f;
+
+    for (uint32_t z = start[2]; z < end[2]; z++)
+    {
+        for (uint32_t y = start[1]; y < end[1]; y++)
+        {
+            for (uint32_t x = start[0]; x < end[0]; x++)
+            {
+                float node[3] = {
+                    extractor->origin[0] + x * extractor->cellSize,
+                    extractor->origin[1] + y * extractor->cellSize,
+                    extractor->origin[2] + z * extractor->cellSize};
+
+                uint32_t bin[3];
+
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    bin[axis] = binCoordinate(extractor, node[axis], axis);
+                }
+
+                float sum = 0.0f;
+
+                for (uint32_t bz = bin[2] > 0 ? bin[2] - 1 : 0; bz <= bin[2] + 1 && bz < extractor->binDim[2]; bz++)
+                {
+                    for (uint32_t by = bin[1] > 0 ? bin[1] - 1 : 0; by <= bin[1] + 1 && by < extractor->binDim[1]; by++)
+                    {
+                        for (uint32_t bx = bin[0] > 0 ? bin[0] - 1 : 0; bx <= bin[0] + 1 && bx < extractor->binDim[0]; bx++)
+                        {
+                            uint32_t key = (bz * extractor->binDim[1] + by) * extractor->binDim[0] + bx;
+
+                            for (uint32_t i = extractor->binStart[key]; i < extractor->binEnd[key]; i++)
+                            {
+                                const float *p = &extractor->binnedPositions[3 * i];
+                                float dx = p[0] - node[0];
+                                float dy = p[1] - node[1];
+                                float dz = p[2] - node[2];
+                                float r2 = dx * dx + dy * dy + dz * dz;
+
+                                if (r2 < radius2)
+                                {
+                                    sum += kernelWeight(r2, radius2);
+                                }
+                            }
+                        }
+                    }
+                }
+
+                size_t index = ((size_t)z * extractor->nodeDim[1] + y) * extractor->nodeDim[0] + x;
+                float value = sum * extractor->fieldScale;
+
+                maxChange = fmaxf(maxChange, fabsf(value - extractor->meshedField[index]));
+                extractor->field[index] = value;
+            }
+        }
+    }
+
+    // Stays set until the block has been meshed, several builds can happen between two updates
+    if (maxChange > extractor->changeThreshold)
+    {
+        extractor->blockChanged[block] = 1;
+    }
+}
+
+void surfaceExtractorBuildField(SurfaceExtractor *extractor, const float *positions, uint32_t count, uint32_t stride)
+{
+    if (count > extractor->binnedCapacity)
+    {
+        extractor->binnedPositions = realloc(extractor->binnedPositions, (size_t)count * 3 * sizeof(float));
+        extractor->binnedCapacity = count;
+
+        if (!extractor->binnedPositions)
+        {
+            fprintf(stderr, "Failed to allocate surface extractor memory!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Counting sort of the particles by bin, binEnd is used as the write cursor
+    memset(extractor->binStart, 0, extractor->binCount * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const float *p = &positions[(size_t)i * stride];
+        uint32_t key = (binCoordinate(extractor, p[2], 2) * extractor->binDim[1] + binCoordinate(extractor, p[1], 1)) * extractor->binDim[0] + binCoordinate(extractor, p[0], 0);
+        extractor->binStart[key]++;
+    }
+
+    uint32_t offset = 0;
+
+    for (uint32_t key = 0; key < extractor->binCount; key++)
+    {
+        uint32_t binSize = extractor->binStart[key];
+        extractor->binStart[key] = offset;
+        extractor->binEnd[key] = offset;
+        offset += binSize;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const float *p = &positions[(size_t)i * stride];
+        uint32_t key = (binCoordinate(extractor, p[2], 2) * extractor->binDim[1] + binCoordinate(extractor, p[1], 1)) * extractor->binDim[0] + binCoordinate(extractor, p[0], 0);
+        float *target = &extractor->binnedPositions[3 * extractor->binEnd[key]++];
+
+        target[0] = p[0];
+        target[1] = p[1];
+        target[2] = p[2];
+    }
+
+    threadPoolRun(sampleBlockTask, extractor, extractor->blockCount);
+}
+
+static void commitBlockTask(void *context, uint32_t block, uint32_t threadIndex)
+{
+    SurfaceExtractor *extractor = context;
+    (void)threadIndex;
+
+    if (!extractor->blockChanged[block])
+    {
+        return;
+    }
+
+    uint32_t start[3], end[3];
+    blockNodeRange(extractor, block, start, end);
+
+    for (uint32_t z = start[2]; z < end[2]; z++)
+    {
+        for (uint32_t y = start[1]; y < end[1]; y++)
+        {
+            size_t row = ((size_t)z * extractor->nodeDim[1] + y) * extractor->nodeDim[0];
+            memcpy(&extractor->meshedField[row + start[0]], &extractor->field[row + start[0]], (end[0] - start[0]) * sizeof(float));
+        }
+    }
+}
+
+static float meshedValue(const SurfaceExtractor *extractor, int32_t x, int32_t y, int32_t z)
+{
+    x = x < 0 ? 0 : (x >= (int32_t)extractor->nodeDim[0] ? (int32_t)extractor->nodeDim[0] - 1 : x);
+    y = y < 0 ? 0 : (y >= (int32_t)extractor->nodeDim[1] ? (int32_t)extractor->nodeDim[1] - 1 : y);
+    z = z < 0 ? 0 : (z >= (int32_t)extractor->nodeDim[2] ? (int32_t)extractor->nodeDim[2] - 1 : z);
+
+    return extractor->meshedField[((size_t)z * extractor->nodeDim[1] + y) * extractor->nodeDim[0] + x];
+}
+
+static void nodeGradient(const SurfaceExtractor *extractor, int32_t x, int32_t y, int32_t z, float out[3])
+{
+    out[0] = meshedValue(extractor, x + 1, y, z) - meshedValue(extractor, x - 1, y, z);
+    out[1] = meshedValue(extractor, x, y + 1, z) - meshedValue(extractor, x, y - 1, z);
+    out[2] = meshedValue(extractor, x, y, z + 1) - meshedValue(extractor, x, y, z - 1);
+}
+
+// Vertex on the edge starting at node (x, y, z) along axis, interpolated where the field crosses the iso level
+static uint32_t emitVertex(const SurfaceExtractor *extractor, SurfaceMesh *mesh, int32_t x, int32_t y, int32_t z, int axis)
+{
+    int32_t node[3] = {x, y, z};
+    int32_t next[3] = {x, y, z};
+    next[axis]++;
+
+    float a = meshedValue(extractor, node[0], node[1], node[2]);
+    float b = meshedValue(extractor, next[0], next[1], next[2]);
+    float t = (extractor->isoLevel - a) / (b - a);
+
+    float gradientA[3], gradientB[3];
+    nodeGradient(extractor, node[0], node[1], node[2], gradientA);
+    nodeGradient(extractor, next[0], next[1], next[2], gradientB);
+
+    reserveMesh(mesh, mesh->vertexCount + 1, mesh->indexCount);
+    SurfaceVertex *vertex = &mesh->vertices[mesh->vertexCount];
+    float length = 0.0f;
+
+    for (int i = 0; i < 3; i++)
+    {
+        vertex->position[i] = extractor->origin[i] + (node[i] + (i == axis ? t : 0.0f)) * extractor->cellSize;
+
+        // The field grows into the fluid, the normal points the other way
+        vertex->normal[i] = -(gradientA[i] + t * (gradientB[i] - gradientA[i]));
+        length += vertex->normal[i] * vertex->normal[i];
+    }
+
+    length = length > 0.0f ? 1.0f / sqrtf(length) : 0.0f;
+
+    for (int i = 0; i < 3; i++)
+    {
+        vertex->normal[i] *= length;
+    }
+
+    return mesh->vertexCount++;
+}
+
+static void meshBlockTask(void *context, uint32_t block, uint32_t threadIndex)
+{
+    SurfaceExtractor *extractor = context;
+
+    if (!extractor->blockDirty[block])
+    {
+        return;
+    }
+
+    SurfaceMesh *mesh = &extractor->blockMeshes[block];
+    mesh->vertexCount = 0;
+    mesh->indexCount = 0;
+
+    // Cells of a block share the vertices on their common edges, the cache maps an edge to its vertex
+    int32_t *edgeCache = extractor->edgeCaches[threadIndex];
+    memset(edgeCache, 0xFF, EDGE_CACHE_SIZE * sizeof(int32_t));
+
+    uint32_t start[3], end[3];
+    blockNodeRange(extractor, block, start, end);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        end[axis] = start[axis] + SURFACE_BLOCK_CELLS < extractor->cellDim[axis] ? start[axis] + SURFACE_BLOCK_CELLS : extractor->cellDim[axis];
+    }
+
+    const uint32_t side = SURFACE_BLOCK_CELLS + 1;
+
+    for (uint32_t z = start[2]; z < end[2]; z++)
+    {
+        for (uint32_t y = start[1]; y < end[1]; y++)
+        {
+            for (uint32_t x = start[0]; x < end[0]; x++)
+            {
+                uint32_t cubeCase = 0;
+
+                for (uint32_t corner = 0; corner < 8; corner++)
+                {
+                    if (meshedValue(extractor, x + (corner & 1), y + ((corner >> 1) & 1), z + ((corner >> 2) & 1)) >= extractor->isoLevel)
+                    {
+                        cubeCase |= 1u << corner;
+                    }
+                }
+
+                const int8_t *edges = triangleTable[cubeCase];
+
+                for (int i = 0; edges[i] >= 0; i++)
+                {
+                    int axis = edges[i] / 4;
+                    uint8_t corner = edgeCorners[edges[i]];
+                    uint32_t localX = x - start[0] + (corner & 1);
+                    uint32_t localY = y - start[1] + ((corner >> 1) & 1);
+                    uint32_t localZ = z - start[2] + ((corner >> 2) & 1);
+                    uint32_t slot = ((localZ * side + localY) * side + localX) * 3 + axis;
+
+                    if (edgeCache[slot] < 0)
+                    {
+                        edgeCache[slot] = (int32_t)emitVertex(extractor, mesh, x + (corner & 1), y + ((corner >> 1) & 1), z + ((corner >> 2) & 1), axis);
+                    }
+
+                    reserveMesh(mesh, mesh->vertexCount, mesh->indexCount + 1);
+                    mesh->indices[mesh->indexCount++] = (uint32_t)edgeCache[slot];
+                }
+            }
+        }
+    }
+}
+
+typedef struct {
+    SurfaceExtractor *extractor;
+    uint32_t *vertexOffsets;
+    uint32_t *indexOffsets;
+} CompactJob;
+
+static void compactBlockTask(void *context, uint32_t block, uint32_t threadIndex)
+{
+    CompactJob *job = context;
+    (void)threadIndex;
+
+    const SurfaceMesh *source = &job->extractor->blockMeshes[block];
+    SurfaceMesh *target = &job->extractor->mesh;
+    uint32_t vertexOffset = job->vertexOffsets[block];
+    uint32_t *indices = &target->indices[job->indexOffsets[block]];
+
+    memcpy(&target->vertices[vertexOffset], source->vertices, source->vertexCount * sizeof(SurfaceVertex));
+
+    for (uint32_t i = 0; i < source->indexCount; i++)
+    {
+        indices[i] = source->indices[i] + vertexOffset;
+    }
+}
+
+uint32_t surfaceExtractorUpdate(SurfaceExtractor *extractor)
+{
+    uint32_t dirtyCount = 0;
+
+    // A cell reads the nodes of its own block and of the blocks right after it on every axis
+    for (uint32_t z = 0; z < extractor->blockDim[2]; z++)
+    {
+        for (uint32_t y = 0; y < extractor->blockDim[1]; y++)
+        {
+            for (uint32_t x = 0; x < extractor->blockDim[0]; x++)
+            {
+                uint8_t dirty = 0;
+
+                for (uint32_t corner = 0; corner < 8 && !dirty; corner++)
+                {
+                    uint32_t nx = x + (corner & 1);
+                    uint32_t ny = y + ((corner >> 1) & 1);
+                    uint32_t nz = z + ((corner >> 2) & 1);
+
+                    if (nx < extractor->blockDim[0] && ny < extractor->blockDim[1] && nz < extractor->blockDim[2])
+                    {
+                        dirty = extractor->blockChanged[(nz * extractor->blockDim[1] + ny) * extractor->blockDim[0] + nx];
+                    }
+                }
+
+                extractor->blockDirty[(z * extractor->blockDim[1] + y) * extractor->blockDim[0] + x] = dirty;
+                dirtyCount += dirty;
+            }
+        }
+    }
+
+    extractor->remeshedBlocks = dirtyCount;
+
+    if (dirtyCount == 0)
+    {
+        return 0;
+    }
+
+    // Blocks are meshed from meshedField only, so a block left alone and its re-meshed neighbour
+    // still agree on the vertices of their shared face
+    threadPoolRun(commitBlockTask, extractor, extractor->blockCount);
+    threadPoolRun(meshBlockTask, extractor, extractor->blockCount);
+
+    memset(extractor->blockChanged, 0, extractor->blockCount);
+
+    CompactJob job = {};
+    job.extractor = extractor;
+    job.vertexOffsets = malloc(extractor->blockCount * sizeof(uint32_t));
+    job.indexOffsets = malloc(extractor->blockCount * sizeof(uint32_t));
+
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+
+    for (uint32_t block = 0; block < extractor->blockCount; block++)
+    {
+        job.vertexOffsets[block] = vertexCount;
+        job.indexOffsets[block] = indexCount;
+        vertexCount += extractor->blockMeshes[block].vertexCount;
+        indexCount += extractor->blockMeshes[block].indexCount;
+    }
+
+    reserveMesh(&extractor->mesh, vertexCount, indexCount);
+    threadPoolRun(compactBlockTask, &job, extractor->blockCount);
+
+    extractor->mesh.vertexCount = vertexCount;
+    extractor->mesh.indexCount = indexCount;
+
+    free(job.vertexOffsets);
+    free(job.indexOffsets);
+
+    return dirtyCount;
+}
+
+int surfaceMeshWritePly(const SurfaceMesh *mesh, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+
+    if (!file)
+    {
+        return 0;
+    }
+
+    uint32_t triangleCount = mesh->indexCount / 3;
+
+    fprintf(file,
+            "ply\n"
+            "format binary_little_endian 1.0\n"
+            "element vertex %u\n"
+            "property float x\nproperty float y\nproperty float z\n"
+            "property float nx\nproperty float ny\nproperty float nz\n"
+            "element face %u\n"
+            "property list uchar uint vertex_indices\n"
+            "end_header\n",
+            mesh->vertexCount, triangleCount);
+
+    size_t written = fwrite(mesh->vertices, sizeof(SurfaceVertex), mesh->vertexCount, file);
+
+    for (uint32_t i = 0; i < triangleCount; i++)
+    {
+        uint8_t cornerCount = 3;
+        fwrite(&cornerCount, 1, 1, file);
+        fwrite(&mesh->indices[3 * i], sizeof(uint32_t), 3, file);
+    }
+
+    return fclose(file) == 0 && written == mesh->vertexCount;
+}
+
+void surfaceExtractorDestroy(SurfaceExtractor *extractor)
+{
+    for (uint32_t block = 0; block < extractor->blockCount; block++)
+    {
+        free(extractor->blockMeshes[block].vertices);
+        free(extractor->blockMeshes[block].indices);
+    }
+
+    for (uint32_t i = 0; extractor->edgeCaches != NULL && i < threadPoolThreadCount(); i++)
+    {
+        free(extractor->edgeCaches[i]);
+    }
+
+    free(extractor->edgeCaches);
+    free(extractor->blockMeshes);
+    free(extractor->field);
+    free(extractor->meshedField);
+    free(extractor->blockChanged);
+    free(extractor->blockDirty);
+    free(extractor->binStart);
+    free(extractor->binEnd);
+    free(extractor->binnedPositions);
+    free(extractor->mesh.vertices);
+    free(extractor->mesh.indices);
+
+    memset(extractor, 0, sizeof(*extractor));
+}